@@ -0,0 +1,303 @@
+#include <string.h>
+#ifdef ESP_PLATFORM
+#include "esp_timer.h"
+#include "esp_log.h"
+#else
+#include <chrono>
+#endif
+#include "actor.hpp"
+
+#define TAG "Actor"
+
+std::vector<ActorEventBus::Subscription> ActorEventBus::s_subscriptions;
+
+ActorBase::ActorBase(const char* name) {
+    m_name = name;
+    m_executor = NULL;
+    m_wake = ACTOR_NO_WAKE;
+    m_eventHead = 0;
+    m_eventCount = 0;
+    m_stats = {};
+}
+
+int64_t ActorBase::now() {
+#ifdef ESP_PLATFORM
+    return esp_timer_get_time();
+#else
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+void ActorBase::getStats(ActorStats* stats) {
+    m_lock.lock();
+    *stats = m_stats;
+    m_lock.unlock();
+}
+
+void ActorBase::notify() {
+    ActorExecutor* executor = m_executor;
+    if (executor != NULL)
+        executor->notify();
+}
+
+void ActorBase::detach() {
+    if (m_executor != NULL)
+        m_executor->remove(this);
+}
+
+// メールボックスが一杯の時に少し待つ
+//  割り込みと自分の実行タスクからは待てない (待っても空かない)
+bool ActorBase::waitSpace(uint32_t waitMs, uint32_t& waited) {
+    bool canWait = waited < waitMs;
+#ifdef ESP_PLATFORM
+    if (xPortInIsrContext())
+        canWait = false;
+#endif
+    if (m_executor != NULL && m_executor->isCurrent())
+        canWait = false;
+    if (!canWait) {
+        m_lock.lock();
+        m_stats.dropped++;
+        m_lock.unlock();
+#ifdef ESP_PLATFORM
+        if (!xPortInIsrContext())
+            ESP_LOGW(TAG, "%s : mailbox full", m_name);
+#endif
+        return false;
+    }
+#ifdef ESP_PLATFORM
+    vTaskDelay(1);
+    waited += portTICK_PERIOD_MS;
+#else
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    waited++;
+#endif
+    return true;
+}
+
+void ActorBase::record(uint32_t postTime) {
+    uint32_t latency = (uint32_t)now() - postTime;
+    m_stats.messages++;
+    m_stats.totalLatency += latency;
+    if (latency > m_stats.maxLatency)
+        m_stats.maxLatency = latency;
+}
+
+// イベント送信 (ActorEventBusから)
+bool ActorBase::postEvent(const ActorEvent& event, uint32_t waitMs) {
+    uint32_t waited = 0;
+    while(true) {
+        m_lock.lock();
+        if (m_eventCount < ACTOR_EVENT_SIZE) {
+            size_t i = (m_eventHead + m_eventCount) % ACTOR_EVENT_SIZE;
+            m_events[i] = event;
+            m_eventTimes[i] = (uint32_t)now();
+            m_eventCount++;
+            m_lock.unlock();
+            notify();
+            return true;
+        }
+        m_lock.unlock();
+        if (!waitSpace(waitMs, waited))
+            return false;
+    }
+}
+
+bool ActorBase::dispatchEvent() {
+    m_lock.lock();
+    if (m_eventCount == 0) {
+        m_lock.unlock();
+        return false;
+    }
+    ActorEvent event = m_events[m_eventHead];
+    record(m_eventTimes[m_eventHead]);
+    m_eventHead = (m_eventHead + 1) % ACTOR_EVENT_SIZE;
+    m_eventCount--;
+    m_lock.unlock();
+    onEvent(event);
+    return true;
+}
+
+bool ActorBase::hasEvent() {
+    m_lock.lock();
+    bool ret = m_eventCount > 0;
+    m_lock.unlock();
+    return ret;
+}
+
+ActorExecutor::ActorExecutor() {
+    m_name = "";
+    memset(m_actors, 0, sizeof(m_actors));
+    m_actorCount = 0;
+    m_isQuit = false;
+#ifdef ESP_PLATFORM
+    m_xHandle = NULL;
+#else
+    m_isNotified = false;
+#endif
+}
+
+bool ActorExecutor::start(const char* name, uint32_t stackSize, int priority, int core) {
+    m_name = name;
+    m_isQuit = false;
+#ifdef ESP_PLATFORM
+    BaseType_t affinity = core < 0 || core >= portNUM_PROCESSORS ? tskNO_AFFINITY : core;
+    return xTaskCreatePinnedToCore(ActorExecutor::task, name, stackSize, (void*)this, priority, &m_xHandle, affinity) == pdPASS;
+#else
+    m_thread = std::thread(ActorExecutor::task, (void*)this);
+    return true;
+#endif
+}
+
+void ActorExecutor::stop() {
+    m_isQuit = true;
+    notify();
+#ifndef ESP_PLATFORM
+    if (m_thread.joinable())
+        m_thread.join();
+#endif
+}
+
+bool ActorExecutor::add(ActorBase* actor) {
+    m_lock.lock();
+    bool ret = m_actorCount < ACTOR_EXECUTOR_MAX;
+    if (ret) {
+        m_actors[m_actorCount++] = actor;
+        actor->m_executor = this;
+    }
+    m_lock.unlock();
+    if (ret)
+        notify();   // 登録前に受け取っていたメッセージを処理
+    return ret;
+}
+
+void ActorExecutor::remove(ActorBase* actor) {
+    m_lock.lock();
+    for(int i=0; i<m_actorCount; i++) {
+        if (m_actors[i] == actor) {
+            memmove(&m_actors[i], &m_actors[i + 1], (m_actorCount - i - 1) * sizeof(ActorBase*));
+            m_actorCount--;
+            actor->m_executor = NULL;
+            break;
+        }
+    }
+    m_lock.unlock();
+}
+
+int ActorExecutor::getActors(ActorBase** actors, int max) {
+    m_lock.lock();
+    int count = m_actorCount < max ? m_actorCount : max;
+    memcpy(actors, m_actors, count * sizeof(ActorBase*));
+    m_lock.unlock();
+    return count;
+}
+
+void ActorExecutor::notify() {
+#ifdef ESP_PLATFORM
+    if (m_xHandle == NULL)
+        return;
+    if (xPortInIsrContext()) {
+        BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+        vTaskNotifyGiveFromISR(m_xHandle, &xHigherPriorityTaskWoken);
+        portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+    } else {
+        xTaskNotifyGive(m_xHandle);
+    }
+#else
+    {
+        std::lock_guard<std::mutex> lock(m_waitMutex);
+        m_isNotified = true;
+    }
+    m_waitCond.notify_one();
+#endif
+}
+
+bool ActorExecutor::isCurrent() {
+#ifdef ESP_PLATFORM
+    return m_xHandle != NULL && xTaskGetCurrentTaskHandle() == m_xHandle;
+#else
+    return std::this_thread::get_id() == m_threadId;
+#endif
+}
+
+void ActorExecutor::wait(int64_t timeout) {
+#ifdef ESP_PLATFORM
+    TickType_t ticks = portMAX_DELAY;
+    if (timeout >= 0) {
+        ticks = pdMS_TO_TICKS((timeout + 999) / 1000);
+        if (ticks == 0)
+            ticks = 1;      // 1tick未満でも待つ (空回りしない)
+    }
+    ulTaskNotifyTake(pdTRUE, ticks);
+#else
+    std::unique_lock<std::mutex> lock(m_waitMutex);
+    if (timeout < 0)
+        m_waitCond.wait(lock, [this] { return m_isNotified; });
+    else
+        m_waitCond.wait_for(lock, std::chrono::microseconds(timeout), [this] { return m_isNotified; });
+    m_isNotified = false;
+#endif
+}
+
+void ActorExecutor::task(void* arg) {
+    ActorExecutor* pThis = (ActorExecutor*)arg;
+#ifndef ESP_PLATFORM
+    pThis->m_threadId = std::this_thread::get_id();
+#endif
+    pThis->run();
+#ifdef ESP_PLATFORM
+    pThis->m_xHandle = NULL;
+    vTaskDelete(NULL);
+#endif
+}
+
+// 登録されたアクターを順に、イベント、メッセージを1件ずつ処理 (1つのアクターが他を待たせ続けない)
+// メールボックスが空で起床時刻を過ぎたアクターはonWake()を呼ぶ
+void ActorExecutor::run() {
+    while(!m_isQuit) {
+        bool isBusy = false;
+        int64_t wake = ACTOR_NO_WAKE;
+        for(int i=0; ; i++) {
+            m_lock.lock();
+            ActorBase* actor = i < m_actorCount ? m_actors[i] : NULL;
+            m_lock.unlock();
+            if (actor == NULL)
+                break;
+            if (actor->dispatchEvent())
+                isBusy = true;
+            if (actor->dispatch())
+                isBusy = true;
+            if (actor->m_executor != this)
+                continue;   // 処理中に外れた
+            if (actor->m_wake != ACTOR_NO_WAKE && !actor->hasEvent() && !actor->hasMessage() && actor->m_wake <= ActorBase::now()) {
+                actor->m_wake = ACTOR_NO_WAKE;
+                actor->onWake();
+                isBusy = true;
+            }
+            if (actor->m_wake < wake)
+                wake = actor->m_wake;
+        }
+        if (!isBusy) {
+            // 確認してから時刻を過ぎた場合も負(無期限)にしない (0は最短の1tick待ってから再確認)
+            int64_t timeout = -1;
+            if (wake != ACTOR_NO_WAKE) {
+                timeout = wake - ActorBase::now();
+                if (timeout < 0)
+                    timeout = 0;
+            }
+            wait(timeout);
+        }
+    }
+}
+
+void ActorEventBus::subscribe(uint16_t topic, ActorBase* actor) {
+    s_subscriptions.push_back({ topic, actor });
+}
+
+void ActorEventBus::publish(uint16_t topic, uint32_t arg) {
+    ActorEvent event = { topic, arg };
+    for(auto& s : s_subscriptions) {
+        if (s.topic == topic)
+            s.actor->postEvent(event);
+    }
+}
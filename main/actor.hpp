@@ -0,0 +1,257 @@
+/**
+ * アクターとイベントバス
+ *
+ * 各クラスがタスクとメッセージキューを1つずつ持つ代わりに、メッセージをメールボックスに受け取るアクターを
+ * 少数の実行タスク(ActorExecutor)で順番に処理します。
+ *  Actor<TMessage> : 型付きのメッセージ(ペイロード付きの構造体や列挙型)を受け取る固定長のメールボックス
+ *  ActorExecutor   : 登録された複数のアクターのメッセージを1件ずつ順番に処理するタスク
+ *  ActorEventBus   : 種別(topic)を購読している全てのアクターにイベントを配信
+ *  ActorWorker     : 関数と引数(ActorJob)を受け取って実行するアクター (待ちの発生する処理を別の実行タスクへ移す)
+ * 1つのアクターのメッセージは常に同じ実行タスクで処理されるので、アクターの状態はロック無しで扱えます。
+ * 処理中に待つと同じ実行タスクの他のアクターも待たされるので、長く待つ処理は別のタスクで行ってください。
+ * メッセージの送信はどのタスク、割り込みからでも可能です。
+ * ESP-IDF以外(PC)ではstd::threadで動作します (tools/actor_bench.cpp)。
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <type_traits>
+#include <vector>
+#include <atomic>
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#else
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#endif
+
+#define ACTOR_MAILBOX_SIZE  10          // メールボックスの既定の件数 (従来のキューと同じ)
+#define ACTOR_EVENT_SIZE    8           // イベントの件数
+#define ACTOR_EXECUTOR_MAX  8           // 1つの実行タスクに登録できるアクター数
+#define ACTOR_WAIT_FOREVER  UINT32_MAX  // メールボックスが空くまで待つ
+#define ACTOR_NO_WAKE       INT64_MAX   // onWake()を呼ばない
+
+class ActorExecutor;
+
+// 排他 (ESP-IDFは割り込みからも使えるスピンロック。保持している間は短い処理のみ)
+class ActorLock {
+    public:
+#ifdef ESP_PLATFORM
+        void lock() { portENTER_CRITICAL_SAFE(&m_mux); }
+        void unlock() { portEXIT_CRITICAL_SAFE(&m_mux); }
+
+    private:
+        portMUX_TYPE m_mux = portMUX_INITIALIZER_UNLOCKED;
+#else
+        void lock() { m_mutex.lock(); }
+        void unlock() { m_mutex.unlock(); }
+
+    private:
+        std::mutex m_mutex;
+#endif
+};
+
+// イベント (ActorEventBus)
+struct ActorEvent {
+    uint16_t topic;         // 種別 (アプリケーションで定義した列挙型)
+    uint32_t arg;
+};
+
+// アクターの統計
+struct ActorStats {
+    uint32_t messages;      // 処理したメッセージ数 (イベントを含む)
+    uint32_t dropped;       // メールボックスが一杯で受け取れなかった数
+    uint32_t pending;       // 処理待ちの数
+    uint32_t maxPending;    // 処理待ちの最大
+    uint64_t totalLatency;  // 送信から処理開始までの時間の合計(us)
+    uint32_t maxLatency;    // 送信から処理開始までの時間の最大(us)
+};
+
+class ActorBase {
+    public:
+        ActorBase(const char* name);
+        virtual ~ActorBase() {}
+
+    public:
+        const char* name() { return m_name; }
+        ActorExecutor* executor() { return m_executor; }
+        bool postEvent(const ActorEvent& event, uint32_t waitMs = ACTOR_WAIT_FOREVER);
+        void getStats(ActorStats* stats);
+        virtual size_t mailboxBytes() = 0;      // メールボックスの大きさ(byte)
+        static int64_t now();                   // 時刻(us)
+
+    protected:
+        // 実行タスクでのみ呼ぶ
+        void setWake(int64_t time) { m_wake = time; }   // time(us)以降、メールボックスが空の時にonWake()を呼ぶ
+        void detach();                                  // 実行タスクから外す (以降のメッセージは処理しない)
+        virtual void onEvent(const ActorEvent& event) {}
+        virtual void onWake() {}
+        // Actor<TMessage>用
+        void notify();
+        bool waitSpace(uint32_t waitMs, uint32_t& waited);  // メールボックスが一杯 (待てない場合はfalse)
+        void record(uint32_t postTime);                     // 処理したメッセージの統計 (m_lockを保持して呼ぶ)
+        ActorLock m_lock;       // メールボックスと統計の排他
+        ActorStats m_stats;
+
+    private:
+        friend class ActorExecutor;
+        virtual bool dispatch() = 0;            // メールボックスから1件処理 (無ければfalse)
+        virtual bool hasMessage() = 0;
+        bool dispatchEvent();
+        bool hasEvent();
+
+    private:
+        const char* m_name;
+        ActorExecutor* m_executor;
+        int64_t m_wake;
+        ActorEvent m_events[ACTOR_EVENT_SIZE];
+        uint32_t m_eventTimes[ACTOR_EVENT_SIZE];
+        size_t m_eventHead;
+        size_t m_eventCount;
+};
+
+template<typename TMessage, size_t N = ACTOR_MAILBOX_SIZE>
+class Actor : public ActorBase {
+    static_assert(std::is_trivially_copyable<TMessage>::value, "actor message must be trivially copyable");
+
+    public:
+        Actor(const char* name) : ActorBase(name), m_head(0), m_count(0) {}
+
+    public:
+        // メッセージ送信 (どのタスク、割り込みからでも可)
+        //  メールボックスが一杯の場合はwaitMsまで待つ。割り込み、同じ実行タスクからは待たずにfalse
+        bool post(const TMessage& msg, uint32_t waitMs = ACTOR_WAIT_FOREVER) {
+            uint32_t waited = 0;
+            while(true) {
+                m_lock.lock();
+                if (m_count < N) {
+                    Slot& slot = m_slots[(m_head + m_count) % N];
+                    slot.msg = msg;
+                    slot.time = (uint32_t)now();
+                    m_count++;
+                    m_stats.pending = m_count;
+                    if (m_count > m_stats.maxPending)
+                        m_stats.maxPending = m_count;
+                    m_lock.unlock();
+                    notify();
+                    return true;
+                }
+                m_lock.unlock();
+                if (!waitSpace(waitMs, waited))
+                    return false;
+            }
+        }
+        size_t mailboxBytes() override { return sizeof(m_slots); }
+
+    protected:
+        virtual void onMessage(TMessage& msg) = 0;  // 実行タスクで1件ずつ呼ばれる
+
+    private:
+        bool dispatch() override {
+            m_lock.lock();
+            if (m_count == 0) {
+                m_lock.unlock();
+                return false;
+            }
+            Slot slot = m_slots[m_head];
+            m_head = (m_head + 1) % N;
+            m_count--;
+            m_stats.pending = m_count;
+            record(slot.time);
+            m_lock.unlock();
+            onMessage(slot.msg);
+            return true;
+        }
+        bool hasMessage() override {
+            m_lock.lock();
+            bool ret = m_count > 0;
+            m_lock.unlock();
+            return ret;
+        }
+
+    private:
+        struct Slot {
+            TMessage msg;
+            uint32_t time;      // 送信時刻(us、下位32bit)
+        };
+        Slot m_slots[N];
+        size_t m_head;
+        size_t m_count;
+};
+
+// ジョブ (ActorWorker)
+struct ActorJob {
+    void (*func)(void* context);
+    void* context;
+};
+
+// ジョブを順番に実行するアクター
+//  ファイルの書き込みなど待ちの発生する処理を、呼び出し元とは別の実行タスクで行います。
+class ActorWorker : public Actor<ActorJob> {
+    public:
+        ActorWorker(const char* name) : Actor<ActorJob>(name) {}
+
+    protected:
+        void onMessage(ActorJob& job) override { job.func(job.context); }
+};
+
+// 実行タスク
+class ActorExecutor {
+    public:
+        ActorExecutor();
+
+    public:
+        // タスクを作成して開始 (stackSizeはbyte、coreは-1でコアを固定しない。PCでは無視)
+        bool start(const char* name, uint32_t stackSize, int priority, int core = -1);
+        void stop();                        // 終了 (処理中のメッセージが終わるまで待たない。PCはスレッドの終了を待つ)
+        bool add(ActorBase* actor);         // アクターを登録 (開始の前後どちらでも可)
+        void remove(ActorBase* actor);
+        void notify();                      // 実行タスクを起こす (どのタスク、割り込みからでも可)
+        bool isCurrent();                   // 呼び出し元がこの実行タスクか
+        const char* name() { return m_name; }
+        int getActors(ActorBase** actors, int max);
+#ifdef ESP_PLATFORM
+        TaskHandle_t handle() { return m_xHandle; }
+#endif
+
+    private:
+        static void task(void* arg);
+        void run();
+        void wait(int64_t timeout);         // notify()またはtimeout(us、負数は無期限)まで待つ
+
+    private:
+        const char* m_name;
+        ActorLock m_lock;                   // アクターの一覧の排他
+        ActorBase* m_actors[ACTOR_EXECUTOR_MAX];
+        int m_actorCount;
+        std::atomic<bool> m_isQuit;
+#ifdef ESP_PLATFORM
+        TaskHandle_t m_xHandle;
+#else
+        std::thread m_thread;
+        std::thread::id m_threadId;
+        std::mutex m_waitMutex;
+        std::condition_variable m_waitCond;
+        bool m_isNotified;
+#endif
+};
+
+// イベントバス
+//  購読は起動時(publish()の前)に行うこと
+class ActorEventBus {
+    public:
+        static void subscribe(uint16_t topic, ActorBase* actor);
+        static void publish(uint16_t topic, uint32_t arg = 0);     // 購読者全てのonEvent()に配信 (どのタスクからでも可)
+        template<typename T> static void subscribe(T topic, ActorBase* actor) { subscribe((uint16_t)topic, actor); }
+        template<typename T> static void publish(T topic, uint32_t arg = 0) { publish((uint16_t)topic, arg); }
+
+    private:
+        struct Subscription {
+            uint16_t topic;
+            ActorBase* actor;
+        };
+        static std::vector<Subscription> s_subscriptions;
+};
@@ -0,0 +1,12 @@
+/**
+ * イベントバス(ActorEventBus)の種別
+*/
+#pragma once
+
+#include <stdint.h>
+
+enum class AppEvent : uint16_t {
+    SDMount,        // SDカードのマウント状態変化 (arg : 1=マウント, 0=アンマウント)
+    WiFiConnect,    // Wi-Fiの接続状態変化 (arg : 1=接続, 0=切断)
+    DisplayReady,   // OLEDの初期化完了
+};
@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_rom_crc.h"
+#include "bin_log.hpp"
+
+#define BINLOG_VERSION  1
+
+static_assert((CONFIG_BINLOG_BUFFER_SIZE & (CONFIG_BINLOG_BUFFER_SIZE - 1)) == 0, "BINLOG_BUFFER_SIZE must be a power of two");
+
+// リング内の記録のヘッダ (引数が続く)
+struct BinLogHeader {
+    uint32_t time;              // esp_log_timestamp() (ms)
+    const BinLogSite* site;     // 呼び出し箇所
+    uint16_t argLen;            // 引数のサイズ
+    uint16_t reserved;
+};
+
+// コア毎のリングバッファ
+struct BinLogRing {
+    uint8_t buf[CONFIG_BINLOG_BUFFER_SIZE];
+    uint32_t head = 0;          // 書き込み位置 (累計バイト数)
+    uint32_t tail = 0;          // 最も古い記録の位置 (累計バイト数)
+    uint32_t overwritten = 0;   // 上書きした記録数
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+    void copyIn(uint32_t pos, const void* data, size_t len) {
+        pos &= CONFIG_BINLOG_BUFFER_SIZE - 1;
+        size_t first = CONFIG_BINLOG_BUFFER_SIZE - pos < len ? CONFIG_BINLOG_BUFFER_SIZE - pos : len;
+        memcpy(buf + pos, data, first);
+        memcpy(buf, (const uint8_t*)data + first, len - first);
+    }
+    void copyOut(uint32_t pos, void* data, size_t len) {
+        pos &= CONFIG_BINLOG_BUFFER_SIZE - 1;
+        size_t first = CONFIG_BINLOG_BUFFER_SIZE - pos < len ? CONFIG_BINLOG_BUFFER_SIZE - pos : len;
+        memcpy(data, buf + pos, first);
+        memcpy((uint8_t*)data + first, buf, len - first);
+    }
+};
+
+// 読み出し用に取り出した記録
+struct BinLogEntry {
+    uint32_t time;
+    const BinLogSite* site;
+    std::string args;
+};
+
+static BinLogRing s_rings[portNUM_PROCESSORS];
+static uint32_t s_drained[portNUM_PROCESSORS];     // drainText()で出力済みの位置 (累計バイト数)
+
+// 記録 (実行中のコアのリングに追加。空きが無ければ古い記録を上書き)
+void BinLog::commit(const BinLogSite* site, const uint8_t* args, size_t len) {
+    BinLogHeader header = { esp_log_timestamp(), site, (uint16_t)len, 0 };
+    uint32_t size = sizeof(header) + len;
+    // 通常は実行中のコア専用 (直後にタスクが別のコアに移っても、ロックしているので正しく書き込める)
+    BinLogRing& ring = s_rings[xPortGetCoreID()];
+    portENTER_CRITICAL_SAFE(&ring.lock);
+    while(ring.head - ring.tail + size > CONFIG_BINLOG_BUFFER_SIZE) {
+        BinLogHeader old;
+        ring.copyOut(ring.tail, &old, sizeof(old));
+        ring.tail += sizeof(old) + old.argLen;
+        ring.overwritten++;
+    }
+    ring.copyIn(ring.head, &header, sizeof(header));
+    ring.copyIn(ring.head + sizeof(header), args, len);
+    ring.head += size;
+    portEXIT_CRITICAL_SAFE(&ring.lock);
+}
+
+uint32_t BinLog::getOverwritten() {
+    uint32_t count = 0;
+    for(int i=0; i<portNUM_PROCESSORS; i++)
+        count += s_rings[i].overwritten;
+    return count;
+}
+
+// 全コアのリングから記録を取り出して時刻順に並べる
+// fromを指定した場合は各リングのfrom[i]以降(上書きされていればtail以降)を取り出し、from[i]を末尾に進める
+static std::vector<BinLogEntry> snapshot(uint32_t* from = NULL) {
+    std::vector<BinLogEntry> entries;
+    uint8_t* copy = new uint8_t[CONFIG_BINLOG_BUFFER_SIZE];
+    for(int i=0; i<portNUM_PROCESSORS; i++) {
+        BinLogRing& ring = s_rings[i];
+        portENTER_CRITICAL(&ring.lock);
+        uint32_t start = from != NULL && (int32_t)(from[i] - ring.tail) > 0 ? from[i] : ring.tail;
+        uint32_t len = ring.head - start;
+        ring.copyOut(start, copy, len);
+        if (from != NULL)
+            from[i] = ring.head;
+        portEXIT_CRITICAL(&ring.lock);
+        for(uint32_t pos=0; pos + sizeof(BinLogHeader) <= len; ) {
+            BinLogHeader header;
+            memcpy(&header, copy + pos, sizeof(header));
+            pos += sizeof(header);
+            if (pos + header.argLen > len)
+                break;
+            entries.push_back({ header.time, header.site, std::string((const char*)copy + pos, header.argLen) });
+            pos += header.argLen;
+        }
+    }
+    delete[] copy;
+    std::stable_sort(entries.begin(), entries.end(), [](const BinLogEntry& a, const BinLogEntry& b) {
+        return (int32_t)(a.time - b.time) < 0;
+    });
+    return entries;
+}
+
+// 引数を取り出す (足りなければfalse)
+static bool take(const std::string& args, size_t& pos, void* value, size_t size) {
+    if (pos + size > args.size())
+        return false;
+    memcpy(value, args.data() + pos, size);
+    pos += size;
+    return true;
+}
+
+// 書式化 (書式の変換指定毎に引数を取り出してsnprintf)
+static void formatArgs(std::string& out, const char* format, const std::string& args) {
+    size_t pos = 0;
+    char spec[32], tmp[128];
+    for(const char* p=format; *p != '\0'; p++) {
+        if (*p != '%') {
+            out += *p;
+            continue;
+        }
+        if (p[1] == '%') {
+            out += '%';
+            p++;
+            continue;
+        }
+        // 変換指定 (フラグ、幅、精度、長さ修飾子、変換指定子)
+        size_t n = 0;
+        spec[n++] = *p++;
+        bool isOk = true;
+        while(*p != '\0' && strchr("-+ #0", *p) != NULL && n < sizeof(spec) - 16)
+            spec[n++] = *p++;
+        for(int part=0; part<2; part++) {
+            if (part == 1) {
+                if (*p != '.')
+                    break;
+                spec[n++] = *p++;
+            }
+            if (*p == '*') {
+                int32_t v;
+                isOk = isOk && take(args, pos, &v, sizeof(v));
+                n += snprintf(spec + n, sizeof(spec) - n - 8, "%ld", (long)v);
+                p++;
+            }
+            while(isdigit((unsigned char)*p) && n < sizeof(spec) - 8)
+                spec[n++] = *p++;
+        }
+        size_t size = 4;
+        bool isLong = false;
+        while(*p != '\0' && strchr("hlLqjzt", *p) != NULL && n < sizeof(spec) - 2) {
+            if (*p == 'l')
+                size = isLong ? 8 : sizeof(long);
+            else if (*p == 'q' || *p == 'j')
+                size = 8;
+            else if (*p == 'z')
+                size = sizeof(size_t);
+            else if (*p == 't')
+                size = sizeof(ptrdiff_t);
+            isLong = isLong || *p == 'l';
+            spec[n++] = *p++;
+        }
+        if (*p == '\0')
+            break;
+        char conv = *p;
+        spec[n++] = conv;
+        spec[n] = '\0';
+        tmp[0] = '\0';
+        if (conv == 's') {
+            uint8_t len;
+            char str[BINLOG_STR_MAX + 1];
+            isOk = isOk && take(args, pos, &len, 1) && len <= BINLOG_STR_MAX && take(args, pos, str, len);
+            if (isOk) {
+                str[len] = '\0';
+                snprintf(tmp, sizeof(tmp), spec, str);
+            }
+        } else if (strchr("fFeEgGaA", conv) != NULL) {
+            double v;
+            isOk = isOk && take(args, pos, &v, sizeof(v));
+            if (isOk)
+                snprintf(tmp, sizeof(tmp), spec, v);
+        } else if (conv == 'p') {
+            uintptr_t v;
+            isOk = isOk && take(args, pos, &v, sizeof(v));
+            if (isOk)
+                snprintf(tmp, sizeof(tmp), spec, (void*)v);
+        } else if (strchr("cdiuxXo", conv) != NULL) {
+            if (size == 8) {
+                uint64_t v;
+                isOk = isOk && take(args, pos, &v, sizeof(v));
+                if (isOk)
+                    snprintf(tmp, sizeof(tmp), spec, (long long)v);
+            } else {
+                uint32_t v;
+                isOk = isOk && take(args, pos, &v, sizeof(v));
+                if (isOk && isLong)
+                    snprintf(tmp, sizeof(tmp), spec, (long)(int32_t)v);
+                else if (isOk)
+                    snprintf(tmp, sizeof(tmp), spec, (int)v);
+            }
+        }
+        if (!isOk) {
+            out += "<?>";
+            break;
+        }
+        out += tmp;
+    }
+}
+
+static void formatEntry(std::string& out, const BinLogEntry& entry) {
+    static const char levels[] = "NEWIDV";
+    char head[48];
+    snprintf(head, sizeof(head), "%c (%lu) ", levels[entry.site->level < 6 ? entry.site->level : 0], (unsigned long)entry.time);
+    out += head;
+    out += entry.site->tag;
+    out += ": ";
+    formatArgs(out, entry.site->format, entry.args);
+    out += '\n';
+}
+
+// テキストのログの行の時刻 ("I (12345) TAG: ..."の12345。色指定のエスケープシーケンスは飛ばす)
+static bool lineTime(const char* line, size_t len, uint32_t* time) {
+    const char* p = (const char*)memchr(line, '(', len < 16 ? len : 16);
+    if (p == NULL || !isdigit((unsigned char)p[1]))
+        return false;
+    char* end;
+    unsigned long v = strtoul(p + 1, &end, 10);
+    if (*end != ')')
+        return false;
+    *time = v;
+    return true;
+}
+
+std::string BinLog::render(const std::string& text) {
+    std::vector<BinLogEntry> entries = snapshot();
+    std::string out;
+    out.reserve(text.size() + entries.size() * 64);
+    size_t index = 0;
+    for(size_t pos=0; pos<text.size(); ) {
+        size_t end = text.find('\n', pos);
+        end = end == std::string::npos ? text.size() : end + 1;
+        uint32_t time;
+        if (lineTime(text.data() + pos, end - pos, &time)) {
+            // この行より前の記録を先に出力
+            while(index < entries.size() && (int32_t)(entries[index].time - time) < 0)
+                formatEntry(out, entries[index++]);
+        }
+        out.append(text, pos, end - pos);
+        pos = end;
+    }
+    while(index < entries.size())
+        formatEntry(out, entries[index++]);
+    return out;
+}
+
+void BinLog::drainText(std::string& out) {
+    std::vector<BinLogEntry> entries = snapshot(s_drained);
+    for(auto& entry : entries)
+        formatEntry(out, entry);
+}
+
+uint32_t BinLog::hash(const char* str) {
+    return str != NULL ? esp_rom_crc32_le(0, (const uint8_t*)str, strlen(str)) : 0;
+}
+
+// バイナリ出力 (リトルエンディアン)
+//  ヘッダ : "WCBL" version(u16) reserved(u16)
+//  書式   : 'S' id(u32) level(u8) tagLen(u8) tag fmtLen(u16) format   (記録で使われているもの)
+//  記録   : 'R' time(u32) id(u32) argLen(u8) args
+std::string BinLog::dump() {
+    std::vector<BinLogEntry> entries = snapshot();
+    std::string out("WCBL", 4);
+    uint16_t version = BINLOG_VERSION, reserved = 0;
+    out.append((const char*)&version, 2);
+    out.append((const char*)&reserved, 2);
+    std::vector<const BinLogSite*> sites;
+    for(auto& entry : entries) {
+        if (std::find(sites.begin(), sites.end(), entry.site) != sites.end())
+            continue;
+        sites.push_back(entry.site);
+        uint32_t id = (uint32_t)(uintptr_t)entry.site;
+        uint8_t level = entry.site->level;
+        uint8_t tagLen = strnlen(entry.site->tag, 255);
+        uint16_t fmtLen = strnlen(entry.site->format, 65535);
+        out += 'S';
+        out.append((const char*)&id, 4);
+        out.append((const char*)&level, 1);
+        out.append((const char*)&tagLen, 1);
+        out.append(entry.site->tag, tagLen);
+        out.append((const char*)&fmtLen, 2);
+        out.append(entry.site->format, fmtLen);
+    }
+    for(auto& entry : entries) {
+        uint32_t id = (uint32_t)(uintptr_t)entry.site;
+        uint8_t argLen = entry.args.size();
+        out += 'R';
+        out.append((const char*)&entry.time, 4);
+        out.append((const char*)&id, 4);
+        out.append((const char*)&argLen, 1);
+        out += entry.args;
+    }
+    return out;
+}
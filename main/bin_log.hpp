@@ -0,0 +1,113 @@
+/**
+ * バイナリログ (書式化を後回しにするログ)
+ *
+ * リクエスト処理などの頻繁に通る箇所用のログです。
+ * 記録時は書式文字列を書式化せず、呼び出し箇所(BinLogSite、静的に配置)のアドレスと引数の値だけを
+ * 実行中のコアのリングバッファにコピーします。リングが一杯の場合は古い記録から上書きします。
+ *
+ *  書式化 : GET /API/logsの読み出し時にrender()でテキストのログと時刻順にまとめて書式化します。
+ *           GET /API/logs?format=binではdump()のバイナリを返し、PCのtools/binlog_decode.pyで書式化します。
+ *  出力   : LogSinkのタスクがdrainText()で新しい記録を書式化し、UARTとSDカードのsystem.logに出力します。
+ *           (ESP_LOGの行とは別にまとめて出力するので、前後の順序は各行の時刻で確認してください)
+ *  レベル : ファイル毎にBINLOG_LOCAL_LEVELを定義するとそのファイルのレベルを変更できます(既定はBINLOG_DEFAULT_LEVEL)。
+ *           無効なレベルの記録はコンパイル時に取り除かれます。
+ *
+ * 引数は整数(64bitまで)、浮動小数点数、ポインタ、文字列(const char*、BINLOG_STR_MAXまで)が使えます。
+ * 文字列は記録時にコピーするので一時的なバッファでも構いません。
+ * 長い文字列(JSON全体など)は切り捨てられるので、長さとhash()の値を記録してください。
+ *
+ * 使い方
+ *  BLOGI(TAG, "getFiles path=%s limit=%d", path.c_str(), limit);
+*/
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+#include <iostream>
+#include "esp_log.h"
+
+#ifndef BINLOG_LOCAL_LEVEL
+#define BINLOG_LOCAL_LEVEL  CONFIG_BINLOG_DEFAULT_LEVEL
+#endif
+
+#define BINLOG_ARGS_MAX     96      // 1記録の引数の最大サイズ(byte)
+#define BINLOG_STR_MAX      48      // 文字列引数の最大長 (超えた分は切り捨て)
+
+// 呼び出し箇所 (マクロ内で静的に配置。アドレスが書式のIDになる)
+struct BinLogSite {
+    const char* tag;
+    const char* format;
+    esp_log_level_t level;
+};
+
+#define BINLOG(level, tag, format, ...) do { \
+        if constexpr ((level) <= BINLOG_LOCAL_LEVEL) { \
+            static const BinLogSite _binlog_site = { tag, format, level }; \
+            if (false) \
+                printf(format, ##__VA_ARGS__);  /* 書式と引数のチェック用 */ \
+            BinLog::write(&_binlog_site, ##__VA_ARGS__); \
+        } \
+    } while(0)
+
+#define BLOGE(tag, format, ...) BINLOG(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define BLOGW(tag, format, ...) BINLOG(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define BLOGI(tag, format, ...) BINLOG(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define BLOGD(tag, format, ...) BINLOG(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+#define BLOGV(tag, format, ...) BINLOG(ESP_LOG_VERBOSE, tag, format, ##__VA_ARGS__)
+
+class BinLog {
+    public:
+        // 記録 (任意のタスク/ISRから呼び出し可能)
+        template<typename... Args>
+        static void write(const BinLogSite* site, Args... args) {
+            uint8_t buf[BINLOG_ARGS_MAX];
+            size_t len = 0;
+            (encode(buf, len, args), ...);
+            commit(site, buf, len);
+        }
+
+        // テキストのログ(ESP_LOGの出力)と時刻順にまとめて書式化
+        static std::string render(const std::string& text);
+        // バイナリ出力 (tools/binlog_decode.py用)
+        static std::string dump();
+        // 前回から増えた記録を書式化してoutに追加 (LogSinkのタスクから呼ぶ。上書きされた記録は出力されない)
+        static void drainText(std::string& out);
+        // 長い文字列の代わりに記録するハッシュ (CRC32)
+        static uint32_t hash(const char* str);
+        // 上書きした記録数
+        static uint32_t getOverwritten();
+
+    private:
+        static void commit(const BinLogSite* site, const uint8_t* args, size_t len);
+        static void put(uint8_t* buf, size_t& len, const void* data, size_t size) {
+            if (len + size > BINLOG_ARGS_MAX)
+                size = len < BINLOG_ARGS_MAX ? BINLOG_ARGS_MAX - len : 0;
+            memcpy(buf + len, data, size);
+            len += size;
+        }
+        // 引数の格納 (整数は4byte(32bit以下)または8byte、浮動小数点数はdouble、文字列は長さ(1byte)+文字列)
+        template<typename T>
+        static void encode(uint8_t* buf, size_t& len, T value) {
+            if constexpr (std::is_floating_point_v<T>) {
+                double v = value;
+                put(buf, len, &v, sizeof(v));
+            } else if constexpr (std::is_same_v<T, const char*> || std::is_same_v<T, char*>) {
+                size_t n = value != NULL ? strnlen(value, BINLOG_STR_MAX) : 0;
+                if (len + 1 + n > BINLOG_ARGS_MAX)
+                    n = len + 1 < BINLOG_ARGS_MAX ? BINLOG_ARGS_MAX - len - 1 : 0;
+                uint8_t n8 = n;
+                put(buf, len, &n8, 1);
+                put(buf, len, value != NULL ? value : "", n);
+            } else if constexpr (std::is_pointer_v<T>) {
+                uintptr_t v = (uintptr_t)value;
+                put(buf, len, &v, sizeof(v));
+            } else if constexpr (sizeof(T) <= 4) {
+                uint32_t v = (uint32_t)value;   // 符号付きは符号拡張
+                put(buf, len, &v, sizeof(v));
+            } else {
+                uint64_t v = (uint64_t)value;
+                put(buf, len, &v, sizeof(v));
+            }
+        }
+};
@@ -0,0 +1,347 @@
+#include <string.h>
+#include <mutex>
+#include <vector>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "buffered_file.hpp"
+#include "task_profile.hpp"
+
+#define TAG "BufferedFile"
+
+// I/Oタスクへの要求 (書き込み用のファイルは書き込み、読み込み用のファイルは先読み)
+struct BufferedFileJob {
+    BufferedFile* file;
+    int index;      // 書き込む/読み込む面
+};
+
+QueueHandle_t BufferedFile::s_xQueue = NULL;
+TaskHandle_t BufferedFile::s_xHandle = NULL;
+
+// バッファのプール
+static std::mutex s_poolMutex;
+static std::vector<uint8_t*> s_poolFree;    // 返却済み
+static int s_poolAllocated = 0;             // 確保済みの数 (貸出中を含む)
+
+BufferedFile::BufferedFile(StorageFile* raw, bool isWrite, off_t pos) {
+    m_raw = raw;
+    m_isOwner = true;
+    m_isWrite = isWrite;
+    m_pos = pos;
+    m_buf[0] = m_buf[1] = NULL;
+    m_active = 0;
+    m_len = 0;
+    m_bufPos = -1;
+    m_bufLen = 0;
+    m_writeLen[0] = m_writeLen[1] = 0;
+    m_prefetchPos = -1;
+    m_prefetchLen = -1;
+    m_free = NULL;
+    m_error = false;
+}
+
+BufferedFile::~BufferedFile() {
+    close();
+    freeBuffers();
+    if (m_free != NULL)
+        vSemaphoreDelete(m_free);
+}
+
+// バッファ付きでファイルを開きます
+StorageFile* BufferedFile::open(Storage* storage, const char* path, const char* mode) {
+    StorageFile* raw = storage->open(path, mode);
+    if (raw == NULL || strchr(mode, '+') != NULL)
+        return raw;
+    bool isWrite = mode[0] != 'r';
+    off_t pos = mode[0] == 'a' ? raw->size() : 0;
+    BufferedFile* file = new BufferedFile(raw, isWrite, pos < 0 ? 0 : pos);
+    if (!file->allocate()) {
+        // バッファが確保できない場合はバッファ無しで続行
+        ESP_LOGW(TAG, "no buffer memory, fallback to unbuffered : %s", path);
+        file->m_raw = NULL;
+        delete file;
+        return raw;
+    }
+    return file;
+}
+
+// 開いているファイルをバッファ付きで読み込み
+StorageFile* BufferedFile::wrap(StorageFile* raw) {
+    BufferedFile* file = new BufferedFile(raw, false, 0);
+    file->m_isOwner = false;
+    if (!file->allocate()) {
+        file->m_raw = NULL;
+        delete file;
+        return NULL;
+    }
+    return file;
+}
+
+// プールからバッファを借りる
+uint8_t* BufferedFile::poolTake() {
+    std::lock_guard<std::mutex> lock(s_poolMutex);
+    if (!s_poolFree.empty()) {
+        uint8_t* buf = s_poolFree.back();
+        s_poolFree.pop_back();
+        return buf;
+    }
+    if (s_poolAllocated >= CONFIG_FILE_BUFFER_POOL_MAX)
+        return NULL;
+    uint8_t* buf = (uint8_t*)heap_caps_malloc(FILE_CLUSTER_SIZE, MALLOC_CAP_DMA);
+    if (buf != NULL)
+        s_poolAllocated++;
+    return buf;
+}
+
+// プールに返す (解放せずに次のファイルで再利用する)
+void BufferedFile::poolGive(uint8_t* buf) {
+    std::lock_guard<std::mutex> lock(s_poolMutex);
+    s_poolFree.push_back(buf);
+}
+
+void BufferedFile::freeBuffers() {
+    for(int i=0; i<2; i++) {
+        if (m_buf[i] != NULL)
+            poolGive(m_buf[i]);
+        m_buf[i] = NULL;
+    }
+}
+
+// バッファ確保とI/Oタスクの起動
+bool BufferedFile::allocate() {
+    for(int i=0; i<2; i++) {
+        m_buf[i] = poolTake();
+        if (m_buf[i] == NULL) {
+            freeBuffers();
+            return false;
+        }
+    }
+    static std::once_flag once;
+    std::call_once(once, []() {
+        s_xQueue = xQueueCreate(10, sizeof(BufferedFileJob));
+        TASK_PROFILE_FILE_WRITER.create(BufferedFile::writer_task, NULL, &s_xHandle);
+    });
+    m_free = xSemaphoreCreateCounting(1, 1);    // I/Oタスクで処理中でない面の数 (現在の面は除く)
+    if (s_xQueue == NULL || m_free == NULL)
+        return false;
+    return true;
+}
+
+// I/Oタスク
+void BufferedFile::writer_task(void* arg) {
+    BufferedFileJob job;
+    while(true) {
+        if (xQueueReceive(s_xQueue, (void*)&job, portMAX_DELAY) == pdTRUE) {
+            BufferedFile* pFile = job.file;
+            if (!pFile->m_isWrite) {
+                // 先読み
+                pFile->m_prefetchLen = pFile->m_raw->pread(pFile->m_buf[job.index], FILE_CLUSTER_SIZE, pFile->m_prefetchPos);
+                xSemaphoreGive(pFile->m_free);
+                continue;
+            }
+            size_t len = pFile->m_writeLen[job.index];
+            const uint8_t* p = pFile->m_buf[job.index];
+            while(len > 0) {
+                int n = pFile->m_raw->write(p, len);
+                if (n <= 0) {
+                    pFile->m_error = true;
+                    break;
+                }
+                p += n;
+                len -= n;
+            }
+            xSemaphoreGive(pFile->m_free);
+        }
+    }
+}
+
+// posを含むクラスタを読み込み
+// 先読み済みならその面に切り替えます。順次読み込み(先頭から、または直前のクラスタの次)の場合は次のクラスタを先読みします。
+bool BufferedFile::fill(off_t pos) {
+    off_t aligned = pos - pos % FILE_CLUSTER_SIZE;
+    bool isSequential = m_bufPos < 0 ? aligned == 0 : aligned == m_bufPos + FILE_CLUSTER_SIZE;
+    bool isPrefetched = false;
+    if (m_prefetchPos >= 0) {
+        // 先読みの完了待ち (位置が違う場合も、もう一方の面を使い終わるまでは次の先読みができない)
+        waitIdle();
+        if (m_prefetchPos == aligned && m_prefetchLen >= 0) {
+            m_active ^= 1;
+            m_bufPos = aligned;
+            m_bufLen = m_prefetchLen;
+            isPrefetched = true;
+        }
+        m_prefetchPos = -1;
+    }
+    if (!isPrefetched) {
+        int n = m_raw->pread(m_buf[m_active], FILE_CLUSTER_SIZE, aligned);
+        if (n < 0) {
+            m_bufPos = -1;
+            m_bufLen = 0;
+            return false;
+        }
+        m_bufPos = aligned;
+        m_bufLen = n;
+    }
+    if ((isSequential || isPrefetched) && m_bufLen == FILE_CLUSTER_SIZE)
+        prefetch(aligned + FILE_CLUSTER_SIZE);
+    return true;
+}
+
+// posのクラスタをもう一方の面に先読み
+void BufferedFile::prefetch(off_t pos) {
+    xSemaphoreTake(m_free, portMAX_DELAY);
+    m_prefetchPos = pos;
+    m_prefetchLen = -1;
+    BufferedFileJob job = { this, m_active ^ 1 };
+    xQueueSend(s_xQueue, &job, portMAX_DELAY);
+}
+
+int BufferedFile::read(void* buf, size_t len) {
+    if (m_raw == NULL || m_isWrite)
+        return -1;
+    uint8_t* dst = (uint8_t*)buf;
+    size_t total = 0;
+    while(len > 0) {
+        if (m_bufPos < 0 || m_pos < m_bufPos || m_pos >= m_bufPos + (off_t)m_bufLen) {
+            if (!fill(m_pos))
+                return total > 0 ? (int)total : -1;
+            if (m_pos >= m_bufPos + (off_t)m_bufLen)
+                break;  // EOF
+        }
+        size_t n = m_bufPos + m_bufLen - m_pos;
+        if (n > len)
+            n = len;
+        memcpy(dst, m_buf[m_active] + (m_pos - m_bufPos), n);
+        dst += n;
+        len -= n;
+        total += n;
+        m_pos += n;
+    }
+    return total;
+}
+
+// 書き込み (各面はファイル位置がクラスタ境界で終わるように区切る)
+int BufferedFile::write(const void* buf, size_t len) {
+    if (m_raw == NULL || !m_isWrite || m_error)
+        return -1;
+    const uint8_t* src = (const uint8_t*)buf;
+    size_t total = 0;
+    while(len > 0) {
+        size_t cap = FILE_CLUSTER_SIZE - (m_pos - m_len) % FILE_CLUSTER_SIZE;
+        size_t n = cap - m_len;
+        if (n > len)
+            n = len;
+        memcpy(m_buf[m_active] + m_len, src, n);
+        m_len += n;
+        m_pos += n;
+        src += n;
+        len -= n;
+        total += n;
+        if (m_len == cap && !submit())
+            return -1;
+    }
+    return total;
+}
+
+// 現在の面をI/Oタスクに渡し、空いている面に切り替え
+bool BufferedFile::submit() {
+    if (m_len == 0)
+        return !m_error;
+    // もう一方の面の書き込み完了を待ってから渡す
+    // (先に渡すと、書き込みが先に完了した場合に上限1のセマフォへのGiveが失われる)
+    xSemaphoreTake(m_free, portMAX_DELAY);
+    m_writeLen[m_active] = m_len;
+    BufferedFileJob job = { this, m_active };
+    xQueueSend(s_xQueue, &job, portMAX_DELAY);
+    m_active ^= 1;
+    m_len = 0;
+    return !m_error;
+}
+
+// I/Oタスクで処理中の面の完了待ち
+void BufferedFile::waitIdle() {
+    xSemaphoreTake(m_free, portMAX_DELAY);
+    xSemaphoreGive(m_free);
+}
+
+int BufferedFile::pread(void* buf, size_t len, off_t offset) {
+    if (m_raw == NULL)
+        return -1;
+    if (m_isWrite) {
+        flush();
+        return m_raw->pread(buf, len, offset);
+    }
+    off_t pos = m_pos;
+    m_pos = offset;
+    int ret = read(buf, len);
+    m_pos = pos;
+    return ret;
+}
+
+bool BufferedFile::seek(off_t offset, int whence) {
+    if (m_raw == NULL)
+        return false;
+    off_t pos;
+    switch(whence) {
+        case SEEK_SET:
+            pos = offset;
+            break;
+        case SEEK_CUR:
+            pos = m_pos + offset;
+            break;
+        case SEEK_END:
+            pos = size() + offset;
+            break;
+        default:
+            return false;
+    }
+    if (pos < 0)
+        return false;
+    if (m_isWrite) {
+        if (!flush() || !m_raw->seek(pos, SEEK_SET))
+            return false;
+    }
+    m_pos = pos;
+    return true;
+}
+
+off_t BufferedFile::size() {
+    if (m_raw == NULL)
+        return -1;
+    off_t size = m_raw->size();
+    return m_isWrite && m_pos > size ? m_pos : size;
+}
+
+// 溜まっているデータを全て書き込み
+bool BufferedFile::flush() {
+    if (m_raw == NULL)
+        return false;
+    if (!m_isWrite)
+        return true;
+    bool ret = submit();
+    waitIdle();
+    return ret && !m_error && m_raw->flush();
+}
+
+bool BufferedFile::close() {
+    if (m_raw == NULL)
+        return true;
+    bool ret = true;
+    if (m_isWrite) {
+        ret = submit();
+        waitIdle();
+        ret = ret && !m_error;
+    } else if (m_free != NULL) {
+        // 先読みの完了待ち
+        waitIdle();
+        m_prefetchPos = -1;
+    }
+    if (m_isOwner) {
+        if (!m_raw->close())
+            ret = false;
+        delete m_raw;
+    }
+    m_raw = NULL;
+    // 次のファイルがすぐ使えるように、deleteを待たずにプールへ返す
+    freeBuffers();
+    return ret;
+}
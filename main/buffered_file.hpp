@@ -0,0 +1,80 @@
+/**
+ * バッファ付きファイル
+ *
+ * StorageFileをFATのクラスタ(16KB)単位でまとめて読み書きします。
+ * SPI転送の回数を減らすため、バッファはDMA可能なメモリに確保します。
+ *
+ *  読み込み : クラスタ単位で読み込み、小さいread()はバッファからコピーします。
+ *             順次読み込み中は次のクラスタをI/Oタスクで先読みし(read-ahead)、
+ *             呼び出し側が現在の面を消費している間にもう一方の面へ読み込みます。
+ *  書き込み : 2面のバッファに溜め、満杯になった面をI/Oタスクに渡して書き込みます(write-behind)。
+ *             書き込み中も呼び出し側はもう一方の面に書き込みを続けられます。
+ *             flush()/close()は全ての書き込み完了を待ちます。
+ *
+ * "+"付きのモード(読み書き両用)はバッファ無しのStorageFileをそのまま返します。
+ *
+ * バッファは全ファイルで共有するプール(最大CONFIG_FILE_BUFFER_POOL_MAX個)から借り、close()で返します。
+ * プールが空の場合はバッファ無しのStorageFileをそのまま使います。
+*/
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "storage.hpp"
+
+#define FILE_CLUSTER_SIZE   (16 * 1024)     // FATのクラスタサイズ (SDCardのallocation_unit_sizeと同じ)
+
+class BufferedFile : public StorageFile {
+    public:
+        ~BufferedFile();
+
+    public:
+        // バッファ付きでファイルを開きます (失敗時はNULL)
+        static StorageFile* open(Storage* storage, const char* path, const char* mode);
+        // 開いているファイルをバッファ付きで読み込みます (rawは閉じずに残す。FileCacheの共有ハンドル用)
+        // pread()だけでアクセスするため、同じrawを複数のBufferedFileで共有できます。バッファが無い場合はNULL
+        static StorageFile* wrap(StorageFile* raw);
+
+        int read(void* buf, size_t len) override;
+        int write(const void* buf, size_t len) override;
+        int pread(void* buf, size_t len, off_t offset) override;
+        bool seek(off_t offset, int whence) override;
+        off_t tell() override { return m_pos; }
+        off_t size() override;
+        bool flush() override;
+        bool close() override;
+
+    private:
+        BufferedFile(StorageFile* raw, bool isWrite, off_t pos);
+        bool allocate();
+        void freeBuffers();
+        static uint8_t* poolTake();         // プールからバッファを借りる (空ならNULL)
+        static void poolGive(uint8_t* buf); // プールに返す
+        bool fill(off_t pos);       // posを含むクラスタを読み込み
+        void prefetch(off_t pos);   // posのクラスタをもう一方の面に先読み (I/Oタスク)
+        bool submit();              // 現在の面をI/Oタスクに渡す
+        void waitIdle();            // I/Oタスクで処理中の面の完了待ち
+        // I/Oタスク (書き込みと先読み)
+        static void writer_task(void* arg);
+
+    private:
+        StorageFile* m_raw;         // バッファ無しのファイル
+        bool m_isOwner;             // close()でm_rawを閉じる
+        bool m_isWrite;             // 書き込み用
+        off_t m_pos;                // 現在位置
+        uint8_t* m_buf[2];          // バッファ (2面)
+        int m_active;               // 呼び出し側が使用中の面
+        size_t m_len;               // 現在の面の有効データ長
+        off_t m_bufPos;             // 読み込みバッファ先頭のファイル位置 (-1は無効)
+        size_t m_bufLen;            // 読み込みバッファの有効データ長
+        size_t m_writeLen[2];       // I/Oタスクに渡した長さ
+        off_t m_prefetchPos;        // 先読み中/先読み済みのファイル位置 (-1は無し)
+        int m_prefetchLen;          // 先読みした長さ (-1はエラー)
+        SemaphoreHandle_t m_free;   // 空き面 (I/Oタスクで処理中でない面の数)
+        volatile bool m_error;      // 書き込みエラー
+
+        static QueueHandle_t s_xQueue;      // I/Oタスク用メッセージキュー
+        static TaskHandle_t s_xHandle;      // I/Oタスクハンドル
+};
@@ -0,0 +1,357 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stddef.h>
+#include <sys/time.h>
+#include <vector>
+#include <algorithm>
+#ifdef ESP_PLATFORM
+#include "esp_timer.h"
+#include "esp_rom_crc.h"
+#include "esp_log.h"
+#include "buffered_file.hpp"
+#include "task_profile.hpp"
+#else
+#include <chrono>
+#endif
+#include "data_logger.hpp"
+
+#define TAG "DataLogger"
+
+#ifndef ESP_PLATFORM
+// PCでの試験用 (Kconfigの既定値。ビルド時に-Dで変更可)
+#define ESP_LOGI(tag, format, ...)  fprintf(stderr, "I %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGE(tag, format, ...)  fprintf(stderr, "E %s: " format "\n", tag, ##__VA_ARGS__)
+#ifndef CONFIG_DATALOG_RING_RECORDS
+#define CONFIG_DATALOG_RING_RECORDS     512
+#endif
+#ifndef CONFIG_DATALOG_FLUSH_MS
+#define CONFIG_DATALOG_FLUSH_MS         200
+#endif
+#ifndef CONFIG_DATALOG_SEGMENT_KB
+#define CONFIG_DATALOG_SEGMENT_KB       1024
+#endif
+#ifndef CONFIG_DATALOG_SEGMENT_SEC
+#define CONFIG_DATALOG_SEGMENT_SEC      600
+#endif
+#ifndef CONFIG_DATALOG_MAX_SEGMENTS
+#define CONFIG_DATALOG_MAX_SEGMENTS     100
+#endif
+#endif
+
+#define DATALOG_SYNC_MS     1000    // この間隔でファイルをflushする (電源断時に失うのはこの間のデータ)
+
+static_assert(sizeof(DataLogRecord) == 24, "DataLogRecord size");
+static_assert(sizeof(DataLogFileHeader) == 128, "DataLogFileHeader size");
+static_assert(sizeof(DataLogBlockHeader) == 12, "DataLogBlockHeader size");
+
+// 起動からの時間(us)
+static int64_t nowUs() {
+#ifdef ESP_PLATFORM
+    return esp_timer_get_time();
+#else
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// CRC32 (zlibと同じ。デコーダはbinascii.crc32で確認する)
+static uint32_t crc32(uint32_t crc, const void* buf, size_t len) {
+#ifdef ESP_PLATFORM
+    return esp_rom_crc32_le(crc, (const uint8_t*)buf, len);
+#else
+    const uint8_t* p = (const uint8_t*)buf;
+    crc = ~crc;
+    while(len-- > 0) {
+        crc ^= *p++;
+        for(int i=0; i<8; i++)
+            crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+    }
+    return ~crc;
+#endif
+}
+
+DataLogger::DataLogger() {
+    m_storage = NULL;
+#ifdef ESP_PLATFORM
+    m_xHandle = NULL;
+#else
+    m_isWoken = false;
+#endif
+    m_ring = NULL;
+    m_mask = 0;
+    m_head = 0;
+    m_tail = 0;
+    m_dropped = 0;
+    m_droppedReported = 0;
+    m_written = 0;
+    m_errors = 0;
+    m_quit = false;
+    m_schema[0] = '\0';
+    m_file = NULL;
+    m_segment = 0;
+    m_segmentStart = 0;
+    m_segmentSize = 0;
+    m_blockSeq = 0;
+    m_lastSync = 0;
+}
+
+void DataLogger::init(Storage* storage, const char* schema) {
+    ESP_LOGI(TAG, "Init(S)");
+    m_storage = storage;
+    snprintf(m_schema, sizeof(m_schema), "%s", schema != NULL ? schema : "");
+
+    // リングバッファ (サイズは2のべき乗に切り上げ)
+    uint32_t size = 2;
+    while(size < CONFIG_DATALOG_RING_RECORDS)
+        size <<= 1;
+    m_ring = new Slot[size];
+    m_mask = size - 1;
+    for(uint32_t i=0; i<size; i++)
+        m_ring[i].seq.store(i, std::memory_order_relaxed);
+
+    // ライタタスク作成 (優先度などはKconfigの設定)
+#ifdef ESP_PLATFORM
+    TASK_PROFILE_DATALOG.create(DataLogger::writer_task, (void*)this, &m_xHandle);
+#else
+    m_thread = std::thread(DataLogger::writer_task, (void*)this);
+#endif
+
+    ESP_LOGI(TAG, "Init(E)");
+}
+
+// 終了 (ライタタスクが残りを書き込んでセグメントを閉じる。PCでは完了を待つ)
+void DataLogger::quit() {
+    m_quit = true;
+    wake();
+#ifndef ESP_PLATFORM
+    if (m_thread.joinable())
+        m_thread.join();
+#endif
+}
+
+void DataLogger::wake() {
+#ifdef ESP_PLATFORM
+    if (m_xHandle != NULL)
+        xTaskNotifyGive(m_xHandle);
+#else
+    std::lock_guard<std::mutex> lock(m_wakeMutex);
+    m_isWoken = true;
+    m_wakeCond.notify_one();
+#endif
+}
+
+void DataLogger::waitWake(uint32_t timeoutMs) {
+#ifdef ESP_PLATFORM
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeoutMs));
+#else
+    std::unique_lock<std::mutex> lock(m_wakeMutex);
+    m_wakeCond.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this]() { return m_isWoken; });
+    m_isWoken = false;
+#endif
+}
+
+// レコード記録
+bool DataLogger::write(uint16_t id, const void* data, size_t len) {
+    if (m_ring == NULL)
+        return false;
+    // 空きスロットを確保 (スロットのseqが位置と一致すれば空き)
+    uint32_t pos = m_head.load(std::memory_order_relaxed);
+    Slot* slot;
+    while(true) {
+        slot = &m_ring[pos & m_mask];
+        uint32_t seq = slot->seq.load(std::memory_order_acquire);
+        int32_t diff = (int32_t)(seq - pos);
+        if (diff == 0) {
+            if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);     // 満杯
+            return false;
+        } else {
+            pos = m_head.load(std::memory_order_relaxed);
+        }
+    }
+    DataLogRecord& record = slot->record;
+    record.time = nowUs();
+    record.id = id;
+    record.len = len < DATALOG_PAYLOAD_SIZE ? len : DATALOG_PAYLOAD_SIZE;
+    memcpy(record.data, data, record.len);
+    memset(record.data + record.len, 0, DATALOG_PAYLOAD_SIZE - record.len);
+    slot->seq.store(pos + 1, std::memory_order_release);    // ライタタスクに公開
+    // リングの半分ごとにライタタスクを起こす
+    if (((pos + 1) & (m_mask >> 1)) == 0)
+        wake();
+    return true;
+}
+
+void DataLogger::getStats(DataLogStats* stats) {
+    stats->written = m_written;
+    stats->dropped = m_dropped;
+    stats->segment = m_segment;
+    stats->segmentSize = m_segmentSize;
+    stats->errors = m_errors;
+}
+
+// ライタタスク
+void DataLogger::writer_task(void* arg) {
+    DataLogger* pThis = (DataLogger*)arg;
+    while(!pThis->m_quit) {
+        pThis->waitWake(CONFIG_DATALOG_FLUSH_MS);
+        pThis->drain();
+    }
+    // 終了処理
+    pThis->drain();
+    pThis->closeSegment();
+#ifdef ESP_PLATFORM
+    vTaskDelete(NULL);
+#endif
+}
+
+// リングからブロックに取り出して書き込み
+size_t DataLogger::drain() {
+    size_t total = 0;
+    while(true) {
+        size_t count = 0;
+        while(count < DATALOG_BLOCK_RECORDS) {
+            Slot* slot = &m_ring[m_tail & m_mask];
+            if (slot->seq.load(std::memory_order_acquire) != m_tail + 1)
+                break;      // まだ書き込まれていない
+            m_block[count++] = slot->record;
+            slot->seq.store(m_tail + m_mask + 1, std::memory_order_release);    // 次の周回で空きになる
+            m_tail++;
+        }
+        if (count == 0)
+            break;
+        if (!writeBlock(count))
+            m_dropped.fetch_add(count, std::memory_order_relaxed);
+        total += count;
+        if (count < DATALOG_BLOCK_RECORDS)
+            break;
+    }
+    // 一定間隔でflush
+    int64_t now = nowUs();
+    if (m_file != NULL && now - m_lastSync >= DATALOG_SYNC_MS * 1000) {
+        if (!m_file->flush()) {
+            m_errors++;
+            closeSegment();
+        }
+        m_lastSync = now;
+    }
+    return total;
+}
+
+// ブロック書き込み
+bool DataLogger::writeBlock(size_t count) {
+    if (!m_storage->isReady()) {
+        closeSegment();
+        return false;
+    }
+    // セグメント切り替え
+    int64_t now = nowUs();
+    if (m_file != NULL && (m_segmentSize >= CONFIG_DATALOG_SEGMENT_KB * 1024 ||
+            now - m_segmentStart >= (int64_t)CONFIG_DATALOG_SEGMENT_SEC * 1000000))
+        closeSegment();
+    if (m_file == NULL && !openSegment())
+        return false;
+    // 前のブロックから破棄した数を記録
+    uint32_t dropped = m_dropped.load(std::memory_order_relaxed);
+    uint32_t delta = dropped - m_droppedReported;
+    m_droppedReported = dropped;
+    DataLogBlockHeader header;
+    memcpy(header.magic, "DLBK", 4);
+    header.seq = m_blockSeq++;
+    header.count = count;
+    header.dropped = delta < 0xffff ? delta : 0xffff;
+    size_t len = count * sizeof(DataLogRecord);
+    uint32_t crc = crc32(0, &header, sizeof(header));
+    crc = crc32(crc, m_block, len);
+    if (m_file->write(&header, sizeof(header)) != sizeof(header) ||
+        m_file->write(m_block, len) != (int)len ||
+        m_file->write(&crc, sizeof(crc)) != sizeof(crc)) {
+        ESP_LOGE(TAG, "write error : segment %lu", (unsigned long)m_segment);
+        m_errors++;
+        closeSegment();
+        return false;
+    }
+    m_segmentSize += sizeof(header) + len + sizeof(crc);
+    m_written.fetch_add(count, std::memory_order_relaxed);
+    return true;
+}
+
+// 新しいセグメントを開く
+bool DataLogger::openSegment() {
+    m_storage->mkdir(DATALOG_DIR);
+    m_segment = scanSegments() + 1;
+    std::string path = segmentPath(m_segment);
+#ifdef ESP_PLATFORM
+    m_file = BufferedFile::open(m_storage, path.c_str(), "w");
+#else
+    m_file = m_storage->open(path.c_str(), "w");
+#endif
+    if (m_file == NULL) {
+        ESP_LOGE(TAG, "open error : %s", path.c_str());
+        m_errors++;
+        return false;
+    }
+    DataLogFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "WCDL", 4);
+    header.version = 1;
+    header.headerSize = sizeof(DataLogFileHeader);
+    header.recordSize = sizeof(DataLogRecord);
+    header.payloadSize = DATALOG_PAYLOAD_SIZE;
+    header.segment = m_segment;
+    m_segmentStart = nowUs();
+    header.startTime = m_segmentStart;
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    header.startEpoch = tv.tv_sec > 1000000000 ? (int64_t)tv.tv_sec * 1000000 + tv.tv_usec : 0;     // 時刻未設定なら0
+    memcpy(header.schema, m_schema, sizeof(header.schema));
+    header.crc = crc32(0, &header, offsetof(DataLogFileHeader, crc));
+    if (m_file->write(&header, sizeof(header)) != sizeof(header)) {
+        m_errors++;
+        closeSegment();
+        return false;
+    }
+    m_segmentSize = sizeof(header);
+    m_blockSeq = 0;
+    m_lastSync = m_segmentStart;
+    ESP_LOGI(TAG, "open segment : %s", path.c_str());
+    return true;
+}
+
+void DataLogger::closeSegment() {
+    if (m_file == NULL)
+        return;
+    if (!m_file->close() && m_storage->isReady())
+        m_errors++;
+    delete m_file;
+    m_file = NULL;
+    m_segmentSize = 0;
+}
+
+// 既存セグメントの最大番号を返し、上限を超えた古いものを削除
+uint32_t DataLogger::scanSegments() {
+    std::vector<uint32_t> segments;
+    m_storage->listDir(DATALOG_DIR, [](const StorageDirEntry* entry, void* context) -> bool {
+        unsigned segment;
+        char ext[4];
+        if (!entry->isDir && sscanf(entry->name, "dl%6u.%3s", &segment, ext) == 2 && strcasecmp(ext, "bin") == 0)
+            ((std::vector<uint32_t>*)context)->push_back(segment);
+        return true;
+    }, &segments);
+    std::sort(segments.begin(), segments.end());
+    // これから作る1つを含めて上限以内にする
+    size_t count = segments.size();
+    for(size_t i=0; count + 1 > CONFIG_DATALOG_MAX_SEGMENTS && i < segments.size(); i++, count--) {
+        ESP_LOGI(TAG, "remove segment : %s", segmentPath(segments[i]).c_str());
+        m_storage->remove(segmentPath(segments[i]).c_str());
+    }
+    return segments.empty() ? 0 : segments.back();
+}
+
+std::string DataLogger::segmentPath(uint32_t segment) {
+    char path[32];
+    snprintf(path, sizeof(path), DATALOG_DIR "/dl%06lu.bin", (unsigned long)segment);
+    return path;
+}
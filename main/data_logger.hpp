@@ -0,0 +1,135 @@
+/**
+ * データロガー
+ *
+ * 固定長のレコードをSDカードの/logにバイナリで記録します。
+ *
+ *  記録 : 任意のタスクからwrite()でロック無しのリングバッファに書き込みます(ブロックしません)。
+ *         リングが満杯の場合は破棄して破棄数を数えます。
+ *  書き込み : 低優先度のライタタスクがリングから取り出してブロックにまとめ、セグメントファイルに書き込みます。
+ *             セグメントはサイズまたは経過時間で切り替え、古いものから削除します。
+ *
+ * ファイル形式 (リトルエンディアン、tools/datalog_decode.pyで読み込めます)
+ *  ファイルヘッダ : DataLogFileHeader (CRC32付き)
+ *  ブロック       : DataLogBlockHeader + レコード × count + CRC32(ブロックヘッダとレコード)
+ *  レコード       : DataLogRecord
+ *
+ * ESP_PLATFORM以外(PC)ではライタタスクの代わりにstd::threadを使い、tools/datalog_test.cppで試験できます。
+*/
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <iostream>
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#else
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#endif
+#include "storage.hpp"
+
+#define DATALOG_DIR             "/log"
+#define DATALOG_PAYLOAD_SIZE    12      // レコードのデータ部のサイズ
+#define DATALOG_BLOCK_RECORDS   128     // 1ブロックの最大レコード数
+#define DATALOG_SCHEMA_SIZE     64      // スキーマ文字列の最大長 (終端含む)
+
+// レコード (24byte)
+struct DataLogRecord {
+    int64_t time;                           // 起動からの時間(us)
+    uint16_t id;                            // 種別 (アプリケーションで定義)
+    uint16_t len;                           // データ部の有効長
+    uint8_t data[DATALOG_PAYLOAD_SIZE];     // データ部
+};
+
+// ファイルヘッダ (128byte)
+struct DataLogFileHeader {
+    char magic[4];          // "WCDL"
+    uint16_t version;       // 1
+    uint16_t headerSize;    // sizeof(DataLogFileHeader)
+    uint16_t recordSize;    // sizeof(DataLogRecord)
+    uint16_t payloadSize;   // DATALOG_PAYLOAD_SIZE
+    uint32_t segment;       // セグメント番号
+    int64_t startTime;      // 作成時の起動からの時間(us)
+    int64_t startEpoch;     // 作成時の時刻(UNIX時間 us、不明な場合は0)
+    char schema[DATALOG_SCHEMA_SIZE];   // データ部の構成 ("name:type,..." typeはu8,i8,u16,i16,u32,i32,f32)
+    uint8_t reserved[28];
+    uint32_t crc;           // ここまでのCRC32
+};
+
+// ブロックヘッダ (12byte)
+struct DataLogBlockHeader {
+    char magic[4];          // "DLBK"
+    uint32_t seq;           // ブロック番号 (セグメント内の連番)
+    uint16_t count;         // レコード数
+    uint16_t dropped;       // 前のブロックからこのブロックまでに破棄したレコード数 (65535で飽和)
+};
+
+// 統計
+struct DataLogStats {
+    uint32_t written;       // 書き込んだレコード数
+    uint32_t dropped;       // 破棄したレコード数
+    uint32_t segment;       // 書き込み中のセグメント番号
+    uint32_t segmentSize;   // 書き込み中のセグメントのサイズ
+    uint32_t errors;        // 書き込みエラー数
+};
+
+class DataLogger {
+    public:
+        DataLogger();
+
+    public:
+        // schemaはデータ部の構成 (ファイルヘッダに記録され、デコーダが使用)
+        void init(Storage* storage, const char* schema);
+        void quit();
+
+        // レコード記録 (任意のタスクから呼び出し可能。リングが満杯ならfalse)
+        bool write(uint16_t id, const void* data, size_t len);
+        void getStats(DataLogStats* stats);
+
+    private:
+        struct Slot {
+            std::atomic<uint32_t> seq;      // Vyukov方式のシーケンス番号
+            DataLogRecord record;
+        };
+        // ライタタスク
+        static void writer_task(void* arg);
+        void wake();                        // ライタタスクを起こす
+        void waitWake(uint32_t timeoutMs);  // wake()またはtimeoutMsまで待つ (ライタタスク)
+        size_t drain();                     // リングからブロックに取り出して書き込み
+        bool writeBlock(size_t count);      // ブロック書き込み
+        bool openSegment();                 // 新しいセグメントを開く
+        void closeSegment();
+        uint32_t scanSegments();            // 既存セグメントの最大番号を返し、上限を超えた古いものを削除
+        static std::string segmentPath(uint32_t segment);
+
+    private:
+        Storage* m_storage;
+#ifdef ESP_PLATFORM
+        TaskHandle_t m_xHandle;             // ライタタスクハンドル
+#else
+        std::thread m_thread;
+        std::mutex m_wakeMutex;
+        std::condition_variable m_wakeCond;
+        bool m_isWoken;
+#endif
+        Slot* m_ring;                       // リングバッファ
+        uint32_t m_mask;                    // リングのサイズ-1
+        std::atomic<uint32_t> m_head;       // 次に書き込む位置 (複数の記録側で共有)
+        uint32_t m_tail;                    // 次に読み出す位置 (ライタタスクのみ)
+        std::atomic<uint32_t> m_dropped;    // 破棄数 (累計)
+        uint32_t m_droppedReported;         // ブロックに記録済みの破棄数
+        std::atomic<uint32_t> m_written;    // 書き込み数 (累計)
+        std::atomic<uint32_t> m_errors;     // 書き込みエラー数
+        std::atomic<bool> m_quit;
+        char m_schema[DATALOG_SCHEMA_SIZE];
+        // ライタタスクのみ使用
+        StorageFile* m_file;                // 書き込み中のセグメント
+        uint32_t m_segment;                 // 書き込み中のセグメント番号
+        int64_t m_segmentStart;             // セグメント作成時刻(us)
+        std::atomic<uint32_t> m_segmentSize;
+        uint32_t m_blockSeq;
+        int64_t m_lastSync;                 // 最後にflushした時刻(us)
+        DataLogRecord m_block[DATALOG_BLOCK_RECORDS];
+};
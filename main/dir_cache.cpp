@@ -0,0 +1,126 @@
+#include <string.h>
+#include "esp_log.h"
+#include "dir_cache.hpp"
+
+#define TAG "DirCache"
+
+DirCache::DirCache() {
+    m_storage = NULL;
+    m_useCount = 0;
+    m_generation = 0;
+}
+
+void DirCache::init(Storage* storage) {
+    m_storage = storage;
+}
+
+// 列挙中の状態
+struct DirCacheScan {
+    int cursor;
+    int limit;
+    std::vector<DirListItem>* page;
+    int total;
+    bool isOverflow;        // キャッシュの上限を超えた
+};
+
+// pathのcursor番目からlimit個をpageに返す
+int DirCache::list(const char* path, int cursor, int limit, std::vector<DirListItem>& page) {
+    page.clear();
+    if (m_storage == NULL)
+        return -1;
+    std::string key = normalize(path);
+    uint32_t generation;
+    {
+        // キャッシュにあればそこから返す
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for(auto& dir : m_dirs) {
+            if (dir.path == key) {
+                dir.lastUse = ++m_useCount;
+                int total = dir.items.size();
+                for(int i=cursor; i<total && (int)page.size()<limit; i++) {
+                    const Item& item = dir.items[i];
+                    page.push_back({ &dir.names[item.name], item.isDir, item.size, item.mtime });
+                }
+                return total;
+            }
+        }
+        generation = m_generation;
+    }
+    // 列挙してページを取り出しつつ、上限内ならキャッシュを作る
+    Dir dir = { key, "", {}, 0 };
+    DirCacheScan scan = { cursor, limit, &page, 0, false };
+    auto callback = [](const StorageDirEntry* entry, void* context) -> bool {
+        auto* ctx = (std::pair<DirCacheScan*, Dir*>*)context;
+        DirCacheScan* scan = ctx->first;
+        Dir* dir = ctx->second;
+        if (scan->total >= scan->cursor && (int)scan->page->size() < scan->limit)
+            scan->page->push_back({ entry->name, entry->isDir, entry->size, entry->mtime });
+        scan->total++;
+        if (!scan->isOverflow) {
+            if (dir->items.size() >= DIR_CACHE_MAX_ENTRIES) {
+                scan->isOverflow = true;
+                dir->items.clear();
+                dir->items.shrink_to_fit();
+                dir->names.clear();
+                dir->names.shrink_to_fit();
+            } else {
+                dir->items.push_back({ (uint32_t)dir->names.size(), entry->isDir, entry->size, entry->mtime });
+                dir->names.append(entry->name);
+                dir->names.push_back('\0');
+            }
+        }
+        return true;
+    };
+    std::pair<DirCacheScan*, Dir*> ctx(&scan, &dir);
+    if (!m_storage->listDir(key.c_str(), callback, &ctx))
+        return -1;
+    if (!scan.isOverflow) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // 列挙中に変更があった場合は古い可能性があるのでキャッシュしない
+        if (generation == m_generation) {
+            dir.items.shrink_to_fit();
+            dir.names.shrink_to_fit();
+            dir.lastUse = ++m_useCount;
+            if (m_dirs.size() >= DIR_CACHE_MAX_DIRS) {
+                auto oldest = m_dirs.begin();
+                for(auto it = m_dirs.begin(); it != m_dirs.end(); it++) {
+                    if (it->lastUse < oldest->lastUse)
+                        oldest = it;
+                }
+                m_dirs.erase(oldest);
+            }
+            m_dirs.push_back(std::move(dir));
+        }
+    } else {
+        ESP_LOGI(TAG, "too many entries, not cached : %s (%d)", key.c_str(), scan.total);
+    }
+    return scan.total;
+}
+
+// pathの変更でキャッシュを破棄
+void DirCache::invalidate(const char* path) {
+    std::string key = normalize(path);
+    std::string parent = key;
+    size_t pos = parent.rfind('/');
+    parent = pos == 0 || pos == std::string::npos ? "/" : parent.substr(0, pos);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_generation++;
+    m_dirs.remove_if([&](const Dir& dir) { return dir.path == key || dir.path == parent; });
+}
+
+// 全キャッシュ破棄
+void DirCache::clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_generation++;
+    m_dirs.clear();
+}
+
+// 末尾の'/'を除いたパス (ルートは"/")
+std::string DirCache::normalize(const char* path) {
+    std::string key = path;
+    while(key.size() > 1 && key.back() == '/')
+        key.pop_back();
+    if (key.empty() || key[0] != '/')
+        key.insert(0, "/");
+    return key;
+}
@@ -0,0 +1,66 @@
+/**
+ * ディレクトリ一覧のキャッシュ
+ *
+ * Storage::listDir()の結果をディレクトリ単位で保持し、ページ単位で取り出します。
+ * エントリはlistDir()の列挙順で保持し、カーソルは先頭からのインデックスです。
+ * ストレージの変更通知で該当ディレクトリを破棄し、アンマウント時はclear()で全て破棄します。
+ *
+ * メモリ節約のため名前は1つのバッファに詰めて保持します。
+ * エントリ数がDIR_CACHE_MAX_ENTRIESを超えるディレクトリはキャッシュせず、毎回列挙します。
+*/
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <list>
+#include <mutex>
+#include <iostream>
+#include "storage.hpp"
+
+#define DIR_CACHE_MAX_DIRS      4       // キャッシュするディレクトリ数
+#define DIR_CACHE_MAX_ENTRIES   512     // キャッシュするディレクトリのエントリ数上限
+
+// 一覧の1エントリ (ページ取得用)
+struct DirListItem {
+    std::string name;
+    bool isDir;
+    off_t size;
+    time_t mtime;
+};
+
+class DirCache {
+    public:
+        DirCache();
+
+    public:
+        void init(Storage* storage);
+
+        // pathのcursor番目からlimit個をpageに返す。戻り値は全エントリ数(ディレクトリが無ければ-1)
+        int list(const char* path, int cursor, int limit, std::vector<DirListItem>& page);
+        // pathの変更でキャッシュを破棄 (pathを含むディレクトリと、path自身がディレクトリならその一覧)
+        void invalidate(const char* path);
+        // 全キャッシュ破棄
+        void clear();
+
+    private:
+        struct Item {
+            uint32_t name;      // namesの中の位置
+            bool isDir;
+            off_t size;
+            time_t mtime;
+        };
+        struct Dir {
+            std::string path;
+            std::string names;  // '\0'区切りの名前
+            std::vector<Item> items;
+            uint32_t lastUse;
+        };
+        static std::string normalize(const char* path);   // 末尾の'/'を除いたパス
+
+    private:
+        Storage* m_storage;
+        std::list<Dir> m_dirs;
+        uint32_t m_useCount;
+        uint32_t m_generation;      // 変更回数 (列挙中の変更検出用)
+        std::mutex m_mutex;
+};
@@ -0,0 +1,124 @@
+#include <string.h>
+#include <errno.h>
+#include <chrono>
+#include "esp_log.h"
+#include "file_cache.hpp"
+
+#define TAG "FileCache"
+
+FileCache::FileCache() {
+    m_storage = NULL;
+    m_maxFiles = 1;
+    m_useCount = 0;
+}
+
+FileCache::~FileCache() {
+    closeAll(0);
+}
+
+void FileCache::init(Storage* storage, int maxFiles) {
+    m_storage = storage;
+    m_maxFiles = maxFiles > 0 ? maxFiles : 1;
+}
+
+// 共有ハンドル取得
+StorageFile* FileCache::acquire(const char* path, uint32_t waitMs) {
+    if (m_storage == NULL)
+        return NULL;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(waitMs);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while(true) {
+        // 開いているハンドルがあれば共有
+        for(auto it = m_entries.begin(); it != m_entries.end(); it++) {
+            if (!it->isStale && it->path == path) {
+                it->refs++;
+                it->lastUse = ++m_useCount;
+                return it->file;
+            }
+        }
+        // 上限に達していれば使用中でないハンドルを閉じて空ける
+        bool isFull = (int)m_entries.size() >= m_maxFiles && !evictIdle();
+        if (!isFull) {
+            StorageFile* file = m_storage->open(path, "r");
+            if (file != NULL) {
+                m_entries.push_back({ path, file, 1, ++m_useCount, false });
+                return file;
+            }
+            // ファイルが無い等はそのまま失敗。VFS全体のハンドル不足なら空きを作って再試行
+            if (errno != ENFILE && errno != EMFILE && errno != ENOMEM)
+                return NULL;
+            if (evictIdle())
+                continue;
+        }
+        // 全て使用中 : 返却を待つ
+        if (m_released.wait_until(lock, deadline) == std::cv_status::timeout) {
+            ESP_LOGW(TAG, "no free handle : %s", path);
+            return NULL;
+        }
+    }
+}
+
+// 共有ハンドル返却
+void FileCache::release(StorageFile* file) {
+    if (file == NULL)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for(auto it = m_entries.begin(); it != m_entries.end(); it++) {
+            if (it->file == file) {
+                if (--it->refs == 0 && it->isStale)
+                    closeEntry(it);
+                break;
+            }
+        }
+    }
+    m_released.notify_all();
+}
+
+// 指定ファイルのハンドルを破棄
+void FileCache::invalidate(const char* path) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for(auto it = m_entries.begin(); it != m_entries.end(); ) {
+        auto next = std::next(it);
+        if (it->path == path) {
+            it->isStale = true;
+            if (it->refs == 0)
+                closeEntry(it);
+        }
+        it = next;
+    }
+}
+
+// 全ハンドルを閉じる
+void FileCache::closeAll(uint32_t waitMs) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for(auto it = m_entries.begin(); it != m_entries.end(); ) {
+        auto next = std::next(it);
+        it->isStale = true;
+        if (it->refs == 0)
+            closeEntry(it);
+        it = next;
+    }
+    // 使用中のハンドルは返却時に閉じられる
+    if (!m_released.wait_for(lock, std::chrono::milliseconds(waitMs), [this]() { return m_entries.empty(); }))
+        ESP_LOGW(TAG, "%d handles still in use", (int)m_entries.size());
+}
+
+// 使用中でない最も古いハンドルを閉じる
+bool FileCache::evictIdle() {
+    auto oldest = m_entries.end();
+    for(auto it = m_entries.begin(); it != m_entries.end(); it++) {
+        if (it->refs == 0 && (oldest == m_entries.end() || it->lastUse < oldest->lastUse))
+            oldest = it;
+    }
+    if (oldest == m_entries.end())
+        return false;
+    closeEntry(oldest);
+    return true;
+}
+
+void FileCache::closeEntry(std::list<Entry>::iterator it) {
+    it->file->close();
+    delete it->file;
+    m_entries.erase(it);
+}
@@ -0,0 +1,56 @@
+/**
+ * オープン済みファイルのキャッシュ
+ *
+ * パスをキーに、読み込み専用で開いたファイルを参照カウント付きで共有します。
+ * 同じファイルを読む複数のリクエストは1つのファイルディスクリプタを共有し、
+ * 各自のオフセットでpread()します(ファイル位置を共有しないためseek()/read()は使用しないこと)。
+ *
+ * 使用中でないハンドルは開いたまま保持し、上限に達したら最も長く使われていないものから閉じます。
+ * 全てのハンドルが使用中の場合は、空くまで指定時間待ちます。
+ * (VFSのmax_filesを使い切ることによるオープン失敗を防ぎます)
+*/
+#pragma once
+
+#include <stdint.h>
+#include <list>
+#include <mutex>
+#include <condition_variable>
+#include <iostream>
+#include "storage.hpp"
+
+class FileCache {
+    public:
+        FileCache();
+        ~FileCache();
+
+    public:
+        void init(Storage* storage, int maxFiles);
+
+        // 共有ハンドル取得 (ファイルが無い、または待ち時間内に空かなければNULL)
+        StorageFile* acquire(const char* path, uint32_t waitMs);
+        // 共有ハンドル返却
+        void release(StorageFile* file);
+        // 指定ファイルのハンドルを破棄 (ファイルを書き換えた時に呼ぶ)
+        void invalidate(const char* path);
+        // 全ハンドルを閉じる (アンマウント前に呼ぶ。使用中のハンドルは返却を最大waitMs待つ)
+        void closeAll(uint32_t waitMs);
+
+    private:
+        struct Entry {
+            std::string path;
+            StorageFile* file;
+            int refs;           // 使用中の数
+            uint32_t lastUse;   // 最終使用順 (LRU用)
+            bool isStale;       // 破棄予定 (返却され次第閉じる)
+        };
+        bool evictIdle();       // 使用中でない最も古いハンドルを閉じる
+        void closeEntry(std::list<Entry>::iterator it);
+
+    private:
+        Storage* m_storage;
+        int m_maxFiles;             // 同時に開いておくハンドルの上限
+        std::list<Entry> m_entries;
+        uint32_t m_useCount;
+        std::mutex m_mutex;
+        std::condition_variable m_released;     // ハンドル返却通知
+};
@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_timer.h"
+#include "log_sink.hpp"
+#include "buffered_file.hpp"
+#include "task_profile.hpp"
+#include "bin_log.hpp"
+
+#define LOGSINK_DRAIN_MS    100     // タスクの起床間隔
+#define LOGSINK_SYNC_MS     1000    // ファイルのflush間隔
+#define LOGSINK_CHUNK       1024    // 1回に取り出すサイズ
+
+LogSink* LogSink::s_instance = NULL;
+
+LogSink::LogSink() {
+    m_storage = NULL;
+    m_xHandle = NULL;
+    m_prevVprintf = NULL;
+    m_ring = NULL;
+    m_size = 0;
+    m_head = 0;
+    m_tail = 0;
+    m_lock = portMUX_INITIALIZER_UNLOCKED;
+    m_dropped = 0;
+    m_quit = false;
+    m_file = NULL;
+    m_fileSize = 0;
+    m_lastSync = 0;
+}
+
+void LogSink::init(Storage* storage) {
+    m_storage = storage;
+    // リングバッファ (サイズは2のべき乗に切り上げ)
+    uint32_t size = 1024;
+    while(size < CONFIG_LOGSINK_BUFFER_SIZE)
+        size <<= 1;
+    m_ring = new char[size];
+    m_size = size;
+
+    // タスク作成
+    TASK_PROFILE_LOGSINK.create(LogSink::task, (void*)this, &m_xHandle);
+
+    // ログ出力先差し替え
+    s_instance = this;
+    m_prevVprintf = esp_log_set_vprintf(log_vprintf);
+}
+
+void LogSink::quit() {
+    m_quit = true;
+    if (m_xHandle != NULL)
+        xTaskNotifyGive(m_xHandle);
+}
+
+// ログ出力 (ESP_LOGxから呼ばれる)
+int LogSink::log_vprintf(const char* format, va_list args) {
+    char line[LOGSINK_LINE_MAX];
+    int len = vsnprintf(line, sizeof(line), format, args);
+    if (len < 0)
+        return len;
+    if (len >= (int)sizeof(line)) {
+        len = sizeof(line) - 1;
+        line[len - 1] = '\n';   // 切り捨てても行として終わらせる
+    }
+    s_instance->push(line, len);
+    return len;
+}
+
+// リングにコピー (出力されていないデータは上書きしない)
+void LogSink::push(const char* line, size_t len) {
+    bool isFull, isWake = false;
+    portENTER_CRITICAL_SAFE(&m_lock);
+    uint32_t pending = m_head - m_tail;
+    isFull = pending + len > m_size;
+    if (!isFull) {
+        uint32_t pos = m_head & (m_size - 1);
+        size_t first = m_size - pos < len ? m_size - pos : len;
+        memcpy(m_ring + pos, line, first);
+        memcpy(m_ring, line + first, len - first);
+        m_head += len;
+        // 未出力が半分を超えたらタスクを起こす
+        isWake = pending < m_size / 2 && pending + len >= m_size / 2;
+    }
+    portEXIT_CRITICAL_SAFE(&m_lock);
+    if (isFull)
+        m_dropped++;
+    if (isWake && m_xHandle != NULL)
+        xTaskNotifyGive(m_xHandle);
+}
+
+// 最近のログ
+std::string LogSink::getRecent(size_t maxLen) {
+    std::string text;
+    if (m_ring == NULL)
+        return text;
+    if (maxLen > m_size)
+        maxLen = m_size;
+    text.resize(maxLen);
+    portENTER_CRITICAL(&m_lock);
+    size_t len = m_head < maxLen ? m_head : maxLen;
+    uint32_t start = m_head - len;
+    for(size_t i=0; i<len; ) {
+        uint32_t pos = (start + i) & (m_size - 1);
+        size_t n = m_size - pos < len - i ? m_size - pos : len - i;
+        memcpy(&text[i], m_ring + pos, n);
+        i += n;
+    }
+    portEXIT_CRITICAL(&m_lock);
+    text.resize(len);
+    // 先頭の途中の行は除く
+    if (len == maxLen) {
+        size_t nl = text.find('\n');
+        text.erase(0, nl == std::string::npos ? text.size() : nl + 1);
+    }
+    return text;
+}
+
+// タスク
+void LogSink::task(void* arg) {
+    LogSink* pThis = (LogSink*)arg;
+    while(!pThis->m_quit) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(LOGSINK_DRAIN_MS));
+        pThis->drain();
+    }
+    // 終了処理
+    esp_log_set_vprintf(pThis->m_prevVprintf);
+    pThis->drain();
+    pThis->closeFile();
+    vTaskDelete(NULL);
+}
+
+// リングから取り出してUART/ファイルに出力
+void LogSink::drain() {
+    char chunk[LOGSINK_CHUNK];
+    while(true) {
+        portENTER_CRITICAL(&m_lock);
+        uint32_t len = m_head - m_tail;
+        if (len > sizeof(chunk))
+            len = sizeof(chunk);
+        uint32_t pos = m_tail & (m_size - 1);
+        size_t first = m_size - pos < len ? m_size - pos : len;
+        memcpy(chunk, m_ring + pos, first);
+        memcpy(chunk + first, m_ring, len - first);
+        portEXIT_CRITICAL(&m_lock);
+        if (len == 0)
+            break;
+#if CONFIG_LOGSINK_UART
+        fwrite(chunk, 1, len, stdout);
+#endif
+        writeFile(chunk, len);
+        // 出力し終えてから空きにする (出力中のログも取り出し済みの分を上書きしない)
+        portENTER_CRITICAL(&m_lock);
+        m_tail += len;
+        portEXIT_CRITICAL(&m_lock);
+    }
+    // バイナリログの新しい記録をここで書式化して出力 (リングには入れない。GET /API/logsでは別に挿入される)
+    std::string blog;
+    BinLog::drainText(blog);
+    if (!blog.empty()) {
+#if CONFIG_LOGSINK_UART
+        fwrite(blog.data(), 1, blog.size(), stdout);
+#endif
+        writeFile(blog.data(), blog.size());
+    }
+#if CONFIG_LOGSINK_UART
+    fflush(stdout);
+#endif
+    // 一定間隔でflush
+    int64_t now = esp_timer_get_time();
+    if (m_file != NULL && now - m_lastSync >= LOGSINK_SYNC_MS * 1000) {
+        if (!m_file->flush())
+            closeFile();
+        m_lastSync = now;
+    }
+}
+
+// ファイルに書き込み (SDカードが無い場合は書き込まない)
+void LogSink::writeFile(const char* data, size_t len) {
+    if (CONFIG_LOGSINK_FILE_KB <= 0 || m_storage == NULL || !m_storage->isReady()) {
+        closeFile();
+        return;
+    }
+    if (m_file != NULL && m_fileSize >= CONFIG_LOGSINK_FILE_KB * 1024) {
+        closeFile();
+        rotate();
+    }
+    if (m_file == NULL) {
+        m_storage->mkdir(LOGSINK_DIR);
+        StorageStat st;
+        m_fileSize = m_storage->stat(LOGSINK_FILE, &st) ? st.size : 0;
+        m_file = BufferedFile::open(m_storage, LOGSINK_FILE, "a");
+        if (m_file == NULL)
+            return;
+        m_lastSync = esp_timer_get_time();
+    }
+    if (m_file->write(data, len) != (int)len) {
+        closeFile();
+        return;
+    }
+    m_fileSize += len;
+}
+
+// system.log -> system.1.log -> system.2.log ... (最も古いものは削除)
+void LogSink::rotate() {
+    char from[32], to[32];
+    for(int i=CONFIG_LOGSINK_FILES - 1; i>=1; i--) {
+        snprintf(to, sizeof(to), LOGSINK_DIR "/system.%d.log", i);
+        if (i == 1)
+            snprintf(from, sizeof(from), "%s", LOGSINK_FILE);
+        else
+            snprintf(from, sizeof(from), LOGSINK_DIR "/system.%d.log", i - 1);
+        StorageStat st;
+        if (m_storage->stat(from, &st))
+            m_storage->rename(from, to);
+    }
+    if (CONFIG_LOGSINK_FILES <= 1)
+        m_storage->remove(LOGSINK_FILE);
+}
+
+void LogSink::closeFile() {
+    if (m_file == NULL)
+        return;
+    m_file->close();
+    delete m_file;
+    m_file = NULL;
+    m_fileSize = 0;
+}
@@ -0,0 +1,63 @@
+/**
+ * ログ出力先 (ESP_LOGxの出力をリングバッファ経由で非同期に出力)
+ *
+ * esp_log_set_vprintf()で出力先を差し替え、ログ出力時は文字列化してリングバッファにコピーするだけにします。
+ * バックグラウンドのタスクがリングから取り出し、SDカードのファイル(/log/system.log)とUART(設定で選択)に書き込みます。
+ *
+ *  ファイルはLOGSINK_FILE_KBを超えるとsystem.1.log, system.2.log...に順に名前を変えて切り替えます。
+ *  リングに空きが無い場合(書き込みが追いつかない場合)はその行を破棄して数えます。
+ *  出力済みの行もリングが上書きされるまで残るので、getRecent()で最近のログを取得できます(SDカードにはアクセスしません)。
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stdarg.h>
+#include <atomic>
+#include <iostream>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "storage.hpp"
+
+#define LOGSINK_DIR         "/log"
+#define LOGSINK_FILE        LOGSINK_DIR "/system.log"
+#define LOGSINK_LINE_MAX    256     // 1行の最大長 (超えた分は切り捨て)
+
+class LogSink {
+    public:
+        LogSink();
+
+    public:
+        void init(Storage* storage);
+        void quit();
+
+        std::string getRecent(size_t maxLen);   // 最近のログ (最大maxLenバイト、行単位)
+        uint32_t getDropped() { return m_dropped; }     // 破棄した行数
+
+    private:
+        static int log_vprintf(const char* format, va_list args);
+        void push(const char* line, size_t len);
+        // タスク
+        static void task(void* arg);
+        void drain();
+        void writeFile(const char* data, size_t len);
+        void rotate();
+        void closeFile();
+
+    private:
+        static LogSink* s_instance;
+        Storage* m_storage;
+        TaskHandle_t m_xHandle;         // タスクハンドル
+        vprintf_like_t m_prevVprintf;   // 差し替え前の出力 (UART)
+        char* m_ring;                   // リングバッファ
+        uint32_t m_size;                // リングのサイズ (2のべき乗)
+        uint32_t m_head;                // 書き込み位置 (累計バイト数)
+        uint32_t m_tail;                // 出力済み位置 (累計バイト数)
+        portMUX_TYPE m_lock;
+        std::atomic<uint32_t> m_dropped;
+        std::atomic<bool> m_quit;
+        // タスクのみ使用
+        StorageFile* m_file;            // 書き込み中のファイル
+        uint32_t m_fileSize;
+        int64_t m_lastSync;             // 最後にflushした時刻(us)
+};
@@ -2,9 +2,11 @@
 #include <sys/types.h>
 #include <dirent.h>
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 #include <iostream>
 #include <map>
+#include <algorithm>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
@@ -16,32 +18,34 @@
 #include "esp_chip_info.h"
 #include "esp_flash.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_system.h"
 
 #include "main.hpp"
+#include "bin_log.hpp"
 
 #define TAG "Application"
-#define ROOT "/mnt"
 
 Application app;
 
-// メッセージ種別 (メッセージキュー用)
-enum class AppMessage {
-    UpdateDisplay,      // ディスプレイに現在状態表示
-    WIFIConnection,     // Wi-Fi接続
-    WIFIDisconnection,  // Wi-Fi切断
-    Quit                // 終了
-};
-
-Application::Application() {
+Application::Application() : Actor(TAG), m_ioWorker("IOWorker") {
     m_LedState = false;
-    m_xHandle = NULL;
-    m_xQueue = NULL;
     m_isWiFi = false;
     m_30sec_off = false;
+    m_isDashboard = false;
+    m_statusRequests = 0;
+    m_statusTime = 0;
+    m_configStamp = {};
+    m_reloadTimer = NULL;
+    m_taskSampleTimer = NULL;
+    m_30secTimer = NULL;
 }
 
 // 初期化
 void Application::init() {
+    // ログ出力先初期化 (以降のログはリングバッファ経由でUART/SDカードに出力)
+    m_log_sink.init(m_sd_card.storage());
+
     ESP_LOGI(TAG, "Init(S)");
 
     // LED初期化
@@ -49,6 +53,9 @@ void Application::init() {
     gpio_set_direction((gpio_num_t)CONFIG_LED_PIN, GPIO_MODE_OUTPUT);
     led(0);
 
+    // 30秒タイマ (ボタン割り込みから延長するので先に作る)
+    m_30secTimer = xTimerCreate("30SecTimer", pdMS_TO_TICKS(30000), pdFALSE, this, timer30secFunc);
+
     // ボタン初期化(GPIO0)
     gpio_reset_pin((gpio_num_t)0);
     gpio_set_intr_type((gpio_num_t)0, GPIO_INTR_NEGEDGE);
@@ -58,61 +65,115 @@ void Application::init() {
     gpio_install_isr_service(0);
     gpio_isr_handler_add((gpio_num_t)0, btn0HandlerFunc, (void*)this);
 
-    // タスク作成
-    xTaskCreate(Application::app_task, TAG, configMINIMAL_STACK_SIZE * 2, (void*)this, tskIDLE_PRIORITY, &m_xHandle);
-
-    // メッセージキューの初期化
-    m_xQueue = xQueueCreate(10, sizeof(AppMessage));
+    // 実行タスク作成
+    //  各クラスはタスクとキューを持たず、メッセージを3つの実行タスクで順番に処理します。
+    //  (以前の5タスク分のスタックとキューが3タスク分のスタックとメールボックスになる)
+    //  SDカードのマウントやWebSocketの送信など待ちの発生するものはIOに置き、Wi-Fiのイベントを待たせない
+    ActorEventBus::subscribe(AppEvent::SDMount, this);
+    ActorEventBus::subscribe(AppEvent::WiFiConnect, this);
+    ActorEventBus::subscribe(AppEvent::DisplayReady, this);
+    m_systemExecutor.add(this);
+    m_systemExecutor.add(&m_wifi);
+    m_ioExecutor.add(&m_sd_card);
+    m_ioExecutor.add(&m_web);
+    m_ioExecutor.add(&m_ioWorker);
+    m_displayExecutor.add(&m_oled);
+    //  優先度、コア、スタックはKconfig(Task scheduling)の設定
+    const TaskProfile& system = TASK_PROFILE_SYSTEM;
+    const TaskProfile& io = TASK_PROFILE_IO;
+    const TaskProfile& display = TASK_PROFILE_DISPLAY;
+    m_systemExecutor.start(system.name, system.stackSize, system.priority, system.core);
+    m_ioExecutor.start(io.name, io.stackSize, io.priority, io.core);
+    m_displayExecutor.start(display.name, display.stackSize, display.priority, display.core);
 
     // SDカード初期化
     m_sd_card.init(ROOT);
-    m_sd_card.setMountCallback(mountFunc, this);
 
     // 保存データ初期化
-    m_save_data.init(ROOT);
+    m_save_data.init(m_sd_card.storage());
+
+    // データロガー初期化
+    m_data_logger.init(m_sd_card.storage(), DATALOG_SCHEMA);
 
     // OLED(SSD1306)ディスプレイ初期化
-    m_oled.init(dispInitCompFunc, this);
+    m_oled.setStatusCallback(dispStatusFunc, this);
+    m_oled.init();
 
     // Wi-Fi初期化
-    m_wifi.init(wifiConnectFunc, this);
+    m_wifi.setSampleCallback(wifiSampleFunc, this);     // リンク状態をデータロガーに記録 (と/wsに送信)
+    m_wifi.init();
 
     // Webサーバー初期化
     m_web.init();
     m_web.addHandler(HTTP_GET, "get_data", getData, this);
     m_web.addHandler(HTTP_POST, "set_data", setData, this);
     m_web.addHandler(HTTP_POST, "save", save, this);
+    m_web.addHandler(HTTP_POST, "storage_bench", storageBench, this);
+    m_web.addHandler(HTTP_POST, "log_bench", logBench, this);
+    m_web.addHandler(HTTP_GET, "files", getFiles, this);
+    m_web.addHandler(HTTP_PUT, "files/*", putFile, this, true);
+    m_web.addHandler(HTTP_POST, "files/*", postFiles, this, true);
+    m_web.addHandler(HTTP_GET, "datalog", getDataLog, this);
+    m_web.addHandler(HTTP_GET, "logs", getLogs, this);
+    m_web.addHandler(HTTP_GET, "wifi/stats", getWiFiStats, this);
+    m_web.addHandler(HTTP_GET, "wifi/scan", getWiFiScan, this, true);
+    m_web.addHandler(HTTP_GET, "tasks", getTasks, this);
     m_web.setWebSocketHandler(sebSocketFunc, this);
 
+    // ./config, ./saveの変更チェック用タイマ開始
+    if (CONFIG_RELOAD_INTERVAL_MS > 0) {
+        m_reloadTimer = xTimerCreate("ReloadTimer", pdMS_TO_TICKS(CONFIG_RELOAD_INTERVAL_MS), pdTRUE, this, reloadTimerFunc);
+        if (m_reloadTimer != NULL)
+            xTimerStart(m_reloadTimer, 0);
+    }
+
+    // GET /API/tasksのCPU使用率の基準を記録するタイマ開始
+    if (TaskMonitor::hasRunTime()) {
+        m_taskSampleTimer = xTimerCreate("TaskSampleTimer", pdMS_TO_TICKS(TASK_SAMPLE_MS), pdTRUE, this, taskSampleTimerFunc);
+        if (m_taskSampleTimer != NULL)
+            xTimerStart(m_taskSampleTimer, 0);
+    }
+
     ESP_LOGI(TAG, "Init(E)");
 }
 
-// タスク
-void Application::app_task(void* arg) {
-    Application* pThis = (Application*)arg;
-    AppMessage msg;
-    bool loop = true;
-    while(loop) {
-        // メッセージキュー読み取り
-        if (pThis->m_xQueue != NULL && xQueueReceive(pThis->m_xQueue, (void*)&msg, portMAX_DELAY) == pdTRUE) {
-            switch(msg) {
-                case AppMessage::UpdateDisplay:     // ディスプレイに現在状態表示
-                    pThis->updateDisplay();
-                    break;
-                case AppMessage::WIFIConnection:    // Wi-Fi接続
-                    pThis->wifiConnection();
-                    break;
-                case AppMessage::WIFIDisconnection: // Wi-Fi切断
-                    pThis->wifiDisconnection();
-                    break;
-                case AppMessage::Quit:              // 終了
-                    loop = false;
-                    break;
-            }
-        }
+// メッセージ処理
+void Application::onMessage(AppMessage& msg) {
+    switch(msg) {
+        case AppMessage::UpdateDisplay:     // ディスプレイに現在状態表示
+            updateDisplay();
+            break;
+        case AppMessage::WIFIConnection:    // Wi-Fi接続
+            wifiConnection();
+            break;
+        case AppMessage::WIFIDisconnection: // Wi-Fi切断
+            wifiDisconnection();
+            break;
+        case AppMessage::ReloadCheck:       // ./config, ./saveの変更チェック
+            reloadCheck();
+            break;
+        case AppMessage::TaskSample:        // CPU使用率の基準を記録
+            TaskMonitor::sample();
+            break;
+        case AppMessage::Quit:              // 終了
+            detach();
+            break;
+    }
+}
+
+// イベント処理
+void Application::onEvent(const ActorEvent& event) {
+    switch((AppEvent)event.topic) {
+        case AppEvent::SDMount:             // SDカードのマウント状態変化
+            onMount(event.arg != 0);
+            break;
+        case AppEvent::WiFiConnect:         // Wi-Fiの接続状態変化
+            onWiFiConnect(event.arg != 0);
+            break;
+        case AppEvent::DisplayReady:        // ディスプレイ初期化完了
+            post(AppMessage::UpdateDisplay);
+            break;
     }
-    // 終了処理
-    vTaskDelete(NULL);
 }
 
 // LED点灯制御
@@ -122,21 +183,16 @@ void Application::led(int state) {
     gpio_set_level((gpio_num_t)CONFIG_LED_PIN, m_LedState);
 }
 
-// SDカードマウントコールバック
-void Application::mountFunc(bool isMount, void* context) {
+// SDカードのマウント状態変化
+void Application::onMount(bool isMount) {
     ESP_LOGI(TAG, "SD Card mount : %d", isMount);
-    Application* pThis = (Application*)context;
-    AppMessage msg = AppMessage::UpdateDisplay;
-    xQueueSend(pThis->m_xQueue, &msg, portMAX_DELAY);
-    if (isMount && pThis->getConfig(ROOT)) {
-        AppMessage msg = AppMessage::WIFIConnection;
-        xQueueSend(pThis->m_xQueue, &msg, portMAX_DELAY);
-    } else {
-        AppMessage msg = AppMessage::WIFIDisconnection;
-        xQueueSend(pThis->m_xQueue, &msg, portMAX_DELAY);
-    }
+    post(AppMessage::UpdateDisplay);
+    if (isMount && getConfig(m_sd_card.storage()))
+        post(AppMessage::WIFIConnection);
+    else
+        post(AppMessage::WIFIDisconnection);
     // 保存データ読み込み
-    pThis->m_save_data.read();
+    m_save_data.read();
 }
 
 // ファイル一覧コールバック
@@ -146,45 +202,58 @@ bool Application::fileFunc(bool isFile, const char* name, void* context) {
     return true;
 }
 
-// ディスプレイ初期化完了コールバック
-void Application::dispInitCompFunc(void* context) {
+// 状態表示の内容 (ディスプレイの実行タスクでCONFIG_OLED_STATUS_MS毎に呼ばれる。待ちの発生する処理はしない)
+void Application::dispStatusFunc(OledStatus* status, void* context) {
     Application* pThis = (Application*)context;
-    AppMessage msg = AppMessage::UpdateDisplay;
-    xQueueSend(pThis->m_xQueue, &msg, portMAX_DELAY);
+    std::shared_ptr<const NetStatus> net = pThis->m_netStatus.load();
+    if (net->isConnected) {
+        snprintf(status->ip, sizeof(status->ip), "%s", net->ipAddress.c_str());
+        WiFiLinkSample sample;
+        if (pThis->m_wifi.getSamples(&sample, 1) == 1)
+            status->rssi = sample.rssi;     // 直近のサンプル (CONFIG_WIFI_TELEMETRY_MS毎)
+    }
+    status->wsClients = pThis->m_web.getWebSocketClients();    // セッションリストの変更時に公開した数 (ロック無し)
+    status->freeHeap = esp_get_free_heap_size();
+    status->minFreeHeap = esp_get_minimum_free_heap_size();
+    // リクエスト数/秒 (前回から間が空いた場合は次回から)
+    int64_t now = esp_timer_get_time();
+    uint32_t requests = pThis->m_web.getRequestCount();
+    int64_t elapsed = now - pThis->m_statusTime;
+    if (pThis->m_statusTime != 0 && elapsed > 0 && elapsed <= CONFIG_OLED_STATUS_MS * 2000LL)
+        status->requestRate = (float)(requests - pThis->m_statusRequests) * 1000000 / elapsed;
+    pThis->m_statusRequests = requests;
+    pThis->m_statusTime = now;
+    // SDカード (SDカードの実行タスクがマウント時とファイル変更後に公開した値。FatFsを呼ばない)
+    status->isSd = pThis->m_sd_card.getUsage(&status->sdTotal, &status->sdUsed);
 }
 
-// Wi-Fi接続コールバック
-void Application::wifiConnectFunc(bool isConnect, void* context) {
-    Application* pThis = (Application*)context;
+// Wi-Fiの接続状態変化
+void Application::onWiFiConnect(bool isConnect) {
     if (isConnect) {
-        pThis->m_30sec_off = pThis->m_isWiFi = true;
-        const char* ipAddress = pThis->m_wifi.getIPAddress();
+        m_30sec_off = m_isWiFi = true;
+        const char* ipAddress = m_wifi.getIPAddress();
         ESP_LOGI(TAG, "IP Address: %s", ipAddress);
-        pThis->led(0);
-        pThis->m_web.start(ipAddress, ROOT);   // Webサーバー開始
+        m_netStatus.publish(NetStatus{ true, ipAddress });
+        m_ioWorker.post({ saveWiFiLinkJob, this }, 0);    // SDカードへの書き込みはIOで (一杯なら次の接続時に)
+        led(0);
+        m_web.start(ipAddress, m_sd_card.storage(), m_sd_card.fileCache());   // Webサーバー開始
 
         // 30秒後に画面を消灯するためにタイマ設定
-        pThis->timer30secStart();
+        timer30secStart();
 
-        // pThis->m_sd_card.fileLists("/document/", fileFunc, pThis);
+        // m_sd_card.fileLists("/document/", fileFunc, this);
     } else {
-        pThis->m_30sec_off = pThis->m_isWiFi = false;
+        m_30sec_off = m_isWiFi = false;
+        m_isDashboard = false;
+        m_netStatus.publish(NetStatus{ false, "" });
     }
-    AppMessage msg = AppMessage::UpdateDisplay;
-    xQueueSend(pThis->m_xQueue, &msg, portMAX_DELAY);
+    post(AppMessage::UpdateDisplay);
 }
 
-// 30秒タイマ開始
+// 30秒タイマ開始 (既に動いていれば30秒後に延長)
 void Application::timer30secStart() {
-    TimerHandle_t xTimer = xTimerCreate(
-        "30SecTimer",
-        pdMS_TO_TICKS(30000),
-        pdFALSE,
-        this,
-        timer30secFunc
-    );
-    if (xTimer != NULL)
-        xTimerStart(xTimer, 0);
+    if (m_30secTimer != NULL)
+        xTimerReset(m_30secTimer, 0);
 }
 
 // 30秒タイマ
@@ -192,18 +261,36 @@ void Application::timer30secFunc(TimerHandle_t xTimer) {
     Application* pThis = (Application*)pvTimerGetTimerID(xTimer);
     if (pThis->m_30sec_off == true) {
         pThis->m_30sec_off = false;
-        AppMessage msg = AppMessage::UpdateDisplay;
-        xQueueSend(pThis->m_xQueue, &msg, portMAX_DELAY);
+        pThis->m_isDashboard = false;
+        pThis->post(AppMessage::UpdateDisplay);
+    }
+}
+
+// ./config, ./save変更チェックタイマ
+void Application::reloadTimerFunc(TimerHandle_t xTimer) {
+    Application* pThis = (Application*)pvTimerGetTimerID(xTimer);
+    if (pThis->m_sd_card.isMount()) {
+        pThis->post(AppMessage::ReloadCheck, 0);    // メールボックスが詰まっている場合は次回に回す
     }
 }
 
+// CPU使用率の基準の記録タイマ
+void Application::taskSampleTimerFunc(TimerHandle_t xTimer) {
+    Application* pThis = (Application*)pvTimerGetTimerID(xTimer);
+    pThis->post(AppMessage::TaskSample, 0);     // メールボックスが詰まっている場合は次回に回す
+}
+
 // 基盤上のボタン押下ハンドラ (GPIO0)
+//  消灯中はQRコードを表示、点灯中はQRコードと状態表示を切り替え
 void IRAM_ATTR Application::btn0HandlerFunc(void* context) {
     Application* pThis = (Application*)context;
+    pThis->m_isDashboard = pThis->m_isWiFi && pThis->m_30sec_off && !pThis->m_isDashboard;
     pThis->m_30sec_off = true;
-    pThis->timer30secStart();
-    AppMessage msg = AppMessage::UpdateDisplay;
-    xQueueSend(pThis->m_xQueue, &msg, portMAX_DELAY);
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    if (pThis->m_30secTimer != NULL)
+        xTimerResetFromISR(pThis->m_30secTimer, &xHigherPriorityTaskWoken);    // init()で作成済みのタイマを延長
+    pThis->post(AppMessage::UpdateDisplay);     // 割り込みからは待たない
+    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
 }
 
 // ディスプレイに現在状態表示
@@ -211,7 +298,9 @@ void Application::updateDisplay() {
     if (!m_oled.isInitialize())
         return;
     if (m_isWiFi) {
-        if (m_30sec_off) {
+        if (m_30sec_off && m_isDashboard) {
+            m_oled.dispStatus();
+        } else if (m_30sec_off) {
             const char* ipAddress = m_wifi.getIPAddress();
             char url[256];
             sprintf(url, "http://%s/", ipAddress);
@@ -230,13 +319,64 @@ void Application::updateDisplay() {
 }
 
 // Wi-Fi接続
+//  接続先はssid/pass, ssid1/pass1, ...の順に優先します。
+//  前回接続したAP(./save.wifi)のSSIDが接続先にあればそのBSSID/チャンネルで先に接続します。
+//  configのip : dhcp(既定)、cached(前回のIPアドレスを静的に使用)、a.b.c.d(静的。netmask, gateway, dnsも指定)
 void Application::wifiConnection() {
     wifiDisconnection();
-    if (m_configMap.find("ssid") == m_configMap.end() || m_configMap.find("pass") == m_configMap.end())
+    std::shared_ptr<const ConfigMap> config = m_config.load();
+    std::vector<WiFiProfile> profiles = getWiFiProfiles(*config);
+    if (profiles.empty())
         return; // CONFIGファイルにssidまたはpassの設定がない
-    const char* ssid = m_configMap["ssid"].c_str();
-    const char* pass = m_configMap["pass"].c_str();
-    m_wifi.connect(ssid, pass);
+    auto value = [&config](const char* key, const char* def) {
+        auto iter = config->find(key);
+        return iter == config->end() ? std::string(def) : iter->second;
+    };
+
+    // 前回接続したAP
+    SaveNamespace& ns = m_save_data.ns("wifi");
+    WiFiLinkCache cache = {};
+    std::vector<uint8_t> link;
+    bool isCache = ns.getBytes("link", link) && link.size() == sizeof(cache);
+    if (isCache) {
+        memcpy(&cache, link.data(), sizeof(cache));
+        cache.ssid[sizeof(cache.ssid) - 1] = '\0';
+        isCache = std::any_of(profiles.begin(), profiles.end(), [&cache](const WiFiProfile& p) { return p.ssid == cache.ssid; });
+    }
+
+    // IPアドレス
+    WiFiIPConfig ipConfig = {};
+    std::string ip = value("ip", "dhcp");
+    if (ip == "cached") {
+        if (isCache && cache.ip != 0)
+            ipConfig = { true, cache.ip, cache.netmask, cache.gw, cache.dns, true };
+    } else if (ip != "dhcp") {
+        ipConfig.isStatic = true;
+        ipConfig.ip = esp_ip4addr_aton(ip.c_str());
+        ipConfig.netmask = esp_ip4addr_aton(value("netmask", "255.255.255.0").c_str());
+        ipConfig.gw = esp_ip4addr_aton(value("gateway", "0.0.0.0").c_str());
+        ipConfig.dns = esp_ip4addr_aton(value("dns", "0.0.0.0").c_str());
+    }
+    m_wifi.connect(profiles, isCache ? &cache : NULL, &ipConfig);
+}
+
+// 接続したAPの保存 (I/Oの実行タスク)
+void Application::saveWiFiLinkJob(void* context) {
+    ((Application*)context)->saveWiFiLink();
+}
+
+// 接続したAPとIPアドレスを保存 (次回の高速接続用。変わった場合のみ書き込み)
+void Application::saveWiFiLink() {
+    if (!m_sd_card.isMount())
+        return;
+    WiFiLinkCache cache;
+    m_wifi.getLinkCache(&cache);
+    SaveNamespace& ns = m_save_data.ns("wifi");
+    std::vector<uint8_t> link;
+    if (ns.getBytes("link", link) && link.size() == sizeof(cache) && memcmp(link.data(), &cache, sizeof(cache)) == 0)
+        return;
+    ns.setBytes("link", &cache, sizeof(cache));
+    ns.save();
 }
 
 // Wi-Fi切断
@@ -256,19 +396,18 @@ void Application::wifiDisconnection() {
 //   "memo": "abcdefg"
 // }
 void Application::getData(httpd_req_t *req, void* context) {
-    ESP_LOGI(TAG, "getData");
+    BLOGI(TAG, "getData");
     Application* pThis = (Application*)context;
     char resp[256];
-    const char* ip_address = pThis->m_wifi.getIPAddress();
-    ip_address = ip_address == NULL ? "" : ip_address;
+    std::shared_ptr<const NetStatus> net = pThis->m_netStatus.load();
+    const char* ip_address = net->ipAddress.c_str();
     esp_chip_info_t chip_info;
     esp_chip_info(&chip_info);
     unsigned major_rev = chip_info.revision / 100;
     unsigned minor_rev = chip_info.revision % 100;
     uint32_t flash_size;
     esp_flash_get_size(NULL, &flash_size);
-    const char* memo = pThis->m_save_data.get("memo");
-    memo = memo == NULL ? "" : memo;
+    std::string memo = pThis->m_save_data.get("memo");
     std::string format = R"({
         "ip_address": "%s",
         "target": "%s",
@@ -288,9 +427,9 @@ void Application::getData(httpd_req_t *req, void* context) {
         (chip_info.features & CHIP_FEATURE_IEEE802154) ? ", 802.15.4 (Zigbee/Thread)" : "",
         major_rev, minor_rev, 
         flash_size,
-        memo
+        memo.c_str()
     );
-    ESP_LOGI(TAG, "%s", resp);
+    BLOGI(TAG, "getData len=%u hash=%08lx", (unsigned)strlen(resp), (unsigned long)BinLog::hash(resp));     // JSON全体はBINLOG_STR_MAXを超える
     httpd_resp_set_type(req, "application/json");
     httpd_resp_send(req, resp, strlen(resp));
 }
@@ -300,7 +439,7 @@ void Application::getData(httpd_req_t *req, void* context) {
 //    memo: "abcdefg"
 // }
 void Application::setData(httpd_req_t *req, void* context) {
-    ESP_LOGI(TAG, "setData");
+    BLOGI(TAG, "setData");
     Application* pThis = (Application*)context;
     int ret, remaining = req->content_len;
     char body[100];
@@ -316,7 +455,7 @@ void Application::setData(httpd_req_t *req, void* context) {
         return;
     }
     body[ret] = '\0';
-    ESP_LOGI(TAG, "body : %s", body);
+    BLOGI(TAG, "body len=%d hash=%08lx", ret, (unsigned long)BinLog::hash(body));
     cJSON* json = cJSON_Parse(body);
     if (json == NULL) {
         ESP_LOGI(TAG, "json null");
@@ -337,12 +476,57 @@ void Application::setData(httpd_req_t *req, void* context) {
 
 // WebAPI POST /API/save
 void Application::save(httpd_req_t *req, void* context) {
-    ESP_LOGI(TAG, "save");
+    BLOGI(TAG, "save");
     Application* pThis = (Application*)context;
     pThis->m_save_data.save();
     httpd_resp_send(req, NULL, 0);
 }
 
+// WebAPI GET /API/datalog
+// {
+//   "written": 12345,      // 書き込んだレコード数
+//   "dropped": 0,          // 破棄したレコード数 (リング満杯またはSDカード未挿入)
+//   "segment": 3,          // 書き込み中のセグメント番号 (/log/dl000003.bin)
+//   "segment_size": 65536,
+//   "errors": 0
+// }
+void Application::getDataLog(httpd_req_t *req, void* context) {
+    Application* pThis = (Application*)context;
+    DataLogStats stats;
+    pThis->m_data_logger.getStats(&stats);
+    char resp[160];
+    snprintf(resp, sizeof(resp), R"({"written":%lu,"dropped":%lu,"segment":%lu,"segment_size":%lu,"errors":%lu})",
+        (unsigned long)stats.written, (unsigned long)stats.dropped, (unsigned long)stats.segment,
+        (unsigned long)stats.segmentSize, (unsigned long)stats.errors);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, resp, strlen(resp));
+}
+
+// WebAPI GET /API/logs?len=4096
+//  最近のログをテキストで返します (メモリ上のリングバッファから取得。SDカードにはアクセスしません)
+//  バイナリログ(BLOGx)の記録はここで書式化し、時刻順に挿入します。
+//  format=binの場合はバイナリログをそのまま返します (tools/binlog_decode.pyで書式化)
+//  ヘッダ X-Log-Dropped : リング満杯で破棄した行数
+void Application::getLogs(httpd_req_t *req, void* context) {
+    Application* pThis = (Application*)context;
+    std::string value;
+    if (WebServer::getQuery(req, "format", value) && value == "bin") {
+        std::string data = BinLog::dump();
+        httpd_resp_set_type(req, "application/octet-stream");
+        httpd_resp_send(req, data.data(), data.size());
+        return;
+    }
+    size_t len = CONFIG_LOGSINK_BUFFER_SIZE;
+    if (WebServer::getQuery(req, "len", value))
+        len = strtoul(value.c_str(), NULL, 10);
+    std::string text = BinLog::render(pThis->m_log_sink.getRecent(len));
+    char dropped[16];
+    snprintf(dropped, sizeof(dropped), "%lu", (unsigned long)pThis->m_log_sink.getDropped());
+    httpd_resp_set_type(req, "text/plain");
+    httpd_resp_set_hdr(req, "X-Log-Dropped", dropped);
+    httpd_resp_send(req, text.c_str(), text.size());
+}
+
 // WebSocketコールバック
 char* Application::sebSocketFunc(const char* data, void* context) {
     return NULL;
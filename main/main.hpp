@@ -2,17 +2,68 @@
 
 #include <iostream>
 #include <map>
+#include <sys/types.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
 #include "freertos/timers.h"
+#include "actor.hpp"
+#include "app_event.hpp"
+#include "task_profile.hpp"
 #include "sd_card.hpp"
 #include "oled_display.hpp"
 #include "wifi.hpp"
 #include "web.hpp"
 #include "save_data.hpp"
+#include "data_logger.hpp"
+#include "log_sink.hpp"
+#include "snapshot.hpp"
 
-class Application {
+#define ROOT "/mnt"     // SDカードのマウント先
+
+typedef std::map<std::string, std::string> ConfigMap;
+
+// ファイルの変更検出用 (サイズと更新日時)
+struct FileStamp {
+    bool exists;
+    off_t size;
+    time_t mtime;
+    bool operator==(const FileStamp& o) const { return exists == o.exists && size == o.size && mtime == o.mtime; }
+};
+
+// Wi-Fiの接続状態 (システムの実行タスクで公開し、ディスプレイの実行タスクやhttpdタスクから参照)
+struct NetStatus {
+    bool isConnected;
+    std::string ipAddress;
+};
+
+// データロガーのレコード種別 (DataLogRecord::id)
+#define DATALOG_ID_WIFI_LINK    1       // Wi-Fiのリンク状態 (CONFIG_WIFI_TELEMETRY_MS毎)
+// データ部の構成 (WiFiLinkRecordと同じ順)
+#define DATALOG_SCHEMA  "rssi:i8,ch:u8,phy:u8,bw:u8,conn_ms:u32,reconn:u16,disc:u16"
+
+// Wi-Fiのリンク状態のレコード (データ部 12byte)
+struct WiFiLinkRecord {
+    int8_t rssi;
+    uint8_t channel;
+    uint8_t phy;
+    uint8_t bandwidth;
+    uint32_t connectedMs;
+    uint16_t reconnects;    // 65535で飽和
+    uint16_t disconnects;   // 65535で飽和
+};
+
+// メッセージ種別
+enum class AppMessage {
+    UpdateDisplay,      // ディスプレイに現在状態表示
+    WIFIConnection,     // Wi-Fi接続
+    WIFIDisconnection,  // Wi-Fi切断
+    ReloadCheck,        // ./config, ./saveの変更チェック
+    TaskSample,         // CPU使用率の基準を記録
+    Quit                // 終了
+};
+
+class Application : public Actor<AppMessage> {
     public:
         Application();
 
@@ -21,38 +72,69 @@ class Application {
         void led(int state);
 
     private:
-        // タスク
-        static void app_task(void* arg);
+        // メッセージ処理 (システムの実行タスク)
+        void onMessage(AppMessage& msg) override;
+        void onEvent(const ActorEvent& event) override;     // AppEvent
+        void onMount(bool isMount);
+        void onWiFiConnect(bool isConnect);
         // コールバック        
-        static void mountFunc(bool isMount, void* context);
         static bool fileFunc(bool isFile, const char* name, void* context);
-        static void dispInitCompFunc(void* context);
-        static void wifiConnectFunc(bool isConnect, void* context);
+        static void dispStatusFunc(OledStatus* status, void* context);
+        static void wifiSampleFunc(const WiFiLinkSample& sample, void* context);
         void timer30secStart();
         static void timer30secFunc(TimerHandle_t xTimer);
         static void btn0HandlerFunc(void* context);
+        static void reloadTimerFunc(TimerHandle_t xTimer);
+        static void taskSampleTimerFunc(TimerHandle_t xTimer);
         // Webコールバック
         static void getData(httpd_req_t *req, void* context);
         static void setData(httpd_req_t *req, void* context);
         static void save(httpd_req_t *req, void* context);
+        static void storageBench(httpd_req_t *req, void* context);
+        static void logBench(httpd_req_t *req, void* context);
+        static void getFiles(httpd_req_t *req, void* context);
+        static void putFile(httpd_req_t *req, void* context);
+        static void postFiles(httpd_req_t *req, void* context);
+        static void getDataLog(httpd_req_t *req, void* context);
+        static void getLogs(httpd_req_t *req, void* context);
+        static void getWiFiStats(httpd_req_t *req, void* context);
+        static void getWiFiScan(httpd_req_t *req, void* context);
+        static void getTasks(httpd_req_t *req, void* context);
         // WebSocketコールバック
         static char* sebSocketFunc(const char* data, void* context);
         //
-        bool getConfig(const char* root);   // SDカード内の./configファイル読み込み。結果はconfigMapに格納。
+        bool getConfig(Storage* storage);   // SDカード内の./configファイル読み込み。結果はm_configに公開。
         void updateDisplay();               // ディスプレイ更新
         void wifiConnection();              // Wi-Fi接続
         void wifiDisconnection();           // Wi-Fi切断
+        void saveWiFiLink();                // 接続したAPを保存
+        static void saveWiFiLinkJob(void* context);     // 同上 (m_ioWorkerで実行)
+        void reloadCheck();                 // ./config, ./saveの変更チェック (変更があれば再読み込み)
+        static FileStamp getFileStamp(Storage* storage, const char* path);
+        static std::vector<WiFiProfile> getWiFiProfiles(const ConfigMap& config);  // CONFIGの接続先 (優先順)
 
     private:
         int m_LedState;
-        TaskHandle_t m_xHandle; // タスクハンドル
-        QueueHandle_t m_xQueue; // メッセージキュー
+        ActorExecutor m_systemExecutor;     // アプリケーション、Wi-Fiの実行タスク
+        ActorExecutor m_ioExecutor;         // SDカード、Webサーバー、I/Oのジョブの実行タスク (待ちの発生する処理)
+        ActorWorker m_ioWorker;             // アプリケーションのI/Oのジョブ (保存データの書き込みなど)
+        ActorExecutor m_displayExecutor;    // ディスプレイの実行タスク (描画と転送に時間がかかるので分ける)
         SDCard m_sd_card;   // SDカード
         OledDisplay m_oled; // OLED(SSD1306)ディスプレイ
         WiFi m_wifi;        // Wi-Fi
         WebServer m_web;    // Webサーバー
         SaveData m_save_data;   // データ保存
-        std::map<std::string, std::string> m_configMap{};     // CONFIG
+        DataLogger m_data_logger;   // データロガー (SDカードの/log)
+        LogSink m_log_sink;         // ログ出力先 (SDカードの/log/system.log)
+        Snapshot<ConfigMap> m_config;   // CONFIG (システムの実行タスクで更新、他タスクからロック無しで参照)
+        FileStamp m_configStamp;        // 読み込み時の./configの状態
+        TimerHandle_t m_reloadTimer;    // 変更チェック用タイマ
+        TimerHandle_t m_taskSampleTimer;    // CPU使用率の基準の記録用タイマ
+        TimerHandle_t m_30secTimer;     // 表示を消すまでの30秒タイマ (1つを延長して使う)
         bool m_isWiFi;
+        Snapshot<NetStatus> m_netStatus;    // Wi-Fiの接続状態 (システムの実行タスク以外からはこちらを参照)
         bool m_30sec_off;
+        bool m_isDashboard;             // 点灯中にボタンで状態表示に切り替えた
+        uint32_t m_statusRequests;      // 前回の状態表示の時点のリクエスト数 (ディスプレイの実行タスクのみ使用)
+        int64_t m_statusTime;           // 前回の状態表示の時刻(us)
 };
\ No newline at end of file
@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "main.hpp"
+#include "buffered_file.hpp"
+#include "bin_log.hpp"
+
+#define TAG "ApplicationBench"
+
+#define BENCH_FILE      "/bench.tmp"
+#define BENCH_SIZE      (256 * 1024)    // 測定に使用するファイルサイズ
+#define BENCH_CHUNK     1000            // 1回のread/writeのサイズ (Webサーバーの送信単位と同じ)
+#define LOG_BENCH_COUNT     200         // ログの測定回数 (既定)
+#define LOG_BENCH_COUNT_MAX 2000
+
+// 測定結果
+struct BenchResult {
+    bool ok;
+    double mbps;        // MB/s
+    double tpm;         // 1MBあたりのファイルシステムへのread/write回数 (stdioは数えられないので-1)
+};
+
+// 変更前の経路 (fopen/fread/fwrite。Webサーバーが元々使っていた方法)
+static BenchResult benchStdio(Storage* storage, bool isWrite) {
+    BenchResult result = { false, 0, -1 };
+    static char chunk[BENCH_CHUNK];
+    memset(chunk, 0x5a, sizeof(chunk));
+    std::string path = std::string(storage->root()) + BENCH_FILE;
+    int64_t start = esp_timer_get_time();
+    FILE* fp = fopen(path.c_str(), isWrite ? "wb" : "rb");
+    if (fp == NULL)
+        return result;
+    size_t total = 0;
+    bool ok = true;
+    while(total < BENCH_SIZE) {
+        size_t n = isWrite ? fwrite(chunk, 1, sizeof(chunk), fp) : fread(chunk, 1, sizeof(chunk), fp);
+        if (n == 0) {
+            ok = !isWrite && feof(fp);
+            break;
+        }
+        total += n;
+    }
+    if (fclose(fp) != 0)
+        ok = false;
+    int64_t elapsed = esp_timer_get_time() - start;
+    result.ok = ok && total > 0;
+    result.mbps = elapsed > 0 ? (double)total / elapsed : 0;
+    return result;
+}
+
+// 書き込みまたは読み込みを1回測定
+static BenchResult benchOne(Storage* storage, bool isWrite, bool isBuffered) {
+    BenchResult result = { false, 0, 0 };
+    static char chunk[BENCH_CHUNK];
+    memset(chunk, 0x5a, sizeof(chunk));
+    Storage::resetIoStats();
+    int64_t start = esp_timer_get_time();
+    const char* mode = isWrite ? "w" : "r";
+    StorageFile* file = isBuffered ? BufferedFile::open(storage, BENCH_FILE, mode) : storage->open(BENCH_FILE, mode);
+    if (file == NULL)
+        return result;
+    size_t total = 0;
+    bool ok = true;
+    while(total < BENCH_SIZE) {
+        int n = isWrite ? file->write(chunk, sizeof(chunk)) : file->read(chunk, sizeof(chunk));
+        if (n <= 0) {
+            ok = !isWrite && n == 0;
+            break;
+        }
+        total += n;
+    }
+    if (!file->close())
+        ok = false;
+    delete file;
+    int64_t elapsed = esp_timer_get_time() - start;
+    StorageIoStats stats;
+    Storage::getIoStats(&stats);
+    uint64_t count = isWrite ? stats.writes : stats.reads;
+    result.ok = ok && total > 0;
+    result.mbps = elapsed > 0 ? (double)total / elapsed : 0;    // byte/us = MB/s
+    result.tpm = total > 0 ? (double)count * 1024 * 1024 / total : 0;
+    return result;
+}
+
+// WebAPI POST /API/storage_bench
+// {
+//   "size": 262144,
+//   "chunk": 1000,
+//   "write": { "stdio": { "mbps": 0.3 }, "raw": { "mbps": 0.35, "tpm": 1048.6 }, "buffered": { "mbps": 0.9, "tpm": 64.0 } },
+//   "read": { "stdio": { ... }, "raw": { ... }, "buffered": { ... } }
+// }
+void Application::storageBench(httpd_req_t *req, void* context) {
+    ESP_LOGI(TAG, "storageBench");
+    Application* pThis = (Application*)context;
+    Storage* storage = pThis->m_sd_card.storage();
+    if (!storage->isReady()) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "SD card not mounted");
+        return;
+    }
+    // 変更前(stdio)、バッファ無しのStorageFile、変更後(バッファ付き)をそれぞれ測定
+    BenchResult writeStdio = benchStdio(storage, true);
+    BenchResult readStdio = benchStdio(storage, false);
+    BenchResult writeRaw = benchOne(storage, true, false);
+    BenchResult readRaw = benchOne(storage, false, false);
+    BenchResult writeBuf = benchOne(storage, true, true);
+    BenchResult readBuf = benchOne(storage, false, true);
+    storage->remove(BENCH_FILE);
+    if (!writeStdio.ok || !readStdio.ok || !writeRaw.ok || !readRaw.ok || !writeBuf.ok || !readBuf.ok) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "benchmark failed");
+        return;
+    }
+    char resp[448];
+    snprintf(resp, sizeof(resp),
+        R"({"size":%d,"chunk":%d,)"
+        R"("write":{"stdio":{"mbps":%.3f},"raw":{"mbps":%.3f,"tpm":%.1f},"buffered":{"mbps":%.3f,"tpm":%.1f}},)"
+        R"("read":{"stdio":{"mbps":%.3f},"raw":{"mbps":%.3f,"tpm":%.1f},"buffered":{"mbps":%.3f,"tpm":%.1f}}})",
+        BENCH_SIZE, BENCH_CHUNK,
+        writeStdio.mbps, writeRaw.mbps, writeRaw.tpm, writeBuf.mbps, writeBuf.tpm,
+        readStdio.mbps, readRaw.mbps, readRaw.tpm, readBuf.mbps, readBuf.tpm);
+    ESP_LOGI(TAG, "%s", resp);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, resp, strlen(resp));
+}
+
+// WebAPI POST /API/log_bench?count=200
+//  同じ書式と引数でESP_LOGIとBLOGIをcount回ずつ呼び、呼び出し側の時間を比較します。
+//  ESP_LOGIは書式化してLogSinkのリングにコピーするまで、BLOGIは引数をコアのリングにコピーするまでです
+//  (UARTとSDカードへの出力はどちらもLogSinkのタスクで行う)。
+// {
+//   "count": 200,
+//   "esp_log": { "us": 48.2, "dropped": 0 },       // 1回当たりの時間(us)、LogSinkのリング満杯で破棄した行数
+//   "blog": { "us": 3.1, "overwritten": 0 }        // 1回当たりの時間(us)、上書きした古い記録の数
+// }
+void Application::logBench(httpd_req_t *req, void* context) {
+    Application* pThis = (Application*)context;
+    std::string value;
+    int count = WebServer::getQuery(req, "count", value) ? atoi(value.c_str()) : LOG_BENCH_COUNT;
+    if (count <= 0)
+        count = LOG_BENCH_COUNT;
+    if (count > LOG_BENCH_COUNT_MAX)
+        count = LOG_BENCH_COUNT_MAX;
+    const char* path = "/document/index.html";
+    uint32_t dropped = pThis->m_log_sink.getDropped();
+    int64_t start = esp_timer_get_time();
+    for(int i=0; i<count; i++)
+        ESP_LOGI(TAG, "bench %d path=%s size=%u ratio=%.3f", i, path, (unsigned)(i * 1000), i * 0.5);
+    int64_t espLog = esp_timer_get_time() - start;
+    dropped = pThis->m_log_sink.getDropped() - dropped;
+    uint32_t overwritten = BinLog::getOverwritten();
+    start = esp_timer_get_time();
+    for(int i=0; i<count; i++)
+        BLOGI(TAG, "bench %d path=%s size=%u ratio=%.3f", i, path, (unsigned)(i * 1000), i * 0.5);
+    int64_t blog = esp_timer_get_time() - start;
+    overwritten = BinLog::getOverwritten() - overwritten;
+    char resp[160];
+    snprintf(resp, sizeof(resp), R"({"count":%d,"esp_log":{"us":%.2f,"dropped":%lu},"blog":{"us":%.2f,"overwritten":%lu}})",
+        count, (double)espLog / count, (unsigned long)dropped, (double)blog / count, (unsigned long)overwritten);
+    ESP_LOGI(TAG, "%s", resp);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, resp, strlen(resp));
+}
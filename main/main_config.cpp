@@ -16,23 +16,21 @@
 
 #define TAG "ApplicationConfig"
 
-// SDカード内の./configファイル読み込み。結果はconfigMapに格納。
-bool Application::getConfig(const char* root) {
+#define WIFI_PROFILE_MAX    8       // ssid/pass, ssid1/pass1 ... ssid7/pass7
+
+// SDカード内の./configファイル読み込み。結果はm_configに公開。
+bool Application::getConfig(Storage* storage) {
     bool ret = false;
     const char* szConfigPath = "/config";
-    char* szPath = new char[strlen(root) + strlen(szConfigPath) + 1];
-    sprintf(szPath, "%s%s", root, szConfigPath);
-    m_configMap.clear();
-    FILE* fd = fopen(szPath, "r");
-    if (fd != NULL) {
+    m_configStamp = getFileStamp(storage, szConfigPath);
+    ConfigMap configMap;
+    std::string data;
+    if (storage->readAll(szConfigPath, data)) {
         char szLine[256];
         int len = 0;
         std::string key, value;
-        while(1) {
-            int c = fgetc(fd);
-            if (feof(fd) || ferror(fd)) {
-                break;
-            }
+        for(size_t i=0; i<data.size(); i++) {
+            char c = data[i];
             if (c == '\r') {
                 continue;                
             } else if (c == '=' || c == '\n') {
@@ -42,22 +40,65 @@ bool Application::getConfig(const char* root) {
                     key = szLine;
                 } else {
                     value = szLine;
-                    m_configMap.insert(std::make_pair(key, value));
+                    configMap.insert(std::make_pair(key, value));
                 }
                 len = 0;
-            } else {
-                szLine[len++] = (char)c;
+            } else if (len < (int)sizeof(szLine) - 1) {
+                szLine[len++] = c;
             }
         }
-        fclose(fd);
         ret = true;
     }
-    delete[] szPath;
 
-    auto iter = m_configMap.begin();
-    while(iter != m_configMap.end()) {
+    auto iter = configMap.begin();
+    while(iter != configMap.end()) {
         ESP_LOGI(TAG, "%s=%s", iter->first.c_str(), iter->second.c_str());
         iter++;
     }
+    m_config.publish(std::move(configMap));
     return ret;
 }
+
+
+// ファイルのサイズと更新日時を取得
+FileStamp Application::getFileStamp(Storage* storage, const char* path) {
+    StorageStat st;
+    if (!storage->stat(path, &st))
+        return FileStamp{ false, 0, 0 };
+    return FileStamp{ true, st.size, st.mtime };
+}
+
+// CONFIGの接続先 (ssid/pass, ssid1/pass1, ...の順に優先。passの無いものは無視)
+std::vector<WiFiProfile> Application::getWiFiProfiles(const ConfigMap& config) {
+    std::vector<WiFiProfile> profiles;
+    for(int i=0; i<WIFI_PROFILE_MAX; i++) {
+        std::string suffix = i == 0 ? "" : std::to_string(i);
+        auto ssid = config.find("ssid" + suffix);
+        auto pass = config.find("pass" + suffix);
+        if (ssid == config.end() || pass == config.end() || ssid->second.empty())
+            continue;
+        profiles.push_back({ ssid->second, pass->second });
+    }
+    return profiles;
+}
+
+// ./config, ./save(各名前空間)の変更チェック
+// 変更のあったファイルのみ再読み込みし、値が変わった設定のみ反映します。
+// (接続先(ssid/pass, ssid1/pass1, ...)が変わった場合のみWi-Fiを再接続)
+void Application::reloadCheck() {
+    if (!m_sd_card.isMount())
+        return;
+    Storage* storage = m_sd_card.storage();
+    if (!(getFileStamp(storage, "/config") == m_configStamp)) {
+        ESP_LOGI(TAG, "config changed");
+        std::shared_ptr<const ConfigMap> before = m_config.load();
+        if (getConfig(storage)) {
+            std::shared_ptr<const ConfigMap> after = m_config.load();
+            if (getWiFiProfiles(*before) != getWiFiProfiles(*after)) {
+                ESP_LOGI(TAG, "Wi-Fi setting changed, reconnect");
+                wifiConnection();
+            }
+        }
+    }
+    m_save_data.reloadChanged();
+}
\ No newline at end of file
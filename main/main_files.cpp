@@ -0,0 +1,422 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+#include "main.hpp"
+#include "buffered_file.hpp"
+#include "bin_log.hpp"
+
+#define TAG "ApplicationFiles"
+
+#define FILES_DEFAULT_LIMIT     50      // 1ページのエントリ数 (既定値)
+#define FILES_MAX_LIMIT         200     // 1ページのエントリ数 (最大)
+#define FILES_CHUNK_SIZE        1024    // この長さ溜まったら送信
+#define UPLOAD_RECV_SIZE        4096    // アップロードの1回の受信サイズ
+#define UPLOAD_RECV_RETRY       5       // 受信タイムアウトの再試行回数
+#define UPLOAD_PART_SUFFIX      ".part" // 受信中のファイル名の末尾
+#define UPLOAD_HEADER_MAX       1024    // マルチパートの各パートのヘッダ長上限
+
+// JSON文字列として出力 (エスケープ付き)
+static void appendJsonString(std::string& out, const char* str) {
+    out += '"';
+    for(const char* p = str; *p != '\0'; p++) {
+        unsigned char c = *p;
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c < 0x20) {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            out += esc;
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+// WebAPI GET /API/files?path=/log&cursor=0&limit=50
+// {
+//   "path": "/log",
+//   "total": 1234,
+//   "entries": [ { "name": "a.bin", "type": "file", "size": 16384, "mtime": 1700000000 }, ... ],
+//   "next": 50             // 次のページのcursor (最後のページはnull)
+// }
+//  ページ単位で一覧を返します。一覧はディレクトリ毎にキャッシュされ、ファイル変更やアンマウントで破棄されます。
+void Application::getFiles(httpd_req_t *req, void* context) {
+    Application* pThis = (Application*)context;
+    std::string path = "/", value;
+    int cursor = 0;
+    int limit = FILES_DEFAULT_LIMIT;
+    WebServer::getQuery(req, "path", path);
+    if (WebServer::getQuery(req, "cursor", value))
+        cursor = atoi(value.c_str());
+    if (WebServer::getQuery(req, "limit", value))
+        limit = atoi(value.c_str());
+    if (cursor < 0)
+        cursor = 0;
+    if (limit <= 0)
+        limit = FILES_DEFAULT_LIMIT;
+    if (limit > FILES_MAX_LIMIT)
+        limit = FILES_MAX_LIMIT;
+    BLOGI(TAG, "getFiles path=%s cursor=%d limit=%d", path.c_str(), cursor, limit);
+    if (!pThis->m_sd_card.isMount()) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "SD card not mounted");
+        return;
+    }
+    if (path.empty() || path[0] != '/' || path.find("..") != std::string::npos) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "invalid path");
+        return;
+    }
+    std::vector<DirListItem> page;
+    int total = pThis->m_sd_card.dirCache()->list(path.c_str(), cursor, limit, page);
+    if (total < 0) {
+        httpd_resp_send_404(req);
+        return;
+    }
+    // ページ内のエントリを少しずつ送信
+    httpd_resp_set_type(req, "application/json");
+    std::string out;
+    out.reserve(FILES_CHUNK_SIZE + 256);
+    out = R"({"path":)";
+    appendJsonString(out, path.c_str());
+    out += R"(,"total":)" + std::to_string(total) + R"(,"entries":[)";
+    for(size_t i=0; i<page.size(); i++) {
+        const DirListItem& item = page[i];
+        char buf[96];
+        out += i == 0 ? "{\"name\":" : ",{\"name\":";
+        appendJsonString(out, item.name.c_str());
+        snprintf(buf, sizeof(buf), R"(,"type":"%s","size":%ld,"mtime":%lld})",
+            item.isDir ? "dir" : "file", (long)item.size, (long long)item.mtime);
+        out += buf;
+        if (out.size() >= FILES_CHUNK_SIZE) {
+            if (httpd_resp_send_chunk(req, out.c_str(), out.size()) != ESP_OK)
+                return;
+            out.clear();
+        }
+    }
+    int next = cursor + page.size();
+    out += next < total ? R"(],"next":)" + std::to_string(next) + "}" : R"(],"next":null})";
+    httpd_resp_send_chunk(req, out.c_str(), out.size());
+    httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// "/API/files"以降のパスを取得 (クエリを除きURLデコード)
+static std::string getFilesPath(httpd_req_t *req) {
+    const char* p = strstr(req->uri, "/API/files");
+    std::string path = p != NULL ? p + strlen("/API/files") : "";
+    size_t pos = path.find('?');
+    if (pos != std::string::npos)
+        path.erase(pos);
+    return WebServer::urlDecode(path.c_str(), false);
+}
+
+// アップロード先として使えるパスか
+static bool isValidUploadPath(const std::string& path) {
+    return path.size() > 1 && path.size() < 200 && path[0] == '/' && path.back() != '/' &&
+        path.find("..") == std::string::npos && path.find("//") == std::string::npos;
+}
+
+// アップロード中のファイル
+//  受信中は"<path>.part"にバッファ付き(write-behind)で書き込み、受信と書き込みを並行させる。
+//  全て受信できたら名前を変更して置き換える(途中で失敗した場合は元のファイルはそのまま)。
+class UploadFile {
+    public:
+        UploadFile(SDCard* sdCard) : m_sdCard(sdCard), m_file(NULL), m_size(0) {}
+        ~UploadFile() { abort(); }
+
+    public:
+        // 受信開始 (途中のディレクトリも作成)
+        bool begin(const std::string& path) {
+            abort();
+            Storage* storage = m_sdCard->storage();
+            for(size_t pos = path.find('/', 1); pos != std::string::npos; pos = path.find('/', pos + 1))
+                storage->mkdir(path.substr(0, pos).c_str());
+            m_path = path;
+            m_partPath = path + UPLOAD_PART_SUFFIX;
+            m_size = 0;
+            m_file = BufferedFile::open(storage, m_partPath.c_str(), "w");
+            return m_file != NULL;
+        }
+        bool write(const char* data, size_t len) {
+            if (m_file == NULL || m_file->write(data, len) != (int)len)
+                return false;
+            m_size += len;
+            return true;
+        }
+        // 受信完了 (書き込み完了を待って置き換え)
+        bool commit() {
+            if (m_file == NULL)
+                return false;
+            bool ret = m_file->close();
+            delete m_file;
+            m_file = NULL;
+            Storage* storage = m_sdCard->storage();
+            if (ret) {
+                m_sdCard->fileCache()->invalidate(m_path.c_str());    // 旧ファイルのハンドルを閉じてから置き換える
+                ret = storage->rename(m_partPath.c_str(), m_path.c_str());
+            }
+            if (!ret)
+                storage->remove(m_partPath.c_str());
+            return ret;
+        }
+        // 中止 (受信中のファイルを削除)
+        void abort() {
+            if (m_file == NULL)
+                return;
+            m_file->close();
+            delete m_file;
+            m_file = NULL;
+            m_sdCard->storage()->remove(m_partPath.c_str());
+        }
+        bool isOpen() { return m_file != NULL; }
+        const std::string& path() { return m_path; }
+        size_t size() { return m_size; }
+
+    private:
+        SDCard* m_sdCard;
+        StorageFile* m_file;
+        std::string m_path;
+        std::string m_partPath;
+        size_t m_size;
+};
+
+// リクエストボディを受信 (戻り値は受信バイト数、0は終了、-1はエラー)
+static int recvBody(httpd_req_t *req, char* buf, size_t len, size_t& remaining) {
+    if (remaining == 0)
+        return 0;
+    for(int retry=0; retry<UPLOAD_RECV_RETRY; retry++) {
+        int n = httpd_req_recv(req, buf, remaining < len ? remaining : len);
+        if (n == HTTPD_SOCK_ERR_TIMEOUT)
+            continue;
+        if (n <= 0)
+            return -1;
+        remaining -= n;
+        return n;
+    }
+    return -1;
+}
+
+// 転送速度をJSONで返す
+static void sendUploadResult(httpd_req_t *req, const std::string& files, size_t size, int64_t elapsed) {
+    char buf[128];
+    snprintf(buf, sizeof(buf), R"(,"size":%u,"ms":%lld,"mbps":%.3f})",
+        (unsigned)size, (long long)(elapsed / 1000), elapsed > 0 ? (double)size / elapsed : 0.0);
+    BLOGI(TAG, "upload %u bytes, %lld ms, %.3f MB/s", (unsigned)size, (long long)(elapsed / 1000), elapsed > 0 ? (double)size / elapsed : 0.0);
+    std::string resp = files + buf;
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, resp.c_str(), resp.size());
+}
+
+// WebAPI PUT /API/files/<path>
+//  ボディをそのままファイルに保存します。
+// { "path": "/document/index.html", "size": 12345, "ms": 820, "mbps": 0.015 }
+void Application::putFile(httpd_req_t *req, void* context) {
+    Application* pThis = (Application*)context;
+    std::string path = getFilesPath(req);
+    BLOGI(TAG, "putFile path=%s size=%u", path.c_str(), (unsigned)req->content_len);
+    if (!pThis->m_sd_card.isMount()) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "SD card not mounted");
+        return;
+    }
+    if (!isValidUploadPath(path)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "invalid path");
+        return;
+    }
+    char* buf = (char*)heap_caps_malloc(UPLOAD_RECV_SIZE, MALLOC_CAP_8BIT);
+    UploadFile file(&pThis->m_sd_card);
+    if (buf == NULL || !file.begin(path)) {
+        heap_caps_free(buf);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "cannot create file");
+        return;
+    }
+    int64_t start = esp_timer_get_time();
+    size_t remaining = req->content_len;
+    int n;
+    while((n = recvBody(req, buf, UPLOAD_RECV_SIZE, remaining)) > 0) {
+        if (!file.write(buf, n)) {
+            n = -1;
+            break;
+        }
+    }
+    heap_caps_free(buf);
+    if (n < 0 || !file.commit()) {
+        file.abort();
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "upload failed");
+        return;
+    }
+    std::string files = R"({"path":)";
+    appendJsonString(files, path.c_str());
+    sendUploadResult(req, files, file.size(), esp_timer_get_time() - start);
+}
+
+// Content-Typeからマルチパートの境界文字列を取得
+static bool getBoundary(httpd_req_t *req, std::string& boundary) {
+    size_t len = httpd_req_get_hdr_value_len(req, "Content-Type");
+    if (len == 0)
+        return false;
+    std::string type(len + 1, '\0');
+    if (httpd_req_get_hdr_value_str(req, "Content-Type", &type[0], type.size()) != ESP_OK)
+        return false;
+    type.resize(len);
+    size_t pos = type.find("boundary=");
+    if (type.find("multipart/form-data") == std::string::npos || pos == std::string::npos)
+        return false;
+    boundary = type.substr(pos + strlen("boundary="));
+    pos = boundary.find(';');
+    if (pos != std::string::npos)
+        boundary.erase(pos);
+    if (boundary.size() >= 2 && boundary.front() == '"' && boundary.back() == '"')
+        boundary = boundary.substr(1, boundary.size() - 2);
+    return !boundary.empty();
+}
+
+// パートのヘッダからファイル名を取得 (パス部分は除く)
+static std::string getPartFileName(const std::string& header) {
+    size_t pos = header.find("filename=\"");
+    if (pos == std::string::npos)
+        return "";
+    pos += strlen("filename=\"");
+    size_t end = header.find('"', pos);
+    if (end == std::string::npos)
+        return "";
+    std::string name = header.substr(pos, end - pos);
+    pos = name.find_last_of("/\\");
+    if (pos != std::string::npos)
+        name.erase(0, pos + 1);
+    return name;
+}
+
+// マルチパートの解析状態
+enum class MultipartState {
+    Preamble,       // 最初の境界まで
+    Boundary,       // 境界の直後 ("\r\n"なら次のパート、"--"なら終了)
+    Header,         // パートのヘッダ
+    Data,           // パートのデータ
+    Done            // 終了
+};
+
+// WebAPI POST /API/files/<dir>
+//  multipart/form-dataのファイルを全て<dir>に保存します。(ファイル以外のパートは無視)
+// { "files": [ "/document/a.html", ... ], "size": 12345, "ms": 820, "mbps": 0.015 }
+void Application::postFiles(httpd_req_t *req, void* context) {
+    Application* pThis = (Application*)context;
+    std::string dir = getFilesPath(req);
+    while(!dir.empty() && dir.back() == '/')
+        dir.pop_back();
+    BLOGI(TAG, "postFiles dir=%s size=%u", dir.c_str(), (unsigned)req->content_len);
+    if (!pThis->m_sd_card.isMount()) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "SD card not mounted");
+        return;
+    }
+    std::string boundary;
+    if (!getBoundary(req, boundary) || (!dir.empty() && !isValidUploadPath(dir))) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "invalid request");
+        return;
+    }
+    char* buf = (char*)heap_caps_malloc(UPLOAD_RECV_SIZE, MALLOC_CAP_8BIT);
+    if (buf == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "no memory");
+        return;
+    }
+    // 受信したデータは未処理分をdataに溜めて解析する
+    //  ボディ先頭の境界も同じ形で見つかるように"\r\n"を前置する
+    std::string delimiter = "\r\n--" + boundary;
+    std::string data = "\r\n";
+    std::string files = R"({"files":[)";
+    MultipartState state = MultipartState::Preamble;
+    UploadFile file(&pThis->m_sd_card);
+    int64_t start = esp_timer_get_time();
+    size_t remaining = req->content_len;
+    size_t total = 0;
+    int count = 0;
+    bool ok = true;
+    bool isEnd = false;
+    while(ok && state != MultipartState::Done) {
+        bool needMore = false;
+        switch(state) {
+            case MultipartState::Preamble:
+            case MultipartState::Data: {
+                size_t pos = data.find(delimiter);
+                size_t len = pos != std::string::npos ? pos :
+                    (data.size() >= delimiter.size() ? data.size() - delimiter.size() + 1 : 0);    // 境界の途中かもしれない末尾は残す
+                if (state == MultipartState::Data && file.isOpen())
+                    ok = file.write(data.data(), len);
+                data.erase(0, len);
+                if (pos != std::string::npos) {
+                    if (state == MultipartState::Data && file.isOpen()) {
+                        ok = ok && file.commit();
+                        if (ok) {
+                            files += count++ == 0 ? "" : ",";
+                            appendJsonString(files, file.path().c_str());
+                            total += file.size();
+                        }
+                    }
+                    data.erase(0, delimiter.size());
+                    state = MultipartState::Boundary;
+                } else {
+                    needMore = true;
+                }
+                break;
+            }
+            case MultipartState::Boundary:
+                if (data.size() < 2) {
+                    needMore = true;
+                } else if (data.compare(0, 2, "--") == 0) {
+                    state = MultipartState::Done;
+                } else if (data.compare(0, 2, "\r\n") == 0) {
+                    data.erase(0, 2);
+                    state = MultipartState::Header;
+                } else {
+                    ok = false;
+                }
+                break;
+            case MultipartState::Header: {
+                size_t pos = data.find("\r\n\r\n");
+                if (pos == std::string::npos) {
+                    needMore = true;
+                    ok = data.size() < UPLOAD_HEADER_MAX;
+                    break;
+                }
+                std::string name = getPartFileName(data.substr(0, pos));
+                data.erase(0, pos + 4);
+                if (!name.empty()) {
+                    std::string path = dir + "/" + name;
+                    ok = isValidUploadPath(path) && file.begin(path);
+                }
+                state = MultipartState::Data;
+                break;
+            }
+            case MultipartState::Done:
+                break;
+        }
+        if (ok && needMore) {
+            if (isEnd) {
+                ok = false;     // 終端の境界が無い
+                break;
+            }
+            int n = recvBody(req, buf, UPLOAD_RECV_SIZE, remaining);
+            if (n < 0)
+                ok = false;
+            else if (n == 0)
+                isEnd = true;
+            else
+                data.append(buf, n);
+        }
+    }
+    heap_caps_free(buf);
+    if (!ok) {
+        file.abort();
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "upload failed");
+        return;
+    }
+    // 終端の境界以降(エピローグ)は読み捨て
+    char discard[64];
+    while(recvBody(req, discard, sizeof(discard), remaining) > 0);
+    files += "]";
+    sendUploadResult(req, files, total, esp_timer_get_time() - start);
+}
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+
+#include "main.hpp"
+
+#define TAG "ApplicationTasks"
+
+#define TASKS_MAX               48      // GET /API/tasksで返すタスク数の上限
+#define TASKS_INTERVAL_MAX_MS   ((TASK_BASELINE_COUNT - 1) * TASK_SAMPLE_MS)    // GET /API/tasksのinterval_msの上限
+
+// WebAPI GET /API/tasks[?interval_ms=N]
+//  タスク毎のスタックの最小空きとCPU使用率、アクター毎のメッセージの統計を返します。
+//  CPU使用率はinterval_msを指定すると直近のその間の値、指定しなければ起動からの値です。
+//  実行時間のカウンタは32bit(esp_timerの1MHzで約71分で一周)なので、起動からの値は一周するまでしか正しくありません。
+//  長時間動かしている場合はinterval_msを指定してください。
+//  待たずに応答するため、TASK_SAMPLE_MS毎に記録した基準のうちinterval_ms以上前の最新のものからの差を返します。
+// {
+//   "run_time": true,          // CPU使用率を取得できる (CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS)
+//   "interval_ms": 1000,       // 実際の基準からの経過時間 (0は起動から)
+//   "tasks": [
+//     { "name": "System",
+//       "priority": 3,
+//       "core": -1,            // -1はコアを固定しない
+//       "stack_free_min": 2480, // スタックの最小空き(byte)
+//       "stack_size": 6144,    // Kconfigの設定 (設定の無いタスクは無し)
+//       "cpu": 1.25 }, ...     // 1コアに対する割合(%)
+//   ],
+//   "actors": [
+//     { "name": "Application", "executor": "System",
+//       "messages": 120, "dropped": 0, "pending": 0, "max_pending": 3,
+//       "latency_us": 85,      // 送信から処理開始までの平均
+//       "max_latency_us": 2300 }, ...
+//   ]
+// }
+void Application::getTasks(httpd_req_t *req, void* context) {
+    Application* pThis = (Application*)context;
+    int interval = 0;
+    std::string value;
+    if (WebServer::getQuery(req, "interval_ms", value))
+        interval = atoi(value.c_str());
+    if (interval < 0)
+        interval = 0;
+    if (interval > TASKS_INTERVAL_MAX_MS)
+        interval = TASKS_INTERVAL_MAX_MS;
+
+    // 実行時間は基準からの差 (基準がまだ無い場合は起動から)
+    bool isRunTime = TaskMonitor::hasRunTime();
+    TaskInfo* tasks = new TaskInfo[TASKS_MAX];
+    uint32_t elapsed;
+    int count = TaskMonitor::getTasks(tasks, TASKS_MAX, &elapsed);
+    if (interval > 0) {
+        interval = TaskMonitor::since(interval, tasks, count, &elapsed);
+        if (interval < 0)
+            interval = 0;
+    }
+
+    char buf[256];
+    snprintf(buf, sizeof(buf), R"({"run_time":%s,"interval_ms":%d,"tasks":[)", isRunTime ? "true" : "false", interval);
+    std::string resp = buf;
+    for(int i=0; i<count; i++) {
+        const TaskInfo& task = tasks[i];
+        int len = snprintf(buf, sizeof(buf), R"(%s{"name":"%s","priority":%u,"core":%d,"stack_free_min":%lu)",
+            i > 0 ? "," : "", task.name, (unsigned)task.priority, task.core, (unsigned long)task.stackFreeMin);
+        if (task.profile != NULL)
+            len += snprintf(buf + len, sizeof(buf) - len, R"(,"stack_size":%lu)", (unsigned long)task.profile->stackSize);
+        if (isRunTime && elapsed > 0)
+            len += snprintf(buf + len, sizeof(buf) - len, R"(,"cpu":%.2f)", (double)task.runTime * 100 / elapsed);
+        snprintf(buf + len, sizeof(buf) - len, "}");
+        resp += buf;
+    }
+    delete[] tasks;
+
+    // アクター
+    resp += R"(],"actors":[)";
+    ActorExecutor* executors[] = { &pThis->m_systemExecutor, &pThis->m_ioExecutor, &pThis->m_displayExecutor };
+    bool isFirst = true;
+    for(ActorExecutor* executor : executors) {
+        ActorBase* actors[ACTOR_EXECUTOR_MAX];
+        int n = executor->getActors(actors, ACTOR_EXECUTOR_MAX);
+        for(int i=0; i<n; i++) {
+            ActorStats stats;
+            actors[i]->getStats(&stats);
+            uint64_t latency = stats.messages > 0 ? stats.totalLatency / stats.messages : 0;
+            snprintf(buf, sizeof(buf),
+                R"(%s{"name":"%s","executor":"%s","messages":%lu,"dropped":%lu,"pending":%lu,"max_pending":%lu,"latency_us":%llu,"max_latency_us":%lu})",
+                isFirst ? "" : ",", actors[i]->name(), executor->name(), (unsigned long)stats.messages, (unsigned long)stats.dropped,
+                (unsigned long)stats.pending, (unsigned long)stats.maxPending, (unsigned long long)latency, (unsigned long)stats.maxLatency);
+            resp += buf;
+            isFirst = false;
+        }
+    }
+    resp += "]}";
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, resp.c_str(), resp.size());
+}
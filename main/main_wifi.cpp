@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "cJSON.h"
+
+#include "main.hpp"
+
+#define TAG "ApplicationWiFi"
+
+// GET /API/wifi/scanのwaitの上限
+// 非同期ハンドラが無い場合はhttpdタスクで実行されて他のリクエストが止まるため待たない (scanningを見てポーリングする)
+#if WEB_ASYNC_HANDLER
+#define WIFI_SCAN_WAIT_MAX_MS   10000
+#else
+#define WIFI_SCAN_WAIT_MAX_MS   0
+#endif
+
+static const char* stateName(WiFiSupervisorState state) {
+    switch(state) {
+        case WiFiSupervisorState::Idle:         return "idle";
+        case WiFiSupervisorState::Connecting:   return "connecting";
+        case WiFiSupervisorState::Connected:    return "connected";
+        case WiFiSupervisorState::Backoff:      return "backoff";
+    }
+    return "";
+}
+
+// リンク状態の記録をJSONに
+static int formatSample(char* buf, size_t size, const WiFiLinkSample& sample) {
+    char phy[16] = "";
+    const char* names[] = { "b", "g", "n", "lr" };
+    for(int i=0; i<4; i++) {
+        if ((sample.phy & (1 << i)) != 0)
+            snprintf(phy + strlen(phy), sizeof(phy) - strlen(phy), "%s%s", phy[0] == '\0' ? "" : "/", names[i]);
+    }
+    return snprintf(buf, size,
+        R"({"time":%lu,"rssi":%d,"channel":%d,"phy":"%s","bandwidth":%d,"reconnects":%lu,"disconnects":%lu,"connected_ms":%lu})",
+        (unsigned long)sample.time, sample.rssi, sample.channel, phy, sample.bandwidth,
+        (unsigned long)sample.reconnects, (unsigned long)sample.disconnects, (unsigned long)sample.connectedMs);
+}
+
+// WebAPI GET /API/wifi/stats[?samples=N]
+// {
+//   "state": "connected",      // idle, connecting, connected, backoff(再接続待ち)
+//   "connects": 3,             // 接続回数
+//   "disconnects": 2,          // 接続中の切断回数
+//   "retries": 5,              // 再接続の試行回数
+//   "last_reason": 200,        // 最後の切断理由 (wifi_err_reason_t)
+//   "availability": 0.998,     // 稼働率
+//   "connected_ms": 3600000,   // 接続していた時間の合計
+//   "outage_ms": 7200,         // 切断していた時間の合計
+//   "current_outage_ms": 0,
+//   "last_outage_ms": 1500,
+//   "max_outage_ms": 5200,
+//   "time_to_ip_ms": 850,      // 直近の接続要求からIPアドレス取得まで
+//   "samples": [               // リンク状態の記録 (CONFIG_WIFI_TELEMETRY_MS毎、古い順、最大60。samplesで個数を指定)
+//     { "time": 123456,        // ログの時刻(ms)と同じ
+//       "rssi": -61, "channel": 6, "phy": "b/g/n", "bandwidth": 20,
+//       "reconnects": 5, "disconnects": 2, "connected_ms": 600000 }, ...
+//   ]
+// }
+void Application::getWiFiStats(httpd_req_t *req, void* context) {
+    Application* pThis = (Application*)context;
+    WiFiSupervisorStats stats;
+    pThis->m_wifi.getStats(&stats);
+    char buf[384];
+    snprintf(buf, sizeof(buf),
+        R"({"state":"%s","connects":%lu,"disconnects":%lu,"retries":%lu,"last_reason":%d,"availability":%.4f,)"
+        R"("connected_ms":%lld,"outage_ms":%lld,"current_outage_ms":%lld,"last_outage_ms":%lld,"max_outage_ms":%lld,"time_to_ip_ms":%lld,)",
+        stateName(stats.state), (unsigned long)stats.connects, (unsigned long)stats.disconnects, (unsigned long)stats.retries,
+        stats.lastReason, stats.availability,
+        (long long)(stats.connectedTime / 1000), (long long)(stats.outageTime / 1000), (long long)(stats.currentOutage / 1000),
+        (long long)(stats.lastOutage / 1000), (long long)(stats.maxOutage / 1000), (long long)(pThis->m_wifi.getTimeToIP() / 1000));
+    std::string resp = buf;
+
+    std::string value;
+    size_t max = WIFI_TELEMETRY_SAMPLES;
+    if (WebServer::getQuery(req, "samples", value))
+        max = strtoul(value.c_str(), NULL, 10);
+    WiFiLinkSample* samples = new WiFiLinkSample[WIFI_TELEMETRY_SAMPLES];
+    size_t count = pThis->m_wifi.getSamples(samples, max);
+    resp += R"("samples":[)";
+    for(size_t i=0; i<count; i++) {
+        if (i > 0)
+            resp += ',';
+        formatSample(buf, sizeof(buf), samples[i]);
+        resp += buf;
+    }
+    resp += "]}";
+    delete[] samples;
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, resp.c_str(), resp.size());
+}
+
+static_assert(sizeof(WiFiLinkRecord) == DATALOG_PAYLOAD_SIZE, "WiFiLinkRecord size");
+
+// リンク状態をデータロガーに記録し、/wsに送信 (CONFIG_WIFI_TELEMETRY_WS)
+//  {"type":"wifi_sample","sample":{...}}  (sampleはGET /API/wifi/statsのsamplesと同じ)
+void Application::wifiSampleFunc(const WiFiLinkSample& sample, void* context) {
+    Application* pThis = (Application*)context;
+    WiFiLinkRecord record = {
+        .rssi = sample.rssi,
+        .channel = sample.channel,
+        .phy = sample.phy,
+        .bandwidth = sample.bandwidth,
+        .connectedMs = sample.connectedMs,
+        .reconnects = (uint16_t)(sample.reconnects < 0xffff ? sample.reconnects : 0xffff),
+        .disconnects = (uint16_t)(sample.disconnects < 0xffff ? sample.disconnects : 0xffff)
+    };
+    pThis->m_data_logger.write(DATALOG_ID_WIFI_LINK, &record, sizeof(record));
+#if CONFIG_WIFI_TELEMETRY_WS
+    char buf[256];
+    int len = snprintf(buf, sizeof(buf), R"({"type":"wifi_sample","sample":)");
+    len += formatSample(buf + len, sizeof(buf) - len - 1, sample);
+    snprintf(buf + len, sizeof(buf) - len, "}");
+    pThis->m_web.sendWebSocket(buf);
+#endif
+}
+
+// WebAPI GET /API/wifi/scan[?refresh=1[&wait=ms]]
+//  バックグラウンドスキャンの結果をすぐに返します。
+//  refresh=1 : スキャンを要求 (スキャン中ならそのスキャンに合流)。waitを指定すると完了まで待つ(最大10秒、ESP-IDF 5.2未満は待たない)
+// {
+//   "age_ms": 12000,           // 結果の経過時間 (-1は未スキャン)
+//   "scanning": false,         // スキャン中または要求済み
+//   "scans": 4,                // スキャン回数
+//   "aps": [ { "ssid": "...", "bssid": "aa:bb:cc:dd:ee:ff", "channel": 6, "rssi": -52, "auth": 3 }, ... ]
+// }
+void Application::getWiFiScan(httpd_req_t *req, void* context) {
+    Application* pThis = (Application*)context;
+    std::string value;
+    if (WebServer::getQuery(req, "refresh", value) && value == "1") {
+        uint32_t count = pThis->m_wifi.requestScan();
+        int wait = WebServer::getQuery(req, "wait", value) ? atoi(value.c_str()) : 0;
+        if (wait > WIFI_SCAN_WAIT_MAX_MS)
+            wait = WIFI_SCAN_WAIT_MAX_MS;
+        if (wait > 0)
+            pThis->m_wifi.waitScan(count, wait);
+    }
+    std::vector<WiFiScanResult> results;
+    int64_t time;
+    bool isScanning;
+    uint32_t count = pThis->m_wifi.getScanResults(results, &time, &isScanning);
+
+    cJSON* json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json, "age_ms", time == 0 ? -1 : (double)((esp_timer_get_time() - time) / 1000));
+    cJSON_AddBoolToObject(json, "scanning", isScanning);
+    cJSON_AddNumberToObject(json, "scans", count);
+    cJSON* aps = cJSON_AddArrayToObject(json, "aps");
+    for(auto& r : results) {
+        char bssid[18];
+        snprintf(bssid, sizeof(bssid), "%02x:%02x:%02x:%02x:%02x:%02x", r.bssid[0], r.bssid[1], r.bssid[2], r.bssid[3], r.bssid[4], r.bssid[5]);
+        cJSON* ap = cJSON_CreateObject();
+        cJSON_AddStringToObject(ap, "ssid", r.ssid);
+        cJSON_AddStringToObject(ap, "bssid", bssid);
+        cJSON_AddNumberToObject(ap, "channel", r.channel);
+        cJSON_AddNumberToObject(ap, "rssi", r.rssi);
+        cJSON_AddNumberToObject(ap, "auth", r.authmode);
+        cJSON_AddItemToArray(aps, ap);
+    }
+    char* resp = cJSON_PrintUnformatted(json);
+    cJSON_Delete(json);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, resp, strlen(resp));
+    cJSON_free(resp);
+}
@@ -0,0 +1,36 @@
+#include <string.h>
+#include "mono_framebuffer.hpp"
+
+MonoFramebuffer::MonoFramebuffer() {
+    clear();
+}
+
+void MonoFramebuffer::clear() {
+    memset(m_buf, 0, sizeof(m_buf));
+    invalidate();
+}
+
+void MonoFramebuffer::invalidate() {
+    for(int page=0; page<MONO_FB_PAGES; page++) {
+        m_dirtyX1[page] = 0;
+        m_dirtyX2[page] = MONO_FB_WIDTH - 1;
+    }
+}
+
+bool MonoFramebuffer::takeDirty(int page, int* x1, int* x2) {
+    if (m_dirtyX1[page] > m_dirtyX2[page])
+        return false;
+    *x1 = m_dirtyX1[page];
+    *x2 = m_dirtyX2[page];
+    m_dirtyX1[page] = MONO_FB_WIDTH;
+    m_dirtyX2[page] = -1;
+    return true;
+}
+
+bool MonoFramebuffer::isDirty() const {
+    for(int page=0; page<MONO_FB_PAGES; page++) {
+        if (m_dirtyX1[page] <= m_dirtyX2[page])
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,48 @@
+/**
+ * モノクロ(1bpp)フレームバッファ
+ *
+ * SSD1306のGDDRAMと同じページ形式(縦8ピクセルで1ページ、1byteが1列の縦8ピクセル、bit0が上)で保持し、
+ * ページ毎に変更のあった列の範囲を記録します。パネルへは変更のあった範囲のみ転送します。
+ * LVGLとESP-IDFのAPIは使わないので、PC上でも使えます。
+*/
+#pragma once
+
+#include <stdint.h>
+
+#define MONO_FB_WIDTH   128
+#define MONO_FB_HEIGHT  64
+#define MONO_FB_PAGES   (MONO_FB_HEIGHT / 8)
+
+class MonoFramebuffer {
+    public:
+        MonoFramebuffer();
+
+    public:
+        void clear();                   // 全て消灯 (全ページを変更ありにする)
+        void invalidate();              // 全ページを変更ありにする (パネルの内容が不明な場合)
+
+        void setPixel(int x, int y, bool isOn) {
+            uint8_t* p = &m_buf[(y >> 3) * MONO_FB_WIDTH + x];
+            uint8_t bit = 1 << (y & 7);
+            uint8_t value = isOn ? (*p | bit) : (*p & ~bit);
+            if (value == *p)
+                return;
+            *p = value;
+            int page = y >> 3;
+            if (x < m_dirtyX1[page])
+                m_dirtyX1[page] = x;
+            if (x > m_dirtyX2[page])
+                m_dirtyX2[page] = x;
+        }
+        bool getPixel(int x, int y) const { return (m_buf[(y >> 3) * MONO_FB_WIDTH + x] & (1 << (y & 7))) != 0; }
+
+        // 変更のあった列の範囲(x1～x2)を取り出して変更無しにする (変更が無ければfalse)
+        bool takeDirty(int page, int* x1, int* x2);
+        bool isDirty() const;
+        const uint8_t* page(int page) const { return &m_buf[page * MONO_FB_WIDTH]; }
+
+    private:
+        uint8_t m_buf[MONO_FB_WIDTH * MONO_FB_PAGES];
+        int16_t m_dirtyX1[MONO_FB_PAGES];   // 変更のあった列の範囲 (x1 > x2は変更無し)
+        int16_t m_dirtyX2[MONO_FB_PAGES];
+};
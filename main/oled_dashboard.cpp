@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <string.h>
+#include "oled_dashboard.hpp"
+
+#define OLED_DASHBOARD_LINE_H   16      // 1行の高さ (64 / OLED_DASHBOARD_LINES)
+
+OledDashboard::OledDashboard() {
+    memset(m_labels, 0, sizeof(m_labels));
+    memset(m_text, 0, sizeof(m_text));
+}
+
+void OledDashboard::create(lv_obj_t* screen) {
+    for(int i=0; i<OLED_DASHBOARD_LINES; i++) {
+        // 幅を固定して折り返さない (文字列が変わってもラベルの大きさは変わらない)
+        m_labels[i] = lv_label_create(screen);
+        lv_label_set_long_mode(m_labels[i], LV_LABEL_LONG_CLIP);
+        lv_obj_set_width(m_labels[i], lv_obj_get_width(screen));
+        lv_obj_align(m_labels[i], LV_ALIGN_TOP_LEFT, 0, i * OLED_DASHBOARD_LINE_H);
+        lv_label_set_text_static(m_labels[i], "");
+        m_text[i][0] = '\0';
+    }
+}
+
+void OledDashboard::detach() {
+    memset(m_labels, 0, sizeof(m_labels));
+}
+
+bool OledDashboard::update(const OledStatus& status, int page) {
+    if (m_labels[0] == NULL)
+        return false;
+    char lines[OLED_DASHBOARD_LINES][OLED_DASHBOARD_CHARS] = {};
+    switch(page) {
+        case 0:     // ネットワーク
+            snprintf(lines[0], OLED_DASHBOARD_CHARS, "Network 1/%d", OLED_DASHBOARD_PAGES);
+            snprintf(lines[1], OLED_DASHBOARD_CHARS, "%s", status.ip[0] != '\0' ? status.ip : "No link");
+            if (status.rssi != 0)
+                snprintf(lines[2], OLED_DASHBOARD_CHARS, "RSSI %d dBm", status.rssi);
+            else
+                snprintf(lines[2], OLED_DASHBOARD_CHARS, "RSSI --");
+            snprintf(lines[3], OLED_DASHBOARD_CHARS, "WS %d client%s", status.wsClients, status.wsClients == 1 ? "" : "s");
+            break;
+        case 1:     // システム
+            snprintf(lines[0], OLED_DASHBOARD_CHARS, "System 2/%d", OLED_DASHBOARD_PAGES);
+            snprintf(lines[1], OLED_DASHBOARD_CHARS, "Heap %lu KB", (unsigned long)(status.freeHeap >> 10));
+            snprintf(lines[2], OLED_DASHBOARD_CHARS, "Min %lu KB", (unsigned long)(status.minFreeHeap >> 10));
+            if (status.requestRate >= 0)
+                snprintf(lines[3], OLED_DASHBOARD_CHARS, "Req %.1f /s", status.requestRate);
+            else
+                snprintf(lines[3], OLED_DASHBOARD_CHARS, "Req --");
+            break;
+        default:    // SDカード
+            snprintf(lines[0], OLED_DASHBOARD_CHARS, "SD card 3/%d", OLED_DASHBOARD_PAGES);
+            if (status.isSd && status.sdTotal > 0) {
+                snprintf(lines[1], OLED_DASHBOARD_CHARS, "Used %.1f %%", (double)status.sdUsed * 100 / status.sdTotal);
+                snprintf(lines[2], OLED_DASHBOARD_CHARS, "%llu MB", (unsigned long long)(status.sdUsed >> 20));
+                snprintf(lines[3], OLED_DASHBOARD_CHARS, "/ %llu MB", (unsigned long long)(status.sdTotal >> 20));
+            } else {
+                snprintf(lines[1], OLED_DASHBOARD_CHARS, "No card");
+            }
+            break;
+    }
+    bool isChanged = false;
+    for(int i=0; i<OLED_DASHBOARD_LINES; i++) {
+        if (setLine(i, lines[i]))
+            isChanged = true;
+    }
+    return isChanged;
+}
+
+// 文字列が変わった場合のみラベルに設定 (LVGLはそのラベルの範囲だけを描き直す)
+bool OledDashboard::setLine(int line, const char* text) {
+    if (strcmp(m_text[line], text) == 0)
+        return false;
+    strcpy(m_text[line], text);
+    lv_label_set_text_static(m_labels[line], m_text[line]);    // m_textを参照 (複製しない)
+    return true;
+}
@@ -0,0 +1,49 @@
+/**
+ * OLEDの状態表示 (ダッシュボード)
+ *
+ * タイトルと3行のラベルを1回だけ作成し、以降は文字列が変わった行のラベルのみ書き換えます。
+ * ページ(ネットワーク、システム、SDカード)を切り替えても同じラベルを使うので、
+ * LVGLが描き直すのは変わった行だけで、パネルへの転送も変わった列の範囲のみになります。
+ * ESP-IDFのAPIは使わないので、PC上でも使えます (tools/oled_sim.cpp)。
+*/
+#pragma once
+
+#include <stdint.h>
+#include "lvgl.h"
+
+#define OLED_DASHBOARD_PAGES    3
+#define OLED_DASHBOARD_LINES    4       // タイトル + 3行
+#define OLED_DASHBOARD_CHARS    24      // 1行の最大文字数 (終端を含む)
+
+// 表示する状態
+struct OledStatus {
+    char ip[16];            // IPアドレス (Wi-Fi未接続は"")
+    int8_t rssi;            // dBm (0は不明)
+    int wsClients;          // WebSocketの接続数
+    uint32_t freeHeap;      // byte
+    uint32_t minFreeHeap;   // byte
+    float requestRate;      // リクエスト数/秒 (負数は不明)
+    bool isSd;              // SDカードの容量を取得できた
+    uint64_t sdTotal;       // byte
+    uint64_t sdUsed;        // byte
+};
+
+class OledDashboard {
+    public:
+        OledDashboard();
+
+    public:
+        // screenにラベルを作成 (LVGLのロック中に呼ぶ。screenの子は削除済みであること)
+        void create(lv_obj_t* screen);
+        // pageの内容で変わった行のみ更新 (LVGLのロック中に呼ぶ。変更があればtrue)
+        bool update(const OledStatus& status, int page);
+        // ラベルを削除した (画面を作り直した時に呼ぶ。以降のupdate()は何もしない)
+        void detach();
+
+    private:
+        bool setLine(int line, const char* text);
+
+    private:
+        lv_obj_t* m_labels[OLED_DASHBOARD_LINES];
+        char m_text[OLED_DASHBOARD_LINES][OLED_DASHBOARD_CHARS];   // 表示中の文字列
+};
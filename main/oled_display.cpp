@@ -15,8 +15,9 @@
 #include "driver/i2c.h"
 #include "esp_err.h"
 #include "esp_log.h"
-#include "extra/libs/qrcode/lv_qrcode.h"
 #include "oled_display.hpp"
+#include "app_event.hpp"
+#include "task_profile.hpp"
 
 #define TAG "OledDisplay"
 
@@ -27,134 +28,201 @@
 #define I2C_OLED_H      128
 #define I2C_OLED_V      64
 
-// メッセージ種別 (メッセージキュー用)
-enum class OledDisplayMessage {
-    Init,       // 画面初期処理
-    Clear,      // 画面消去
-    On,         // 画面On
-    Off,        // 画面Off
-    QRCode,     // QRコード表示
-    String,     // 文字列表示
-    Quit        // 終了
-};
-
-OledDisplay::OledDisplay() {
+static_assert(I2C_OLED_H == MONO_FB_WIDTH && I2C_OLED_V == MONO_FB_HEIGHT, "framebuffer size");
+
+// メッセージから画面の種類
+static OledScreenKind screenKind(OledDisplayMessage msg) {
+    switch(msg) {
+        case OledDisplayMessage::QRCode:    return OledScreenKind::QRCode;
+        case OledDisplayMessage::String:    return OledScreenKind::String;
+        case OledDisplayMessage::Status:    return OledScreenKind::Status;
+        default:                            return OledScreenKind::Clear;
+    }
+}
+
+OledDisplay::OledDisplay() : Actor(TAG) {
     clear();
 }
 
 void OledDisplay::clear() {
-    m_funcInitilizationComplettion = NULL;
     m_hDisp = NULL;
     m_panel_handle = NULL;
-    m_xHandle = NULL;
-    m_xQueue = NULL;
-    m_text = "";
+    m_shown = { OledScreenKind::Init, "" };     // "Initilize"表示中
+    m_pending = m_shown;
+    m_isPending = false;
+    m_lastRender = 0;
+    m_statusFunc = NULL;
+    m_statusFuncContext = NULL;
+    m_statusStart = 0;
+    m_nextStatus = 0;
+    m_renders = 0;
+    m_coalesced = 0;
+    m_statusUpdates = 0;
+    m_statusLastTime = 0;
+    m_statusMaxTime = 0;
 }
 
-void OledDisplay::init(CallbackInitializationCompletionFunction func, void* context) {
+void OledDisplay::init() {
     ESP_LOGI(TAG, "Init(S)");
 
-    m_funcInitilizationComplettion = func;
-    m_funcInitilizationComplettionContext = context;
-
-    // タスク作成
-    xTaskCreate(OledDisplay::task, TAG, configMINIMAL_STACK_SIZE * 3, (void*)this, tskIDLE_PRIORITY, &m_xHandle);
-
-    // メッセージキューの初期化
-    m_xQueue = xQueueCreate(10, sizeof(OledDisplayMessage));
-
     // 初期化用メッセージポスト
-    OledDisplayMessage msg = OledDisplayMessage::Init;
-    xQueueSend(m_xQueue, &msg, portMAX_DELAY);
+    request(OledDisplayMessage::Init, NULL);
 
    ESP_LOGI(TAG, "Init(E)");
 }
 
-// タスク
-void OledDisplay::task(void* arg) {
-    OledDisplay* pThis = (OledDisplay*)arg;
-    OledDisplayMessage msg;
-    bool loop = true;
-    while(loop) {
-        // メッセージキュー読み取り
-        if (pThis->m_xQueue != NULL && xQueueReceive(pThis->m_xQueue, (void*)&msg, portMAX_DELAY) == pdTRUE) {
-            switch(msg) {
-                case OledDisplayMessage::Init:      // 画面初期化処理
-                    pThis->initDisplay();
-                    break;
-                case OledDisplayMessage::Clear:     // 画面消去
-                    lv_obj_clean(lv_scr_act());
-                    break;
-                case OledDisplayMessage::On:        // 画面On
-                    esp_lcd_panel_disp_on_off(pThis->m_panel_handle, true);     // LCDのON/OFF  ONにする
-                    break;
-                case OledDisplayMessage::Off:       // 画面Off
-                    esp_lcd_panel_disp_on_off(pThis->m_panel_handle, false);    // LCDのON/OFF  OFFにする
-                    break;
-                case OledDisplayMessage::QRCode:    // QRコード表示
-                    {
-                        lv_obj_t* active_screen = lv_scr_act();
-                        lv_obj_clean(active_screen);
-                        lv_obj_t *qr = lv_qrcode_create(active_screen, 64, lv_color_hex3(0xFF), lv_color_hex3(0x00));
-                        lv_qrcode_update(qr, pThis->m_text.c_str(), pThis->m_text.size());
-                        lv_obj_center(qr);
-                    }
-                    break;
-                case OledDisplayMessage::String:    // 文字列表示
-                    {
-                        lv_obj_t* active_screen = lv_scr_act();
-                        lv_obj_clean(active_screen);
-                        lv_obj_t *label = lv_label_create(active_screen);
-                        lv_label_set_text(label, pThis->m_text.c_str());
-                        lv_obj_center(label);
-                    }
-                    break;
-                case OledDisplayMessage::Quit:      // 終了
-                    loop = false;
-                    break;
+// 状態表示の内容を取得するコールバック設定
+void OledDisplay::setStatusCallback(CallbackOledStatusFunction func, void* context) {
+    m_statusFunc = func;
+    m_statusFuncContext = context;
+}
+
+// メッセージ処理
+//  表示内容(消去、QRコード、文字列)の要求は覚えておくだけで、描画はメールボックスが空になってから(onWake)
+//  最後のものだけ行います。
+//  描画はCONFIG_OLED_FRAME_MSに1回まで (それより早い要求は次の描画にまとめる)
+void OledDisplay::onMessage(OledDisplayQueueItem& item) {
+    switch(item.msg) {
+        case OledDisplayMessage::Init:      // 画面初期化処理
+            initDisplay();
+            break;
+        case OledDisplayMessage::Clear:     // 画面消去
+        case OledDisplayMessage::QRCode:    // QRコード表示
+        case OledDisplayMessage::String:    // 文字列表示
+        case OledDisplayMessage::Status:    // 状態表示
+            if (m_isPending) {
+                std::lock_guard<std::mutex> lock(m_statsMutex);
+                m_coalesced++;   // 描画前に次の要求が来た
             }
-        }
+            m_pending = { screenKind(item.msg), item.text != NULL ? item.text : "" };
+            m_isPending = true;
+            setWake(m_lastRender + CONFIG_OLED_FRAME_MS * 1000LL);     // 描画できる時刻
+            break;
+        case OledDisplayMessage::On:        // 画面On
+            esp_lcd_panel_disp_on_off(m_panel_handle, true);     // LCDのON/OFF  ONにする
+            break;
+        case OledDisplayMessage::Off:       // 画面Off
+            esp_lcd_panel_disp_on_off(m_panel_handle, false);    // LCDのON/OFF  OFFにする
+            break;
+        case OledDisplayMessage::Quit:      // 終了
+            clear();
+            detach();
+            break;
+    }
+    delete[] item.text;
+}
+
+// 描画待ちの描画、状態表示の更新 (メールボックスが空で、setWake()の時刻を過ぎた時)
+//  状態表示中は要求が無くてもCONFIG_OLED_STATUS_MS毎に内容を更新します。
+void OledDisplay::onWake() {
+    if (m_isPending) {
+        if (m_hDisp != NULL)
+            render();
+        m_isPending = false;
+    } else if (m_shown.kind == OledScreenKind::Status) {
+        updateStatus();
+    }
+    if (m_shown.kind == OledScreenKind::Status)
+        setWake(m_nextStatus);
+}
+
+// 表示内容の描画 (表示中と同じ内容なら何もしない)
+void OledDisplay::render() {
+    if (m_pending == m_shown) {
+        std::lock_guard<std::mutex> lock(m_statsMutex);
+        m_coalesced++;
+        return;
+    }
+    int64_t start = esp_timer_get_time();
+    lvgl_port_lock(0);
+    if (!m_screen.build(lv_scr_act(), m_pending))
+        ESP_LOGE(TAG, "QR code encode failed");
+    lvgl_port_unlock();
+    m_shown = m_pending;
+    m_lastRender = esp_timer_get_time();
+    {
+        std::lock_guard<std::mutex> lock(m_statsMutex);
+        m_renders++;
+    }
+    if (m_pending.kind == OledScreenKind::QRCode)
+        ESP_LOGI(TAG, "QR code %s : %lld us", m_screen.qr().isHit() ? "cached" : "encoded", (long long)(m_lastRender - start));
+    if (m_shown.kind == OledScreenKind::Status) {
+        m_statusStart = m_lastRender;
+        updateStatus();     // ラベルを作成しただけなので内容を設定
     }
-    // 終了処理
-    pThis->clear();
-    vTaskDelete(NULL);
+}
+
+// 状態表示の更新
+//  ラベルは作成済みのものを使い、文字列が変わった行だけ書き換えます。
+//  描画と転送もディスプレイの実行タスク(優先度は最低)で行い、LVGLのタスクやWebサーバーのタスクに負荷を掛けません。
+void OledDisplay::updateStatus() {
+    int64_t start = esp_timer_get_time();
+    m_nextStatus = start + CONFIG_OLED_STATUS_MS * 1000LL;
+    OledStatus status = {};
+    status.requestRate = -1;
+    if (m_statusFunc != NULL)
+        m_statusFunc(&status, m_statusFuncContext);
+    int page = (int)((start - m_statusStart) / (CONFIG_OLED_STATUS_PAGE_S * 1000000LL) % OLED_DASHBOARD_PAGES);
+    lvgl_port_lock(0);
+    if (m_screen.dashboard().update(status, page))
+        lv_refr_now(m_hDisp);
+    lvgl_port_unlock();
+    int64_t time = esp_timer_get_time() - start;
+    {
+        std::lock_guard<std::mutex> lock(m_statsMutex);
+        m_statusUpdates++;
+        m_statusLastTime = time;
+        if (time > m_statusMaxTime)
+            m_statusMaxTime = time;
+    }
+    ESP_LOGD(TAG, "status page %d : %lld us", page, (long long)time);
+}
+
+// メッセージ送信 (textは複製して渡す)
+void OledDisplay::request(OledDisplayMessage msg, const char* text) {
+    OledDisplayQueueItem item = { msg, NULL };
+    if (text != NULL) {
+        item.text = new char[strlen(text) + 1];
+        strcpy(item.text, text);
+    }
+    if (!post(item))
+        delete[] item.text;
 }
 
 // 表示内容をクリア
 void OledDisplay::dispClear() {
     ESP_LOGI(TAG, "dispClear");
-    OledDisplayMessage msg = OledDisplayMessage::Clear;
-    xQueueSend(m_xQueue, &msg, portMAX_DELAY);
+    request(OledDisplayMessage::Clear, NULL);
 }
 
 // ディスプレイON
 void OledDisplay::dispOn() {
     ESP_LOGI(TAG, "dispOn");
-    OledDisplayMessage msg = OledDisplayMessage::On;
-    xQueueSend(m_xQueue, &msg, portMAX_DELAY);
+    request(OledDisplayMessage::On, NULL);
 }
 
 // ディスプレイOFF
 void OledDisplay::dispOff() {
     ESP_LOGI(TAG, "dispOff");
-    OledDisplayMessage msg = OledDisplayMessage::Off;
-    xQueueSend(m_xQueue, &msg, portMAX_DELAY);
+    request(OledDisplayMessage::Off, NULL);
 }
 
 // QRコード表示
 void OledDisplay::dispQRCode(const char* text) {
     ESP_LOGI(TAG, "dispQRCode");
-    m_text = text;
-    OledDisplayMessage msg = OledDisplayMessage::QRCode;
-    xQueueSend(m_xQueue, &msg, portMAX_DELAY);
+    request(OledDisplayMessage::QRCode, text);
 }
 
 // 文字列表示
 void OledDisplay::dispString(const char* text) {
     ESP_LOGI(TAG, "dispString");
-    m_text = text;
-    OledDisplayMessage msg = OledDisplayMessage::String;
-    xQueueSend(m_xQueue, &msg, portMAX_DELAY);
+    request(OledDisplayMessage::String, text);
+}
+
+// 状態表示
+void OledDisplay::dispStatus() {
+    ESP_LOGI(TAG, "dispStatus");
+    request(OledDisplayMessage::Status, NULL);
 }
 
 void OledDisplay::initDisplay() {
@@ -213,39 +281,45 @@ void OledDisplay::initDisplay() {
 
     // espressif__esp_lvgl_port (https://components.espressif.com/components/espressif/esp_lvgl_port)
     // 上記はLVGLをESP上で動作させるためのブリッジドライバ・・・のようなもの？
-    // 初期化
-    const lvgl_port_cfg_t lvgl_cfg = ESP_LVGL_PORT_INIT_CONFIG();
+    // 初期化 (LVGLのタスクとtickのみ使用。ディスプレイドライバは下で登録)
+    lvgl_port_cfg_t lvgl_cfg = ESP_LVGL_PORT_INIT_CONFIG();
+    lvgl_cfg.task_priority = TASK_PROFILE_LVGL.priority;
+    lvgl_cfg.task_stack = TASK_PROFILE_LVGL.stackSize;
+    BaseType_t affinity = TASK_PROFILE_LVGL.affinity();     // シングルコアでは固定しない
+    lvgl_cfg.task_affinity = affinity == tskNO_AFFINITY ? -1 : (int)affinity;   // esp_lvgl_portは-1がコア固定無し
     lvgl_port_init(&lvgl_cfg);
-    // 画面追加
-    const lvgl_port_display_cfg_t disp_cfg = {
-        .io_handle = io_handle,
-        .panel_handle = m_panel_handle,
-        .buffer_size = I2C_OLED_H * I2C_OLED_V,
-        .double_buffer = true,
-        .hres = I2C_OLED_H,
-        .vres = I2C_OLED_V,
-        .monochrome = true,
-        .rotation = {
-            .swap_xy = false,
-            .mirror_x = false,
-            .mirror_y = false,
-        }
-    };
-    m_hDisp = lvgl_port_add_disp(&disp_cfg);
 
-    /* LCDの回転を180°回転に設定 */
-    lv_disp_set_rotation(m_hDisp, LV_DISP_ROT_180);     // 他に LV_DISP_ROT_NONE, LV_DISP_ROT_90, LV_DISP_ROT_180, LV_DISP_ROT_270 がある。
+    /* LCDの回転を180°回転に設定 (パネル側で反転するので描画の負荷は無い) */
+    esp_lcd_panel_mirror(m_panel_handle, true, true);
+
+    // 画面追加
+    //  LVGLの描画結果は1bppのフレームバッファ(1KB)に詰めて、変更のあったページの列範囲のみI2Cで転送します。
+    //  (lvgl_port_add_dispは全画面分のlv_color_tのバッファを2面確保し、全画面を転送していた)
+    m_ssd1306.setHandle(m_panel_handle);
+    lvgl_port_lock(0);
+    m_hDisp = m_driver.init(&m_ssd1306);
 
     // "Initilize"を表示
-    lv_obj_t* active_screen = lv_scr_act();
-    lv_obj_clean(active_screen);
-    lv_obj_t *label = lv_label_create(active_screen);
-    lv_label_set_text(label, "Initilize");
-    lv_obj_center(label);
+    m_screen.build(lv_scr_act(), m_shown);
+    lvgl_port_unlock();
 
     // 初期化完了
-    if (m_funcInitilizationComplettion != NULL)
-        m_funcInitilizationComplettion(m_funcInitilizationComplettionContext);
+    ActorEventBus::publish(AppEvent::DisplayReady);
 
     ESP_LOGI(TAG, "initDisplay(E)");
 }
+
+// 変更のあったページの列範囲を転送 (LVGLのタスクで実行)
+void Ssd1306Panel::drawPage(int page, int x1, int x2, const uint8_t* data) {
+    esp_lcd_panel_draw_bitmap(m_panel_handle, x1, page * 8, x2 + 1, page * 8 + 8, data);
+}
+
+void OledDisplay::getFlushStats(OledFlushStats* stats) {
+    m_driver.getStats(stats);
+    std::lock_guard<std::mutex> lock(m_statsMutex);
+    stats->renders = m_renders;
+    stats->coalesced = m_coalesced;
+    stats->statusUpdates = m_statusUpdates;
+    stats->statusLastTime = m_statusLastTime;
+    stats->statusMaxTime = m_statusMaxTime;
+}
@@ -5,21 +5,60 @@
 #pragma once
 
 #include <iostream>
+#include <mutex>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
 #include "esp_lcd_panel_vendor.h"
 #include "esp_lvgl_port.h"
 #include "lvgl.h"
+#include "actor.hpp"
+#include "oled_panel.hpp"
+#include "oled_lvgl_driver.hpp"
+#include "oled_screen.hpp"
+#include "oled_dashboard.hpp"
 
-typedef void (*CallbackInitializationCompletionFunction)(void* context);
+typedef void (*CallbackOledStatusFunction)(OledStatus* status, void* context);  // 状態表示の内容 (ディスプレイの実行タスクで呼ばれる)
 
-class OledDisplay {
+// メッセージ種別
+enum class OledDisplayMessage {
+    Init,       // 画面初期処理
+    Clear,      // 画面消去
+    On,         // 画面On
+    Off,        // 画面Off
+    QRCode,     // QRコード表示
+    String,     // 文字列表示
+    Status,     // 状態表示
+    Quit        // 終了
+};
+
+// メッセージ
+struct OledDisplayQueueItem {
+    OledDisplayMessage msg;
+    char* text;         // QRCode、Stringの文字列 (new[]。受け取った側が解放)
+};
+
+// SSD1306への転送 (esp_lcd)
+class Ssd1306Panel : public OledPanel {
+    public:
+        Ssd1306Panel() { m_panel_handle = NULL; }
+
+    public:
+        void setHandle(esp_lcd_panel_handle_t panel_handle) { m_panel_handle = panel_handle; }
+        void drawPage(int page, int x1, int x2, const uint8_t* data) override;
+
+    private:
+        esp_lcd_panel_handle_t m_panel_handle;
+};
+
+// 初期化の完了はAppEvent::DisplayReadyで通知
+class OledDisplay : public Actor<OledDisplayQueueItem> {
     public:
         OledDisplay();
     
     public:
-        void init(CallbackInitializationCompletionFunction func, void* context);
+        void init();
+        void setStatusCallback(CallbackOledStatusFunction func, void* context);    // init()の前に設定
 
         bool isInitialize() { return m_panel_handle != NULL ? true : false; };
 
@@ -28,20 +67,39 @@ class OledDisplay {
         void dispOff();     // ディスプレイOFF
         void dispQRCode(const char* text);  // QRコード表示
         void dispString(const char* text);  // 文字列表示
+        void dispStatus();                  // 状態表示 (CONFIG_OLED_STATUS_MS毎に更新、CONFIG_OLED_STATUS_PAGE_S毎にページ切り替え)
+        void getFlushStats(OledFlushStats* stats);
 
     private:
         void clear();
-        // タスク
-        static void task(void* arg);
+        // メッセージ処理 (実行タスク)
+        void onMessage(OledDisplayQueueItem& item) override;
+        void onWake() override;
         // 
         void initDisplay();
+        void request(OledDisplayMessage msg, const char* text);
+        void render();          // m_pendingを描画
+        void updateStatus();    // 状態表示の更新
 
     private:
-        CallbackInitializationCompletionFunction m_funcInitilizationComplettion;
-        void* m_funcInitilizationComplettionContext;
         lv_disp_t *m_hDisp;
         esp_lcd_panel_handle_t m_panel_handle;
-        TaskHandle_t m_xHandle; // タスクハンドル
-        QueueHandle_t m_xQueue; // メッセージキュー
-        std::string m_text;     // QRコードますたはテキスト表示用
+        OledScreenContent m_shown;      // 表示中の内容 (タスクのみ使用)
+        OledScreenContent m_pending;    // 描画待ちの内容 (要求が続いた場合は最後のもの)
+        bool m_isPending;
+        int64_t m_lastRender;           // 最後に描画した時刻(us)
+        OledScreen m_screen;            // 画面 (QRコードと状態表示のラベルを保持)
+        CallbackOledStatusFunction m_statusFunc;
+        void* m_statusFuncContext;
+        int64_t m_statusStart;          // 状態表示を開始した時刻(us) (ページの切り替え用)
+        int64_t m_nextStatus;           // 次に状態表示を更新する時刻(us)
+        // ディスプレイドライバ
+        Ssd1306Panel m_ssd1306;
+        OledLvglDriver m_driver;
+        std::mutex m_statsMutex;
+        uint32_t m_renders;     // OledFlushStats.renders
+        uint32_t m_coalesced;   // OledFlushStats.coalesced
+        uint32_t m_statusUpdates;   // OledFlushStats.statusUpdates
+        int64_t m_statusLastTime;   // OledFlushStats.statusLastTime
+        int64_t m_statusMaxTime;    // OledFlushStats.statusMaxTime
 };
@@ -0,0 +1,77 @@
+#include <chrono>
+#include "oled_lvgl_driver.hpp"
+
+static int64_t nowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+OledLvglDriver::OledLvglDriver() {
+    m_panel = NULL;
+    m_drawPixels = NULL;
+    m_stats = {};
+}
+
+OledLvglDriver::~OledLvglDriver() {
+    delete[] m_drawPixels;
+}
+
+lv_disp_t* OledLvglDriver::init(OledPanel* panel) {
+    m_panel = panel;
+    m_fb.clear();   // 最初の描画で全画面を転送
+    m_drawPixels = new lv_color_t[MONO_FB_WIDTH * OLED_DRAW_BUF_LINES];
+    lv_disp_draw_buf_init(&m_drawBuf, m_drawPixels, NULL, MONO_FB_WIDTH * OLED_DRAW_BUF_LINES);
+    lv_disp_drv_init(&m_dispDrv);
+    m_dispDrv.hor_res = MONO_FB_WIDTH;
+    m_dispDrv.ver_res = MONO_FB_HEIGHT;
+    m_dispDrv.draw_buf = &m_drawBuf;
+    m_dispDrv.flush_cb = flush_cb;
+    m_dispDrv.user_data = this;
+    return lv_disp_drv_register(&m_dispDrv);
+}
+
+void OledLvglDriver::getStats(OledFlushStats* stats) {
+    std::lock_guard<std::mutex> lock(m_statsMutex);
+    *stats = m_stats;
+}
+
+// LVGLの描画結果をフレームバッファに反映 (LVGLのタスクで実行)
+//  黒(full == 0)を点灯 (esp_lvgl_portのモノクロ用と同じ。既定のテーマは白地に黒文字)
+void OledLvglDriver::flush_cb(lv_disp_drv_t* drv, const lv_area_t* area, lv_color_t* color_map) {
+    OledLvglDriver* pThis = (OledLvglDriver*)drv->user_data;
+    for(int y=area->y1; y<=area->y2; y++) {
+        for(int x=area->x1; x<=area->x2; x++) {
+            pThis->m_fb.setPixel(x, y, color_map->full == 0);
+            color_map++;
+        }
+    }
+    if (lv_disp_flush_is_last(drv))
+        pThis->flushPages();
+    lv_disp_flush_ready(drv);
+}
+
+// 変更のあったページの列範囲のみ転送
+void OledLvglDriver::flushPages() {
+    int64_t start = nowUs();
+    uint32_t bytes = 0;
+    for(int page=0; page<MONO_FB_PAGES; page++) {
+        int x1, x2;
+        if (!m_fb.takeDirty(page, &x1, &x2))
+            continue;
+        m_panel->drawPage(page, x1, x2, m_fb.page(page) + x1);
+        bytes += x2 - x1 + 1;
+    }
+    if (bytes == 0)
+        return;     // 描画したが内容は変わっていない
+    int64_t time = nowUs() - start;
+    {
+        std::lock_guard<std::mutex> lock(m_statsMutex);
+        m_stats.flushes++;
+        m_stats.lastBytes = bytes;
+        m_stats.totalBytes += bytes;
+        m_stats.lastTime = time;
+        m_stats.totalTime += time;
+        if (time > m_stats.maxTime)
+            m_stats.maxTime = time;
+    }
+    m_panel->endFrame();
+}
@@ -0,0 +1,55 @@
+/**
+ * 128x64モノクロOLED用のLVGLディスプレイドライバ
+ *
+ * LVGLはOLED_DRAW_BUF_LINES行ずつ描画し、flush_cbで1bppのフレームバッファ(1KB)に詰めて
+ * 変更のあったページの列範囲のみOledPanelへ転送します。
+ * ESP-IDFのAPIは使わないので、PC上でもLVGLと組み合わせて使えます (tools/oled_sim.cpp)。
+*/
+#pragma once
+
+#include <stdint.h>
+#include <mutex>
+#include "lvgl.h"
+#include "mono_framebuffer.hpp"
+#include "oled_panel.hpp"
+
+#define OLED_DRAW_BUF_LINES 16      // LVGLの描画バッファの行数 (画面はこれを単位に分けて描画される)
+
+// パネルへの転送の統計
+struct OledFlushStats {
+    uint32_t renders;       // 描画回数 (OledDisplayが設定)
+    uint32_t coalesced;     // 描画せずにまとめた要求の数 (描画前に次の要求が来た、表示中と同じ内容。OledDisplayが設定)
+    uint32_t flushes;       // 転送回数 (変更の無い描画は数えない)
+    uint32_t lastBytes;     // 直近の転送バイト数 (全画面は1024)
+    uint64_t totalBytes;
+    int64_t lastTime;       // 直近の転送時間(us)
+    int64_t maxTime;
+    int64_t totalTime;
+    uint32_t statusUpdates;     // 状態表示の更新回数 (OledDisplayが設定)
+    int64_t statusLastTime;     // 直近の状態表示の更新時間(us) (値の取得、ラベルの更新、描画、転送。OledDisplayが設定)
+    int64_t statusMaxTime;
+};
+
+class OledLvglDriver {
+    public:
+        OledLvglDriver();
+        ~OledLvglDriver();
+
+    public:
+        // LVGLにディスプレイを登録 (LVGLのロック中に呼ぶ)
+        lv_disp_t* init(OledPanel* panel);
+        void getStats(OledFlushStats* stats);
+
+    private:
+        static void flush_cb(lv_disp_drv_t* drv, const lv_area_t* area, lv_color_t* color_map);
+        void flushPages();      // 変更のあったページをパネルへ転送
+
+    private:
+        OledPanel* m_panel;
+        MonoFramebuffer m_fb;           // パネルと同じ内容 (1bpp)
+        lv_color_t* m_drawPixels;       // LVGLの描画バッファ (OLED_DRAW_BUF_LINES行分)
+        lv_disp_draw_buf_t m_drawBuf;
+        lv_disp_drv_t m_dispDrv;
+        std::mutex m_statsMutex;
+        OledFlushStats m_stats;
+};
@@ -0,0 +1,20 @@
+/**
+ * OLEDパネルの転送先
+ *
+ * OledLvglDriverが変更のあったページの列範囲を渡します。
+ * 実機はSSD1306(I2C)、PC上ではSoftPanel(メモリ上の画像)を使います。
+*/
+#pragma once
+
+#include <stdint.h>
+
+class OledPanel {
+    public:
+        virtual ~OledPanel() {}
+
+    public:
+        // 1ページ(縦8ピクセル、bit0が上)のx1～x2列を転送 (dataはx1列目から、1列1byte)
+        virtual void drawPage(int page, int x1, int x2, const uint8_t* data) = 0;
+        // 1回の描画の転送が終わった (転送が無かった場合は呼ばない)
+        virtual void endFrame() {}
+};
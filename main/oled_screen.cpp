@@ -0,0 +1,42 @@
+#include "oled_screen.hpp"
+
+#define OLED_QRCODE_SIZE    64
+
+bool OledScreen::build(lv_obj_t* screen, const OledScreenContent& content) {
+    lv_obj_clean(screen);   // (QRコードは前回の画像を参照しているオブジェクトを先に削除)
+    m_dashboard.detach();
+    switch(content.kind) {
+        case OledScreenKind::Init:
+            {
+                lv_obj_t *label = lv_label_create(screen);
+                lv_label_set_text(label, "Initilize");
+                lv_obj_center(label);
+            }
+            break;
+        case OledScreenKind::Clear:
+            break;
+        case OledScreenKind::QRCode:
+            // 同じ文字列(IPアドレスが変わらない間)は前回の画像を表示するだけ
+            if (!m_qr.update(content.text.c_str(), OLED_QRCODE_SIZE, lv_color_hex3(0xFF), lv_color_hex3(0x00)))
+                return false;
+            if (!m_qr.isHit())
+                lv_img_cache_invalidate_src(m_qr.image());   // 同じアドレスで内容が変わった
+            {
+                lv_obj_t *img = lv_img_create(screen);
+                lv_img_set_src(img, m_qr.image());
+                lv_obj_center(img);
+            }
+            break;
+        case OledScreenKind::String:
+            {
+                lv_obj_t *label = lv_label_create(screen);
+                lv_label_set_text(label, content.text.c_str());
+                lv_obj_center(label);
+            }
+            break;
+        case OledScreenKind::Status:
+            m_dashboard.create(screen);
+            break;
+    }
+    return true;
+}
@@ -0,0 +1,39 @@
+/**
+ * OLEDの画面 (表示内容からLVGLのオブジェクトを作成)
+ *
+ * OledDisplay(実機)とtools/oled_sim.cpp(PC)で同じ画面を作るために分けています。
+*/
+#pragma once
+
+#include <string>
+#include "lvgl.h"
+#include "qr_bitmap.hpp"
+#include "oled_dashboard.hpp"
+
+// 画面の種類
+enum class OledScreenKind {
+    Init,       // "Initilize"
+    Clear,      // 何も表示しない
+    QRCode,     // textのQRコード
+    String,     // textを中央に表示
+    Status      // 状態表示 (OledDashboard。内容はdashboard().update()で設定)
+};
+
+// 表示内容
+struct OledScreenContent {
+    OledScreenKind kind;
+    std::string text;
+    bool operator==(const OledScreenContent& o) const { return kind == o.kind && text == o.text; }
+};
+
+class OledScreen {
+    public:
+        // screenの子を削除して作成 (LVGLのロック中に呼ぶ。falseはQRコードを作成できない)
+        bool build(lv_obj_t* screen, const OledScreenContent& content);
+        QRBitmap& qr() { return m_qr; }                     // 表示したQRコード (同じ文字列なら再利用)
+        OledDashboard& dashboard() { return m_dashboard; }  // 状態表示のラベル
+
+    private:
+        QRBitmap m_qr;
+        OledDashboard m_dashboard;
+};
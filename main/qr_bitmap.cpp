@@ -0,0 +1,83 @@
+#include <string.h>
+#include "extra/libs/qrcode/qrcodegen.h"
+#include "qr_bitmap.hpp"
+
+#define QR_PALETTE_SIZE     8       // 2色 x lv_color32_t
+
+QRBitmap::QRBitmap() {
+    m_size = 0;
+    m_dark = lv_color_black();
+    m_light = lv_color_white();
+    m_data = NULL;
+    memset(&m_image, 0, sizeof(m_image));
+    m_isHit = false;
+}
+
+QRBitmap::~QRBitmap() {
+    release();
+}
+
+void QRBitmap::release() {
+    delete[] m_data;
+    m_data = NULL;
+    m_text = "";
+    memset(&m_image, 0, sizeof(m_image));
+}
+
+bool QRBitmap::update(const char* text, lv_coord_t size, lv_color_t dark, lv_color_t light) {
+    if (m_data != NULL && m_text == text && m_size == size && m_dark.full == dark.full && m_light.full == light.full) {
+        m_isHit = true;
+        return true;
+    }
+    m_isHit = false;
+    release();
+
+    // 符号化
+    uint8_t* qrcode = new uint8_t[qrcodegen_BUFFER_LEN_FOR_VERSION(QR_BITMAP_VERSION_MAX)];
+    uint8_t* temp = new uint8_t[qrcodegen_BUFFER_LEN_FOR_VERSION(QR_BITMAP_VERSION_MAX)];
+    size_t len = strlen(text);
+    bool isOk = len <= qrcodegen_BUFFER_LEN_FOR_VERSION(QR_BITMAP_VERSION_MAX);
+    if (isOk) {
+        // lv_qrcode_updateと同じ (バイナリモード、誤り訂正M)
+        memcpy(temp, text, len);
+        isOk = qrcodegen_encodeBinary(temp, len, qrcode, qrcodegen_Ecc_MEDIUM, qrcodegen_VERSION_MIN, QR_BITMAP_VERSION_MAX, qrcodegen_Mask_AUTO, true);
+    }
+    delete[] temp;
+    int modules = isOk ? qrcodegen_getSize(qrcode) : 0;
+    if (!isOk || modules > size) {
+        delete[] qrcode;
+        return false;
+    }
+
+    // 1bppに描画 (1 = dark、各行はbyte単位、MSBが左)
+    int stride = (size + 7) / 8;
+    uint32_t dataSize = QR_PALETTE_SIZE + stride * size;
+    m_data = new uint8_t[dataSize];
+    memset(m_data, 0, dataSize);
+    m_image.header.cf = LV_IMG_CF_INDEXED_1BIT;
+    m_image.header.w = size;
+    m_image.header.h = size;
+    m_image.data_size = dataSize;
+    m_image.data = m_data;
+    lv_img_buf_set_palette(&m_image, 0, light);
+    lv_img_buf_set_palette(&m_image, 1, dark);
+    int scale = size / modules;
+    int margin = (size - modules * scale) / 2;
+    uint8_t* pixels = m_data + QR_PALETTE_SIZE;
+    for(int my=0; my<modules; my++) {
+        for(int mx=0; mx<modules; mx++) {
+            if (!qrcodegen_getModule(qrcode, mx, my))
+                continue;
+            for(int y=margin + my * scale; y<margin + (my + 1) * scale; y++) {
+                for(int x=margin + mx * scale; x<margin + (mx + 1) * scale; x++)
+                    pixels[y * stride + x / 8] |= 0x80 >> (x % 8);
+            }
+        }
+    }
+    delete[] qrcode;
+    m_text = text;
+    m_size = size;
+    m_dark = dark;
+    m_light = light;
+    return true;
+}
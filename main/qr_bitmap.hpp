@@ -0,0 +1,40 @@
+/**
+ * QRコードの1bppビットマップ
+ *
+ * qrcodegen(LVGL同梱)で符号化したモジュールを指定サイズに拡大した1bppの画像(lv_img_dsc_t)を保持します。
+ * 同じ文字列なら符号化と描画を省略し、保持している画像をそのまま使います。
+ * 見た目はlv_qrcode_create(size, dark, light)と同じです (整数倍に拡大して中央に配置、余白はlight)。
+ * ESP-IDFのAPIは使わないので、PC上でも使えます。
+*/
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include "lvgl.h"
+
+#define QR_BITMAP_VERSION_MAX   11      // 61x61モジュール (64ピクセルに1倍で収まる最大)
+
+class QRBitmap {
+    public:
+        QRBitmap();
+        ~QRBitmap();
+
+    public:
+        // textの画像を作成 (textとサイズ、色が前回と同じなら何もしない。falseは符号化できない)
+        bool update(const char* text, lv_coord_t size, lv_color_t dark, lv_color_t light);
+        const lv_img_dsc_t* image() { return &m_image; }
+        const std::string& text() { return m_text; }
+        bool isHit() { return m_isHit; }            // 直前のupdate()が前回の画像を使ったか
+
+    private:
+        void release();
+
+    private:
+        std::string m_text;
+        lv_coord_t m_size;
+        lv_color_t m_dark;
+        lv_color_t m_light;
+        uint8_t* m_data;        // パレット(2色) + 1bppのピクセル
+        lv_img_dsc_t m_image;
+        bool m_isHit;
+};
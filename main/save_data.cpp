@@ -1,77 +1,548 @@
+#include <stdlib.h>
+#include "esp_rom_crc.h"
 #include "save_data.hpp"
 #include "esp_log.h"
 
 #define TAG "SaveData"
 
-#define SAVE_FILE "/save"
+#define SAVE_FILE "/save"      // 既定の名前空間のファイル
 
-SaveData::SaveData() {
-    m_rootPath[0] = '\0';
-    m_saveDataMap.clear();
+// バイナリ形式
+//  ヘッダ  : "WCSD"(4) + バージョン(1) + 予約(1) + 件数(2)
+//  エントリ: 型(1) + キー長(1) + キー + 値長(可変長整数) + 値
+//  末尾    : CRC32(4) ヘッダからエントリ末尾まで
+#define SAVE_MAGIC          "WCSD"
+#define SAVE_VERSION        1
+#define SAVE_HEADER_SIZE    8
+#define SAVE_CRC_SIZE       4
+
+// テキスト形式での型名
+static const char* typeNames[] = { "string", "int", "float", "bool", "bytes" };
+
+static void putU16(std::vector<uint8_t>& buf, uint16_t v) {
+    buf.push_back(v & 0xff);
+    buf.push_back((v >> 8) & 0xff);
 }
 
-void SaveData::init(const char* root) {
-    strcpy(m_rootPath, root);
-    m_saveDataMap.clear();
+static void putU32(std::vector<uint8_t>& buf, uint32_t v) {
+    for(int i=0; i<4; i++)
+        buf.push_back((v >> (i * 8)) & 0xff);
 }
 
-void SaveData::read() {
-    char* szPath = new char[strlen(m_rootPath) + strlen(SAVE_FILE) + 1];
-    sprintf(szPath, "%s%s", m_rootPath, SAVE_FILE);
-    m_saveDataMap.clear();
-    FILE* fd = fopen(szPath, "r");
-    if (fd != NULL) {
-        char szLine[256];
-        int len = 0;
-        std::string key, value;
-        while(1) {
-            int c = fgetc(fd);
-            if (feof(fd) || ferror(fd)) {
-                break;
+static uint32_t getU32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// 可変長整数 (LEB128)
+static void putVarint(std::vector<uint8_t>& buf, uint32_t v) {
+    while(v >= 0x80) {
+        buf.push_back((v & 0x7f) | 0x80);
+        v >>= 7;
+    }
+    buf.push_back(v);
+}
+
+static bool getVarint(const uint8_t*& p, const uint8_t* end, uint32_t* v) {
+    *v = 0;
+    for(int shift=0; shift<32 && p < end; shift+=7) {
+        uint8_t c = *p++;
+        *v |= (uint32_t)(c & 0x7f) << shift;
+        if ((c & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+// 値の生成
+static SaveValue makeValue(SaveValueType type) {
+    SaveValue v;
+    v.type = type;
+    v.num.i = 0;
+    return v;
+}
+
+static SaveValue makeString(const std::string& value) {
+    SaveValue v = makeValue(SaveValueType::String);
+    v.data = value;
+    return v;
+}
+
+SaveNamespace::SaveNamespace() {
+    m_storage = NULL;
+    m_loaded = false;
+    m_dirty = false;
+    m_fileExists = false;
+    m_fileSize = 0;
+    m_fileMtime = 0;
+}
+
+void SaveNamespace::init(Storage* storage, const char* file) {
+    m_storage = storage;
+    m_file = file;
+    unload();
+}
+
+// ファイル読み込み
+// 先頭がバイナリ形式のマジックで無い場合は旧形式(テキスト)として読み込みます。
+void SaveNamespace::read() {
+    std::lock_guard<std::mutex> lock(m_fileMutex);
+    SaveDataMap map;
+    std::string data;
+    if (m_storage != NULL && m_storage->readAll(m_file.c_str(), data) && !data.empty()) {
+        const uint8_t* buf = (const uint8_t*)data.data();
+        if (data.size() >= SAVE_HEADER_SIZE && memcmp(buf, SAVE_MAGIC, 4) == 0) {
+            if (!decodeBinary(buf, data.size(), map)) {
+                ESP_LOGE(TAG, "%s is corrupted", m_file.c_str());
+                map.clear();
             }
-            if (c == '\r') {
+        } else {
+            parseText(data.c_str(), data.size(), map);
+        }
+    }
+    m_saveData.publish(std::move(map));
+    m_fileExists = getFileStat(&m_fileSize, &m_fileMtime);
+    m_dirty = false;
+    m_loaded.store(true, std::memory_order_release);
+}
+
+// 読み込み済みの内容を破棄
+void SaveNamespace::unload() {
+    std::lock_guard<std::mutex> lock(m_fileMutex);
+    m_loaded = false;
+    m_dirty = false;
+    m_saveData.publish(SaveDataMap());
+}
+
+// ファイル書き込み (バイナリ形式)
+void SaveNamespace::save() {
+    std::lock_guard<std::mutex> lock(m_fileMutex);
+    if (!isLoaded() || m_storage == NULL)
+        return;     // 読み込んでいない内容でファイルを上書きしない
+    m_dirty = false;
+    std::vector<uint8_t> buf;
+    encodeBinary(*m_saveData.load(), buf);
+    if (!m_storage->writeAll(m_file.c_str(), buf.data(), buf.size()))
+        ESP_LOGE(TAG, "write error %s", m_file.c_str());
+    m_fileExists = getFileStat(&m_fileSize, &m_fileMtime);
+}
+
+// ファイルのサイズと更新日時を取得
+bool SaveNamespace::getFileStat(off_t* size, time_t* mtime) {
+    StorageStat st;
+    bool exists = m_storage != NULL && m_storage->stat(m_file.c_str(), &st);
+    *size = exists ? st.size : 0;
+    *mtime = exists ? st.mtime : 0;
+    return exists;
+}
+
+// 最後の読み込み/保存以降にファイルが変更されたか
+bool SaveNamespace::isChanged() {
+    off_t size;
+    time_t mtime;
+    bool exists = getFileStat(&size, &mtime);
+    return exists != m_fileExists || size != m_fileSize || mtime != m_fileMtime;
+}
+
+// バイナリ形式をデコードしてmapに格納
+bool SaveNamespace::decodeBinary(const uint8_t* buf, size_t size, SaveDataMap& map) {
+    if (size < SAVE_HEADER_SIZE + SAVE_CRC_SIZE)
+        return false;
+    if (buf[4] != SAVE_VERSION) {
+        ESP_LOGE(TAG, "unsupported version %d", buf[4]);
+        return false;
+    }
+    const uint8_t* end = buf + size - SAVE_CRC_SIZE;
+    uint32_t crc = esp_rom_crc32_le(0, buf, end - buf);
+    if (crc != getU32(end))
+        return false;
+    uint16_t count = buf[6] | (buf[7] << 8);
+    const uint8_t* p = buf + SAVE_HEADER_SIZE;
+    for(int i=0; i<count; i++) {
+        if (end - p < 2)
+            return false;
+        SaveValue value = makeValue((SaveValueType)*p++);
+        uint8_t keyLen = *p++;
+        if (end - p < keyLen)
+            return false;
+        std::string key((const char*)p, keyLen);
+        p += keyLen;
+        uint32_t len;
+        if (!getVarint(p, end, &len) || (uint32_t)(end - p) < len)
+            return false;
+        switch(value.type) {
+            case SaveValueType::Int:
+            case SaveValueType::Float:
+                if (len != 4)
+                    return false;
+                memcpy(&value.num.i, p, 4);     // リトルエンディアン前提
+                break;
+            case SaveValueType::Bool:
+                if (len != 1)
+                    return false;
+                value.num.b = *p != 0;
+                break;
+            case SaveValueType::String:
+            case SaveValueType::Bytes:
+                value.data.assign((const char*)p, len);
+                break;
+            default:
+                // 未知の型は読み飛ばす
+                p += len;
                 continue;
-            } else if(c == '=' || c == '\n') {
-                szLine[len] = '\0';
-                value = szLine;
-                if (c == '=') {
-                    key = szLine;
+        }
+        p += len;
+        map[key] = value;
+    }
+    return true;
+}
+
+// mapをバイナリ形式にエンコード
+void SaveNamespace::encodeBinary(const SaveDataMap& map, std::vector<uint8_t>& buf) {
+    buf.clear();
+    buf.insert(buf.end(), SAVE_MAGIC, SAVE_MAGIC + 4);
+    buf.push_back(SAVE_VERSION);
+    buf.push_back(0);
+    putU16(buf, 0);
+    uint16_t count = 0;
+    for(auto iter = map.begin(); iter != map.end(); iter++) {
+        const std::string& key = iter->first;
+        const SaveValue& value = iter->second;
+        if (key.size() > 255) {
+            ESP_LOGE(TAG, "key over 255 length : %s", key.c_str());
+            continue;
+        }
+        buf.push_back((uint8_t)value.type);
+        buf.push_back((uint8_t)key.size());
+        buf.insert(buf.end(), key.begin(), key.end());
+        switch(value.type) {
+            case SaveValueType::Int:
+            case SaveValueType::Float:
+                putVarint(buf, 4);
+                putU32(buf, (uint32_t)value.num.i);
+                break;
+            case SaveValueType::Bool:
+                putVarint(buf, 1);
+                buf.push_back(value.num.b ? 1 : 0);
+                break;
+            case SaveValueType::String:
+            case SaveValueType::Bytes:
+                putVarint(buf, value.data.size());
+                buf.insert(buf.end(), value.data.begin(), value.data.end());
+                break;
+        }
+        count++;
+    }
+    buf[6] = count & 0xff;
+    buf[7] = (count >> 8) & 0xff;
+    putU32(buf, esp_rom_crc32_le(0, buf.data(), buf.size()));
+}
+
+// テキスト形式の解析
+//  key=value           文字列
+//  key:int=value       整数 (他に float, bool, bytes(16進数), string)
+void SaveNamespace::parseText(const char* text, size_t size, SaveDataMap& map) {
+    const char* end = text + size;
+    const char* line = text;
+    while(line < end) {
+        const char* eol = (const char*)memchr(line, '\n', end - line);
+        if (eol == NULL)
+            eol = end;
+        std::string s(line, eol - line);
+        line = eol + 1;
+        if (!s.empty() && s.back() == '\r')
+            s.pop_back();
+        size_t eq = s.find('=');
+        if (s.empty() || eq == std::string::npos)
+            continue;
+        std::string key = s.substr(0, eq);
+        std::string str = s.substr(eq + 1);
+        std::string type = "string";
+        size_t colon = key.find(':');
+        if (colon != std::string::npos) {
+            type = key.substr(colon + 1);
+            key = key.substr(0, colon);
+        }
+        if (type == "int") {
+            SaveValue v = makeValue(SaveValueType::Int);
+            v.num.i = (int32_t)strtol(str.c_str(), NULL, 0);
+            map[key] = v;
+        } else if (type == "float") {
+            SaveValue v = makeValue(SaveValueType::Float);
+            v.num.f = strtof(str.c_str(), NULL);
+            map[key] = v;
+        } else if (type == "bool") {
+            SaveValue v = makeValue(SaveValueType::Bool);
+            v.num.b = str == "1" || str == "true";
+            map[key] = v;
+        } else if (type == "bytes") {
+            SaveValue v = makeValue(SaveValueType::Bytes);
+            for(size_t i=0; i+1<str.size(); i+=2)
+                v.data.push_back((char)strtol(str.substr(i, 2).c_str(), NULL, 16));
+            map[key] = v;
+        } else {
+            // 文字列は \n と \\ をエスケープ
+            std::string value;
+            for(size_t i=0; i<str.size(); i++) {
+                if (str[i] == '\\' && i + 1 < str.size()) {
+                    i++;
+                    value.push_back(str[i] == 'n' ? '\n' : str[i]);
                 } else {
-                    value = szLine;
-                    ESP_LOGI(TAG, "key=%s, value=%s", key.c_str(), value.c_str());
-                    m_saveDataMap.insert(std::make_pair(key, value));
+                    value.push_back(str[i]);
                 }
-                len = 0;
-            } else {
-                szLine[len++] = (char)c;
             }
+            map[key] = makeString(value);
         }
-        fclose(fd);
+        ESP_LOGI(TAG, "key=%s, type=%s", key.c_str(), type.c_str());
     }
-    delete[] szPath;
 }
 
-void SaveData::save() {
-    char* szPath = new char[strlen(m_rootPath) + strlen(SAVE_FILE) + 1];
-    sprintf(szPath, "%s%s", m_rootPath, SAVE_FILE);
-    FILE* fd = fopen(szPath, "w");
-    if (fd != NULL) {
-        auto iter = m_saveDataMap.begin();
-        while(iter != m_saveDataMap.end()) {
-            fprintf(fd, "%s=%s\n", iter->first.c_str(), iter->second.c_str());
-            iter++;
+// テキスト形式のファイルを読み込み保存データに追加
+bool SaveNamespace::importText(const char* path) {
+    std::string text;
+    if (m_storage == NULL || !m_storage->readAll(path, text))
+        return false;
+    SaveDataMap map;
+    parseText(text.c_str(), text.size(), map);
+    load();
+    m_saveData.update([&map](SaveDataMap& current) {
+        for(auto iter = map.begin(); iter != map.end(); iter++)
+            current[iter->first] = iter->second;
+    });
+    m_dirty = true;     // 公開の後 (setValue()参照)
+    return true;
+}
+
+// 保存データをテキスト形式で書き出し
+bool SaveNamespace::exportText(const char* path) {
+    if (m_storage == NULL)
+        return false;
+    std::string text;
+    char buf[64];
+    std::shared_ptr<const SaveDataMap> map = snapshot();
+    for(auto iter = map->begin(); iter != map->end(); iter++) {
+        const std::string& key = iter->first;
+        const SaveValue& value = iter->second;
+        switch(value.type) {
+            case SaveValueType::Int:
+                snprintf(buf, sizeof(buf), "%ld", (long)value.num.i);
+                text += key + ":" + typeNames[(int)value.type] + "=" + buf + "\n";
+                break;
+            case SaveValueType::Float:
+                snprintf(buf, sizeof(buf), "%g", value.num.f);
+                text += key + ":" + typeNames[(int)value.type] + "=" + buf + "\n";
+                break;
+            case SaveValueType::Bool:
+                text += key + ":" + typeNames[(int)value.type] + "=" + (value.num.b ? "1" : "0") + "\n";
+                break;
+            case SaveValueType::Bytes:
+                text += key + ":" + typeNames[(int)value.type] + "=";
+                for(size_t i=0; i<value.data.size(); i++) {
+                    snprintf(buf, sizeof(buf), "%02x", (uint8_t)value.data[i]);
+                    text += buf;
+                }
+                text += "\n";
+                break;
+            case SaveValueType::String:
+                text += key + "=";
+                for(size_t i=0; i<value.data.size(); i++) {
+                    char c = value.data[i];
+                    if (c == '\n')
+                        text += "\\n";
+                    else if (c == '\\')
+                        text += "\\\\";
+                    else
+                        text += c;
+                }
+                text += "\n";
+                break;
         }
-        fclose(fd);
     }
-    delete[] szPath;
+    return m_storage->writeAll(path, text.data(), text.size());
+}
+
+std::string SaveNamespace::get(const char* key, const char* def) {
+    std::shared_ptr<const SaveDataMap> map = snapshot();
+    auto iter = map->find(key);
+    if (iter == map->end() || iter->second.type != SaveValueType::String)
+        return def;
+    return iter->second.data;
+}
+
+void SaveNamespace::set(const char* key, const char* value) {
+    setValue(key, makeString(value));
+}
+
+// 整数取得 (旧形式から読み込んだ文字列の場合は変換して返す)
+int32_t SaveNamespace::getInt(const char* key, int32_t def) {
+    std::shared_ptr<const SaveDataMap> map = snapshot();
+    auto iter = map->find(key);
+    if (iter == map->end())
+        return def;
+    const SaveValue& v = iter->second;
+    switch(v.type) {
+        case SaveValueType::Int:
+            return v.num.i;
+        case SaveValueType::Bool:
+            return v.num.b ? 1 : 0;
+        case SaveValueType::Float:
+            return (int32_t)v.num.f;
+        case SaveValueType::String:
+            return (int32_t)strtol(v.data.c_str(), NULL, 0);
+        default:
+            return def;
+    }
+}
+
+float SaveNamespace::getFloat(const char* key, float def) {
+    std::shared_ptr<const SaveDataMap> map = snapshot();
+    auto iter = map->find(key);
+    if (iter == map->end())
+        return def;
+    const SaveValue& v = iter->second;
+    switch(v.type) {
+        case SaveValueType::Float:
+            return v.num.f;
+        case SaveValueType::Int:
+            return (float)v.num.i;
+        case SaveValueType::String:
+            return strtof(v.data.c_str(), NULL);
+        default:
+            return def;
+    }
+}
+
+bool SaveNamespace::getBool(const char* key, bool def) {
+    std::shared_ptr<const SaveDataMap> map = snapshot();
+    auto iter = map->find(key);
+    if (iter == map->end())
+        return def;
+    const SaveValue& v = iter->second;
+    switch(v.type) {
+        case SaveValueType::Bool:
+            return v.num.b;
+        case SaveValueType::Int:
+            return v.num.i != 0;
+        case SaveValueType::String:
+            return v.data == "1" || v.data == "true";
+        default:
+            return def;
+    }
+}
+
+// バイト列取得 (キーが無い場合はfalse)
+bool SaveNamespace::getBytes(const char* key, std::vector<uint8_t>& value) {
+    std::shared_ptr<const SaveDataMap> map = snapshot();
+    auto iter = map->find(key);
+    if (iter == map->end() || iter->second.type != SaveValueType::Bytes)
+        return false;
+    value.assign(iter->second.data.begin(), iter->second.data.end());
+    return true;
+}
+
+void SaveNamespace::setInt(const char* key, int32_t value) {
+    SaveValue v = makeValue(SaveValueType::Int);
+    v.num.i = value;
+    setValue(key, v);
+}
+
+void SaveNamespace::setFloat(const char* key, float value) {
+    SaveValue v = makeValue(SaveValueType::Float);
+    v.num.f = value;
+    setValue(key, v);
+}
+
+void SaveNamespace::setBool(const char* key, bool value) {
+    SaveValue v = makeValue(SaveValueType::Bool);
+    v.num.b = value;
+    setValue(key, v);
+}
+
+void SaveNamespace::setBytes(const char* key, const void* data, size_t len) {
+    SaveValue v = makeValue(SaveValueType::Bytes);
+    v.data.assign((const char*)data, len);
+    setValue(key, v);
+}
+
+bool SaveNamespace::has(const char* key) {
+    std::shared_ptr<const SaveDataMap> map = snapshot();
+    return map->find(key) != map->end();
+}
+
+void SaveNamespace::remove(const char* key) {
+    load();
+    m_saveData.update([key](SaveDataMap& map) {
+        map.erase(key);
+    });
+    m_dirty = true;
+}
+
+// 新しい版を作成して値を設定
+// 未保存フラグは公開の後に立てます。save()はフラグを落としてから現在の版を読むため、
+// フラグが落とされる前に公開した変更は書き込まれ、後に立てたフラグは次の保存まで残ります。
+void SaveNamespace::setValue(const char* key, const SaveValue& value) {
+    load();
+    m_saveData.update([key, &value](SaveDataMap& map) {
+        map[key] = value;
+    });
+    m_dirty = true;
+}
+
+SaveData::SaveData() {
+}
+
+void SaveData::init(Storage* storage) {
+    SaveNamespace::init(storage, SAVE_FILE);
+}
+
+// マウント時の読み込み
+// 既定の名前空間のみ読み込み、他の名前空間は次回アクセス時に読み込みます。
+void SaveData::read() {
+    {
+        std::lock_guard<std::mutex> lock(m_namespacesMutex);
+        for(auto iter = m_namespaces.begin(); iter != m_namespaces.end(); iter++)
+            iter->second->unload();
+    }
+    SaveNamespace::read();
 }
 
-const char* SaveData::get(const char* key) {
-    if (m_saveDataMap.find(key) == m_saveDataMap.end())
-        return NULL;
-    return m_saveDataMap[key].c_str();
+// 変更のある名前空間を保存
+void SaveData::save() {
+    if (isDirty())
+        SaveNamespace::save();
+    std::lock_guard<std::mutex> lock(m_namespacesMutex);
+    for(auto iter = m_namespaces.begin(); iter != m_namespaces.end(); iter++) {
+        if (iter->second->isDirty())
+            iter->second->save();
+    }
+}
+
+// 読み込み済みでファイルが変更された名前空間を再読み込み
+void SaveData::reloadChanged() {
+    if (isLoaded() && isChanged()) {
+        ESP_LOGI(TAG, "reload %s", SAVE_FILE);
+        SaveNamespace::read();
+    }
+    std::lock_guard<std::mutex> lock(m_namespacesMutex);
+    for(auto iter = m_namespaces.begin(); iter != m_namespaces.end(); iter++) {
+        SaveNamespace* pNs = iter->second.get();
+        if (pNs->isLoaded() && pNs->isChanged()) {
+            ESP_LOGI(TAG, "reload %s%s", SAVE_FILE ".", iter->first.c_str());
+            pNs->read();
+        }
+    }
 }
 
-void SaveData::set(const char* key, const char* value) {
-    m_saveDataMap[key] = value;
+// 名前空間取得 (初回は作成のみで、ファイルは最初のアクセス時に読み込まれます)
+SaveNamespace& SaveData::ns(const char* name) {
+    if (name == NULL || name[0] == '\0')
+        return *this;
+    std::lock_guard<std::mutex> lock(m_namespacesMutex);
+    auto iter = m_namespaces.find(name);
+    if (iter != m_namespaces.end())
+        return *iter->second;
+    std::string file = std::string(SAVE_FILE ".") + name;
+    SaveNamespace* pNs = new SaveNamespace();
+    pNs->init(storage(), file.c_str());
+    m_namespaces[name] = std::unique_ptr<SaveNamespace>(pNs);
+    return *pNs;
 }
@@ -1,26 +1,120 @@
 /**
  * データ保存
  * SDカードの/saveファイルに保存/読み込みを行う。
+ *
+ * 名前空間ごとに別ファイル(/save.<名前空間>)に保存できます。
+ * 各名前空間は最初にアクセスした時点で読み込まれ(遅延読み込み)、個別に保存されます。
+ *
+ * 保存データはスナップショット(RCU方式)で公開しており、読み込みはロック無しで行えます。
+ * 値は型付き(int, float, bool, bytes, string)で保持し、ファイルには
+ * 長さ付きのバイナリ形式(末尾にCRC32)で格納します。
+ * 人が読み書きするためのテキスト形式(key=value)のインポート/エクスポートも可能です。
 */
 #pragma once
 
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
 #include <iostream>
 #include <map>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <sys/types.h>
+#include "snapshot.hpp"
+#include "storage.hpp"
 
-class SaveData {
+// 保存データの型
+enum class SaveValueType : uint8_t {
+    String = 0,     // 文字列
+    Int = 1,        // 整数 (int32_t)
+    Float = 2,      // 浮動小数点 (float)
+    Bool = 3,       // 真偽値
+    Bytes = 4       // バイト列
+};
+
+// 保存データの値
+struct SaveValue {
+    SaveValueType type;
+    union {
+        int32_t i;
+        float f;
+        bool b;
+    } num;
+    std::string data;   // String/Bytesの内容
+};
+
+typedef std::map<std::string, SaveValue> SaveDataMap;
+
+// 1ファイル分の保存データ
+class SaveNamespace {
     public:
-        SaveData();
+        SaveNamespace();
 
     public:
-        void init(const char* root);
-        void read();
-        void save();
-        const char* get(const char* key);
+        void init(Storage* storage, const char* file);
+        void read();        // ファイルを読み込み
+        void unload();      // 読み込み済みの内容を破棄 (次回アクセス時に再読み込み)
+        void save();        // ファイルに書き込み (未読み込みの場合は何もしない)
+        Storage* storage() { return m_storage; }
+        bool isLoaded() { return m_loaded.load(std::memory_order_acquire); }
+        bool isDirty() { return m_dirty.load(std::memory_order_acquire); }
+        bool isChanged();   // 最後の読み込み/保存以降にファイルが変更されたか
+        // 現在の版 (まとめて複数のキーを読む場合に使用)
+        std::shared_ptr<const SaveDataMap> snapshot() { load(); return m_saveData.load(); }
+        // 文字列 (キーが無い場合はdefを返す)
+        std::string get(const char* key, const char* def = "");
         void set(const char* key, const char* value);
+        // 型付きアクセサ (キーが無い場合はdefを返す)
+        int32_t getInt(const char* key, int32_t def = 0);
+        float getFloat(const char* key, float def = 0.0f);
+        bool getBool(const char* key, bool def = false);
+        bool getBytes(const char* key, std::vector<uint8_t>& value);
+        void setInt(const char* key, int32_t value);
+        void setFloat(const char* key, float value);
+        void setBool(const char* key, bool value);
+        void setBytes(const char* key, const void* data, size_t len);
+        bool has(const char* key);
+        void remove(const char* key);
+        // テキスト形式のインポート/エクスポート (パスはストレージのルートからの相対)
+        bool importText(const char* path);
+        bool exportText(const char* path);
+
+    private:
+        void load() { if (!isLoaded()) read(); }
+        bool getFileStat(off_t* size, time_t* mtime);
+        void setValue(const char* key, const SaveValue& value);
+        static bool decodeBinary(const uint8_t* buf, size_t size, SaveDataMap& map);
+        static void encodeBinary(const SaveDataMap& map, std::vector<uint8_t>& buf);
+        static void parseText(const char* text, size_t size, SaveDataMap& map);
+
+    private:
+        Storage* m_storage;                 // ストレージ
+        std::string m_file;                 // ファイル名 (/save, /save.wifi など)
+        Snapshot<SaveDataMap> m_saveData;   // 保存データ
+        std::atomic<bool> m_loaded;         // 読み込み済み
+        std::atomic<bool> m_dirty;          // 未保存の変更あり
+        std::mutex m_fileMutex;             // ファイル読み書きの排他
+        bool m_fileExists;      // 最後の読み込み/保存時のファイルの状態
+        off_t m_fileSize;
+        time_t m_fileMtime;
+};
+
+// 保存データ
+// 自身は既定の名前空間(/save)で、ns()で他の名前空間を取得します。
+class SaveData : public SaveNamespace {
+    public:
+        SaveData();
+
+    public:
+        void init(Storage* storage);
+        void read();        // マウント時に呼び出し。全名前空間を未読み込みに戻し、既定の名前空間のみ読み込みます
+        void save();        // 変更のある名前空間を保存
+        void reloadChanged();   // 読み込み済みでファイルが変更された名前空間を再読み込み
+        SaveNamespace& ns(const char* name);    // 名前空間取得 (""は既定の名前空間)
 
     private:
-        char m_rootPath[256];
-        std::map<std::string, std::string> m_saveDataMap{};     // 保存データ
+        std::map<std::string, std::unique_ptr<SaveNamespace>> m_namespaces{};
+        std::mutex m_namespacesMutex;
 };
@@ -4,25 +4,23 @@
 #include <dirent.h>
 #include <errno.h>
 #include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-#include "freertos/queue.h"
+#include "freertos/timers.h"
 #include "driver/gpio.h"
 #include "esp_timer.h"
 #include "esp_log.h"
 #include "sd_card.hpp"
 #include "esp_vfs_fat.h"
+#include "diskio_sdmmc.h"
+#include "buffered_file.hpp"
+#include "app_event.hpp"
 
 #define TAG "SDCard"
 
-#define DEBOUNCE_TIME_MS    500  // デバウンズ時間=500ms
+#define SETTLE_TIME_MS      200     // 挿入スイッチの最後の変化からこの時間変化が無ければ確定
+#define RETRY_MIN_MS        250     // マウント失敗時の再試行間隔 (初回)
+#define RETRY_MAX_MS        8000    // マウント失敗時の再試行間隔 (最大)
 
-// メッセージ種別 (メッセージキュー用)
-enum class SDCardMessage {
-    SlotStateChange,        // SDカードスロット状態変化
-    Quit                    // 終了
-};
-
-SDCard::SDCard() {
+SDCard::SDCard() : Actor(TAG) {
     clear();
 }
 
@@ -30,10 +28,14 @@ void SDCard::clear() {
     m_isSlot = false;
     m_base_path = NULL;
     m_card = NULL;
-    m_xHandle = NULL;
-    m_xQueue = NULL;
-    m_mountCallback = NULL;
-    m_mountCallbackContext = NULL;
+    m_settleTimer = NULL;
+    m_retryTimer = NULL;
+    m_state = SDCardState::Empty;
+    m_isBusInit = false;
+    m_retryCount = 0;
+    m_edgeTime = 0;
+    m_mountLatency = 0;
+    m_isUsagePending = false;
 }
 
 void SDCard::init(const char* base_path) {
@@ -42,12 +44,15 @@ void SDCard::init(const char* base_path) {
     // ベースパス退避
     m_base_path = new char[strlen(base_path) + 1];
     strcpy(m_base_path, base_path);
+    m_storage.init(m_base_path);
+    m_storage.setReady(false);
+    m_fileCache.init(&m_storage, CONFIG_FILE_CACHE_MAX_FILES);
+    m_dirCache.init(&m_storage);
+    m_storage.addChangeListener(storage_change, this);
 
-    // タスク作成
-    xTaskCreate(SDCard::sd_card_task, TAG, configMINIMAL_STACK_SIZE * 3, (void*)this, tskIDLE_PRIORITY, &m_xHandle);
-
-    // メッセージキューの初期化
-    m_xQueue = xQueueCreate(10, sizeof(SDCardMessage));
+    // デバウンス/再試行用タイマ
+    m_settleTimer = xTimerCreate("SDSettle", pdMS_TO_TICKS(SETTLE_TIME_MS), pdFALSE, this, settle_timer_func);
+    m_retryTimer = xTimerCreate("SDRetry", pdMS_TO_TICKS(RETRY_MIN_MS), pdFALSE, this, retry_timer_func);
 
     // SD Slot スイッチの初期化/ハンドラ登録
     gpio_num_t sw = (gpio_num_t)CONFIG_CARD_SW_PIN;
@@ -58,147 +63,290 @@ void SDCard::init(const char* base_path) {
     gpio_pullup_en(sw);
     gpio_install_isr_service(0);
     gpio_isr_handler_add(sw, sd_card_slot_sw_handler, (void*)this);
-    update_sd_card_slot_sw();
+
+    // 起動時の状態もデバウンス後に確定させる
+    m_edgeTime = esp_timer_get_time();
+    xTimerStart(m_settleTimer, portMAX_DELAY);
 
     ESP_LOGI(TAG, "Init(E)");
 }
 
 void SDCard::quit() {
-    // SDCard用メッセージキューに投入
-    SDCardMessage msg = SDCardMessage::Quit;
-    xQueueSend(m_xQueue, &msg, portMAX_DELAY);
+    post(SDCardMessage::Quit);
 }
 
-// タスク
-void SDCard::sd_card_task(void* arg) {
-    SDCard* pThis = (SDCard*)arg;
-    SDCardMessage msg;
-    int64_t last_interrupt_time = DEBOUNCE_TIME_MS * -1000;
-    int64_t now;
-    bool loop = true;
-    while(loop) {
-        // メッセージキュー読み取り
-        if (pThis->m_xQueue != NULL && xQueueReceive(pThis->m_xQueue, (void*)&msg, portMAX_DELAY) == pdTRUE) {
-            switch(msg) {
-                case SDCardMessage::SlotStateChange:    // SDカードスロット状態変化
-                    now = esp_timer_get_time();
-                    if (now - last_interrupt_time > DEBOUNCE_TIME_MS * 1000) {
-                        pThis->sd_card_slot_state_change();
-                        last_interrupt_time = now;
-                    }
-                    break;
-                case SDCardMessage::Quit:               // 終了
-                    loop = false;
-                    break;
+// メッセージ処理
+void SDCard::onMessage(SDCardMessage& msg) {
+    switch(msg) {
+        case SDCardMessage::SlotSettled:        // SDカードスロット状態確定
+            sd_card_slot_state_change();
+            break;
+        case SDCardMessage::MountRetry:         // マウント再試行
+            if (m_state == SDCardState::Retry)
+                sd_card_try_mount();
+            break;
+        case SDCardMessage::UsageUpdate:        // 使用量の更新
+            m_isUsagePending = false;
+            if (isMount())
+                updateUsage();
+            break;
+        case SDCardMessage::Quit:               // 終了
+            gpio_isr_handler_remove((gpio_num_t)CONFIG_CARD_SW_PIN);
+            xTimerDelete(m_settleTimer, portMAX_DELAY);
+            xTimerDelete(m_retryTimer, portMAX_DELAY);
+            sd_card_unmount();
+            if (m_isBusInit) {
+                sdmmc_host_t host = SDSPI_HOST_DEFAULT();
+                spi_bus_free((spi_host_device_t)host.slot);
             }
-        }
+            clear();
+            detach();
+            break;
     }
-    // 終了処理
-    pThis->sd_card_unmount();
-    pThis->clear();
-    vTaskDelete(NULL);
 }
 
-// SDカードスロット状態変化
+// 状態変更
+void SDCard::setState(SDCardState state) {
+    if (m_state == state)
+        return;
+    static const char* names[] = { "Empty", "Mounting", "Mounted", "Retry" };
+    ESP_LOGI(TAG, "state %s -> %s", names[(int)m_state], names[(int)state]);
+    bool wasMount = isMount();
+    m_state = state;
+    // マウント状態が変化した時だけ通知
+    if (wasMount != isMount())
+        ActorEventBus::publish(AppEvent::SDMount, isMount());
+}
+
+// SDカードスロット状態確定 (挿入スイッチの変化が落ち着いた後の最終レベルで判定)
 void SDCard::sd_card_slot_state_change() {
-    if (m_isSlot)
-        sd_card_mount();    // SDカードマウント
-    else
-        sd_card_unmount();  // SDカードアンマウント
-    if (m_mountCallback != NULL) {
-        m_mountCallback(isMount(), m_mountCallbackContext);
+    m_isSlot = gpio_get_level((gpio_num_t)CONFIG_CARD_SW_PIN) == 0;
+    xTimerStop(m_retryTimer, portMAX_DELAY);
+    if (m_isSlot) {
+        if (m_state == SDCardState::Empty || m_state == SDCardState::Retry) {
+            m_retryCount = 0;
+            sd_card_try_mount();
+        }
+    } else {
+        if (m_state != SDCardState::Empty) {
+            sd_card_unmount();
+            setState(SDCardState::Empty);
+        }
     }
+    if (m_state != SDCardState::Retry)
+        m_edgeTime = 0;     // 再試行中は挿入時刻を保持して、成功までの時間を測る
+}
+
+// マウントを試み、失敗したら間隔を倍にしながら再試行する
+void SDCard::sd_card_try_mount() {
+    setState(SDCardState::Mounting);
+    int64_t start = esp_timer_get_time();
+    if (sd_card_mount()) {
+        int64_t now = esp_timer_get_time();
+        m_mountLatency = m_edgeTime != 0 ? now - m_edgeTime : now - start;
+        ESP_LOGI(TAG, "mounted : latency %lld ms (mount %lld ms, retry %d)",
+            (long long)(m_mountLatency / 1000), (long long)((now - start) / 1000), m_retryCount);
+        // 空きクラスタ数を数えておく (FATの走査はここで1回だけ。以降はFatFsが保持している値を使う)
+        updateUsage();
+        std::shared_ptr<const SDUsage> usage = m_usage.load();
+        if (usage->isMount)
+            ESP_LOGI(TAG, "usage : %llu / %llu MB", (unsigned long long)(usage->used >> 20), (unsigned long long)(usage->total >> 20));
+        setState(SDCardState::Mounted);
+        return;
+    }
+    uint32_t wait = RETRY_MIN_MS << (m_retryCount < 5 ? m_retryCount : 5);
+    if (wait > RETRY_MAX_MS)
+        wait = RETRY_MAX_MS;
+    m_retryCount++;
+    ESP_LOGW(TAG, "mount failed, retry %d in %lu ms", m_retryCount, (unsigned long)wait);
+    setState(SDCardState::Retry);
+    xTimerChangePeriod(m_retryTimer, pdMS_TO_TICKS(wait), portMAX_DELAY);   // 期間変更でタイマも開始される
 }
 
 // SDカードマウント
-void SDCard::sd_card_mount() {
+bool SDCard::sd_card_mount() {
     if (m_card != NULL)
         sd_card_unmount();
     // SDカード初期化 (SPI & VFS初期化)
     sdmmc_card_t* card = NULL;
     esp_vfs_fat_sdmmc_mount_config_t mount_config = {
         .format_if_mount_failed = false,
-        .max_files = 5,
-        .allocation_unit_size = 16 * 1024
+        .max_files = CONFIG_SD_MAX_FILES,
+        .allocation_unit_size = FILE_CLUSTER_SIZE
     };
     sdmmc_host_t host = SDSPI_HOST_DEFAULT();
-    spi_bus_config_t bus_config = {
-        .mosi_io_num = CONFIG_MOSI_PIN,
-        .miso_io_num = CONFIG_MISO_PIN,
-        .sclk_io_num = CONFIG_CLK_PIN,
-        .quadwp_io_num = -1,
-        .quadhd_io_num = -1,
-        .max_transfer_sz = 4000,
-    };
-    esp_err_t ret = spi_bus_initialize((spi_host_device_t)host.slot, &bus_config, SDSPI_DEFAULT_DMA);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to initialize bus.");
-        ESP_ERROR_CHECK(ret);
+    // SPIバスは最初のマウント時に1回だけ初期化し、抜き差しの間も保持する
+    if (!m_isBusInit) {
+        spi_bus_config_t bus_config = {
+            .mosi_io_num = CONFIG_MOSI_PIN,
+            .miso_io_num = CONFIG_MISO_PIN,
+            .sclk_io_num = CONFIG_CLK_PIN,
+            .quadwp_io_num = -1,
+            .quadhd_io_num = -1,
+            .max_transfer_sz = FILE_CLUSTER_SIZE,    // クラスタ単位の読み書きを1回のDMA転送で行う
+        };
+        esp_err_t ret = spi_bus_initialize((spi_host_device_t)host.slot, &bus_config, SDSPI_DEFAULT_DMA);
+        if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) {
+            ESP_LOGE(TAG, "Failed to initialize bus. (%s)", esp_err_to_name(ret));
+            return false;
+        }
+        m_isBusInit = true;
     }
     sdspi_device_config_t slot_config = SDSPI_DEVICE_CONFIG_DEFAULT();
     slot_config.gpio_cs = (gpio_num_t)CONFIG_CS_PIN;
     slot_config.host_id = (spi_host_device_t)host.slot;
-    ret = esp_vfs_fat_sdspi_mount(m_base_path, &host, &slot_config, &mount_config, &card);
+    esp_err_t ret = esp_vfs_fat_sdspi_mount(m_base_path, &host, &slot_config, &mount_config, &card);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to mount filesystem. (%s)", esp_err_to_name(ret));
+        return false;
+    }
     sdmmc_card_print_info(stdout, card);
     m_card = card;
+    BYTE pdrv = ff_diskio_get_pdrv_card(card);
+    m_storage.setDrive(pdrv != 0xFF ? pdrv : -1);
+    m_storage.setReady(true);
+    return true;
 }
 
-// SDカードアンマウント
+// SDカードアンマウント (SPIバスは解放しない)
 void SDCard::sd_card_unmount() {
     if (m_card == NULL)
         return;
+    m_usage.publish(SDUsage{});     // 先に未マウントを公開 (以降の参照はFatFsを待たない)
+    m_storage.setReady(false);
+    m_fileCache.closeAll(1000);     // 開いたままのハンドルを閉じてからアンマウント
+    m_dirCache.clear();
+    m_storage.setDrive(-1);
     esp_vfs_fat_sdcard_unmount(m_base_path, m_card);
-    sdmmc_host_t host = SDSPI_HOST_DEFAULT();
-    spi_bus_free((spi_host_device_t)host.slot);
     m_card = NULL;
 }
 
-// SDカードスロット挿入スイッチON/OFFハンドラ
+// ストレージ変更通知 (変更されたファイル/ディレクトリのキャッシュを破棄)
+void SDCard::storage_change(const char* path, void* context) {
+    SDCard* pThis = (SDCard*)context;
+    pThis->m_fileCache.invalidate(path);
+    pThis->m_dirCache.invalidate(path);
+    // 使用量は実行タスクで数え直す (続けて変更された場合は1回にまとめる)
+    if (!pThis->m_isUsagePending.exchange(true) && !pThis->post(SDCardMessage::UsageUpdate, 0))
+        pThis->m_isUsagePending = false;
+}
+
+// 使用量を数えて公開 (実行タスク)
+void SDCard::updateUsage() {
+    SDUsage usage;
+    usage.isMount = m_storage.getUsage(&usage.total, &usage.used);
+    m_usage.publish(std::move(usage));
+}
+
+// 容量と使用量 (公開済みの値)
+bool SDCard::getUsage(uint64_t* total, uint64_t* used) {
+    std::shared_ptr<const SDUsage> usage = m_usage.load();
+    if (!usage->isMount)
+        return false;
+    *total = usage->total;
+    *used = usage->used;
+    return true;
+}
+
+// SDカードスロット挿入スイッチON/OFFハンドラ (ISR)
+//  変化の度にデバウンスタイマを再始動するだけで、レベルの判定はタスクで行う
 void IRAM_ATTR SDCard::sd_card_slot_sw_handler(void* arg) {
     SDCard* pThis = (SDCard*)arg;
-    pThis->update_sd_card_slot_sw();
+    if (pThis->m_edgeTime == 0)
+        pThis->m_edgeTime = esp_timer_get_time();
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    xTimerResetFromISR(pThis->m_settleTimer, &xHigherPriorityTaskWoken);
+    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
 }
 
-// m_isSlot更新 SDカードスロット挿入スイッチのGPIOの状態を見てm_isSlotを更新
-void SDCard::update_sd_card_slot_sw() {
-    bool isSlot = m_isSlot;
-    gpio_num_t sw = (gpio_num_t)CONFIG_CARD_SW_PIN;
-    if (gpio_get_level(sw) == 0) {
-        m_isSlot = true;
-    } else {
-        m_isSlot = false;
-    }
-    if (m_isSlot != isSlot) {
-        // スロット状態変化あり SDCard用メッセージキューに投入
-        SDCardMessage msg = SDCardMessage::SlotStateChange;
-        xQueueSend(m_xQueue, &msg, portMAX_DELAY);
-    }
+// デバウンスタイマ満了 (タイマタスク)
+void SDCard::settle_timer_func(TimerHandle_t xTimer) {
+    SDCard* pThis = (SDCard*)pvTimerGetTimerID(xTimer);
+    pThis->post(SDCardMessage::SlotSettled, 0);
 }
 
-// SDカードマウント状態コールバック設定
-void SDCard::setMountCallback(CallbackMountFunction callback, void* context) {
-    m_mountCallback = callback;
-    m_mountCallbackContext = context;
+// 再試行タイマ満了 (タイマタスク)
+void SDCard::retry_timer_func(TimerHandle_t xTimer) {
+    SDCard* pThis = (SDCard*)pvTimerGetTimerID(xTimer);
+    pThis->post(SDCardMessage::MountRetry, 0);
 }
 
 // SDカードの指定パスのファイル一覧を返します
+struct FileListsContext {
+    CallbackFileFunction callback;
+    void* context;
+};
+
 void SDCard::fileLists(const char* path, CallbackFileFunction callback, void* context) {
     if (m_card == NULL || path == NULL)
         return;
     // ファイル一覧取得
-    char* p = new char[strlen(m_base_path) + strlen(path) + 1];
-    sprintf(p, "%s%s", m_base_path, path);
-    ESP_LOGI(TAG, "fileLists : %s", p);
-    DIR *dir = opendir(p);
-    if (dir == NULL) {
+    ESP_LOGI(TAG, "fileLists : %s%s", m_base_path, path);
+    FileListsContext ctx = { callback, context };
+    if (!m_storage.listDir(path, file_lists_entry, &ctx))
         ESP_LOGE(TAG, "opendir error %d", errno);
-        return;
-    }
-    struct dirent *entry;
-    while((entry = readdir(dir)) != NULL) {
-        bool is_file = entry->d_type == DT_DIR ? false : true;
-        if (callback(is_file, entry->d_name, context) == false)
+}
+
+bool SDCard::file_lists_entry(const StorageDirEntry* entry, void* context) {
+    FileListsContext* ctx = (FileListsContext*)context;
+    return ctx->callback(!entry->isDir, entry->name, ctx->context);
+}
+
+// ディレクトリ内のエントリを列挙 (FatFsのディレクトリエントリからサイズと更新日時を取得)
+bool FatStorage::listDir(const char* path, CallbackDirEntryFunction callback, void* context) {
+    if (m_pdrv < 0)
+        return PosixStorage::listDir(path, callback, context);
+    if (!isReady())
+        return false;
+    char drivePath[256];
+    snprintf(drivePath, sizeof(drivePath), "%d:%s", m_pdrv, path);
+    FF_DIR dir;
+    if (f_opendir(&dir, drivePath) != FR_OK)
+        return false;
+    FILINFO info;
+    while(f_readdir(&dir, &info) == FR_OK && info.fname[0] != '\0') {
+        if (strcmp(info.fname, ".") == 0 || strcmp(info.fname, "..") == 0)
+            continue;
+        // FATの日付/時刻をtime_tに変換 (VFSのstat()と同じ)
+        struct tm tm = {
+            .tm_sec = (info.ftime & 0x1f) * 2,
+            .tm_min = (info.ftime >> 5) & 0x3f,
+            .tm_hour = info.ftime >> 11,
+            .tm_mday = info.fdate & 0x1f,
+            .tm_mon = ((info.fdate >> 5) & 0x0f) - 1,
+            .tm_year = (info.fdate >> 9) + 80,
+            .tm_isdst = -1
+        };
+        StorageDirEntry e = {
+            .name = info.fname,
+            .isDir = (info.fattrib & AM_DIR) != 0,
+            .size = (off_t)info.fsize,
+            .mtime = mktime(&tm)
+        };
+        if (callback(&e, context) == false)
             break;
     }
+    f_closedir(&dir);
+    return true;
 }
 
+// 容量と使用量
+//  最初の呼び出しは空きクラスタ数をFATから数える(カードの容量によっては数秒かかる)。以降はFatFsが保持している値を返す
+bool FatStorage::getUsage(uint64_t* total, uint64_t* used) {
+    if (m_pdrv < 0 || !isReady())
+        return false;
+    char drive[8];
+    snprintf(drive, sizeof(drive), "%d:", m_pdrv);
+    DWORD freeClusters;
+    FATFS* fs;
+    if (f_getfree(drive, &freeClusters, &fs) != FR_OK)
+        return false;
+#if FF_MAX_SS != FF_MIN_SS
+    uint64_t clusterSize = (uint64_t)fs->csize * fs->ssize;
+#else
+    uint64_t clusterSize = (uint64_t)fs->csize * FF_MAX_SS;
+#endif
+    *total = (uint64_t)(fs->n_fatent - 2) * clusterSize;
+    *used = *total - (uint64_t)freeClusters * clusterSize;
+    return true;
+}
@@ -2,20 +2,67 @@
  * ストレージ
  * 
  * microSDのマウント/アンマウントを行います。
+ * マウント中のファイルアクセスはstorage()で取得できるStorage経由で行います。
+ * マウント状態の変化はイベントバスのAppEvent::SDMountで通知します。
  * 
 */
 #pragma once
 
 #include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-#include "freertos/queue.h"
+#include "freertos/timers.h"
 #include "driver/gpio.h"
 #include "sdmmc_cmd.h"
+#include "actor.hpp"
+#include "storage.hpp"
+#include "file_cache.hpp"
+#include "dir_cache.hpp"
+#include "snapshot.hpp"
+
+// 状態
+//  Empty --(挿入確定)--> Mounting --(成功)--> Mounted --(抜去確定)--> Empty
+//                           |(失敗)
+//                           v
+//                         Retry --(再試行タイマ)--> Mounting
+enum class SDCardState {
+    Empty,          // 未挿入 (またはアンマウント済み)
+    Mounting,       // マウント中
+    Mounted,        // マウント済み
+    Retry           // マウント失敗。再試行待ち
+};
+
+// SDカード(FAT)用ストレージ
+//  ディレクトリ列挙はFatFsを直接使い、readdir()後のエントリ毎のstat()(毎回ディレクトリを先頭から探索する)を省く
+class FatStorage : public PosixStorage {
+    public:
+        FatStorage() : m_pdrv(-1) {}
+
+    public:
+        void setDrive(int pdrv) { m_pdrv = pdrv; }  // FatFsのドライブ番号 (-1はPOSIX APIを使用)
+        bool listDir(const char* path, CallbackDirEntryFunction callback, void* context) override;
+        bool getUsage(uint64_t* total, uint64_t* used);     // 容量と使用量(byte)
+
+    private:
+        int m_pdrv;
+};
+
+// 容量と使用量 (マウント中のみ有効。SDカードの実行タスクで更新)
+struct SDUsage {
+    bool isMount = false;
+    uint64_t total = 0;     // 容量(byte)
+    uint64_t used = 0;      // 使用量(byte)
+};
 
-typedef void (*CallbackMountFunction)(bool isMount, void* context);
 typedef bool (*CallbackFileFunction)(bool is_file, const char* name, void* context);
 
-class SDCard {
+// メッセージ種別
+enum class SDCardMessage {
+    SlotSettled,            // SDカードスロット状態確定
+    MountRetry,             // マウント再試行
+    UsageUpdate,            // 使用量の更新 (ファイル変更後)
+    Quit                    // 終了
+};
+
+class SDCard : public Actor<SDCardMessage> {
     public:
         SDCard();
 
@@ -25,27 +72,46 @@ class SDCard {
         void quit();
 
         bool isSlot() { return m_isSlot; }              // SDカード挿入状態取得
-        bool isMount() { return m_card != NULL ? true : false; }
-        void setMountCallback(CallbackMountFunction callback, void* context);
+        bool isMount() { return m_state == SDCardState::Mounted; }
+        SDCardState state() { return m_state; }
+        int64_t mountLatency() { return m_mountLatency; }   // 直近の挿入からマウント完了までの時間(us)
+        Storage* storage() { return &m_storage; }         // ストレージ (マウント中のみアクセス可能)
+        FileCache* fileCache() { return &m_fileCache; }   // 読み込み用ハンドルのキャッシュ (アンマウント時に全て閉じる)
+        DirCache* dirCache() { return &m_dirCache; }      // ディレクトリ一覧のキャッシュ (変更/アンマウント時に破棄)
+        bool getUsage(uint64_t* total, uint64_t* used);     // 容量と使用量(byte) (公開済みの値。ロック無し、FatFsを呼ばない)
         void fileLists(const char* path, CallbackFileFunction callback, void* context); // SDカードの指定パスのファイル一覧を返します
 
     private:
-        // タスク
-        static void sd_card_task(void* arg);
+        // メッセージ処理 (実行タスク)
+        void onMessage(SDCardMessage& msg) override;
         // SDカード関連
-        void sd_card_slot_state_change();   // SDカードスロット状態変化
-        void sd_card_mount();               // SDカードマウント
+        void setState(SDCardState state);
+        void sd_card_slot_state_change();   // SDカードスロット状態確定
+        void sd_card_try_mount();           // マウント (失敗時は再試行を予約)
+        bool sd_card_mount();               // SDカードマウント
         void sd_card_unmount();             // SDカードアンマウント
+        void updateUsage();                 // 使用量を数えて公開
+        static bool file_lists_entry(const StorageDirEntry* entry, void* context);
+        static void storage_change(const char* path, void* context);   // ストレージ変更通知
         // SDカードスロットSW関連
         static void sd_card_slot_sw_handler(void* arg); // SDカードスロット挿入スイッチON/OFFハンドラ
-        void update_sd_card_slot_sw();                  // m_isSlot更新
+        static void settle_timer_func(TimerHandle_t xTimer);
+        static void retry_timer_func(TimerHandle_t xTimer);
 
     private:
         bool m_isSlot;          // true = SDカード挿入中
         char* m_base_path;      // ベースパス
-        TaskHandle_t m_xHandle; // タスクハンドル
-        QueueHandle_t m_xQueue; // メッセージキュー
         sdmmc_card_t* m_card;   // SDカード (マウント中以外はNULL)
-        CallbackMountFunction m_mountCallback;  // マウントコールバック
-        void* m_mountCallbackContext;
+        SDCardState m_state;    // 状態 (実行タスクのみ変更)
+        TimerHandle_t m_settleTimer;    // デバウンス用タイマ
+        TimerHandle_t m_retryTimer;     // マウント再試行用タイマ
+        bool m_isBusInit;       // SPIバス初期化済み
+        int m_retryCount;       // マウント再試行回数
+        volatile int64_t m_edgeTime;    // 最初のスイッチ変化の時刻(us) (0は変化無し)
+        int64_t m_mountLatency; // 直近の挿入からマウント完了までの時間(us)
+        FatStorage m_storage;   // ストレージ (VFS(FAT)経由)
+        FileCache m_fileCache;  // 読み込み用ハンドルのキャッシュ
+        DirCache m_dirCache;    // ディレクトリ一覧のキャッシュ
+        Snapshot<SDUsage> m_usage;          // 容量と使用量 (他タスクからはこちらを参照)
+        std::atomic<bool> m_isUsagePending; // 使用量の更新を通知済み
 };
@@ -0,0 +1,93 @@
+/**
+ * スナップショット (RCU方式の共有データ)
+ *
+ * 不変(immutable)なデータを参照カウント付きで公開し、ポインタの差し替えで更新します。
+ * 読み込み側はロックを取らずに版を取得でき、取得した版は保持している間は変化しません。
+ * 書き込み側は現在の版を複製して変更した新しい版を作成し、差し替えます。
+ * 古い版は最後の参照が外れた時点で解放されます。
+ *
+ * 版は2つの枠に交互に置き、枠毎に読み込み中の数を数えます(Left-Right方式)。
+ * 読み込み側は現在の枠の数を加算してから枠が変わっていないことを確かめ、shared_ptrを複製して減算します。
+ * 書き込み側(std::mutexで1つずつ)は使っていない方の枠の読み込み中が0になるのを待ってから書き換え、現在の枠を切り替えます。
+ * 読み込み側が待つことはありません(書き込みと重なった場合のみ数回やり直します)。
+ * 直前の版は次の更新まで枠に残ります。
+ * std::atomic<std::shared_ptr>はlibstdc++(GCC 12)の実装がload()の内部ロックをrelaxedで解放するため使いません(tools/snapshot_stress.cpp)。
+*/
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+template<typename T>
+class Snapshot {
+    public:
+        Snapshot() : m_index(0) {
+            m_slots[0] = std::make_shared<const T>();
+            m_readers[0] = 0;
+            m_readers[1] = 0;
+        }
+
+    public:
+        // 現在の版を取得 (ロック無し。取得した版は保持している間は変化しない)
+        std::shared_ptr<const T> load() const {
+            while(true) {
+                int index = m_index.load();
+                m_readers[index]++;
+                // 加算の前に枠が切り替わっていたら、書き込み側がこの枠を書き換えている可能性がある
+                if (m_index.load() == index) {
+                    std::shared_ptr<const T> value = m_slots[index];
+                    m_readers[index]--;
+                    return value;
+                }
+                m_readers[index]--;
+            }
+        }
+
+        // 新しい版を公開
+        void publish(std::shared_ptr<const T> value) {
+            std::lock_guard<std::mutex> lock(m_writeMutex);
+            store(std::move(value));
+        }
+        void publish(T&& value) {
+            publish(std::make_shared<const T>(std::move(value)));
+        }
+
+        // 現在の版を複製してfuncで変更し公開します。
+        // 他の書き込みと競合した場合は最新の版から再度やり直します。
+        template<typename F>
+        void update(F func) {
+            std::shared_ptr<const T> current = load();
+            while(true) {
+                std::shared_ptr<T> next = std::make_shared<T>(*current);
+                func(*next);
+                std::lock_guard<std::mutex> lock(m_writeMutex);
+                if (m_slots[m_index.load()] == current) {
+                    store(std::move(next));
+                    break;
+                }
+                current = m_slots[m_index.load()];
+            }
+        }
+
+    private:
+        // 使っていない方の枠に書き込んで切り替え (m_writeMutexを取得して呼ぶ)
+        void store(std::shared_ptr<const T> value) {
+            int next = 1 - m_index.load();
+            // 読み込み中はshared_ptrの複製だけなのですぐに抜ける。低優先度のタスクに譲るため寝て待つ
+            while(m_readers[next].load() != 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            m_slots[next].swap(value);
+            m_index.store(next);
+            // 2つ前の版はここで解放される (valueのデストラクタ。読み込み側は待たない)
+        }
+
+    private:
+        std::mutex m_writeMutex;                // 書き込み同士の排他
+        std::atomic<int> m_index;               // 現在の版の枠
+        mutable std::atomic<int> m_readers[2];  // 枠毎の読み込み中の数
+        std::shared_ptr<const T> m_slots[2];    // 版
+};
@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <string.h>
+#include "soft_panel.hpp"
+
+SoftPanel::SoftPanel() {
+    memset(m_buf, 0, sizeof(m_buf));
+    m_frames = 0;
+    m_bytes = 0;
+    m_frameBytes = 0;
+}
+
+void SoftPanel::drawPage(int page, int x1, int x2, const uint8_t* data) {
+    memcpy(&m_buf[page * MONO_FB_WIDTH + x1], data, x2 - x1 + 1);
+    m_frameBytes += x2 - x1 + 1;
+}
+
+void SoftPanel::endFrame() {
+    m_frames++;
+    m_bytes = m_frameBytes;
+    m_frameBytes = 0;
+    if (m_dumpDir.empty())
+        return;
+    char path[256];
+    snprintf(path, sizeof(path), "%s/frame_%05lu.pbm", m_dumpDir.c_str(), (unsigned long)m_frames);
+    writePBM(path);
+}
+
+// PBM(P4) : ヘッダの後に1行16byte (MSBが左)
+std::string SoftPanel::toPBM() const {
+    char header[32];
+    int len = snprintf(header, sizeof(header), "P4\n%d %d\n", MONO_FB_WIDTH, MONO_FB_HEIGHT);
+    std::string out(header, len);
+    for(int y=0; y<MONO_FB_HEIGHT; y++) {
+        for(int x=0; x<MONO_FB_WIDTH; x+=8) {
+            uint8_t bits = 0;
+            for(int i=0; i<8; i++) {
+                if (getPixel(x + i, y))
+                    bits |= 0x80 >> i;
+            }
+            out += (char)bits;
+        }
+    }
+    return out;
+}
+
+bool SoftPanel::writePBM(const char* path) const {
+    FILE* fp = fopen(path, "wb");
+    if (fp == NULL)
+        return false;
+    std::string pbm = toPBM();
+    bool ret = fwrite(pbm.data(), 1, pbm.size(), fp) == pbm.size();
+    fclose(fp);
+    return ret;
+}
@@ -0,0 +1,36 @@
+/**
+ * ソフトウェアのOLEDパネル
+ *
+ * 転送された内容をメモリ上の128x64の画像に反映し、PBM(P4)で出力します。
+ * dumpDirを指定すると転送毎にframe_00001.pbm, frame_00002.pbm, ...を書き出します。
+ * ESP-IDFのAPIは使わないので、PC上で画面の確認や比較に使えます (tools/oled_sim.cpp)。
+*/
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include "mono_framebuffer.hpp"
+#include "oled_panel.hpp"
+
+class SoftPanel : public OledPanel {
+    public:
+        SoftPanel();
+
+    public:
+        void drawPage(int page, int x1, int x2, const uint8_t* data) override;
+        void endFrame() override;
+
+        void setDumpDir(const char* dir) { m_dumpDir = dir != NULL ? dir : ""; }
+        bool getPixel(int x, int y) const { return (m_buf[(y >> 3) * MONO_FB_WIDTH + x] & (1 << (y & 7))) != 0; }
+        std::string toPBM() const;                  // 点灯=1(黒)
+        bool writePBM(const char* path) const;
+        uint32_t getFrames() { return m_frames; }   // 転送のあった描画の回数
+        uint32_t getBytes() { return m_bytes; }     // 直近の描画で転送されたバイト数
+
+    private:
+        uint8_t m_buf[MONO_FB_WIDTH * MONO_FB_PAGES];   // パネルのGDDRAMと同じ形式
+        std::string m_dumpDir;
+        uint32_t m_frames;
+        uint32_t m_bytes;
+        uint32_t m_frameBytes;      // 描画中の転送バイト数
+};
@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <atomic>
+#include "storage.hpp"
+
+// I/O統計
+static std::atomic<uint64_t> s_reads(0);
+static std::atomic<uint64_t> s_writes(0);
+static std::atomic<uint64_t> s_readBytes(0);
+static std::atomic<uint64_t> s_writeBytes(0);
+
+// POSIXファイルディスクリプタによるファイル
+class PosixStorageFile : public StorageFile {
+    public:
+        PosixStorageFile(int fd, Storage* owner, const char* path) : m_fd(fd), m_owner(owner) {
+            if (m_owner != NULL)
+                m_path = path;
+        }
+        ~PosixStorageFile() { close(); }
+
+    public:
+        int read(void* buf, size_t len) override {
+            return countRead(::read(m_fd, buf, len));
+        }
+        int write(const void* buf, size_t len) override {
+            int ret = ::write(m_fd, buf, len);
+            s_writes++;
+            if (ret > 0)
+                s_writeBytes += ret;
+            return ret;
+        }
+        int pread(void* buf, size_t len, off_t offset) override {
+            return countRead(::pread(m_fd, buf, len, offset));
+        }
+        bool seek(off_t offset, int whence) override {
+            return lseek(m_fd, offset, whence) >= 0;
+        }
+        off_t tell() override {
+            return lseek(m_fd, 0, SEEK_CUR);
+        }
+        off_t size() override {
+            struct stat st;
+            return fstat(m_fd, &st) == 0 ? st.st_size : -1;
+        }
+        bool flush() override {
+            return fsync(m_fd) == 0;
+        }
+        bool close() override {
+            if (m_fd < 0)
+                return true;
+            int ret = ::close(m_fd);
+            m_fd = -1;
+            // 書き込み用に開いたファイルはサイズ等が変わるので通知
+            if (m_owner != NULL)
+                m_owner->notifyChange(m_path.c_str());
+            return ret == 0;
+        }
+
+    private:
+        static int countRead(int ret) {
+            s_reads++;
+            if (ret > 0)
+                s_readBytes += ret;
+            return ret;
+        }
+
+    private:
+        int m_fd;
+        Storage* m_owner;       // 変更通知先 (読み込み専用はNULL)
+        std::string m_path;
+};
+
+// I/O統計取得
+void Storage::getIoStats(StorageIoStats* stats) {
+    stats->reads = s_reads;
+    stats->writes = s_writes;
+    stats->readBytes = s_readBytes;
+    stats->writeBytes = s_writeBytes;
+}
+
+void Storage::resetIoStats() {
+    s_reads = 0;
+    s_writes = 0;
+    s_readBytes = 0;
+    s_writeBytes = 0;
+}
+
+// 変更通知先を登録
+void Storage::addChangeListener(CallbackStorageChangeFunction callback, void* context) {
+    m_changeListeners.push_back({ callback, context });
+}
+
+void Storage::notifyChange(const char* path) {
+    for(auto& listener : m_changeListeners)
+        listener.callback(path, listener.context);
+}
+
+// ファイル全体の読み込み
+bool Storage::readAll(const char* path, std::string& data) {
+    data.clear();
+    StorageFile* file = open(path, "r");
+    if (file == NULL)
+        return false;
+    off_t size = file->size();
+    bool ret = true;
+    if (size > 0) {
+        data.resize(size);
+        size_t pos = 0;
+        while(pos < (size_t)size) {
+            int len = file->read(&data[pos], size - pos);
+            if (len <= 0) {
+                ret = len == 0;
+                break;
+            }
+            pos += len;
+        }
+        data.resize(pos);
+    }
+    file->close();
+    delete file;
+    return ret;
+}
+
+// ファイル全体の書き込み
+bool Storage::writeAll(const char* path, const void* data, size_t len) {
+    StorageFile* file = open(path, "w");
+    if (file == NULL)
+        return false;
+    const uint8_t* p = (const uint8_t*)data;
+    bool ret = true;
+    while(len > 0) {
+        int n = file->write(p, len);
+        if (n <= 0) {
+            ret = false;
+            break;
+        }
+        p += n;
+        len -= n;
+    }
+    if (!file->close())
+        ret = false;
+    delete file;
+    return ret;
+}
+
+PosixStorage::PosixStorage() {
+    m_isReady = false;
+}
+
+void PosixStorage::init(const char* root) {
+    m_root = root;
+    m_isReady = true;
+}
+
+StorageFile* PosixStorage::open(const char* path, const char* mode) {
+    if (!m_isReady)
+        return NULL;
+    // fopenのmodeをopenのフラグに変換
+    int flags;
+    bool plus = strchr(mode, '+') != NULL;
+    switch(mode[0]) {
+        case 'r':
+            flags = plus ? O_RDWR : O_RDONLY;
+            break;
+        case 'w':
+            flags = (plus ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC;
+            break;
+        case 'a':
+            flags = (plus ? O_RDWR : O_WRONLY) | O_CREAT | O_APPEND;
+            break;
+        default:
+            errno = EINVAL;
+            return NULL;
+    }
+    int fd = ::open(makePath(path).c_str(), flags, 0666);
+    if (fd < 0)
+        return NULL;
+    bool isWrite = (flags & O_ACCMODE) != O_RDONLY;
+    if (isWrite)
+        notifyChange(path);     // 作成/切り詰め
+    return new PosixStorageFile(fd, isWrite ? this : NULL, path);
+}
+
+bool PosixStorage::stat(const char* path, StorageStat* st) {
+    if (!m_isReady)
+        return false;
+    struct stat s;
+    if (::stat(makePath(path).c_str(), &s) != 0)
+        return false;
+    st->isDir = S_ISDIR(s.st_mode);
+    st->size = s.st_size;
+    st->mtime = s.st_mtime;
+    return true;
+}
+
+bool PosixStorage::remove(const char* path) {
+    if (!m_isReady || unlink(makePath(path).c_str()) != 0)
+        return false;
+    notifyChange(path);
+    return true;
+}
+
+// 名前変更
+// FATは変更先が存在すると失敗するので、変更先を"<変更先>.bak"に退避してから変更し、最後に退避したファイルを削除する。
+// 変更に失敗した場合は退避したファイルを元に戻すので、途中で失敗しても変更先が失われない。
+bool PosixStorage::rename(const char* from, const char* to) {
+    if (!m_isReady)
+        return false;
+    std::string dst = makePath(to);
+    std::string bak = dst + ".bak";
+    struct stat s;
+    bool isBackup = false;
+    if (::stat(dst.c_str(), &s) == 0 && !S_ISDIR(s.st_mode)) {
+        unlink(bak.c_str());
+        if (::rename(dst.c_str(), bak.c_str()) != 0)
+            return false;
+        isBackup = true;
+    }
+    if (::rename(makePath(from).c_str(), dst.c_str()) != 0) {
+        if (isBackup)
+            ::rename(bak.c_str(), dst.c_str());
+        return false;
+    }
+    if (isBackup)
+        unlink(bak.c_str());
+    notifyChange(from);
+    notifyChange(to);
+    return true;
+}
+
+bool PosixStorage::mkdir(const char* path) {
+    if (!m_isReady)
+        return false;
+    if (::mkdir(makePath(path).c_str(), 0777) == 0) {
+        notifyChange(path);
+        return true;
+    }
+    return errno == EEXIST;
+}
+
+// ディレクトリ内のエントリを列挙 (callbackがfalseを返すと中断)
+bool PosixStorage::listDir(const char* path, CallbackDirEntryFunction callback, void* context) {
+    if (!m_isReady)
+        return false;
+    std::string dirPath = makePath(path);
+    DIR* dir = opendir(dirPath.c_str());
+    if (dir == NULL)
+        return false;
+    if (dirPath.empty() || dirPath.back() != '/')
+        dirPath += '/';
+    struct dirent* entry;
+    while((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        StorageDirEntry e = {
+            .name = entry->d_name,
+            .isDir = entry->d_type == DT_DIR,
+            .size = 0,
+            .mtime = 0
+        };
+        struct stat s;
+        if (::stat((dirPath + entry->d_name).c_str(), &s) == 0) {
+            e.isDir = S_ISDIR(s.st_mode);
+            e.size = s.st_size;
+            e.mtime = s.st_mtime;
+        }
+        if (callback(&e, context) == false)
+            break;
+    }
+    closedir(dir);
+    return true;
+}
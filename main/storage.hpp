@@ -0,0 +1,122 @@
+/**
+ * ストレージ
+ *
+ * ファイル入出力のインターフェースです。SDカード、保存データ、Webサーバーは全てこのインターフェース経由でファイルにアクセスします。
+ * パスはストレージのルートからの相対パス("/config", "/document/index.html" など)で指定します。
+ *
+ * PosixStorageはPOSIXのファイルAPIで実装したバックエンドで、
+ * ESP-IDFのVFS(SDカードのFATマウント)とホスト(Linux等)のディレクトリのどちらでも動作します。
+ * (ESP-IDFに依存しないため、ホストでのI/O性能測定にそのまま使用できます)
+*/
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+#include <iostream>
+#include <vector>
+
+// ファイル/ディレクトリ情報
+struct StorageStat {
+    bool isDir;
+    off_t size;
+    time_t mtime;
+};
+
+// ディレクトリエントリ
+struct StorageDirEntry {
+    const char* name;
+    bool isDir;
+    off_t size;
+    time_t mtime;
+};
+
+// 実際にファイルシステムに対して発行したread/writeの回数とバイト数 (性能測定用)
+struct StorageIoStats {
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t readBytes;
+    uint64_t writeBytes;
+};
+
+typedef bool (*CallbackDirEntryFunction)(const StorageDirEntry* entry, void* context);
+typedef void (*CallbackStorageChangeFunction)(const char* path, void* context);
+
+// オープン中のファイル (close()後にdeleteすること)
+class StorageFile {
+    public:
+        virtual ~StorageFile() {}
+
+    public:
+        virtual int read(void* buf, size_t len) = 0;                    // 読み込みバイト数を返す(エラー時は-1)
+        virtual int write(const void* buf, size_t len) = 0;             // 書き込みバイト数を返す(エラー時は-1)
+        virtual int pread(void* buf, size_t len, off_t offset) = 0;     // 位置指定読み込み (ファイル位置は変化しない)
+        virtual bool seek(off_t offset, int whence) = 0;
+        virtual off_t tell() = 0;
+        virtual off_t size() = 0;
+        virtual bool flush() = 0;
+        virtual bool close() = 0;
+};
+
+class Storage {
+    public:
+        virtual ~Storage() {}
+
+    public:
+        virtual bool isReady() = 0;     // アクセス可能か (SDカードの場合はマウント中)
+        virtual const char* root() = 0; // ルートパス
+        // mode は fopen と同様 ("r", "w", "a", "r+" 等。"b"は無視)
+        virtual StorageFile* open(const char* path, const char* mode) = 0;
+        virtual bool stat(const char* path, StorageStat* st) = 0;
+        virtual bool remove(const char* path) = 0;
+        virtual bool rename(const char* from, const char* to) = 0;
+        virtual bool mkdir(const char* path) = 0;
+        virtual bool listDir(const char* path, CallbackDirEntryFunction callback, void* context) = 0;
+
+        // ファイル全体の読み込み/書き込み
+        bool readAll(const char* path, std::string& data);
+        bool writeAll(const char* path, const void* data, size_t len);
+
+        // I/O統計 (全ストレージ共通)
+        static void getIoStats(StorageIoStats* stats);
+        static void resetIoStats();
+
+        // 変更通知 (ファイルの作成/書き込み/削除/名前変更、ディレクトリ作成時に変更したパスで呼ばれる)
+        // 登録はアクセス開始前に行うこと
+        void addChangeListener(CallbackStorageChangeFunction callback, void* context);
+        void notifyChange(const char* path);
+
+    private:
+        struct ChangeListener {
+            CallbackStorageChangeFunction callback;
+            void* context;
+        };
+        std::vector<ChangeListener> m_changeListeners;
+};
+
+// POSIXファイルAPIによる実装
+class PosixStorage : public Storage {
+    public:
+        PosixStorage();
+
+    public:
+        void init(const char* root);
+        void setReady(bool isReady) { m_isReady = isReady; }
+
+        bool isReady() override { return m_isReady; }
+        const char* root() override { return m_root.c_str(); }
+        StorageFile* open(const char* path, const char* mode) override;
+        bool stat(const char* path, StorageStat* st) override;
+        bool remove(const char* path) override;
+        bool rename(const char* from, const char* to) override;
+        bool mkdir(const char* path) override;
+        bool listDir(const char* path, CallbackDirEntryFunction callback, void* context) override;
+
+    protected:
+        std::string makePath(const char* path) { return m_root + path; }
+
+    private:
+        std::string m_root;     // ルートパス (SDカードの場合はマウント先)
+        bool m_isReady;
+};
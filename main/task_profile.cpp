@@ -0,0 +1,188 @@
+#include <string.h>
+#include <mutex>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "task_profile.hpp"
+
+#define TAG "TaskProfile"
+
+const TaskProfile TASK_PROFILE_SYSTEM = { "System", CONFIG_TASK_SYSTEM_STACK, CONFIG_TASK_SYSTEM_PRIORITY, CONFIG_TASK_SYSTEM_CORE };
+const TaskProfile TASK_PROFILE_IO = { "IO", CONFIG_TASK_IO_STACK, CONFIG_TASK_IO_PRIORITY, CONFIG_TASK_IO_CORE };
+const TaskProfile TASK_PROFILE_DISPLAY = { "Display", CONFIG_TASK_DISPLAY_STACK, CONFIG_TASK_DISPLAY_PRIORITY, CONFIG_TASK_DISPLAY_CORE };
+const TaskProfile TASK_PROFILE_LVGL = { "LVGL task", CONFIG_TASK_LVGL_STACK, CONFIG_TASK_LVGL_PRIORITY, CONFIG_TASK_LVGL_CORE };
+const TaskProfile TASK_PROFILE_HTTPD = { "httpd", CONFIG_TASK_HTTPD_STACK, CONFIG_TASK_HTTPD_PRIORITY, CONFIG_TASK_HTTPD_CORE };
+const TaskProfile TASK_PROFILE_WEB_ASYNC = { "WebAsync", CONFIG_TASK_WEB_ASYNC_STACK, CONFIG_TASK_WEB_ASYNC_PRIORITY, CONFIG_TASK_WEB_ASYNC_CORE };
+const TaskProfile TASK_PROFILE_LOGSINK = { "LogSink", CONFIG_TASK_LOGSINK_STACK, CONFIG_TASK_LOGSINK_PRIORITY, CONFIG_TASK_LOGSINK_CORE };
+const TaskProfile TASK_PROFILE_DATALOG = { "DataLogger", CONFIG_TASK_DATALOG_STACK, CONFIG_TASK_DATALOG_PRIORITY, CONFIG_TASK_DATALOG_CORE };
+const TaskProfile TASK_PROFILE_FILE_WRITER = { "BufferedFile", CONFIG_TASK_FILE_WRITER_STACK, CONFIG_TASK_FILE_WRITER_PRIORITY, CONFIG_TASK_FILE_WRITER_CORE };
+
+static const TaskProfile* const s_profiles[] = {
+    &TASK_PROFILE_SYSTEM,
+    &TASK_PROFILE_IO,
+    &TASK_PROFILE_DISPLAY,
+    &TASK_PROFILE_LVGL,
+    &TASK_PROFILE_HTTPD,
+    &TASK_PROFILE_WEB_ASYNC,
+    &TASK_PROFILE_LOGSINK,
+    &TASK_PROFILE_DATALOG,
+    &TASK_PROFILE_FILE_WRITER,
+};
+#define PROFILE_COUNT   (int)(sizeof(s_profiles) / sizeof(s_profiles[0]))
+
+BaseType_t TaskProfile::affinity() const {
+    if (core < 0 || core >= portNUM_PROCESSORS)
+        return tskNO_AFFINITY;  // シングルコアでは1を指定しても固定しない
+    return core;
+}
+
+BaseType_t TaskProfile::create(TaskFunction_t func, void* arg, TaskHandle_t* handle) const {
+    BaseType_t ret = xTaskCreatePinnedToCore(func, name, stackSize, arg, priority, handle, affinity());
+    if (ret != pdPASS)
+        ESP_LOGE(TAG, "%s : create failed (stack %lu)", name, (unsigned long)stackSize);
+    return ret;
+}
+
+const TaskProfile* TaskProfile::find(const char* name) {
+    for(int i=0; i<PROFILE_COUNT; i++) {
+        if (strcmp(s_profiles[i]->name, name) == 0)
+            return s_profiles[i];
+    }
+    return NULL;
+}
+
+bool TaskMonitor::hasRunTime() {
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY && CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    return true;
+#else
+    return false;
+#endif
+}
+
+// 実行時間の基準
+struct TaskBaseline {
+    int64_t time;           // 記録した時刻(us、0は未記録)
+    uint32_t totalRunTime;  // 全体の経過時間のカウンタ
+    int count;
+    TaskHandle_t handles[TASK_BASELINE_TASKS];
+    uint32_t nameHashes[TASK_BASELINE_TASKS];   // ハンドルの再利用の検出用
+    uint32_t runTimes[TASK_BASELINE_TASKS];
+};
+static TaskBaseline s_baselines[TASK_BASELINE_COUNT];
+static int s_baselineNext = 0;      // 次に記録する位置
+static std::mutex s_baselineMutex;
+
+// タスク名のハッシュ (FNV-1a)
+static uint32_t nameHash(const char* name) {
+    uint32_t hash = 2166136261u;
+    for(; *name != '\0'; name++)
+        hash = (hash ^ (uint8_t)*name) * 16777619u;
+    return hash;
+}
+
+void TaskMonitor::sample() {
+    if (!hasRunTime())
+        return;
+    TaskInfo* tasks = new TaskInfo[TASK_BASELINE_TASKS];
+    uint32_t total;
+    int count = getTasks(tasks, TASK_BASELINE_TASKS, &total);
+    int64_t now = esp_timer_get_time();
+    {
+        std::lock_guard<std::mutex> lock(s_baselineMutex);
+        TaskBaseline& base = s_baselines[s_baselineNext];
+        s_baselineNext = (s_baselineNext + 1) % TASK_BASELINE_COUNT;
+        base.time = now;
+        base.totalRunTime = total;
+        base.count = count;
+        for(int i=0; i<count; i++) {
+            base.handles[i] = tasks[i].handle;
+            base.nameHashes[i] = nameHash(tasks[i].name);
+            base.runTimes[i] = tasks[i].runTime;
+        }
+    }
+    delete[] tasks;
+}
+
+int TaskMonitor::since(int intervalMs, TaskInfo* tasks, int count, uint32_t* totalRunTime) {
+    int64_t now = esp_timer_get_time();
+    std::lock_guard<std::mutex> lock(s_baselineMutex);
+    // 新しい順に探す
+    const TaskBaseline* base = NULL;
+    for(int i=1; i<=TASK_BASELINE_COUNT; i++) {
+        const TaskBaseline& b = s_baselines[(s_baselineNext - i + TASK_BASELINE_COUNT) % TASK_BASELINE_COUNT];
+        if (b.time == 0)
+            break;
+        base = &b;
+        if (now - b.time >= (int64_t)intervalMs * 1000)
+            break;
+    }
+    if (base == NULL)
+        return -1;
+    // カウンタは32bitで一周するので、差は常にmod 2^32で求める (基準との間に1回までの一周は正しく求まる)
+    *totalRunTime -= base->totalRunTime;
+    for(int i=0; i<count; i++) {
+        uint32_t prev = 0;  // 基準の後に作成されたタスクは0から
+        uint32_t hash = nameHash(tasks[i].name);
+        for(int j=0; j<base->count; j++) {
+            // 削除されたタスクのハンドルが別のタスクに再利用された場合は名前が異なるので0から
+            if (base->handles[j] == tasks[i].handle && base->nameHashes[j] == hash) {
+                prev = base->runTimes[j];
+                break;
+            }
+        }
+        uint32_t delta = tasks[i].runTime - prev;
+        // 同じ名前で作り直されたタスク (全体の経過時間より長く動いたことになる) も0から
+        if (delta > *totalRunTime)
+            delta = tasks[i].runTime;
+        tasks[i].runTime = delta;
+    }
+    return (int)((now - base->time) / 1000);
+}
+
+static int taskCore(TaskHandle_t handle) {
+    BaseType_t core = xTaskGetAffinity(handle);
+    return core == tskNO_AFFINITY ? -1 : (int)core;
+}
+
+int TaskMonitor::getTasks(TaskInfo* tasks, int max, uint32_t* totalRunTime) {
+    *totalRunTime = 0;
+    int count = 0;
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+    // 全タスク (取得中に増えた分は取れないので少し多めに確保)
+    UBaseType_t size = uxTaskGetNumberOfTasks() + 4;
+    TaskStatus_t* status = new TaskStatus_t[size];
+    UBaseType_t n = uxTaskGetSystemState(status, size, totalRunTime);
+    for(UBaseType_t i=0; i<n && count<max; i++) {
+        TaskInfo& info = tasks[count++];
+        info.handle = status[i].xHandle;
+        strncpy(info.name, status[i].pcTaskName, sizeof(info.name) - 1);
+        info.name[sizeof(info.name) - 1] = '\0';
+        info.priority = status[i].uxCurrentPriority;
+        info.core = taskCore(status[i].xHandle);
+        info.stackFreeMin = status[i].usStackHighWaterMark;
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+        info.runTime = status[i].ulRunTimeCounter;
+#else
+        info.runTime = 0;
+#endif
+        info.profile = TaskProfile::find(info.name);
+    }
+    delete[] status;
+#else
+    // 設定のあるタスクのみ (名前で探す)
+    for(int i=0; i<PROFILE_COUNT && count<max; i++) {
+        TaskHandle_t handle = xTaskGetHandle(s_profiles[i]->name);
+        if (handle == NULL)
+            continue;   // 未作成 (Webサーバー停止中など)
+        TaskInfo& info = tasks[count++];
+        info.handle = handle;
+        strncpy(info.name, s_profiles[i]->name, sizeof(info.name) - 1);
+        info.name[sizeof(info.name) - 1] = '\0';
+        info.priority = uxTaskPriorityGet(handle);
+        info.core = taskCore(handle);
+        info.stackFreeMin = uxTaskGetStackHighWaterMark(handle);
+        info.runTime = 0;
+        info.profile = s_profiles[i];
+    }
+#endif
+    return count;
+}
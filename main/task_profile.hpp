@@ -0,0 +1,66 @@
+/**
+ * タスクのスケジューリング設定と実行状況
+ *
+ * 各サブシステムのタスクの優先度、コア、スタックの大きさはKconfig(Task scheduling)で設定します。
+ * TaskProfile::create()は設定のとおりにタスクを作成します (coreが-1、またはシングルコアの場合はコアを固定しない)。
+ * TaskMonitor::getTasks()は全タスクのスタックの最小空き(ハイウォーターマーク)と実行時間を取得します。
+ *  CONFIG_FREERTOS_USE_TRACE_FACILITYが無効の場合は設定のあるタスクのみ
+ *  実行時間はCONFIG_FREERTOS_GENERATE_RUN_TIME_STATSが有効の場合のみ
+ * TaskMonitor::sample()をTASK_SAMPLE_MS毎に呼ぶと実行時間の基準を記録し、
+ * TaskMonitor::since()で待たずに直近の一定時間のCPU使用率を求められます。
+*/
+#pragma once
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define TASK_SAMPLE_MS          1000    // TaskMonitor::sample()を呼ぶ間隔
+#define TASK_BASELINE_COUNT     6       // 保持する実行時間の基準の数 (TASK_SAMPLE_MS毎)
+#define TASK_BASELINE_TASKS     48      // 1つの基準に記録するタスク数の上限
+
+// 設定
+struct TaskProfile {
+    const char* name;       // タスク名 (ESP-IDFのコンポーネントが作成するタスクはその名前)
+    uint32_t stackSize;     // byte
+    UBaseType_t priority;
+    int core;               // -1はコアを固定しない
+
+    BaseType_t affinity() const;    // xTaskCreatePinnedToCore()のコア (tskNO_AFFINITYを含む)
+    BaseType_t create(TaskFunction_t func, void* arg, TaskHandle_t* handle) const;
+    static const TaskProfile* find(const char* name);
+};
+
+extern const TaskProfile TASK_PROFILE_SYSTEM;       // システムの実行タスク (アプリケーション、Wi-Fi)
+extern const TaskProfile TASK_PROFILE_IO;           // I/Oの実行タスク (SDカード、Webサーバー、I/Oのジョブ)
+extern const TaskProfile TASK_PROFILE_DISPLAY;      // ディスプレイの実行タスク
+extern const TaskProfile TASK_PROFILE_LVGL;         // esp_lvgl_portのタスク
+extern const TaskProfile TASK_PROFILE_HTTPD;        // esp_http_serverのタスク
+extern const TaskProfile TASK_PROFILE_WEB_ASYNC;    // Webサーバーのワーカータスク (ESP-IDF 5.2以降のみ)
+extern const TaskProfile TASK_PROFILE_LOGSINK;      // ログ出力
+extern const TaskProfile TASK_PROFILE_DATALOG;      // データロガーのライタ
+extern const TaskProfile TASK_PROFILE_FILE_WRITER;  // BufferedFileの書き込みと先読み
+
+// 実行状況
+struct TaskInfo {
+    TaskHandle_t handle;
+    char name[configMAX_TASK_NAME_LEN];
+    UBaseType_t priority;   // 現在の優先度
+    int core;               // -1はコアを固定しない
+    uint32_t stackFreeMin;  // スタックの最小空き(byte)
+    uint32_t runTime;       // 実行時間 (run time statsのカウンタ。無効の場合は0)
+                            //  起動からの累計の下位32bitで、esp_timer(1MHz)では約71分で一周する
+    const TaskProfile* profile; // 設定 (設定の無いタスクはNULL)
+};
+
+class TaskMonitor {
+    public:
+        // 最大max個のタスクの実行状況 (戻り値はタスク数。totalRunTimeは全体の経過時間のカウンタ)
+        static int getTasks(TaskInfo* tasks, int max, uint32_t* totalRunTime);
+        static bool hasRunTime();   // 実行時間を取得できる
+        static void sample();       // 現在の実行時間を基準として記録 (TASK_SAMPLE_MS毎に呼ぶ)
+        // getTasks()の結果を、intervalMs以上前の最新の基準(無ければ最も古い基準)からの差に置き換えます。
+        // 戻り値は基準からの経過時間(ms)。基準が無い場合は-1で、tasksとtotalRunTimeは変更しません。
+        // 差はmod 2^32で求めるので、基準(最大でTASK_BASELINE_COUNT x TASK_SAMPLE_MS前)の後のカウンタの一周は問題ありません。
+        static int since(int intervalMs, TaskInfo* tasks, int count, uint32_t* totalRunTime);
+};
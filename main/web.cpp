@@ -1,105 +1,135 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <unistd.h>
 #include <regex>
+#include <algorithm>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
 #include "esp_http_server.h"
+#include "esp_heap_caps.h"
 #include "esp_log.h"
 
 #include "web.hpp"
+#include "buffered_file.hpp"
+#include "bin_log.hpp"
 
 #define TAG "Web"
 
-// メッセージ種別 (メッセージキュー用)
-enum class WebMessage {
-    Init,       // 初期化
-    Start,      // 開始
-    Stop,       // 停止
-    WebSocketSend,       // WebSocket送信
-    Quit        // 終了
+#define WEB_SEND_CHUNK  4096    // 静的ファイルの送信単位 (httpd_resp_send_chunk 1回分)
+
+// ワーカータスクへの要求
+struct WebAsyncJob {
+    httpd_req_t* req;       // httpd_req_async_handler_begin()で複製したリクエスト
+    CallbackWebAPIFunction callback;
+    void* context;
 };
 
-WebServer::WebServer() {
+WebServer::WebServer() : Actor(TAG) {
     clear();
 }
 
 void WebServer::clear() {
-    m_xHandle = NULL;
-    m_xQueue = NULL;
+    for(int i=0; i<CONFIG_TASK_WEB_ASYNC_COUNT; i++)
+        m_xAsyncHandles[i] = NULL;
+    m_xAsyncQueue = NULL;
     m_server = NULL;
+    m_storage = NULL;
+    m_fileCache = NULL;
     for(int i=0; i<m_apiCallbacks.size(); i++) {
         delete (ST_API_CALLBACK_DATA*)m_apiCallbacks[i];
     }
     m_apiCallbacks.clear();
+    for(auto pSession : m_webSocketSessions)
+        delete pSession;
     m_webSocketSessions.clear();
+    m_webSocketClients = 0;
     while(!m_webSocketSendMessages.empty()) {
-        delete[] m_webSocketSendMessages.top();
+        delete[] m_webSocketSendMessages.front();
         m_webSocketSendMessages.pop();
     }
     m_webSocketCallback = NULL;
     m_webSocketCallbackContext = NULL;
+    m_requestCount = 0;
 }
 
 void WebServer::init() {
     ESP_LOGI(TAG, "Init(S)");
 
-    // タスク作成
-    xTaskCreate(WebServer::task, TAG, configMINIMAL_STACK_SIZE * 2, (void*)this, tskIDLE_PRIORITY, &m_xHandle);
-
-    // メッセージキューの初期化
-    m_xQueue = xQueueCreate(10, sizeof(WebMessage));
-
     // 初期化用メッセージポスト
-    WebMessage msg = WebMessage::Init;
-    xQueueSend(m_xQueue, &msg, portMAX_DELAY);
+    post(WebMessage::Init);
+
+#if WEB_ASYNC_HANDLER
+    // ワーカータスク作成 (全ワーカーが1つのキューから取り出す)
+    m_xAsyncQueue = xQueueCreate(4, sizeof(WebAsyncJob));
+    for(int i=0; i<CONFIG_TASK_WEB_ASYNC_COUNT; i++)
+        TASK_PROFILE_WEB_ASYNC.create(WebServer::async_task, (void*)this, &m_xAsyncHandles[i]);
+#endif
 
     ESP_LOGI(TAG, "Init(E)");
 }
 
-void WebServer::start(const char* ipAddress, const char* root) {
+void WebServer::start(const char* ipAddress, Storage* storage, FileCache* fileCache) {
     m_ipAddress = ipAddress;
-    m_root = root;
-    WebMessage msg = WebMessage::Start;
-    xQueueSend(m_xQueue, &msg, portMAX_DELAY);
+    m_storage = storage;
+    m_fileCache = fileCache;
+    post(WebMessage::Start);
 }
 
 void WebServer::stop() {
-    WebMessage msg = WebMessage::Stop;
-    xQueueSend(m_xQueue, &msg, portMAX_DELAY);
+    post(WebMessage::Stop);
+}
+
+// メッセージ処理
+void WebServer::onMessage(WebMessage& msg) {
+    switch(msg) {
+        case WebMessage::Init:          // 初期化
+            webInit();
+            break;
+        case WebMessage::Start:         // 開始
+            webStart();
+            break;
+        case WebMessage::Stop:          // 停止
+            webStop();
+            break;
+        case WebMessage::WebSocketSend: // WebSocket送信
+            webSocketSend();
+            break;
+        case WebMessage::Quit:          // 終了
+            webStop();
+            clear();
+            detach();
+            break;
+    }
 }
 
-// タスク
-void WebServer::task(void* arg) {
+// ワーカータスク
+void WebServer::async_task(void* arg) {
     WebServer* pThis = (WebServer*)arg;
-    WebMessage msg;
-    bool loop = true;
-    while(loop) {
-        // メツセージキュー読み取り
-        if (pThis->m_xQueue != NULL && xQueueReceive(pThis->m_xQueue, (void*)&msg, portMAX_DELAY) == pdTRUE) {
-            switch(msg) {
-                case WebMessage::Init:          // 初期化
-                    pThis->webInit();
-                    break;
-                case WebMessage::Start:         // 開始
-                    pThis->webStart();
-                    break;
-                case WebMessage::Stop:          // 停止
-                    pThis->webStop();
-                    break;
-                case WebMessage::WebSocketSend: // WebSocket送信
-                    pThis->webSocketSend();
-                    break;
-                case WebMessage::Quit:          // 終了
-                    loop = false;
-                    break;
-            }
+    WebAsyncJob job;
+    while(true) {
+        if (xQueueReceive(pThis->m_xAsyncQueue, (void*)&job, portMAX_DELAY) == pdTRUE) {
+            job.callback(job.req, job.context);
+#if WEB_ASYNC_HANDLER
+            httpd_req_async_handler_complete(job.req);
+#endif
         }
     }
-    // 終了処理
-    pThis->stop();
-    pThis->clear();
-    vTaskDelete(NULL);
+}
+
+// リクエストを複製してワーカータスクに渡す (空きが無ければfalseで、呼び出し側で同期実行する)
+bool WebServer::startAsync(WebServer* pThis, httpd_req_t *req, CallbackWebAPIFunction callback, void* context) {
+#if WEB_ASYNC_HANDLER
+    WebAsyncJob job = { NULL, callback, context };
+    if (httpd_req_async_handler_begin(req, &job.req) == ESP_OK) {
+        if (xQueueSend(pThis->m_xAsyncQueue, &job, 0) == pdTRUE)
+            return true;
+        httpd_req_async_handler_complete(job.req);
+    }
+#endif
+    return false;
 }
 
 void WebServer::webInit() {
@@ -108,28 +138,33 @@ void WebServer::webInit() {
 // GET "/API" ハンドラ
 esp_err_t WebServer::get_api(httpd_req_t *req) {
     WebServer* pThis = (WebServer*)req->user_ctx;
-    ESP_LOGI(TAG, "request uri : %s", req->uri);
+    pThis->m_requestCount++;
+    BLOGI(TAG, "request uri : %s", req->uri);
     // コールバックを検索/実行
     bool isCall = false;
     std::string path = req->uri;
     std::regex pattern(R"(^.*/API/)");
-    std::regex pattern2(R"(&.*)");
+    std::regex pattern2(R"([&?].*)");
     path = std::regex_replace(path, pattern, "");
     path = std::regex_replace(path, pattern2, "");
-    ESP_LOGI(TAG, "API request path=%s", path.c_str());
+    BLOGI(TAG, "API request path=%s", path.c_str());
     for(int i=0; i<pThis->m_apiCallbacks.size(); i++) {
         ST_API_CALLBACK_DATA* v = pThis->m_apiCallbacks[i];
         if (v != NULL) {
-            if (req->method == v->method && path == v->path) {
-                ESP_LOGI(TAG, "API Call path=%s", v->path.c_str());
-                v->callback(req, v->context);
+            bool isMatch = v->path.back() == '*' ?
+                path.compare(0, v->path.size() - 1, v->path, 0, v->path.size() - 1) == 0 : path == v->path;
+            if (req->method == v->method && isMatch) {
+                BLOGI(TAG, "API Call path=%s", v->path.c_str());
                 isCall = true;
+                if (v->isAsync && startAsync(pThis, req, v->callback, v->context))
+                    break;
+                v->callback(req, v->context);
                 break;
             }
         }
     }
     if (isCall == false) {
-        ESP_LOGI(TAG, "API NOT FOUND");
+        BLOGI(TAG, "API NOT FOUND");
         httpd_resp_send_404(req);
     }
     return ESP_OK;
@@ -166,34 +201,56 @@ esp_err_t WebServer::get_api_patch(httpd_req_t *req) {
 // GET "/*" ハンドラ
 esp_err_t WebServer::get_root(httpd_req_t *req) {
     WebServer* pThis = (WebServer*)req->user_ctx;
-    std::string contentType = pThis->getContentType(req->uri);
+    pThis->m_requestCount++;
+    // ワーカータスクで送信し、httpdタスクは次のリクエストを受け付ける
+    // (ワーカーに空きが無い場合はhttpdタスクで送信。ハンドルの空きは待たない)
+    if (!startAsync(pThis, req, send_file, pThis))
+        pThis->sendFile(req, 0);
+    return ESP_OK;
+}
+
+void WebServer::send_file(httpd_req_t *req, void* context) {
+    ((WebServer*)context)->sendFile(req, CONFIG_FILE_CACHE_WAIT_MS);
+}
+
+// 静的ファイル送信
+// waitMsは全てのハンドルが他のワーカーで使用中の場合に返却を待つ時間
+void WebServer::sendFile(httpd_req_t *req, uint32_t waitMs) {
+    std::string contentType = getContentType(req->uri);
     const char* docRoot = "/document";
-    char* path = (char*)heap_caps_malloc(pThis->m_root.size() + strlen(docRoot) + strlen(req->uri) + strlen("/index.html") + 1, MALLOC_CAP_8BIT);
+    std::string path = docRoot;
+    path += req->uri;
     if (req->uri[strlen(req->uri)-1] == '/') {
-        sprintf(path, "%s%s%sindex.html", pThis->m_root.c_str(), docRoot, req->uri);
+        path += "index.html";
         contentType = "text/html";
-    } else {
-        sprintf(path, "%s%s%s", pThis->m_root.c_str(), docRoot, req->uri);
     }
-    ESP_LOGI(TAG, "request path : %s", path);
+    BLOGI(TAG, "request path : %s", path.c_str());
     
-    FILE* fd = fopen(path, "rb");
-    if (fd != NULL) {
-        char* buffer = new char[1000];
+    // 同じファイルを読む他のリクエストとハンドルを共有し、各自のBufferedFileでクラスタ単位に読み込む
+    StorageFile* file = m_fileCache != NULL ? m_fileCache->acquire(path.c_str(), waitMs) : NULL;
+    if (file != NULL) {
+        // バッファのプールが空の場合は共有ハンドルから直接pread()する
+        StorageFile* buffered = BufferedFile::wrap(file);
+        char* buffer = new char[WEB_SEND_CHUNK];
+        off_t offset = 0;
         int ret;
         httpd_resp_set_type(req, contentType.c_str());
-        while ((ret = fread(buffer, 1, 1000, fd)) > 0) {
-            httpd_resp_send_chunk(req, buffer, ret);
+        while ((ret = buffered != NULL ? buffered->read(buffer, WEB_SEND_CHUNK) : file->pread(buffer, WEB_SEND_CHUNK, offset)) > 0) {
+            if (httpd_resp_send_chunk(req, buffer, ret) != ESP_OK)
+                break;
+            offset += ret;
         }
         httpd_resp_send_chunk(req, NULL, 0);
         delete[] buffer;
-        fclose(fd);
+        if (buffered != NULL) {
+            buffered->close();
+            delete buffered;
+        }
+        m_fileCache->release(file);
     } else {
-        ESP_LOGI(TAG, "NOT FOUND");
+        BLOGI(TAG, "NOT FOUND");
         httpd_resp_send_404(req);
     }
-    heap_caps_free(path);
-    return ESP_OK;
 }
 
 // GET "/ws" WebSocketハンドラ
@@ -204,9 +261,11 @@ esp_err_t WebServer::websocket_callback(httpd_req_t *req) {
         // セッション格納
         ST_WEBSOCKET_SESSION* pSession = new ST_WEBSOCKET_SESSION {
             .isActive = true,
-            .req = req
+            .fd = httpd_req_to_sockfd(req)
         };
+        std::lock_guard<std::mutex> lock(pThis->m_webSocketMutex);
         pThis->m_webSocketSessions.push_back(pSession);
+        pThis->m_webSocketClients = pThis->m_webSocketSessions.size();
 
         ESP_LOGI(TAG, "Handshake done, the new connection was opened");
         return ESP_OK;
@@ -310,11 +369,17 @@ bool WebServer::custom_uri_matcher(const char* reference_uri, const char* uri_to
 }
 
 void WebServer::webStart() {
-    webStop();
+    if (m_server != NULL)
+        return;     // 起動中 (Wi-Fi再接続時はそのまま使用)
     // Webサーバー開始
     httpd_config_t conf = HTTPD_DEFAULT_CONFIG();
     conf.max_uri_handlers = 15;
     conf.uri_match_fn = custom_uri_matcher;
+    conf.task_priority = TASK_PROFILE_HTTPD.priority;
+    conf.stack_size = TASK_PROFILE_HTTPD.stackSize;
+    conf.core_id = TASK_PROFILE_HTTPD.affinity();
+    conf.global_user_ctx = this;
+    conf.close_fn = session_close;
     if (httpd_start(&m_server, &conf) == ESP_OK) {
         // URLマップハンドラ登録 (API)
         httpd_uri_t api = {
@@ -370,39 +435,78 @@ void WebServer::webStop() {
     m_server = NULL;
 }
 
+// 送信データとセッションのfdをロック中に取り出し、送信はロックの外で行う
+// (送信が詰まっても、sendWebSocketや新しい接続の受け付けを止めない)
 void WebServer::webSocketSend() {
-    while(!m_webSocketSendMessages.empty()) {
-        char* data = m_webSocketSendMessages.top();
+    std::queue<char*> messages;
+    std::vector<int> fds;
+    {
+        std::lock_guard<std::mutex> lock(m_webSocketMutex);
+        std::swap(messages, m_webSocketSendMessages);
+        for(auto pSession : m_webSocketSessions) {
+            if (pSession->isActive)
+                fds.push_back(pSession->fd);
+        }
+    }
+    std::vector<int> closed;
+    while(!messages.empty()) {
+        char* data = messages.front();
+        messages.pop();
         httpd_ws_frame_t ws_pkt = {
             .final = true,
             .type = HTTPD_WS_TYPE_TEXT,
             .payload = (uint8_t*)data,
             .len = strlen(data),
         };
-        for(int i=0; i<m_webSocketSessions.size(); i++) {
-            ST_WEBSOCKET_SESSION* pSession = m_webSocketSessions[0];
-            esp_err_t ret = httpd_ws_send_frame(pSession->req, &ws_pkt);
-            if (ret != ESP_OK) {
-                pSession->isActive = false;
+        for(int fd : fds) {
+            if (std::find(closed.begin(), closed.end(), fd) != closed.end())
+                continue;
+            if (m_server == NULL || httpd_ws_get_fd_info(m_server, fd) != HTTPD_WS_CLIENT_WEBSOCKET
+                || httpd_ws_send_frame_async(m_server, fd, &ws_pkt) != ESP_OK) {
+                closed.push_back(fd);   // 切断済み
             }
         }
-        m_webSocketSessions.erase(std::remove_if(m_webSocketSessions.begin(), m_webSocketSessions.end(), [](ST_WEBSOCKET_SESSION* pSession) {
-            bool isDelete = !pSession->isActive;
-            delete pSession;
-            return isDelete;
-        }), m_webSocketSessions.end());
         delete[] data;
-        m_webSocketSendMessages.pop();
     }
+    if (closed.empty())
+        return;
+    // 送信中に同じfdで新しく接続したセッションは残す
+    std::lock_guard<std::mutex> lock(m_webSocketMutex);
+    m_webSocketSessions.erase(std::remove_if(m_webSocketSessions.begin(), m_webSocketSessions.end(), [this, &closed](ST_WEBSOCKET_SESSION* pSession) {
+        if (pSession->isActive && (std::find(closed.begin(), closed.end(), pSession->fd) == closed.end()
+            || (m_server != NULL && httpd_ws_get_fd_info(m_server, pSession->fd) == HTTPD_WS_CLIENT_WEBSOCKET)))
+            return false;
+        delete pSession;
+        return true;
+    }), m_webSocketSessions.end());
+    m_webSocketClients = m_webSocketSessions.size();
+}
+
+// ソケットを閉じる時 (httpdタスク)
+//  WebSocketのセッションを外してクライアント数を更新する (次の送信の失敗を待たない)
+void WebServer::session_close(httpd_handle_t hd, int sockfd) {
+    WebServer* pThis = (WebServer*)httpd_get_global_user_ctx(hd);
+    {
+        std::lock_guard<std::mutex> lock(pThis->m_webSocketMutex);
+        pThis->m_webSocketSessions.erase(std::remove_if(pThis->m_webSocketSessions.begin(), pThis->m_webSocketSessions.end(), [sockfd](ST_WEBSOCKET_SESSION* pSession) {
+            if (pSession->fd != sockfd)
+                return false;
+            delete pSession;
+            return true;
+        }), pThis->m_webSocketSessions.end());
+        pThis->m_webSocketClients = pThis->m_webSocketSessions.size();
+    }
+    close(sockfd);      // close_fnを指定するとhttpdは閉じないので、ここで閉じる
 }
 
 // "/API"のハンドラを登録
-int WebServer::addHandler(httpd_method_t method, const char* path, CallbackWebAPIFunction callback, void* context) {
+int WebServer::addHandler(httpd_method_t method, const char* path, CallbackWebAPIFunction callback, void* context, bool isAsync) {
     ST_API_CALLBACK_DATA* pCallback = new ST_API_CALLBACK_DATA{
         method,
         path,
         callback,
-        context
+        context,
+        isAsync
     };
     m_apiCallbacks.push_back(pCallback);
     return m_apiCallbacks.size() - 1;
@@ -424,9 +528,43 @@ void WebServer::setWebSocketHandler(CallbackWebSocketFunction callback, void* co
 void WebServer::sendWebSocket(const char* data) {
     char* buf = new char[strlen(data) + 1];
     strcpy(buf, data);
-    m_webSocketSendMessages.push(buf);
-    WebMessage msg = WebMessage::WebSocketSend;
-    xQueueSend(m_xQueue, &msg, portMAX_DELAY);
+    {
+        std::lock_guard<std::mutex> lock(m_webSocketMutex);
+        m_webSocketSendMessages.push(buf);
+    }
+    // メールボックスが一杯の場合は次の送信時にまとめて送る (呼び出し元のタスクを止めない)
+    post(WebMessage::WebSocketSend, 0);
+}
+
+// クエリ文字列から値を取得
+bool WebServer::getQuery(httpd_req_t *req, const char* key, std::string& value) {
+    size_t len = httpd_req_get_url_query_len(req);
+    if (len == 0)
+        return false;
+    std::string query(len + 1, '\0');
+    std::string raw(len + 1, '\0');
+    if (httpd_req_get_url_query_str(req, &query[0], query.size()) != ESP_OK ||
+        httpd_query_key_value(query.c_str(), key, &raw[0], raw.size()) != ESP_OK)
+        return false;
+    value = urlDecode(raw.c_str());
+    return true;
+}
+
+// URLデコード ("%xx"と"+")
+std::string WebServer::urlDecode(const char* str, bool isQuery) {
+    std::string value;
+    for(const char* p = str; *p != '\0'; p++) {
+        char c = *p;
+        if (c == '+' && isQuery) {
+            c = ' ';
+        } else if (c == '%' && isxdigit((unsigned char)p[1]) && isxdigit((unsigned char)p[2])) {
+            char hex[3] = { p[1], p[2], '\0' };
+            c = (char)strtol(hex, NULL, 16);
+            p += 2;
+        }
+        value += c;
+    }
+    return value;
 }
 
 // URIから拡張子のみを返します
@@ -5,47 +5,81 @@
 
 #include <vector>
 #include <iostream>
-#include <stack>
+#include <queue>
+#include <mutex>
+#include <atomic>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
 #include "esp_http_server.h"
+#include "esp_idf_version.h"
+#include "actor.hpp"
+#include "task_profile.hpp"
+#include "storage.hpp"
+#include "file_cache.hpp"
+
+// 非同期ハンドラはESP-IDF 5.2以降 (0の場合isAsyncのハンドラもhttpdタスクで実行)
+#define WEB_ASYNC_HANDLER   (ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 2, 0))
+#if !WEB_ASYNC_HANDLER
+// idf_component.ymlで5.2以降を指定しているので、ここに来るのはコンポーネントマネージャを使わずにビルドした場合のみ
+#warning "ESP-IDF < 5.2: no async HTTP handlers, long requests (uploads, scans, static files) block the web server"
+#endif
 
 typedef void (*CallbackWebAPIFunction)(httpd_req_t *req, void* context);
 typedef char* (*CallbackWebSocketFunction)(const char* data, void* context);
 
 struct ST_API_CALLBACK_DATA {
     httpd_method_t method;
-    std::string path;
+    std::string path;           // 末尾が'*'なら前方一致
     CallbackWebAPIFunction callback;
     void* context;
+    bool isAsync;               // ワーカータスクで実行
 };
 
 struct ST_WEBSOCKET_SESSION {
     bool isActive;
-    httpd_req_t* req;
+    int fd;                     // ソケット (httpd_reqはハンドラの外では無効なので保持しない)
+};
+
+// メッセージ種別
+enum class WebMessage {
+    Init,       // 初期化
+    Start,      // 開始
+    Stop,       // 停止
+    WebSocketSend,       // WebSocket送信
+    Quit        // 終了
 };
 
-class WebServer {
+class WebServer : public Actor<WebMessage> {
     public:
         WebServer();
     
     public:
         void init();
-        void start(const char* ipAddress, const char* root);
+        void start(const char* ipAddress, Storage* storage, FileCache* fileCache);
         void stop();
 
         // "/API"用コールバック
-        int addHandler(httpd_method_t method, const char* path, CallbackWebAPIFunction callback, void* context);
+        //  isAsync=trueはワーカータスクで実行し、処理中も他のリクエストを受け付ける (アップロード等の長時間の処理用)
+        //  ESP-IDF 5.2未満は非同期ハンドラが無いため、httpdタスクでそのまま実行する
+        int addHandler(httpd_method_t method, const char* path, CallbackWebAPIFunction callback, void* context, bool isAsync = false);
         void removeHandler(int handle);
         // WebSocket用コールバック
         void setWebSocketHandler(CallbackWebSocketFunction callback, void* context);
-        void sendWebSocket(const char* data);   // WebSocketの接続先にデータ送信
+        void sendWebSocket(const char* data);   // WebSocketの接続先にデータ送信 (どのタスクからでも可)
+        // クエリ文字列(?key=value&...)から値を取得 (URLデコード済み)
+        static bool getQuery(httpd_req_t *req, const char* key, std::string& value);
+        static std::string urlDecode(const char* str, bool isQuery = true);   // isQuery=falseは'+'をそのまま残す(パス用)
+        // 状態 (どのタスクからでも可)
+        uint32_t getRequestCount() { return m_requestCount; }   // 受け付けたリクエスト数 ("/API"と"/*")
+        int getWebSocketClients() { return m_webSocketClients; } // 接続中のWebSocketクライアント数 (ロック無し)
 
     private:
         void clear();
-        // タスク
-        static void task(void* arg);
+        // メッセージ処理 (実行タスク)
+        void onMessage(WebMessage& msg) override;
+        static void async_task(void* arg);  // 非同期ハンドラ用ワーカータスク
+        static bool startAsync(WebServer* pThis, httpd_req_t *req, CallbackWebAPIFunction callback, void* context);
         //
         void webInit();
         void webStart();
@@ -62,7 +96,10 @@ class WebServer {
         static esp_err_t get_api_options(httpd_req_t *req);
         static esp_err_t get_api_patch(httpd_req_t *req);
         static esp_err_t get_root(httpd_req_t *req);
+        static void send_file(httpd_req_t *req, void* context);    // 静的ファイル送信 (ワーカータスク)
+        void sendFile(httpd_req_t *req, uint32_t waitMs);
         static esp_err_t websocket_callback(httpd_req_t *req);
+        static void session_close(httpd_handle_t hd, int sockfd);  // ソケットを閉じる時 (httpdタスク)
         static bool custom_uri_matcher(const char* reference_uri, const char* uri_to_match, size_t match_upto);
         esp_err_t trigger_async_send(httpd_handle_t handle, httpd_req_t *req);
         static void ws_async_send(void *arg);
@@ -70,14 +107,18 @@ class WebServer {
         const char* getContentType(const char* uri);
 
     private:
-        TaskHandle_t m_xHandle;     // タスクハンドル
-        QueueHandle_t m_xQueue;     // メッセージキュー
+        TaskHandle_t m_xAsyncHandles[CONFIG_TASK_WEB_ASYNC_COUNT];  // ワーカータスクハンドル
+        QueueHandle_t m_xAsyncQueue;    // ワーカータスク用キュー
         httpd_handle_t m_server;    // httpdサーバー
         std::string m_ipAddress;    // IPアドレス
-        std::string m_root;         // ファイルシステムルートパス
+        Storage* m_storage;         // ドキュメントを格納しているストレージ
+        FileCache* m_fileCache;     // ドキュメント読み込み用ハンドルのキャッシュ
         std::vector<ST_API_CALLBACK_DATA*> m_apiCallbacks;  // "/API"用コールバック
         std::vector<ST_WEBSOCKET_SESSION*> m_webSocketSessions; // WebSocket用のセッションリスト
-        std::stack<char*> m_webSocketSendMessages;          // WebSocket送信データのスタック
+        std::queue<char*> m_webSocketSendMessages;          // WebSocket送信データ (送信順)
+        std::mutex m_webSocketMutex;                        // セッションリストと送信データの排他
+        std::atomic<int> m_webSocketClients;                // セッション数 (セッションリストの変更時に更新)
         CallbackWebSocketFunction m_webSocketCallback;      // WebSocket用コールバック
         void* m_webSocketCallbackContext;
+        std::atomic<uint32_t> m_requestCount;               // 受け付けたリクエスト数
 };
@@ -1,99 +1,117 @@
 #include <stdio.h>
 #include <string.h>
+#include <algorithm>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
+#include "esp_timer.h"
+#include "esp_random.h"
 #include "esp_log.h"
 
 #include "wifi.hpp"
+#include "app_event.hpp"
 
 #define TAG "Wi-Fi"
 
-// メッセージ種別 (メッセージキュー用)
-enum class WiFiMessage {
-    Init,       // 初期化
-    Connect,    // 接続
-    Disconnect, // 切断
-    Quit        // 終了
-};
-
-WiFi::WiFi() {
+WiFi::WiFi() : Actor(TAG) {
+    m_sampleFunc = NULL;
+    m_sampleFuncContext = NULL;
     clear();
 }
 
 void WiFi::clear() {
-    m_func = NULL;
-    m_funcContext = NULL;
-    m_xHandle = NULL;
-    m_xQueue = NULL;
-    m_ssid = "";
-    m_pass = "";
+    m_isInit = false;
+    m_profiles.clear();
+    m_profile = -1;
+    m_candidates.clear();
+    m_candidate = 0;
+    m_reqProfiles.clear();
+    m_reqCache = {};
+    m_reqIPConfig = {};
     m_netif_tcpstack = NULL;
     m_ipAddress = "";
+    m_cache = {};
+    m_linkCache = {};
+    m_ipConfig = {};
+    m_isStaticIP = false;
+    m_attempt = WiFiAttempt::None;
+    m_fastTimer = NULL;
+    m_connectStart = 0;
+    m_attemptStart = 0;
+    m_timeToIP = 0;
+    m_retryTimer = NULL;
+    m_scanTimer = NULL;
+    m_isBgScan = false;
+    m_isScanPending = false;
+    m_isBeginPending = false;
+    m_isScanRequested = false;
+    m_isScanning = false;
+    m_scanCount = 0;
+    m_scanTime = 0;
+    m_scanResults.clear();
+    m_sampleTimer = NULL;
+    m_connectedAt = 0;
+    m_sampleCount = 0;
 }
 
-void WiFi::init(CallbackWiFiFunction func, void* context) {
+void WiFi::init() {
     ESP_LOGI(TAG, "Init(S)");
 
-    m_func = func;
-    m_funcContext = context;
+    m_isInit = true;
+
+    // 高速接続のタイムアウト用タイマ
+    m_fastTimer = xTimerCreate("WiFiFast", pdMS_TO_TICKS(CONFIG_WIFI_FAST_CONNECT_MS), pdFALSE, this, fast_timer_func);
 
-    // タスク作成
-    xTaskCreate(WiFi::task, TAG, configMINIMAL_STACK_SIZE * 2, (void*)this, tskIDLE_PRIORITY, &m_xHandle);
+    // 再接続
+    m_supervisor.init(CONFIG_WIFI_RETRY_MIN_MS * 1000LL, CONFIG_WIFI_RETRY_MAX_MS * 1000LL, esp_random());
+    m_retryTimer = xTimerCreate("WiFiRetry", pdMS_TO_TICKS(CONFIG_WIFI_RETRY_MIN_MS), pdFALSE, this, retry_timer_func);
 
-    // メッセージキューの初期化
-    m_xQueue = xQueueCreate(10, sizeof(WiFiMessage));
+    // 定期スキャン
+    if (CONFIG_WIFI_SCAN_INTERVAL_S > 0) {
+        m_scanTimer = xTimerCreate("WiFiScan", pdMS_TO_TICKS(CONFIG_WIFI_SCAN_INTERVAL_S * 1000), pdTRUE, this, scan_timer_func);
+        if (m_scanTimer != NULL)
+            xTimerStart(m_scanTimer, 0);
+    }
+
+    // リンク状態の記録
+    if (CONFIG_WIFI_TELEMETRY_MS > 0) {
+        m_sampleTimer = xTimerCreate("WiFiSample", pdMS_TO_TICKS(CONFIG_WIFI_TELEMETRY_MS), pdTRUE, this, sample_timer_func);
+        if (m_sampleTimer != NULL)
+            xTimerStart(m_sampleTimer, 0);
+    }
 
     // 初期化用メッセージポスト
-    WiFiMessage msg = WiFiMessage::Init;
-    xQueueSend(m_xQueue, &msg, portMAX_DELAY);
+    post({ WiFiMessage::Init, 0 });
 
     ESP_LOGI(TAG, "Init(E)");
 }
 
 // 接続要求
-bool WiFi::connect(const char* ssid, const char* pass) {
-    if (m_netif_tcpstack != NULL)
-        disconnect();
-    m_ssid = ssid;
-    m_pass = pass;
-
-    // Wi-Fi APへ接続
-    wifi_config_t wifi_config = {
-        .sta = {
-            .scan_method = WIFI_ALL_CHANNEL_SCAN,
-            .sort_method = WIFI_CONNECT_AP_BY_SIGNAL,
-            .threshold = {
-                .rssi = (int8_t)-127,
-                .authmode = (wifi_auth_mode_t)WIFI_AUTH_WPA2_PSK
-            }
+//  ipConfigで静的IPアドレスを指定するとDHCPを使いません。
+bool WiFi::connect(const std::vector<WiFiProfile>& profiles, const WiFiLinkCache* cache, const WiFiIPConfig* ipConfig) {
+    for(auto& profile : profiles) {
+        if (profile.ssid.size() > 32) {
+            ESP_LOGE(TAG, "wifi ssid over 32 lenght");
+            return false;
         }
-    };
-    if (m_ssid.size() <= 32) {
-        for(int i=0; i<m_ssid.size(); i++) {
-            wifi_config.sta.ssid[i] = m_ssid[i];
-        }        
-    } else {
-        ESP_LOGE(TAG, "wifi ssid over 32 lenght");
-        return false;
-    }
-    if (m_pass.size() <= 64) {
-        for(int i=0; i<m_pass.size(); i++) {
-            wifi_config.sta.password[i] = m_pass[i];
+        if (profile.pass.size() > 64) {
+            ESP_LOGE(TAG, "wifi pass over 64 lenght");
+            return false;
         }
-    } else {
-        ESP_LOGE(TAG, "wifi pass over 64 lenght");
-        return false;
     }
-    ESP_LOGI("Wi-Fi", "Connecting to %s (%s)...", wifi_config.sta.ssid, wifi_config.sta.password);
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
-    esp_err_t ret = esp_wifi_connect();     // Wi-Fi APへ接続
-    if (ret != ESP_OK) {
-        ESP_LOGE("Wi-Fi", "WiFi connect failed! ret:%x", ret);
+    if (profiles.empty())
         return false;
+    if (m_netif_tcpstack != NULL)
+        disconnect();
+    {
+        std::lock_guard<std::mutex> lock(m_requestMutex);
+        m_reqProfiles = profiles;
+        m_reqCache = cache != NULL ? *cache : WiFiLinkCache{};
+        m_reqIPConfig = ipConfig != NULL ? *ipConfig : WiFiIPConfig{};
     }
+    post({ WiFiMessage::Start, 0 });
     return true;
 }
 
@@ -101,37 +119,87 @@ bool WiFi::connect(const char* ssid, const char* pass) {
 void WiFi::disconnect() {
     if (m_netif_tcpstack == NULL)
         return;
-    esp_wifi_disconnect();
+    post({ WiFiMessage::Stop, 0 });
 }
 
-// タスク
-void WiFi::task(void* arg) {
-    WiFi* pThis = (WiFi*)arg;
-    WiFiMessage msg;
-    bool loop = true;
-    while(loop) {
-        // メツセージキュー読み取り
-        if (pThis->m_xQueue != NULL && xQueueReceive(pThis->m_xQueue, (void*)&msg, portMAX_DELAY) == pdTRUE) {
-            switch(msg) {
-                case WiFiMessage::Init:         // 初期化処理
-                    pThis->wifiInit();
-                    break;
-                case WiFiMessage::Connect:      // 接続
-                    pThis->wifiConnect();
-                    break;
-                case WiFiMessage::Disconnect:   // 切断
-                    pThis->wifiDisconnect();
-                    break;
-                case WiFiMessage::Quit:         // 終了
-                    loop = false;
-                    break;
+// メッセージ処理
+void WiFi::onMessage(WiFiQueueItem& item) {
+    switch(item.msg) {
+        case WiFiMessage::Init:         // 初期化処理
+            wifiInit();
+            break;
+        case WiFiMessage::Start:        // 接続開始
+            m_connectStart = esp_timer_get_time();
+            {
+                std::lock_guard<std::mutex> lock(m_supervisorMutex);
+                m_supervisor.start(m_connectStart);
             }
-        }
+            xTimerStop(m_retryTimer, 0);
+            {
+                std::lock_guard<std::mutex> lock(m_requestMutex);
+                m_profiles = m_reqProfiles;
+                m_cache = m_reqCache;
+                m_ipConfig = m_reqIPConfig;
+                m_linkCache = {};
+            }
+            wifiBegin();
+            break;
+        case WiFiMessage::Stop:         // 切断要求
+            m_attempt = WiFiAttempt::None;
+            m_connectedAt = 0;
+            m_isBeginPending = false;
+            {
+                std::lock_guard<std::mutex> lock(m_supervisorMutex);
+                m_supervisor.stop(esp_timer_get_time());
+            }
+            xTimerStop(m_fastTimer, 0);
+            xTimerStop(m_retryTimer, 0);
+            esp_wifi_disconnect();
+            if (m_isScanPending)
+                wifiBackgroundScan();
+            break;
+        case WiFiMessage::Associated:   // APと接続
+            xTimerStop(m_fastTimer, 0);
+            ESP_LOGI(TAG, "associated : %lld ms", (long long)((esp_timer_get_time() - m_attemptStart) / 1000));
+            break;
+        case WiFiMessage::ScanDone:     // スキャン完了
+            if (m_attempt == WiFiAttempt::Scan)
+                wifiScanDone();
+            else
+                wifiBackgroundScanDone();    // 切断要求で中断した接続用のスキャンも含む
+            break;
+        case WiFiMessage::Connect:      // 接続
+            wifiConnect();
+            break;
+        case WiFiMessage::Disconnect:   // 切断
+            wifiDisconnect(item.reason);
+            break;
+        case WiFiMessage::FastTimeout:  // 高速接続のタイムアウト
+            wifiFastTimeout();
+            break;
+        case WiFiMessage::Retry:        // 再接続
+            wifiRetry();
+            break;
+        case WiFiMessage::Scan:         // バックグラウンドスキャン
+            wifiBackgroundScan();
+            break;
+        case WiFiMessage::Sample:       // リンク状態の記録
+            wifiSample();
+            break;
+        case WiFiMessage::Quit:         // 終了
+            if (m_fastTimer != NULL)
+                xTimerDelete(m_fastTimer, 0);
+            if (m_retryTimer != NULL)
+                xTimerDelete(m_retryTimer, 0);
+            if (m_scanTimer != NULL)
+                xTimerDelete(m_scanTimer, 0);
+            if (m_sampleTimer != NULL)
+                xTimerDelete(m_sampleTimer, 0);
+            esp_wifi_disconnect();
+            clear();
+            detach();
+            break;
     }
-    // 終了処理
-    pThis->disconnect();
-    pThis->clear();
-    vTaskDelete(NULL);
 }
 
 // Wi-Fi初期化
@@ -162,7 +230,9 @@ void WiFi::wifiInit() {
 
     // イベントハンドラ登録
     ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &connect_handler, this));                // Wi-Fiのアクセスポイント(AP)からIPを取得
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, &connect_handler, this));         // Wi-Fiステーション接続 (IP取得前)
     ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &disconnect_handler, this));   // Wi-Fiステーション切断
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_SCAN_DONE, &scan_done_handler, this));            // スキャン完了
 }
 
 
@@ -171,17 +241,400 @@ void WiFi::connect_handler(void* arg, esp_event_base_t event_base, int32_t event
 {
     WiFi *pThis = (WiFi*)arg;
     // 
-    WiFiMessage msg = WiFiMessage::Connect;
-    xQueueSend(pThis->m_xQueue, &msg, portMAX_DELAY);
+    pThis->post({ event_base == WIFI_EVENT ? WiFiMessage::Associated : WiFiMessage::Connect, 0 });
 }
 
 // Wi-Fi切断イベントハンドラ
 void WiFi::disconnect_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data)
 {
     WiFi *pThis = (WiFi*)arg;
+    wifi_event_sta_disconnected_t* event = (wifi_event_sta_disconnected_t*)event_data;
     // 
-    WiFiMessage msg = WiFiMessage::Disconnect;
-    xQueueSend(pThis->m_xQueue, &msg, portMAX_DELAY);
+    pThis->post({ WiFiMessage::Disconnect, event->reason });
+}
+
+// スキャン完了イベントハンドラ
+void WiFi::scan_done_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data)
+{
+    WiFi *pThis = (WiFi*)arg;
+    pThis->post({ WiFiMessage::ScanDone, 0 });
+}
+
+// 高速接続のタイムアウト
+// (タイマタスクは待てないので、メールボックスが一杯なら次のtickで再度通知する。周期は開始時に設定し直す)
+void WiFi::fast_timer_func(TimerHandle_t xTimer) {
+    WiFi* pThis = (WiFi*)pvTimerGetTimerID(xTimer);
+    if (!pThis->post({ WiFiMessage::FastTimeout, 0 }, 0))
+        xTimerChangePeriod(xTimer, 1, 0);
+}
+
+// 再接続タイマ
+// (メールボックスが一杯なら次のtickで再度通知する。周期は切断時に設定し直す)
+void WiFi::retry_timer_func(TimerHandle_t xTimer) {
+    WiFi* pThis = (WiFi*)pvTimerGetTimerID(xTimer);
+    if (!pThis->post({ WiFiMessage::Retry, 0 }, 0))
+        xTimerChangePeriod(xTimer, 1, 0);
+}
+
+// 定期スキャンタイマ
+void WiFi::scan_timer_func(TimerHandle_t xTimer) {
+    WiFi* pThis = (WiFi*)pvTimerGetTimerID(xTimer);
+    pThis->requestScan();
+}
+
+// リンク状態の記録タイマ (記録は実行タスクで行う。メールボックスが一杯なら今回は飛ばす)
+void WiFi::sample_timer_func(TimerHandle_t xTimer) {
+    WiFi* pThis = (WiFi*)pvTimerGetTimerID(xTimer);
+    pThis->post({ WiFiMessage::Sample, 0 }, 0);
+}
+
+// 接続開始
+//  前回接続したプロファイルがあればそのチャンネルで接続し、無ければスキャン
+//  (バックグラウンドスキャン中はスキャン完了後に開始)
+void WiFi::wifiBegin() {
+    if (m_isBgScan) {
+        m_isBeginPending = true;
+        return;
+    }
+    m_isBeginPending = false;
+    int profile = findProfile(m_cache.ssid);
+    if (m_cache.channel == 0 || profile < 0 || !wifiStart(WiFiAttempt::Fast, profile, m_cache.bssid, m_cache.channel))
+        wifiScan();
+}
+
+// 接続試行
+bool WiFi::wifiStart(WiFiAttempt attempt, int profile, const uint8_t* bssid, uint8_t channel) {
+    const WiFiProfile& p = m_profiles[profile];
+    wifi_config_t wifi_config = {
+        .sta = {
+            .scan_method = WIFI_ALL_CHANNEL_SCAN,
+            .sort_method = WIFI_CONNECT_AP_BY_SIGNAL,
+            .threshold = {
+                .rssi = (int8_t)-127,
+                .authmode = (wifi_auth_mode_t)WIFI_AUTH_WPA2_PSK
+            }
+        }
+    };
+    memcpy(wifi_config.sta.ssid, p.ssid.c_str(), p.ssid.size());
+    memcpy(wifi_config.sta.password, p.pass.c_str(), p.pass.size());
+    if (bssid != NULL) {
+        // 指定したAPのチャンネルのみ
+        wifi_config.sta.scan_method = WIFI_FAST_SCAN;
+        wifi_config.sta.bssid_set = true;
+        memcpy(wifi_config.sta.bssid, bssid, sizeof(wifi_config.sta.bssid));
+        wifi_config.sta.channel = channel;
+    }
+    ESP_LOGI(TAG, "Connecting to %s (%s, ch %d)...", p.ssid.c_str(), attempt == WiFiAttempt::Fast ? "fast" : "scanned", channel);
+    m_attempt = attempt;
+    m_attemptStart = esp_timer_get_time();
+    m_profile = profile;
+    applyIPConfig(profile);
+    esp_err_t ret = esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    if (ret == ESP_OK)
+        ret = esp_wifi_connect();     // Wi-Fi APへ接続
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "WiFi connect failed! ret:%x", ret);
+        m_attempt = WiFiAttempt::None;
+        return false;
+    }
+    if (attempt == WiFiAttempt::Fast)
+        xTimerChangePeriod(m_fastTimer, pdMS_TO_TICKS(CONFIG_WIFI_FAST_CONNECT_MS), 0);     // タイマも開始される
+    return true;
+}
+
+int WiFi::findProfile(const char* ssid) {
+    for(size_t i=0; i<m_profiles.size(); i++) {
+        if (strncmp(m_profiles[i].ssid.c_str(), ssid, 33) == 0)
+            return i;
+    }
+    return -1;
+}
+
+// 全チャンネルスキャン (完了するとWIFI_EVENT_SCAN_DONE)
+void WiFi::wifiScan() {
+    wifi_scan_config_t config = {};
+    config.show_hidden = false;
+    config.scan_type = WIFI_SCAN_TYPE_ACTIVE;
+    m_attempt = WiFiAttempt::Scan;
+    m_attemptStart = esp_timer_get_time();
+    m_candidates.clear();
+    {
+        std::lock_guard<std::mutex> lock(m_scanMutex);
+        m_isScanning = true;    // この結果もスキャン結果として公開
+    }
+    esp_err_t ret = esp_wifi_scan_start(&config, false);
+    if (ret != ESP_OK) {
+        {
+            std::lock_guard<std::mutex> lock(m_scanMutex);
+            m_isScanning = false;
+        }
+        // スキャンできない場合は先頭のプロファイルのAPを探して接続
+        ESP_LOGW(TAG, "scan failed ret:%x, connect to %s", ret, m_profiles[0].ssid.c_str());
+        m_attempt = WiFiAttempt::None;
+        wifiStart(WiFiAttempt::Full, 0, NULL, 0);
+    }
+}
+
+// スキャン結果からプロファイルに一致するAPを優先順(プロファイルの順、RSSIの強い順)に並べて接続
+void WiFi::wifiScanDone() {
+    if (m_attempt != WiFiAttempt::Scan)
+        return;
+    uint16_t count;
+    wifi_ap_record_t* records = getScanRecords(&count);
+    updateScanResults(records, count);
+    for(int i=0; i<count; i++) {
+        int profile = findProfile((const char*)records[i].ssid);
+        if (profile < 0)
+            continue;
+        WiFiCandidate candidate = { profile, {}, records[i].primary, records[i].rssi };
+        memcpy(candidate.bssid, records[i].bssid, sizeof(candidate.bssid));
+        m_candidates.push_back(candidate);
+    }
+    delete[] records;
+    std::stable_sort(m_candidates.begin(), m_candidates.end(), [](const WiFiCandidate& a, const WiFiCandidate& b) {
+        return a.profile != b.profile ? a.profile < b.profile : a.rssi > b.rssi;
+    });
+    ESP_LOGI(TAG, "scan : %d APs, %d candidates, %lld ms", count, (int)m_candidates.size(),
+        (long long)((esp_timer_get_time() - m_attemptStart) / 1000));
+    m_attempt = WiFiAttempt::None;
+    m_candidate = 0;
+    if (m_candidates.empty()) {
+        wifiDisconnect(WIFI_REASON_NO_AP_FOUND);
+        return;
+    }
+    for(; m_candidate<m_candidates.size(); m_candidate++) {
+        WiFiCandidate& c = m_candidates[m_candidate];
+        if (wifiStart(WiFiAttempt::Full, c.profile, c.bssid, c.channel))
+            return;
+    }
+    wifiDisconnect(WIFI_REASON_CONNECTION_FAIL);
+}
+
+// バックグラウンドスキャン開始
+//  パッシブスキャンなので接続中のAPとの通信への影響が少ない。接続試行中は試行が終わるまで後回し。
+void WiFi::wifiBackgroundScan() {
+    if (m_isBgScan)
+        return;     // スキャン中の結果に合流
+    if (m_attempt != WiFiAttempt::None) {
+        m_isScanPending = true;
+        return;
+    }
+    m_isScanPending = false;
+    wifi_scan_config_t config = {};
+    config.show_hidden = false;
+    config.scan_type = WIFI_SCAN_TYPE_PASSIVE;
+    config.scan_time.passive = CONFIG_WIFI_SCAN_DWELL_MS;
+    {
+        std::lock_guard<std::mutex> lock(m_scanMutex);
+        m_isScanRequested = false;
+        m_isScanning = true;
+    }
+    esp_err_t ret = esp_wifi_scan_start(&config, false);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "background scan failed ret:%x", ret);
+        std::lock_guard<std::mutex> lock(m_scanMutex);
+        m_isScanning = false;
+        return;
+    }
+    m_isBgScan = true;
+}
+
+// バックグラウンドスキャン完了
+void WiFi::wifiBackgroundScanDone() {
+    m_isBgScan = false;
+    uint16_t count;
+    wifi_ap_record_t* records = getScanRecords(&count);
+    updateScanResults(records, count);
+    delete[] records;
+    if (m_isBeginPending)
+        wifiBegin();
+}
+
+// スキャン結果の取り出し (見つかった全てのAPを取り出す。戻り値はdelete[]で解放)
+wifi_ap_record_t* WiFi::getScanRecords(uint16_t* count) {
+    *count = 0;
+    if (esp_wifi_scan_get_ap_num(count) != ESP_OK || *count == 0) {
+        *count = 0;
+        esp_wifi_clear_ap_list();   // ドライバ内のスキャン結果を解放
+        return NULL;
+    }
+    wifi_ap_record_t* records = new wifi_ap_record_t[*count];
+    if (esp_wifi_scan_get_ap_records(count, records) != ESP_OK)
+        *count = 0;
+    return records;
+}
+
+// スキャン結果の公開 (待っているrequestScanの呼び出し元を起こす)
+void WiFi::updateScanResults(const wifi_ap_record_t* records, int count) {
+    std::vector<WiFiScanResult> results(count);
+    for(int i=0; i<count; i++) {
+        WiFiScanResult& r = results[i];
+        memcpy(r.ssid, records[i].ssid, sizeof(r.ssid) - 1);
+        r.ssid[sizeof(r.ssid) - 1] = '\0';
+        memcpy(r.bssid, records[i].bssid, sizeof(r.bssid));
+        r.channel = records[i].primary;
+        r.rssi = records[i].rssi;
+        r.authmode = records[i].authmode;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_scanMutex);
+        m_scanResults = std::move(results);
+        m_scanTime = esp_timer_get_time();
+        m_scanCount++;
+        m_isScanning = false;
+    }
+    m_scanCond.notify_all();
+}
+
+// スキャン要求
+uint32_t WiFi::requestScan() {
+    std::lock_guard<std::mutex> lock(m_scanMutex);
+    uint32_t count = m_scanCount;
+    if (m_isScanning || m_isScanRequested || !m_isInit)
+        return count;   // スキャン中または要求済み
+    if (post({ WiFiMessage::Scan, 0 }, 0))
+        m_isScanRequested = true;
+    return count;
+}
+
+bool WiFi::waitScan(uint32_t count, int timeoutMs) {
+    std::unique_lock<std::mutex> lock(m_scanMutex);
+    return m_scanCond.wait_for(lock, std::chrono::milliseconds(timeoutMs), [&]() {
+        return (int32_t)(m_scanCount - count) > 0;
+    });
+}
+
+uint32_t WiFi::getScanResults(std::vector<WiFiScanResult>& results, int64_t* time, bool* isScanning) {
+    std::lock_guard<std::mutex> lock(m_scanMutex);
+    results = m_scanResults;
+    *time = m_scanTime;
+    *isScanning = m_isScanning || m_isScanRequested;
+    return m_scanCount;
+}
+
+// リンク状態の記録
+void WiFi::wifiSample() {
+    WiFiSupervisorStats stats;
+    int64_t now = esp_timer_get_time();
+    {
+        std::lock_guard<std::mutex> lock(m_supervisorMutex);
+        m_supervisor.getStats(now, &stats);
+    }
+    if (stats.state == WiFiSupervisorState::Idle)
+        return;     // 接続要求無し
+    WiFiLinkSample sample = {};
+    sample.time = esp_log_timestamp();
+    sample.reconnects = stats.retries;
+    sample.disconnects = stats.disconnects;
+    wifi_ap_record_t ap;
+    if (m_connectedAt != 0 && esp_wifi_sta_get_ap_info(&ap) == ESP_OK) {
+        sample.rssi = ap.rssi;
+        sample.channel = ap.primary;
+        sample.phy = (ap.phy_11b ? WIFI_PHY_11B : 0) | (ap.phy_11g ? WIFI_PHY_11G : 0)
+            | (ap.phy_11n ? WIFI_PHY_11N : 0) | (ap.phy_lr ? WIFI_PHY_LR : 0);
+        wifi_bandwidth_t bw;
+        sample.bandwidth = ap.second != WIFI_SECOND_CHAN_NONE && esp_wifi_get_bandwidth(WIFI_IF_STA, &bw) == ESP_OK && bw == WIFI_BW_HT40 ? 40 : 20;
+        sample.connectedMs = (now - m_connectedAt) / 1000;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_sampleMutex);
+        m_samples[m_sampleCount % WIFI_TELEMETRY_SAMPLES] = sample;
+        m_sampleCount++;
+    }
+    if (m_sampleFunc != NULL)
+        m_sampleFunc(sample, m_sampleFuncContext);
+}
+
+void WiFi::setSampleCallback(CallbackWiFiSampleFunction func, void* context) {
+    m_sampleFunc = func;
+    m_sampleFuncContext = context;
+}
+
+size_t WiFi::getSamples(WiFiLinkSample* samples, size_t max) {
+    std::lock_guard<std::mutex> lock(m_sampleMutex);
+    size_t count = m_sampleCount < WIFI_TELEMETRY_SAMPLES ? m_sampleCount : WIFI_TELEMETRY_SAMPLES;
+    if (count > max)
+        count = max;
+    for(size_t i=0; i<count; i++)
+        samples[i] = m_samples[(m_sampleCount - count + i) % WIFI_TELEMETRY_SAMPLES];
+    return count;
+}
+
+// 次の候補に接続 (無ければfalse)
+bool WiFi::wifiNextCandidate() {
+    while(++m_candidate < m_candidates.size()) {
+        WiFiCandidate& c = m_candidates[m_candidate];
+        ESP_LOGW(TAG, "try next candidate %s (rssi %d)", m_profiles[c.profile].ssid.c_str(), c.rssi);
+        if (wifiStart(WiFiAttempt::Full, c.profile, c.bssid, c.channel))
+            return true;
+    }
+    return false;
+}
+
+// IPアドレス設定 (静的IPアドレスまたはDHCP)
+// 前回DHCPで取得した値(ip=cached)は、そのSSIDのネットワークでのみ有効なので前回のSSIDに接続する場合のみ設定する
+void WiFi::applyIPConfig(int profile) {
+    m_isStaticIP = m_ipConfig.isStatic && (!m_ipConfig.isCachedLease || m_profiles[profile].ssid == m_cache.ssid);
+    if (!m_isStaticIP) {
+        esp_netif_dhcpc_start(m_netif_tcpstack);    // 開始済みの場合はエラーになるが問題無い
+        return;
+    }
+    esp_netif_dhcpc_stop(m_netif_tcpstack);
+    esp_netif_ip_info_t ip = {};
+    ip.ip.addr = m_ipConfig.ip;
+    ip.netmask.addr = m_ipConfig.netmask;
+    ip.gw.addr = m_ipConfig.gw;
+    if (esp_netif_set_ip_info(m_netif_tcpstack, &ip) != ESP_OK) {
+        ESP_LOGE(TAG, "static ip failed, use DHCP");
+        m_isStaticIP = false;
+        esp_netif_dhcpc_start(m_netif_tcpstack);
+        return;
+    }
+    if (m_ipConfig.dns != 0) {
+        esp_netif_dns_info_t dns = {};
+        dns.ip.u_addr.ip4.addr = m_ipConfig.dns;
+        dns.ip.type = ESP_IPADDR_TYPE_V4;
+        esp_netif_set_dns_info(m_netif_tcpstack, ESP_NETIF_DNS_MAIN, &dns);
+    }
+    ESP_LOGI(TAG, "static IP Address: " IPSTR, IP2STR(&ip.ip));
+}
+
+// 再接続 (接続できたことがあればそのAPのチャンネルで先に接続)
+void WiFi::wifiRetry() {
+    {
+        std::lock_guard<std::mutex> lock(m_supervisorMutex);
+        if (m_supervisor.state() != WiFiSupervisorState::Backoff)
+            return;     // 切断要求済み
+        m_supervisor.onRetry(esp_timer_get_time());
+    }
+    m_connectStart = esp_timer_get_time();
+    {
+        std::lock_guard<std::mutex> lock(m_requestMutex);
+        if (m_linkCache.channel != 0)
+            m_cache = m_linkCache;
+    }
+    wifiBegin();
+}
+
+// 接続中のAP
+void WiFi::getLinkCache(WiFiLinkCache* cache) {
+    std::lock_guard<std::mutex> lock(m_requestMutex);
+    *cache = m_linkCache;
+}
+
+// 接続の統計
+void WiFi::getStats(WiFiSupervisorStats* stats) {
+    std::lock_guard<std::mutex> lock(m_supervisorMutex);
+    m_supervisor.getStats(esp_timer_get_time(), stats);
+}
+
+// 高速接続がタイムアウトしたら全チャンネルスキャンで接続し直す
+void WiFi::wifiFastTimeout() {
+    if (m_attempt != WiFiAttempt::Fast)
+        return;
+    ESP_LOGW(TAG, "fast connect timeout, fallback to full scan");
+    esp_wifi_disconnect();
+    wifiScan();
 }
 
 // Wi-Fi接続後処理
@@ -190,17 +643,84 @@ void WiFi::wifiConnect() {
     esp_netif_ip_info_t ip;
     ESP_ERROR_CHECK(esp_netif_get_ip_info(m_netif_tcpstack, &ip));
     ESP_LOGI(TAG, "IP Address: " IPSTR, IP2STR(&ip.ip));
+    {
+        std::lock_guard<std::mutex> lock(m_supervisorMutex);
+        m_supervisor.onConnected(esp_timer_get_time());
+    }
+    if (m_connectedAt == 0)
+        m_connectedAt = esp_timer_get_time();   // IPアドレスの再取得では更新しない
+    if (m_attempt != WiFiAttempt::None) {
+        int64_t now = esp_timer_get_time();
+        m_timeToIP = now - m_connectStart;
+        ESP_LOGI(TAG, "time to IP : %lld ms (%s %lld ms, %s)", (long long)(m_timeToIP / 1000),
+            m_attempt == WiFiAttempt::Fast ? "fast" : "scanned", (long long)((now - m_attemptStart) / 1000),
+            m_isStaticIP ? "static" : "DHCP");
+        m_attempt = WiFiAttempt::None;
+        xTimerStop(m_fastTimer, 0);
+    }
+    // 次回の高速接続用に接続中のAPとIPアドレスを保持
+    WiFiLinkCache link = {};
+    if (m_profile >= 0)
+        snprintf(link.ssid, sizeof(link.ssid), "%s", m_profiles[m_profile].ssid.c_str());
+    wifi_ap_record_t ap;
+    if (esp_wifi_sta_get_ap_info(&ap) == ESP_OK) {
+        memcpy(link.bssid, ap.bssid, sizeof(link.bssid));
+        link.channel = ap.primary;
+    }
+    link.ip = ip.ip.addr;
+    link.netmask = ip.netmask.addr;
+    link.gw = ip.gw.addr;
+    esp_netif_dns_info_t dns;
+    link.dns = esp_netif_get_dns_info(m_netif_tcpstack, ESP_NETIF_DNS_MAIN, &dns) == ESP_OK ? dns.ip.u_addr.ip4.addr : 0;
+    {
+        std::lock_guard<std::mutex> lock(m_requestMutex);
+        m_linkCache = link;
+    }
     char ipaddr[256];
     sprintf(ipaddr, IPSTR, IP2STR(&ip.ip));
     m_ipAddress = ipaddr;
-    if (m_func != NULL) {
-        m_func(true, m_funcContext);
-    }
+    ActorEventBus::publish(AppEvent::WiFiConnect, 1);
+    if (m_isScanPending)
+        wifiBackgroundScan();
 }
 
 // Wi-Fi切断後処理
-void WiFi::wifiDisconnect() {
-    if (m_func != NULL) {
-        m_func(false, m_funcContext);
+void WiFi::wifiDisconnect(uint8_t reason) {
+    if (m_attempt != WiFiAttempt::None && reason == WIFI_REASON_ASSOC_LEAVE)
+        return;     // 接続前に自分で切断した分 (接続試行中)
+    if (m_attempt == WiFiAttempt::Scan)
+        return;     // スキャン前の接続試行の分
+    if (m_attempt == WiFiAttempt::Fast) {
+        ESP_LOGW(TAG, "fast connect failed (reason %d), fallback to full scan", reason);
+        xTimerStop(m_fastTimer, 0);
+        wifiScan();
+        return;
+    }
+    if (m_attempt == WiFiAttempt::Full && wifiNextCandidate())
+        return;
+    m_attempt = WiFiAttempt::None;
+    m_connectedAt = 0;
+    // 再接続の予約 (接続中からの切断のみ通知し、再接続を繰り返している間は通知しない)
+    int64_t delay;
+    bool wasConnected;
+    {
+        std::lock_guard<std::mutex> lock(m_supervisorMutex);
+        delay = m_supervisor.onDisconnected(reason, esp_timer_get_time());
+        wasConnected = m_supervisor.wasConnected();
+    }
+    if (delay >= 0) {
+        ESP_LOGW(TAG, "disconnected (reason %d), retry in %lld ms", reason, (long long)(delay / 1000));
+        TickType_t ticks = pdMS_TO_TICKS(delay / 1000);
+        if (ticks == 0) {
+            if (!post({ WiFiMessage::Retry, 0 }, 0))
+                xTimerChangePeriod(m_retryTimer, 1, 0);     // メールボックスが一杯なら次のtickで
+        } else {
+            xTimerChangePeriod(m_retryTimer, ticks, 0);     // タイマも開始される
+        }
+    }
+    if (wasConnected || delay < 0) {
+        ActorEventBus::publish(AppEvent::WiFiConnect, 0);
     }
+    if (m_isScanPending)
+        wifiBackgroundScan();
 }
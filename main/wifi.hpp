@@ -4,43 +4,217 @@
 #pragma once
 
 #include <iostream>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
+#include "freertos/timers.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
+#include "actor.hpp"
+#include "wifi_supervisor.hpp"
 
-typedef void (*CallbackWiFiFunction)(bool isConnect, void* context);
+#define WIFI_TELEMETRY_SAMPLES  60  // リンク状態の記録数 (古いものから上書き)
 
-class WiFi {
+// PHYモード (WiFiLinkSample::phy)
+#define WIFI_PHY_11B    0x01
+#define WIFI_PHY_11G    0x02
+#define WIFI_PHY_11N    0x04
+#define WIFI_PHY_LR     0x08
+
+// 接続先 (リストの先頭ほど優先)
+struct WiFiProfile {
+    std::string ssid;
+    std::string pass;
+    bool operator==(const WiFiProfile& o) const { return ssid == o.ssid && pass == o.pass; }
+};
+
+// 前回接続したAPとIPアドレス (高速再接続用。保存と復元はアプリケーションが行う)
+struct WiFiLinkCache {
+    char ssid[33];          // 接続したプロファイルのSSID
+    uint8_t bssid[6];
+    uint8_t channel;        // 0は無効
+    uint8_t reserved[4];    // (パディング無しで保存できるように)
+    uint32_t ip;            // 前回取得したIPアドレス (esp_ip4_addr_tと同じ並び)
+    uint32_t netmask;
+    uint32_t gw;
+    uint32_t dns;
+};
+
+// IPアドレス設定
+struct WiFiIPConfig {
+    bool isStatic;          // true = DHCPを使わずに以下を設定
+    uint32_t ip;
+    uint32_t netmask;
+    uint32_t gw;
+    uint32_t dns;           // 0は設定しない
+    bool isCachedLease;     // true = 前回DHCPで取得した値 (前回のSSIDに接続する場合のみ設定し、他のSSIDはDHCP)
+};
+
+// 接続試行の種類
+enum class WiFiAttempt {
+    None,
+    Fast,       // 前回のBSSID/チャンネルで接続 (スキャン無し)
+    Scan,       // 全チャンネルスキャン中
+    Full        // スキャン結果から選んだAPに接続 (スキャンできない場合は先頭のプロファイルでAPを探して接続)
+};
+
+// スキャン結果から選んだ接続先の候補
+struct WiFiCandidate {
+    int profile;            // プロファイルの番号 (優先順位)
+    uint8_t bssid[6];
+    uint8_t channel;
+    int8_t rssi;
+};
+
+// スキャンで見つかったAP
+struct WiFiScanResult {
+    char ssid[33];
+    uint8_t bssid[6];
+    uint8_t channel;
+    int8_t rssi;
+    uint8_t authmode;       // wifi_auth_mode_t
+};
+
+// リンク状態の記録 (CONFIG_WIFI_TELEMETRY_MS毎)
+struct WiFiLinkSample {
+    uint32_t time;          // esp_log_timestamp() (ms。ログの時刻と比較できる)
+    int8_t rssi;            // 接続中のAPのRSSI (未接続は0)
+    uint8_t channel;        // 0は未接続
+    uint8_t phy;            // WIFI_PHY_xxx (APとの間で使えるもの)
+    uint8_t bandwidth;      // 20 or 40 (MHz)
+    uint32_t reconnects;    // 切断後の再接続の試行回数 (累計。ドライバ内部の再送は含まない)
+    uint32_t disconnects;   // 接続中の切断回数 (累計)
+    uint32_t connectedMs;   // 現在の接続の継続時間 (未接続は0)
+};
+
+typedef void (*CallbackWiFiSampleFunction)(const WiFiLinkSample& sample, void* context);
+
+// メッセージ種別
+enum class WiFiMessage {
+    Init,       // 初期化
+    Start,      // 接続開始
+    Stop,       // 切断要求
+    Associated, // APと接続 (IPアドレス取得前)
+    ScanDone,   // スキャン完了
+    Connect,    // 接続
+    Disconnect, // 切断
+    FastTimeout,    // 高速接続のタイムアウト
+    Retry,      // 再接続
+    Scan,       // バックグラウンドスキャン
+    Sample,     // リンク状態の記録
+    Quit        // 終了
+};
+
+// メッセージ
+struct WiFiQueueItem {
+    WiFiMessage msg;
+    uint8_t reason;     // 切断理由 (Disconnect、wifi_err_reason_t)
+};
+
+// 接続状態の変化はAppEvent::WiFiConnectで通知 (arg : 1=接続, 0=切断)
+class WiFi : public Actor<WiFiQueueItem> {
     public:
         WiFi();
 
     public:
-        void init(CallbackWiFiFunction func, void* context);
-        bool connect(const char* ssid, const char* pass);   // Wi-Fi接続
+        void init();
+        // Wi-Fi接続
+        //  cacheのSSIDがprofilesにあれば先に前回のチャンネルで接続し、失敗したら全チャンネルスキャンして
+        //  見つかったAPをプロファイルの順(同じプロファイルはRSSIの強い順)に試します。
+        bool connect(const std::vector<WiFiProfile>& profiles, const WiFiLinkCache* cache = NULL, const WiFiIPConfig* ipConfig = NULL);
         void disconnect();                                  // Wi-Fi切断
         const char* getIPAddress() { return m_ipAddress.c_str(); }
+        void getLinkCache(WiFiLinkCache* cache);            // 接続中のAP (接続完了後に有効)
+        int64_t getTimeToIP() { return m_timeToIP; }        // 直近の接続要求からIPアドレス取得までの時間(us)
+        void getStats(WiFiSupervisorStats* stats);          // 接続の統計 (稼働率、切断時間など)
+        // スキャン
+        //  バックグラウンドでCONFIG_WIFI_SCAN_INTERVAL_S毎にパッシブスキャンし、結果を保持します。
+        //  requestScan()はスキャン中ならそのスキャンに合流し、二重にスキャンしません。
+        //  戻り値は完了を待つためのスキャン回数 (waitScanに渡す)
+        uint32_t requestScan();
+        bool waitScan(uint32_t count, int timeoutMs);       // スキャン回数がcountを超えるまで待つ
+        // スキャン結果 (戻り値はスキャン回数。timeは結果の時刻(us、0は未スキャン))
+        uint32_t getScanResults(std::vector<WiFiScanResult>& results, int64_t* time, bool* isScanning);
+        // リンク状態の記録
+        void setSampleCallback(CallbackWiFiSampleFunction func, void* context);    // 記録毎に呼ぶ (Wi-Fiの実行タスクで実行。init()の前に設定)
+        size_t getSamples(WiFiLinkSample* samples, size_t max); // 新しいものからmax個を古い順に取り出す
 
     private:
         void clear();
-        // タスク
-        static void task(void* arg);
+        // メッセージ処理 (実行タスク)
+        void onMessage(WiFiQueueItem& item) override;
         //
         void wifiInit();
+        bool wifiStart(WiFiAttempt attempt, int profile, const uint8_t* bssid, uint8_t channel);   // 接続開始 (bssid=NULLはチャンネルスキャン)
+        void wifiBegin();       // 接続開始 (前回のチャンネルまたはスキャン)
+        void wifiScan();        // 全チャンネルスキャン開始
+        void wifiScanDone();    // スキャン完了 (候補を選んで接続)
+        void wifiBackgroundScan();      // バックグラウンドスキャン開始 (接続試行中は後回し)
+        void wifiBackgroundScanDone();
+        wifi_ap_record_t* getScanRecords(uint16_t* count);
+        void updateScanResults(const wifi_ap_record_t* records, int count);
+        bool wifiNextCandidate();   // 次の候補に接続
+        int findProfile(const char* ssid);
         void wifiConnect();     // Wi-Fi接続後処理
-        void wifiDisconnect();  // Wi-Fi切断後処理
+        void wifiDisconnect(uint8_t reason);    // Wi-Fi切断後処理
+        void wifiFastTimeout(); // 高速接続のタイムアウト
+        void wifiRetry();       // 再接続
+        void applyIPConfig(int profile);    // 接続試行するプロファイルのIPアドレス設定
+        void wifiSample();      // リンク状態の記録
+        static void fast_timer_func(TimerHandle_t xTimer);
+        static void retry_timer_func(TimerHandle_t xTimer);
+        static void scan_timer_func(TimerHandle_t xTimer);
+        static void sample_timer_func(TimerHandle_t xTimer);
         // Wi-Fiハンドラ
         static void connect_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data);
         static void disconnect_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data);
+        static void scan_done_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data);
 
     private:
-        CallbackWiFiFunction m_func;    // コールバック
-        void* m_funcContext;            
-        TaskHandle_t m_xHandle; // タスクハンドル
-        QueueHandle_t m_xQueue; // メッセージキュー
-        std::string m_ssid;     // SSID
-        std::string m_pass;     // PASS
+        bool m_isInit;          // init()済み
+        std::vector<WiFiProfile> m_profiles;    // 接続先 (タスクのみ使用)
+        int m_profile;          // 接続中(試行中)のプロファイル (-1は無し)
+        std::vector<WiFiCandidate> m_candidates;    // スキャン結果から選んだ候補 (優先順)
+        size_t m_candidate;     // 試行中の候補
+        std::mutex m_requestMutex;  // 接続要求と接続中のAPの排他
+        std::vector<WiFiProfile> m_reqProfiles;     // 接続要求 (タスクが取り出す)
+        WiFiLinkCache m_reqCache;
+        WiFiIPConfig m_reqIPConfig;
         esp_netif_t *m_netif_tcpstack;    // TCP/IPスタック
         std::string m_ipAddress;// IPアドレス
+        WiFiLinkCache m_cache;  // 接続要求時に渡された前回のAP (channel=0は無し)
+        WiFiLinkCache m_linkCache;  // 接続中のAP
+        WiFiIPConfig m_ipConfig;
+        bool m_isStaticIP;      // 現在の接続試行で静的IPアドレスを設定したか
+        WiFiAttempt m_attempt;  // 接続試行中の種類 (Noneは接続済みまたは未接続)
+        TimerHandle_t m_fastTimer;  // 高速接続のタイムアウト用タイマ
+        int64_t m_connectStart; // 接続要求の時刻(us)
+        int64_t m_attemptStart; // 現在の試行の開始時刻(us)
+        int64_t m_timeToIP;     // 直近の接続要求からIPアドレス取得までの時間(us)
+        WiFiSupervisor m_supervisor;    // 再接続の間隔と統計
+        std::mutex m_supervisorMutex;
+        TimerHandle_t m_retryTimer;     // 再接続用タイマ
+        // バックグラウンドスキャン
+        TimerHandle_t m_scanTimer;      // 定期スキャン用タイマ
+        bool m_isBgScan;                // スキャン中 (タスクのみ使用)
+        bool m_isScanPending;           // 接続試行の後にスキャン (タスクのみ使用)
+        bool m_isBeginPending;          // スキャンの後に接続開始 (タスクのみ使用)
+        std::mutex m_scanMutex;         // 以下の排他
+        std::condition_variable m_scanCond;
+        bool m_isScanRequested;         // 要求済み (スキャン開始まで)
+        bool m_isScanning;
+        uint32_t m_scanCount;           // 完了したスキャンの回数
+        int64_t m_scanTime;             // 結果の時刻(us)
+        std::vector<WiFiScanResult> m_scanResults;
+        // リンク状態の記録
+        TimerHandle_t m_sampleTimer;
+        CallbackWiFiSampleFunction m_sampleFunc;
+        void* m_sampleFuncContext;
+        int64_t m_connectedAt;          // IPアドレスを取得した時刻(us) (0は未接続。タスクのみ使用)
+        std::mutex m_sampleMutex;       // 以下の排他
+        WiFiLinkSample m_samples[WIFI_TELEMETRY_SAMPLES];
+        uint32_t m_sampleCount;         // 記録した数 (累計)
 };
@@ -0,0 +1,157 @@
+#include "wifi_supervisor.hpp"
+
+// wifi_err_reason_t (esp_wifi_types.h)
+#define REASON_AUTH_EXPIRE              2
+#define REASON_AUTH_LEAVE               3
+#define REASON_ASSOC_EXPIRE             4
+#define REASON_ASSOC_LEAVE              8
+#define REASON_4WAY_HANDSHAKE_TIMEOUT   15
+#define REASON_802_1X_AUTH_FAILED       23
+#define REASON_BEACON_TIMEOUT           200
+#define REASON_NO_AP_FOUND              201
+#define REASON_AUTH_FAIL                202
+#define REASON_ASSOC_FAIL               203
+#define REASON_HANDSHAKE_TIMEOUT        204
+#define REASON_CONNECTION_FAIL          205
+#define REASON_AP_TSF_RESET             206
+#define REASON_ROAMING                  207
+
+#define AUTH_DELAY_FACTOR   8       // 認証失敗時の最初の再接続間隔 (minDelayの倍数)
+
+WiFiSupervisor::WiFiSupervisor() {
+    init(500000, 60000000, 1);
+}
+
+void WiFiSupervisor::init(int64_t minDelay, int64_t maxDelay, uint32_t seed) {
+    m_state = WiFiSupervisorState::Idle;
+    m_minDelay = minDelay;
+    m_maxDelay = maxDelay < minDelay ? minDelay : maxDelay;
+    m_delay = minDelay;
+    m_random = seed != 0 ? seed : 1;
+    m_wasConnected = false;
+    m_lastAccount = 0;
+    m_outageStart = 0;
+    m_stats = {};
+}
+
+WiFiDisconnectClass WiFiSupervisor::classify(uint8_t reason) {
+    switch(reason) {
+        case REASON_ASSOC_LEAVE:
+            return WiFiDisconnectClass::Leave;
+        case REASON_AUTH_EXPIRE:
+        case REASON_AUTH_LEAVE:
+        case REASON_ASSOC_EXPIRE:
+        case REASON_BEACON_TIMEOUT:
+        case REASON_AP_TSF_RESET:
+        case REASON_ROAMING:
+        case REASON_CONNECTION_FAIL:
+            return WiFiDisconnectClass::Transient;
+        case REASON_NO_AP_FOUND:
+            return WiFiDisconnectClass::NotFound;
+        case REASON_4WAY_HANDSHAKE_TIMEOUT:
+        case REASON_802_1X_AUTH_FAILED:
+        case REASON_AUTH_FAIL:
+        case REASON_HANDSHAKE_TIMEOUT:
+            return WiFiDisconnectClass::Auth;
+        default:
+            return WiFiDisconnectClass::Other;
+    }
+}
+
+// xorshift32
+uint32_t WiFiSupervisor::random() {
+    m_random ^= m_random << 13;
+    m_random ^= m_random >> 17;
+    m_random ^= m_random << 5;
+    return m_random;
+}
+
+void WiFiSupervisor::account(int64_t now) {
+    if (m_lastAccount != 0) {
+        int64_t elapsed = now - m_lastAccount;
+        if (m_state == WiFiSupervisorState::Connected)
+            m_stats.connectedTime += elapsed;
+        else if (m_state != WiFiSupervisorState::Idle)
+            m_stats.outageTime += elapsed;
+    }
+    m_lastAccount = now;
+}
+
+void WiFiSupervisor::start(int64_t now) {
+    account(now);
+    m_state = WiFiSupervisorState::Connecting;
+    m_delay = m_minDelay;
+    m_stats.failures = 0;
+    m_outageStart = now;
+}
+
+void WiFiSupervisor::stop(int64_t now) {
+    account(now);
+    m_state = WiFiSupervisorState::Idle;
+    m_outageStart = 0;
+}
+
+void WiFiSupervisor::onConnected(int64_t now) {
+    account(now);
+    if (m_state == WiFiSupervisorState::Connected)
+        return;     // IPアドレスの変更
+    if (m_outageStart != 0 && m_stats.connects > 0) {
+        m_stats.lastOutage = now - m_outageStart;
+        if (m_stats.lastOutage > m_stats.maxOutage)
+            m_stats.maxOutage = m_stats.lastOutage;
+    }
+    m_state = WiFiSupervisorState::Connected;
+    m_outageStart = 0;
+    m_delay = m_minDelay;
+    m_stats.failures = 0;
+    m_stats.connects++;
+}
+
+int64_t WiFiSupervisor::onDisconnected(uint8_t reason, int64_t now) {
+    account(now);
+    m_stats.lastReason = reason;
+    m_wasConnected = m_state == WiFiSupervisorState::Connected;
+    if (m_state == WiFiSupervisorState::Idle)
+        return -1;
+    WiFiDisconnectClass cls = classify(reason);
+    if (cls == WiFiDisconnectClass::Leave)
+        cls = WiFiDisconnectClass::Transient;   // 自分からの切断はstop()済みなので、ここに来るのはAPからの切断
+    if (m_wasConnected) {
+        // 接続中からの切断 (新しいoutage)
+        m_stats.disconnects++;
+        m_outageStart = now;
+        m_delay = m_minDelay;
+        m_state = WiFiSupervisorState::Backoff;
+        if (cls == WiFiDisconnectClass::Transient)
+            return 0;   // 一時的な切断はすぐに再接続
+    } else {
+        m_stats.failures++;
+        m_state = WiFiSupervisorState::Backoff;
+    }
+    if (cls == WiFiDisconnectClass::Auth && m_delay < m_minDelay * AUTH_DELAY_FACTOR)
+        m_delay = m_minDelay * AUTH_DELAY_FACTOR;
+    if (m_delay > m_maxDelay)
+        m_delay = m_maxDelay;
+    // ジッタ (間隔の半分から全体の範囲で乱数)
+    int64_t half = m_delay / 2;
+    int64_t delay = half + (half > 0 ? (int64_t)(random() % (uint32_t)(half > 0x7fffffff ? 0x7fffffff : half)) : 0);
+    m_delay *= 2;
+    return delay;
+}
+
+void WiFiSupervisor::onRetry(int64_t now) {
+    account(now);
+    if (m_state != WiFiSupervisorState::Backoff)
+        return;
+    m_state = WiFiSupervisorState::Connecting;
+    m_stats.retries++;
+}
+
+void WiFiSupervisor::getStats(int64_t now, WiFiSupervisorStats* stats) {
+    account(now);
+    *stats = m_stats;
+    stats->state = m_state;
+    stats->currentOutage = m_outageStart != 0 && m_state != WiFiSupervisorState::Idle ? now - m_outageStart : 0;
+    int64_t total = m_stats.connectedTime + m_stats.outageTime;
+    stats->availability = total > 0 ? (float)m_stats.connectedTime / total : 0.0f;
+}
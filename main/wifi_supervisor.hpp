@@ -0,0 +1,83 @@
+/**
+ * Wi-Fi接続の監視
+ *
+ * 切断時の再接続の間隔(指数バックオフ+ジッタ)を決め、接続の稼働率と切断時間を集計します。
+ * 時刻は呼び出し側が渡し、ESP-IDFのAPIは使わないので、PC上でイベント列を与えて確認できます。
+ *
+ *  start()         : 接続要求
+ *  onConnected()   : IPアドレス取得
+ *  onDisconnected(): 切断 (戻り値の時間後に再接続。-1は再接続しない(stop()後))
+ *  stop()          : 切断要求 (再接続しない)
+*/
+#pragma once
+
+#include <stdint.h>
+
+// 切断理由の分類
+enum class WiFiDisconnectClass {
+    Leave,      // 切断 (stop()後は自分からの切断。それ以外はAPからとみなして再接続)
+    Transient,  // 一時的 (ビーコン消失、ローミングなど) : 最初はすぐに再接続
+    NotFound,   // APが見つからない
+    Auth,       // 認証失敗 (パスワード違いなど) : 長めの間隔から開始
+    Other
+};
+
+// 状態
+enum class WiFiSupervisorState {
+    Idle,       // 接続要求無し
+    Connecting, // 接続中 (最初の接続または再接続)
+    Connected,  // 接続済み
+    Backoff     // 再接続待ち
+};
+
+// 統計
+struct WiFiSupervisorStats {
+    WiFiSupervisorState state;
+    uint32_t connects;          // 接続回数
+    uint32_t disconnects;       // 接続中の切断回数 (outage数)
+    uint32_t retries;           // 再接続の試行回数 (累計)
+    uint32_t failures;          // 現在の切断中に失敗した試行回数
+    uint8_t lastReason;         // 最後の切断理由 (wifi_err_reason_t)
+    int64_t connectedTime;      // 接続していた時間の合計(us)
+    int64_t outageTime;         // 切断していた時間の合計(us) (接続要求中のみ)
+    int64_t currentOutage;      // 現在の切断時間(us) (接続中は0)
+    int64_t lastOutage;         // 直近の切断時間(us)
+    int64_t maxOutage;          // 最長の切断時間(us)
+    float availability;         // 稼働率 (connectedTime / (connectedTime + outageTime))
+};
+
+class WiFiSupervisor {
+    public:
+        WiFiSupervisor();
+
+    public:
+        // minDelay/maxDelay : 再接続間隔の下限/上限(us)、seed : ジッタ用の乱数の種
+        void init(int64_t minDelay, int64_t maxDelay, uint32_t seed);
+
+        void start(int64_t now);
+        void stop(int64_t now);
+        void onConnected(int64_t now);
+        int64_t onDisconnected(uint8_t reason, int64_t now);   // 再接続までの時間(us) (-1は再接続しない)
+        void onRetry(int64_t now);                              // 再接続開始
+
+        WiFiSupervisorState state() { return m_state; }
+        bool wasConnected() { return m_wasConnected; }          // 直前のonDisconnected()が接続中からの切断だったか
+        void getStats(int64_t now, WiFiSupervisorStats* stats);
+
+        static WiFiDisconnectClass classify(uint8_t reason);
+
+    private:
+        void account(int64_t now);      // 前回からの経過時間を接続/切断時間に加算
+        uint32_t random();
+
+    private:
+        WiFiSupervisorState m_state;
+        int64_t m_minDelay;
+        int64_t m_maxDelay;
+        int64_t m_delay;                // 次の再接続間隔 (ジッタ前)
+        uint32_t m_random;
+        bool m_wasConnected;
+        int64_t m_lastAccount;          // 最後に時間を加算した時刻(us)
+        int64_t m_outageStart;          // 現在の切断の開始時刻(us) (0は切断中でない)
+        WiFiSupervisorStats m_stats;
+};
@@ -0,0 +1,283 @@
+/**
+ * アクターの実行タスク構成の比較 (PC上で実行)
+ *
+ * 以前の構成(クラス毎に1タスク+1キュー)、2つの実行タスクの構成(システムとディスプレイ)、
+ * 現在の構成(システム、I/O、ディスプレイの3つの実行タスク)をmain/actor.cppのActorExecutorで再現して、
+ * 同じ負荷を掛けた時のメッセージの待ち時間を比較します。
+ * 各アクターのメッセージは実機と同じ大きさの代わりの構造体で、処理時間は指定した時間だけ空回りします。
+ * SDカードのマウントと空き容量の計算、遅いクライアントへのWebSocket送信、保存データの書き込みは
+ * 時々長くかかる処理として入れてあり、同じ実行タスクのアプリケーションとWi-Fiの待ち時間に現れます。
+ * 実機のRAM(スタック、TCB、キュー、メールボックス)は下の値からの概算です。
+ * 最後に、起床時刻が既に過ぎている場合(onWake()の直後に数us先を指定した場合を含む)に
+ * 実行タスクが止まらずにonWake()を呼び続けることを確認します(止まった場合は終了コード1)。
+ *
+ * ビルド:
+ *     g++ -std=gnu++20 -O2 -Imain tools/actor_bench.cpp main/actor.cpp -lpthread -o actor_bench
+ *
+ * 使い方:
+ *     ./actor_bench [-t seconds] [-s stack]
+ *         -t seconds : 1つの構成の計測時間 (既定は3秒)
+ *         -s stack   : configMINIMAL_STACK_SIZE(byte、既定はESP-IDFの既定値1536)
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "actor.hpp"
+
+#define BENCH_TCB_BYTES     350     // タスク1つのTCB (StaticTask_tの大きさ、概算)
+#define BENCH_QUEUE_BYTES   80      // キュー1つの管理領域 (StaticQueue_tの大きさ、概算)
+
+// 実機のメッセージと同じ大きさ
+struct Msg4 { uint32_t value; };                    // AppMessage, SDCardMessage, WebMessage
+struct Msg8 { uint32_t value; uint32_t arg; };      // WiFiQueueItem, OledDisplayQueueItem, ActorJob (ESP32はポインタが4byte)
+
+// 実行タスク
+enum BenchExecutor {
+    EXEC_SYSTEM,
+    EXEC_IO,
+    EXEC_DISPLAY,
+    EXEC_COUNT
+};
+
+// 負荷 (実機の処理時間と頻度の目安)
+struct BenchLoad {
+    const char* name;
+    int stack;          // 以前のタスクのスタック (configMINIMAL_STACK_SIZEの倍数。0は以前はタスクが無い)
+    bool isMsg8;        // メッセージの大きさ (Msg8)
+    int workUs;         // 1件の処理時間(us)
+    int periodUs;       // 送信間隔(us)
+    int spikeUs;        // 時々長くかかる処理の時間(us) (0は無し)
+    int spikeEvery;     // 長くかかる処理の頻度 (件数毎)
+    int beforeTask;     // 以前の構成で処理するタスク (LOADSの番号)
+    BenchExecutor twoExecutors;     // 2つの実行タスクの構成
+    BenchExecutor current;          // 現在の構成
+};
+
+static const BenchLoad LOADS[] = {
+    // 表示更新、再読み込みチェック
+    { "Application",    2,  false,  100,    20000,  0,      0,      0,  EXEC_SYSTEM,    EXEC_SYSTEM },
+    // ディレクトリキャッシュ、使用量の更新、2秒毎にマウントとFATの空き容量の走査
+    { "SDCard",         3,  false,  2000,   50000,  150000, 40,     1,  EXEC_SYSTEM,    EXEC_IO },
+    // イベント、リンク状態の記録
+    { "Wi-Fi",          2,  true,   200,    10000,  0,      0,      2,  EXEC_SYSTEM,    EXEC_SYSTEM },
+    // WebSocket送信、1秒毎に遅いクライアントで送信が詰まる
+    { "WebServer",      2,  false,  300,    5000,   20000,  200,    3,  EXEC_SYSTEM,    EXEC_IO },
+    // 保存データの書き込み (以前はアプリケーションのタスクで書き込んでいた)
+    { "IOWorker",       0,  true,   30000,  1000000, 0,     0,      0,  EXEC_SYSTEM,    EXEC_IO },
+    // 描画と転送
+    { "OledDisplay",    3,  true,   3000,   33000,  0,      0,      5,  EXEC_DISPLAY,   EXEC_DISPLAY },
+};
+#define BENCH_ACTORS    (int)(sizeof(LOADS) / sizeof(LOADS[0]))
+#define BENCH_WAKES     20000   // 起床時刻の確認でonWake()を呼ぶ回数
+
+static const char* EXECUTOR_NAMES[EXEC_COUNT] = { "System", "IO", "Display" };
+
+template<typename TMessage>
+class BenchActor : public Actor<TMessage> {
+    public:
+        BenchActor(const BenchLoad& load) : Actor<TMessage>(load.name), m_load(load), m_count(0) {}
+
+    protected:
+        void onMessage(TMessage& msg) override {
+            m_count++;
+            bool isSpike = m_load.spikeUs > 0 && m_count % m_load.spikeEvery == 0;
+            int64_t end = ActorBase::now() + (isSpike ? m_load.spikeUs : m_load.workUs);
+            while(ActorBase::now() < end)
+                ;
+        }
+
+    private:
+        const BenchLoad& m_load;
+        int m_count;
+};
+
+// 起床時刻の確認用
+//  メッセージ受信時に過去の時刻を指定し、onWake()では0〜2us先を指定し直す。
+//  実行タスクが起床時刻を確認してから待つまでの間に時刻を過ぎると、待ち時間が負になる。
+class WakeActor : public Actor<Msg4> {
+    public:
+        WakeActor() : Actor<Msg4>("Wake"), m_wakes(0) {}
+        int wakes() { return m_wakes.load(); }
+
+    protected:
+        void onMessage(Msg4& msg) override {
+            setWake(ActorBase::now() - 1000);
+        }
+        void onWake() override {
+            int n = ++m_wakes;
+            if (n < BENCH_WAKES)
+                setWake(ActorBase::now() + n % 3);
+        }
+
+    private:
+        std::atomic<int> m_wakes;
+};
+
+// 起床時刻が過ぎている場合も止まらずにonWake()が呼ばれるか
+static bool runWake() {
+    WakeActor actor;
+    ActorExecutor executor;
+    executor.add(&actor);
+    executor.start("Wake", 0, 0);
+    actor.post({ 0 });
+    int64_t end = ActorBase::now() + 2000000;
+    while(actor.wakes() < BENCH_WAKES && ActorBase::now() < end)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    int wakes = actor.wakes();
+    executor.stop();
+    bool ret = wakes == BENCH_WAKES;
+    printf("wake in the past : %d/%d onWake %s\n", wakes, BENCH_WAKES, ret ? "ok" : "(stalled)");
+    return ret;
+}
+
+// 負荷を掛けて各アクターの統計を取る
+static void run(ActorBase** actors, double seconds, ActorStats* stats) {
+    int64_t start = ActorBase::now();
+    int64_t end = start + (int64_t)(seconds * 1000000);
+    int64_t next[BENCH_ACTORS];
+    for(int i=0; i<BENCH_ACTORS; i++)
+        next[i] = start;
+    int64_t now;
+    while((now = ActorBase::now()) < end) {
+        for(int i=0; i<BENCH_ACTORS; i++) {
+            if (now < next[i])
+                continue;
+            next[i] += LOADS[i].periodUs;
+            if (LOADS[i].isMsg8)
+                ((BenchActor<Msg8>*)actors[i])->post({ 0, 0 }, 0);
+            else
+                ((BenchActor<Msg4>*)actors[i])->post({ 0 }, 0);
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));    // 残りを処理
+    for(int i=0; i<BENCH_ACTORS; i++)
+        actors[i]->getStats(&stats[i]);
+}
+
+static void createActors(ActorBase** actors) {
+    for(int i=0; i<BENCH_ACTORS; i++) {
+        if (LOADS[i].isMsg8)
+            actors[i] = new BenchActor<Msg8>(LOADS[i]);
+        else
+            actors[i] = new BenchActor<Msg4>(LOADS[i]);
+    }
+}
+
+static void print(const char* title, ActorStats* stats) {
+    printf("%s\n", title);
+    printf("  %-12s %8s %8s %10s %10s\n", "actor", "messages", "dropped", "mean(us)", "max(us)");
+    for(int i=0; i<BENCH_ACTORS; i++) {
+        uint64_t mean = stats[i].messages > 0 ? stats[i].totalLatency / stats[i].messages : 0;
+        printf("  %-12s %8u %8u %10llu %10u\n", LOADS[i].name, stats[i].messages, stats[i].dropped,
+            (unsigned long long)mean, stats[i].maxLatency);
+    }
+}
+
+// 実行タスクの割り当てで負荷を掛ける
+static void runExecutors(BenchExecutor BenchLoad::*assign, double seconds, ActorStats* stats) {
+    ActorBase* actors[BENCH_ACTORS];
+    createActors(actors);
+    ActorExecutor executors[EXEC_COUNT];
+    for(int i=0; i<BENCH_ACTORS; i++)
+        executors[LOADS[i].*assign].add(actors[i]);
+    for(int i=0; i<EXEC_COUNT; i++)
+        executors[i].start(EXECUTOR_NAMES[i], 0, 0);
+    run(actors, seconds, stats);
+    for(int i=0; i<EXEC_COUNT; i++)
+        executors[i].stop();
+}
+
+// 現在の構成でシステムの実行タスクに残るアクター(アプリケーション、Wi-Fi)の待ち時間
+static void systemLatency(ActorStats* stats, uint64_t* mean, uint32_t* max) {
+    uint64_t total = 0;
+    uint32_t messages = 0;
+    *max = 0;
+    for(int i=0; i<BENCH_ACTORS; i++) {
+        if (LOADS[i].current != EXEC_SYSTEM)
+            continue;
+        total += stats[i].totalLatency;
+        messages += stats[i].messages;
+        if (stats[i].maxLatency > *max)
+            *max = stats[i].maxLatency;
+    }
+    *mean = messages > 0 ? total / messages : 0;
+}
+
+int main(int argc, char* argv[]) {
+    double seconds = 3;
+    int minStack = 1536;
+    for(int i=1; i<argc; i++) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            minStack = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [-t seconds] [-s stack]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    // 以前の構成 : クラス毎に1タスク (保存データの書き込みはアプリケーションのタスク)
+    ActorBase* before[BENCH_ACTORS];
+    ActorStats beforeStats[BENCH_ACTORS];
+    createActors(before);
+    ActorExecutor beforeExecutors[BENCH_ACTORS];
+    for(int i=0; i<BENCH_ACTORS; i++)
+        beforeExecutors[LOADS[i].beforeTask].add(before[i]);
+    for(int i=0; i<BENCH_ACTORS; i++) {
+        if (LOADS[i].stack > 0)
+            beforeExecutors[i].start(LOADS[i].name, 0, 0);
+    }
+    run(before, seconds, beforeStats);
+    for(int i=0; i<BENCH_ACTORS; i++) {
+        if (LOADS[i].stack > 0)
+            beforeExecutors[i].stop();
+    }
+
+    // 2つの実行タスク : システムとディスプレイ
+    ActorStats twoStats[BENCH_ACTORS];
+    runExecutors(&BenchLoad::twoExecutors, seconds, twoStats);
+
+    // 現在の構成 : システム、I/O、ディスプレイ
+    ActorStats currentStats[BENCH_ACTORS];
+    runExecutors(&BenchLoad::current, seconds, currentStats);
+
+    print("before : 1 task per class", beforeStats);
+    print("2 executors : System + Display", twoStats);
+    print("current : System + IO + Display", currentStats);
+
+    // システムの実行タスク(アプリケーション、Wi-Fi)の待ち時間
+    uint64_t twoMean, currentMean;
+    uint32_t twoMax, currentMax;
+    systemLatency(twoStats, &twoMean, &twoMax);
+    systemLatency(currentStats, &currentMean, &currentMax);
+    printf("System executor latency (Application, Wi-Fi)\n");
+    printf("  2 executors : mean %6llu us, max %7u us\n", (unsigned long long)twoMean, twoMax);
+    printf("  current     : mean %6llu us, max %7u us\n", (unsigned long long)currentMean, currentMax);
+
+    // RAMの概算
+    //  以前 : スタック + TCB + キュー(管理領域 + 10件)
+    //  現在 : スタック + TCB + メールボックス + イベント
+    int eventBytes = ACTOR_EVENT_SIZE * (sizeof(ActorEvent) + sizeof(uint32_t));
+    int beforeBytes = 0;
+    int mailboxBytes = 0;
+    for(int i=0; i<BENCH_ACTORS; i++) {
+        int item = LOADS[i].isMsg8 ? sizeof(Msg8) : sizeof(Msg4);
+        if (LOADS[i].stack > 0)
+            beforeBytes += LOADS[i].stack * minStack + BENCH_TCB_BYTES + BENCH_QUEUE_BYTES + ACTOR_MAILBOX_SIZE * item;
+        mailboxBytes += ACTOR_MAILBOX_SIZE * (item + sizeof(uint32_t)) + eventBytes;
+    }
+    //  実行タスクのスタックはKconfig(Task scheduling)の既定値 (System, IO : 4 x 1536, Display : 3 x 1536)
+    int twoBytes = mailboxBytes + (4 + 3) * minStack + 2 * BENCH_TCB_BYTES;
+    int currentBytes = mailboxBytes + (4 + 4 + 3) * minStack + 3 * BENCH_TCB_BYTES;
+    printf("estimated RAM (configMINIMAL_STACK_SIZE=%d)\n", minStack);
+    printf("  before      : %6d bytes (%d tasks)\n", beforeBytes, BENCH_ACTORS - 1);
+    printf("  2 executors : %6d bytes (2 tasks)\n", twoBytes);
+    printf("  current     : %6d bytes (3 tasks)\n", currentBytes);
+
+    return runWake() ? 0 : 1;
+}
@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+"""
+バイナリログ(GET /API/logs?format=bin)のデコーダ
+
+使い方:
+    curl -o binlog.bin "http://<IPアドレス>/API/logs?format=bin"
+    python3 tools/binlog_decode.py binlog.bin [-o out.log]
+
+ESP_LOGと同じ形式で1記録1行を出力します。
+    I (12345) Web: request uri : /index.html
+書式文字列はダンプに含まれる書式(S)を使うので、ELFファイルは不要です。
+引数はESP32(32bit)の大きさで格納されています (long, size_t, ポインタは4byte、long long, intmax_tは8byte)。
+"""
+import argparse
+import re
+import struct
+import sys
+
+LEVELS = "NEWIDV"
+SPEC = re.compile(r"%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d+))?(hh|h|ll|l|L|q|j|z|t)?([diouxXcsfFeEgGaAp%])")
+
+
+class Reader:
+    def __init__(self, data, pos=0):
+        self.data = data
+        self.pos = pos
+
+    def take(self, fmt):
+        value = struct.unpack_from("<" + fmt, self.data, self.pos)
+        self.pos += struct.calcsize("<" + fmt)
+        return value[0] if len(value) == 1 else value
+
+    def bytes(self, n):
+        if self.pos + n > len(self.data):
+            raise struct.error("short data")
+        value = self.data[self.pos:self.pos + n]
+        self.pos += n
+        return value
+
+
+def format_args(fmt, args):
+    r = Reader(args)
+    out = []
+    last = 0
+    for m in SPEC.finditer(fmt):
+        out.append(fmt[last:m.start()])
+        last = m.end()
+        flags, width, prec, length, conv = m.groups()
+        if conv == "%":
+            out.append("%")
+            continue
+        try:
+            if width == "*":
+                width = str(r.take("i"))
+            if prec == "*":
+                prec = str(r.take("i"))
+            spec = "%" + flags + (width or "") + ("." + prec if prec is not None else "")
+            if conv == "s":
+                n = r.take("B")
+                out.append((spec + "s") % r.bytes(n).decode("utf-8", "replace"))
+            elif conv in "fFeEgGaA":
+                value = r.take("d")
+                out.append((spec + ("e" if conv in "aA" else conv)) % value)
+            elif conv == "p":
+                out.append("0x%x" % r.take("I"))
+            else:
+                signed = conv in "di"
+                if length in ("ll", "q", "j"):
+                    value = r.take("q" if signed else "Q")
+                else:
+                    value = r.take("i" if signed else "I")
+                if conv == "c":
+                    out.append((spec + "c") % chr(value & 0xff))
+                else:
+                    out.append((spec + ("d" if conv in "diu" else conv)) % value)
+        except struct.error:
+            out.append("<?>")
+            return "".join(out)
+    out.append(fmt[last:])
+    return "".join(out)
+
+
+def decode(data, out):
+    if data[:4] != b"WCBL":
+        raise ValueError("not a binary log dump")
+    r = Reader(data, 4)
+    version, _ = r.take("HH")
+    if version != 1:
+        raise ValueError("unsupported version %d" % version)
+    sites = {}
+    count = 0
+    while r.pos < len(data):
+        kind = r.bytes(1)
+        if kind == b"S":
+            sid, level, tag_len = r.take("IBB")
+            tag = r.bytes(tag_len).decode("utf-8", "replace")
+            fmt_len = r.take("H")
+            sites[sid] = (level, tag, r.bytes(fmt_len).decode("utf-8", "replace"))
+        elif kind == b"R":
+            time_ms, sid, arg_len = r.take("IIB")
+            args = r.bytes(arg_len)
+            level, tag, fmt = sites.get(sid, (0, "?", "<unknown format 0x%08x>" % sid))
+            out.write("%s (%d) %s: %s\n" % (LEVELS[level] if level < len(LEVELS) else "?", time_ms, tag, format_args(fmt, args)))
+            count += 1
+        else:
+            raise ValueError("broken dump at offset %d" % (r.pos - 1))
+    return count
+
+
+def main():
+    parser = argparse.ArgumentParser(description="WiFiControlBase binary log decoder")
+    parser.add_argument("file", help="dump from GET /API/logs?format=bin")
+    parser.add_argument("-o", "--output", help="output file (default: stdout)")
+    args = parser.parse_args()
+    with open(args.file, "rb") as f:
+        data = f.read()
+    out = open(args.output, "w") if args.output else sys.stdout
+    count = decode(data, out)
+    if out is not sys.stdout:
+        out.close()
+    print("records=%d" % count, file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+"""
+データロガー(/log/dlNNNNNN.bin)のデコーダ
+
+使い方:
+    python3 tools/datalog_decode.py dl000001.bin [dl000002.bin ...] [--csv out.csv] [--schema "a:i16,b:f32"]
+
+各レコードを1行(CSV)で出力します。
+    segment,block,time_us,epoch_us,id,len,<データ部>
+データ部はファイルヘッダのスキーマ(または--schema)に従って展開し、スキーマが無ければ16進で出力します。
+CRCが一致しないブロックは読み飛ばし、破棄数(dropped)と合わせて最後に標準エラーへ集計を出力します。
+"""
+import argparse
+import binascii
+import csv
+import struct
+import sys
+
+FILE_HEADER = struct.Struct("<4sHHHHIqq64s28sI")
+BLOCK_HEADER = struct.Struct("<4sIHH")
+RECORD_HEAD = struct.Struct("<qHH")
+TYPES = {"u8": "B", "i8": "b", "u16": "H", "i16": "h", "u32": "I", "i32": "i", "f32": "f"}
+
+
+def parse_schema(schema):
+    fields = []
+    for item in filter(None, (s.strip() for s in schema.split(","))):
+        name, _, typ = item.partition(":")
+        if typ not in TYPES:
+            raise ValueError("unknown type in schema: %s" % item)
+        fields.append((name, TYPES[typ]))
+    return fields
+
+
+def decode_file(path, schema_override, writer, stats):
+    with open(path, "rb") as f:
+        data = f.read()
+    if len(data) < FILE_HEADER.size:
+        print("%s: too short" % path, file=sys.stderr)
+        return
+    (magic, version, header_size, record_size, payload_size, segment,
+     start_time, start_epoch, schema, _, crc) = FILE_HEADER.unpack_from(data, 0)
+    if magic != b"WCDL" or version != 1:
+        print("%s: not a data log" % path, file=sys.stderr)
+        return
+    if binascii.crc32(data[:FILE_HEADER.size - 4]) != crc:
+        print("%s: header CRC error" % path, file=sys.stderr)
+        return
+    schema = schema_override if schema_override is not None else schema.split(b"\0")[0].decode()
+    fields = parse_schema(schema)
+    fmt = struct.Struct("<" + "".join(t for _, t in fields)) if fields else None
+    if fmt is not None and fmt.size > payload_size:
+        raise ValueError("schema is larger than payload (%d > %d)" % (fmt.size, payload_size))
+    pos = header_size
+    while pos + BLOCK_HEADER.size <= len(data):
+        magic, seq, count, dropped = BLOCK_HEADER.unpack_from(data, pos)
+        end = pos + BLOCK_HEADER.size + count * record_size + 4
+        if magic != b"DLBK" or end > len(data):
+            # 壊れたブロック (電源断で途中まで書かれた等)。次のブロックを探す
+            next_pos = data.find(b"DLBK", pos + 1)
+            stats["bad"] += 1
+            if next_pos < 0:
+                break
+            pos = next_pos
+            continue
+        (crc,) = struct.unpack_from("<I", data, end - 4)
+        if binascii.crc32(data[pos:end - 4]) != crc:
+            stats["bad"] += 1
+            pos = data.find(b"DLBK", pos + 1)
+            if pos < 0:
+                break
+            continue
+        stats["dropped"] += dropped
+        stats["blocks"] += 1
+        rec = pos + BLOCK_HEADER.size
+        for _ in range(count):
+            time_us, rid, length = RECORD_HEAD.unpack_from(data, rec)
+            payload = data[rec + RECORD_HEAD.size:rec + RECORD_HEAD.size + payload_size]
+            epoch = start_epoch + (time_us - start_time) if start_epoch else ""
+            if fmt is not None:
+                values = list(fmt.unpack_from(payload, 0))
+            else:
+                values = [payload[:length].hex()]
+            writer.writerow([segment, seq, time_us, epoch, rid, length] + values)
+            stats["records"] += 1
+            rec += record_size
+        pos = end
+
+
+def main():
+    parser = argparse.ArgumentParser(description="WiFiControlBase data log decoder")
+    parser.add_argument("files", nargs="+", help="segment files (dlNNNNNN.bin)")
+    parser.add_argument("--csv", help="output CSV file (default: stdout)")
+    parser.add_argument("--schema", help="override the schema in the file header")
+    args = parser.parse_args()
+    out = open(args.csv, "w", newline="") if args.csv else sys.stdout
+    writer = csv.writer(out)
+    stats = {"records": 0, "blocks": 0, "dropped": 0, "bad": 0}
+    for path in sorted(args.files):
+        decode_file(path, args.schema, writer, stats)
+    if out is not sys.stdout:
+        out.close()
+    print("records=%(records)d blocks=%(blocks)d dropped=%(dropped)d bad_blocks=%(bad)d" % stats, file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,289 @@
+/**
+ * データロガーの往復試験と記録レートの測定 (PC上で実行)
+ *
+ * main/data_logger.cppのDataLoggerを一時ディレクトリ(PosixStorage)に書き込ませ、
+ * tools/datalog_decode.pyでCSVに変換した結果を書き込んだ内容と照合します。
+ *   - 記録に成功した(write()がtrueの)レコードが全て1回ずつ、スレッド毎に記録順で現れる
+ *   - データ部がスキーマのとおりに展開され、値が一致する
+ *   - デコーダが集計した破棄数(dropped)が記録に失敗した数と一致する (ブロック毎の破棄数が飽和しない範囲)
+ *   - セグメントが切り替わっても欠けない (ビルド時にCONFIG_DATALOG_SEGMENT_KBを小さくする)
+ * 続けて、指定したレートで記録し続けた時の書き込み数と破棄数を表示します。
+ * -wでSDカードの書き込み遅延を模擬すると、ライタが追いつかない場合の破棄を確認できます。
+ * 異常があれば内容を表示して終了コード1で終了します。
+ *
+ * ビルド:
+ *     g++ -std=gnu++20 -O2 -Imain -DCONFIG_DATALOG_SEGMENT_KB=64 tools/datalog_test.cpp main/data_logger.cpp main/storage.cpp -lpthread -o datalog_test
+ *
+ * 使い方 (リポジトリのルートで実行):
+ *     ./datalog_test [-p producers] [-n records] [-r rate] [-t seconds] [-w us] [-d decoder]
+ *         -p producers : 往復試験で記録するスレッド数 (既定は4)
+ *         -n records   : 往復試験でスレッド1つ当たりに記録する数 (既定は20000)
+ *         -r rate      : レート測定で1秒当たりに記録する数 (既定は5000。0はレート測定無し)
+ *         -t seconds   : レート測定の時間 (既定は3秒)
+ *         -w us        : ファイルへのwrite 1回毎に入れる遅延(us、既定は0)
+ *         -d decoder   : デコーダのパス (既定はtools/datalog_decode.py)
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include "storage.hpp"
+#include "data_logger.hpp"
+
+#define TEST_SCHEMA     "producer:u16,seq:u32,value:f32,check:u16"
+
+// 試験用のデータ部 (TEST_SCHEMAと同じ順)
+struct __attribute__((packed)) TestPayload {
+    uint16_t producer;
+    uint32_t seq;
+    float value;
+    uint16_t check;
+};
+static_assert(sizeof(TestPayload) == DATALOG_PAYLOAD_SIZE, "TestPayload size");
+
+static uint16_t checkOf(uint16_t producer, uint32_t seq) {
+    return (uint16_t)(producer * 40503u + seq * 2654435761u);
+}
+
+// 書き込み遅延の模擬 (SDカードの代わり)
+static int s_writeDelayUs = 0;
+
+class SlowFile : public StorageFile {
+    public:
+        SlowFile(StorageFile* file) : m_file(file) {}
+        ~SlowFile() { delete m_file; }
+        int read(void* buf, size_t len) override { return m_file->read(buf, len); }
+        int write(const void* buf, size_t len) override {
+            if (s_writeDelayUs > 0)
+                std::this_thread::sleep_for(std::chrono::microseconds(s_writeDelayUs));
+            return m_file->write(buf, len);
+        }
+        int pread(void* buf, size_t len, off_t offset) override { return m_file->pread(buf, len, offset); }
+        bool seek(off_t offset, int whence) override { return m_file->seek(offset, whence); }
+        off_t tell() override { return m_file->tell(); }
+        off_t size() override { return m_file->size(); }
+        bool flush() override { return m_file->flush(); }
+        bool close() override { return m_file->close(); }
+
+    private:
+        StorageFile* m_file;
+};
+
+class SlowStorage : public PosixStorage {
+    public:
+        StorageFile* open(const char* path, const char* mode) override {
+            StorageFile* file = PosixStorage::open(path, mode);
+            return file != NULL ? new SlowFile(file) : NULL;
+        }
+};
+
+static bool makeStorage(SlowStorage& storage, char* dir) {
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return false;
+    }
+    storage.init(dir);
+    storage.setReady(true);
+    return true;
+}
+
+// デコーダでCSVに変換 (集計はsummaryに書き込まれる)
+static bool decode(const char* decoder, const char* dir, std::string& csvPath, std::string& summaryPath) {
+    csvPath = std::string(dir) + "/out.csv";
+    summaryPath = std::string(dir) + "/summary.txt";
+    std::string cmd = std::string("python3 ") + decoder + " " + dir + "/log/*.bin --csv " + csvPath + " 2> " + summaryPath;
+    if (system(cmd.c_str()) != 0) {
+        fprintf(stderr, "decoder failed : %s\n", cmd.c_str());
+        return false;
+    }
+    return true;
+}
+
+// 往復試験
+static int roundTrip(int producers, int records, const char* decoder) {
+    char dir[] = "/tmp/datalog_testXXXXXX";
+    SlowStorage storage;
+    if (!makeStorage(storage, dir))
+        return 1;
+    DataLogger logger;
+    logger.init(&storage, TEST_SCHEMA);
+    std::vector<std::vector<bool>> accepted(producers, std::vector<bool>(records, false));
+    std::atomic<uint32_t> failures(0);
+    std::vector<std::thread> threads;
+    for(int p=0; p<producers; p++) {
+        threads.emplace_back([&, p]() {
+            for(int n=0; n<records; n++) {
+                TestPayload payload = { (uint16_t)p, (uint32_t)n, n * 0.5f, checkOf(p, n) };
+                if (logger.write((uint16_t)(p + 1), &payload, sizeof(payload)))
+                    accepted[p][n] = true;
+                else
+                    failures++;
+                if ((n & 0x3f) == 0)
+                    std::this_thread::yield();     // ライタにも順番を回す (破棄が多すぎると照合にならない)
+            }
+        });
+    }
+    for(auto& t : threads)
+        t.join();
+    logger.quit();
+    DataLogStats stats;
+    logger.getStats(&stats);
+
+    std::string csvPath, summaryPath;
+    if (!decode(decoder, dir, csvPath, summaryPath))
+        return 1;
+    int errors = 0;
+    // 集計 (records=... blocks=... dropped=... bad_blocks=...)
+    unsigned long decRecords = 0, decBlocks = 0, decDropped = 0, decBad = 0;
+    FILE* fp = fopen(summaryPath.c_str(), "r");
+    char line[512];
+    while(fp != NULL && fgets(line, sizeof(line), fp) != NULL) {
+        if (sscanf(line, "records=%lu blocks=%lu dropped=%lu bad_blocks=%lu", &decRecords, &decBlocks, &decDropped, &decBad) == 4)
+            break;
+    }
+    if (fp != NULL)
+        fclose(fp);
+    // レコードの照合
+    std::vector<int64_t> lastSeq(producers, -1);
+    std::vector<int64_t> lastTime(producers, 0);
+    std::vector<std::vector<bool>> seen(producers, std::vector<bool>(records, false));
+    std::map<unsigned, int> segments;
+    unsigned long rows = 0;
+    fp = fopen(csvPath.c_str(), "r");
+    while(fp != NULL && fgets(line, sizeof(line), fp) != NULL) {
+        // segment,block,time_us,epoch_us,id,len,producer,seq,value,check (epoch_usは時刻未設定なら空)
+        std::vector<std::string> cols;
+        for(char* p = line; ; ) {
+            char* comma = strpbrk(p, ",\r\n");
+            cols.push_back(std::string(p, comma != NULL ? comma - p : strlen(p)));
+            if (comma == NULL || *comma != ',')
+                break;
+            p = comma + 1;
+        }
+        if (cols.size() != 10) {
+            fprintf(stderr, "unexpected row : %s", line);
+            errors++;
+            break;
+        }
+        unsigned segment = atoi(cols[0].c_str());
+        long long time = atoll(cols[2].c_str());
+        unsigned id = atoi(cols[4].c_str());
+        unsigned len = atoi(cols[5].c_str());
+        unsigned producer = atoi(cols[6].c_str());
+        unsigned seq = strtoul(cols[7].c_str(), NULL, 10);
+        double value = strtod(cols[8].c_str(), NULL);
+        unsigned check = atoi(cols[9].c_str());
+        rows++;
+        segments[segment]++;
+        if (producer >= (unsigned)producers || seq >= (unsigned)records || id != producer + 1 || len != sizeof(TestPayload)) {
+            fprintf(stderr, "bad record : %s", line);
+            errors++;
+            continue;
+        }
+        if (value != seq * 0.5 || check != checkOf(producer, seq)) {
+            fprintf(stderr, "payload mismatch : %s", line);
+            errors++;
+        }
+        if (!accepted[producer][seq] || seen[producer][seq]) {
+            fprintf(stderr, "%s record : %s", seen[producer][seq] ? "duplicate" : "unexpected", line);
+            errors++;
+        }
+        if ((int64_t)seq <= lastSeq[producer] || time < lastTime[producer]) {
+            fprintf(stderr, "out of order : %s", line);
+            errors++;
+        }
+        seen[producer][seq] = true;
+        lastSeq[producer] = seq;
+        lastTime[producer] = time;
+    }
+    if (fp != NULL)
+        fclose(fp);
+    unsigned long missing = 0;
+    for(int p=0; p<producers; p++) {
+        for(int n=0; n<records; n++) {
+            if (accepted[p][n] && !seen[p][n])
+                missing++;
+        }
+    }
+    if (missing > 0) {
+        fprintf(stderr, "missing records : %lu\n", missing);
+        errors++;
+    }
+    // ブロックヘッダの破棄数は65535で飽和するので、それ以上の破棄では少なく数える
+    bool isDroppedMatch = failures < 0xffff ? decDropped == failures : decDropped <= failures;
+    if (!isDroppedMatch || stats.dropped != failures || decBad != 0 || decRecords != rows || stats.written != rows) {
+        fprintf(stderr, "count mismatch : failures=%u stats.dropped=%u decoder.dropped=%lu bad_blocks=%lu rows=%lu decoder.records=%lu stats.written=%u\n",
+            failures.load(), stats.dropped, decDropped, decBad, rows, decRecords, stats.written);
+        errors++;
+    }
+    printf("round trip : producers=%d records=%d written=%lu dropped=%u segments=%d blocks=%lu errors=%d\n",
+        producers, records * producers, rows, failures.load(), (int)segments.size(), decBlocks, errors);
+    system((std::string("rm -rf ") + dir).c_str());
+    return errors == 0 ? 0 : 1;
+}
+
+// 記録レートの測定
+static void rateBench(int rate, int seconds) {
+    char dir[] = "/tmp/datalog_benchXXXXXX";
+    SlowStorage storage;
+    if (!makeStorage(storage, dir))
+        return;
+    DataLogger logger;
+    logger.init(&storage, TEST_SCHEMA);
+    // 1msごとにまとめて記録 (レートを保つため、遅れた分は次で取り戻す)
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + std::chrono::seconds(seconds);
+    uint64_t offered = 0;
+    uint64_t rejected = 0;
+    while(true) {
+        auto now = std::chrono::steady_clock::now();
+        if (now >= end)
+            break;
+        uint64_t due = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(now - start).count() * rate / 1000000;
+        for(; offered < due; offered++) {
+            TestPayload payload = { 0, (uint32_t)offered, 0, 0 };
+            if (!logger.write(1, &payload, sizeof(payload)))
+                rejected++;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    logger.quit();
+    DataLogStats stats;
+    logger.getStats(&stats);
+    printf("rate : offered=%llu/s for %ds written=%u dropped=%u (%.2f%%) segments=%u errors=%u write_delay=%dus\n",
+        (unsigned long long)rate, seconds, stats.written, stats.dropped,
+        offered > 0 ? stats.dropped * 100.0 / offered : 0.0, stats.segment, stats.errors, s_writeDelayUs);
+    system((std::string("rm -rf ") + dir).c_str());
+}
+
+int main(int argc, char* argv[]) {
+    int producers = 4;
+    int records = 20000;
+    int rate = 5000;
+    int seconds = 3;
+    const char* decoder = "tools/datalog_decode.py";
+    int opt;
+    while((opt = getopt(argc, argv, "p:n:r:t:w:d:")) != -1) {
+        switch(opt) {
+            case 'p': producers = atoi(optarg); break;
+            case 'n': records = atoi(optarg); break;
+            case 'r': rate = atoi(optarg); break;
+            case 't': seconds = atoi(optarg); break;
+            case 'w': s_writeDelayUs = atoi(optarg); break;
+            case 'd': decoder = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-p producers] [-n records] [-r rate] [-t seconds] [-w us] [-d decoder]\n", argv[0]);
+                return 2;
+        }
+    }
+    int ret = roundTrip(producers, records, decoder);
+    if (rate > 0)
+        rateBench(rate, seconds);
+    return ret;
+}
@@ -0,0 +1,221 @@
+/**
+ * OLED表示のシミュレータ (PC上で実行)
+ *
+ * 実機と同じOledScreen(画面の作成)とOledLvglDriver(1bppのフレームバッファ、変更ページの転送)を
+ * LVGLと組み合わせ、SSD1306の代わりにSoftPanel(メモリ上の画像)へ転送します。
+ * 画面毎の描画時間と転送量を表示し、画面をPBM(P4)で保存します。保存した画像と比較すればスナップショットテストになります。
+ * 状態表示(OledDashboard)は各ページの画像と、値が1つ変わった時の更新時間と転送量を計測します。
+ *
+ * ビルド (LVGLはdependencies.lockと同じv8.3を展開したディレクトリ):
+ *     LVGL=~/lvgl
+ *     mkdir -p /tmp/oled_sim && cd /tmp/oled_sim
+ *     gcc -O2 -DLV_CONF_SKIP -DLV_COLOR_DEPTH=1 -DLV_USE_QRCODE=1 -I$LVGL -c $(find $LVGL/src -name '*.c')
+ *     ar rcs liblvgl.a *.o
+ *     cd -
+ *     g++ -std=gnu++20 -O2 -DLV_CONF_SKIP -DLV_COLOR_DEPTH=1 -DLV_USE_QRCODE=1 -I$LVGL -I$LVGL/src -Imain \
+ *         tools/oled_sim.cpp main/oled_lvgl_driver.cpp main/oled_screen.cpp main/oled_dashboard.cpp main/soft_panel.cpp \
+ *         main/qr_bitmap.cpp main/mono_framebuffer.cpp /tmp/oled_sim/liblvgl.a -o oled_sim
+ *
+ * 使い方:
+ *     ./oled_sim [-o dir] [-n count] [--update dir] [--check dir]
+ *         -o dir       : 画面をdir/screen_<名前>.pbm、転送毎の画像をdir/frame_00001.pbm, ...に保存
+ *         -n count     : 描画時間の計測回数 (既定は100)
+ *         --update dir : 画面だけをdir/screen_<名前>.pbmに保存 (基準画像の作成)
+ *         --check dir  : dir/screen_<名前>.pbmと比較 (異なる画面があれば終了コード1)
+ *
+ * 基準画像はtools/oled_sim_ref/に置きます。画面を変更した時は画像を確認してから
+ *     ./oled_sim --update tools/oled_sim_ref
+ * で作り直し、変更と一緒にコミットしてください。確認は ./oled_sim --check tools/oled_sim_ref です。
+ *
+ * LV_COLOR_DEPTHなどLVGLの設定はsdkconfig(上のREADME参照)と合わせてください。異なると画像が実機と一致しません。
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include "lvgl.h"
+#include "oled_lvgl_driver.hpp"
+#include "oled_screen.hpp"
+#include "oled_dashboard.hpp"
+#include "soft_panel.hpp"
+
+// 表示する画面 (アプリケーションが表示するもの)
+struct SimScreen {
+    const char* name;
+    OledScreenContent content;
+};
+
+static const SimScreen SCREENS[] = {
+    { "init",       { OledScreenKind::Init, "" } },
+    { "no_file",    { OledScreenKind::String, "No File" } },
+    { "connecting", { OledScreenKind::String, "Wi-Fi Connecting" } },
+    { "qrcode",     { OledScreenKind::QRCode, "http://192.168.1.10/" } },
+    { "qrcode_hit", { OledScreenKind::QRCode, "http://192.168.1.10/" } },     // 同じ文字列 (画像を再利用)
+    { "clear",      { OledScreenKind::Clear, "" } },
+};
+
+// 状態表示の値
+static const OledStatus STATUS = {
+    .ip = "192.168.1.10",
+    .rssi = -58,
+    .wsClients = 1,
+    .freeHeap = 151 * 1024,
+    .minFreeHeap = 118 * 1024,
+    .requestRate = 2.5f,
+    .isSd = true,
+    .sdTotal = 31902ULL << 20,
+    .sdUsed = 1843ULL << 20,
+};
+
+static int64_t nowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool readFile(const std::string& path, std::string& data) {
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (fp == NULL)
+        return false;
+    char buf[512];
+    size_t len;
+    data.clear();
+    while((len = fread(buf, 1, sizeof(buf), fp)) > 0)
+        data.append(buf, len);
+    fclose(fp);
+    return true;
+}
+
+// 画面をdir/screen_<名前>.pbmに保存、または比較 (異なればfalse)
+static bool snapshot(SoftPanel& panel, const char* name, const char* outDir, const char* updateDir, const char* checkDir) {
+    std::string file = std::string("screen_") + name + ".pbm";
+    if (outDir != NULL)
+        panel.writePBM((std::string(outDir) + "/" + file).c_str());
+    if (updateDir != NULL)
+        panel.writePBM((std::string(updateDir) + "/" + file).c_str());
+    if (checkDir == NULL)
+        return true;
+    std::string expected;
+    if (!readFile(std::string(checkDir) + "/" + file, expected)) {
+        fprintf(stderr, "%s : %s/%s not found\n", name, checkDir, file.c_str());
+        return false;
+    }
+    if (expected != panel.toPBM()) {
+        fprintf(stderr, "%s : differs from %s/%s\n", name, checkDir, file.c_str());
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    const char* outDir = NULL;
+    const char* updateDir = NULL;
+    const char* checkDir = NULL;
+    int count = 100;
+    for(int i=1; i<argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            outDir = argv[++i];
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            count = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--update") == 0 && i + 1 < argc) {
+            updateDir = argv[++i];
+        } else if (strcmp(argv[i], "--check") == 0 && i + 1 < argc) {
+            checkDir = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [-o dir] [-n count] [--update dir] [--check dir]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (count < 1)
+        count = 1;
+
+    lv_init();
+    SoftPanel panel;
+    panel.setDumpDir(outDir);
+    OledLvglDriver driver;
+    lv_disp_t* disp = driver.init(&panel);
+    OledScreen oledScreen;
+
+    int mismatch = 0;
+    printf("%-12s %10s %10s %8s %10s\n", "screen", "build(us)", "refr(us)", "bytes", "flush(us)");
+    for(const SimScreen& screen : SCREENS) {
+        // 1回目 : 前の画面からの切り替え (転送量と画像はこの描画のもの)
+        OledFlushStats before, after;
+        driver.getStats(&before);
+        int64_t start = nowUs();
+        if (!oledScreen.build(lv_scr_act(), screen.content))
+            fprintf(stderr, "%s : QR code encode failed\n", screen.name);
+        int64_t built = nowUs();
+        lv_refr_now(disp);
+        int64_t refreshed = nowUs();
+        driver.getStats(&after);
+        uint32_t bytes = after.flushes != before.flushes ? after.lastBytes : 0;
+        int64_t flushTime = after.totalTime - before.totalTime;
+        bool isHit = screen.content.kind == OledScreenKind::QRCode && oledScreen.qr().isHit();
+        if (!snapshot(panel, screen.name, outDir, updateDir, checkDir))
+            mismatch++;
+
+        // 計測 : 同じ画面を作り直して描画 (内容が同じなので転送は無い)
+        int64_t buildTotal = 0, refrTotal = 0;
+        for(int i=0; i<count; i++) {
+            int64_t t0 = nowUs();
+            oledScreen.build(lv_scr_act(), screen.content);
+            int64_t t1 = nowUs();
+            lv_refr_now(disp);
+            int64_t t2 = nowUs();
+            buildTotal += t1 - t0;
+            refrTotal += t2 - t1;
+        }
+        printf("%-12s %10lld %10lld %8lu %10lld%s\n", screen.name,
+            (long long)(built - start), (long long)(refreshed - built), (unsigned long)bytes, (long long)flushTime,
+            isHit ? "  (cached)" : "");
+        printf("%-12s %10.1f %10.1f   (average of %d)\n", "",
+            (double)buildTotal / count, (double)refrTotal / count, count);
+    }
+
+    // 状態表示 : ラベルを作成して各ページを表示
+    oledScreen.build(lv_scr_act(), { OledScreenKind::Status, "" });
+    for(int page=0; page<OLED_DASHBOARD_PAGES; page++) {
+        OledFlushStats before, after;
+        driver.getStats(&before);
+        int64_t start = nowUs();
+        oledScreen.dashboard().update(STATUS, page);
+        lv_refr_now(disp);
+        int64_t time = nowUs() - start;
+        driver.getStats(&after);
+        char name[32];
+        snprintf(name, sizeof(name), "status_%d", page + 1);
+        printf("%-12s %10s %10lld %8lu %10lld\n", name, "-", (long long)time,
+            (unsigned long)(after.totalBytes - before.totalBytes), (long long)(after.totalTime - before.totalTime));
+        if (!snapshot(panel, name, outDir, updateDir, checkDir))
+            mismatch++;
+    }
+    // 状態表示 : 値が1つ変わった時の更新 (空きヒープの行だけ描き直して転送)
+    {
+        panel.setDumpDir(NULL);
+        OledStatus status = STATUS;
+        OledFlushStats before, after;
+        driver.getStats(&before);
+        int64_t total = 0;
+        for(int i=0; i<count; i++) {
+            status.freeHeap = STATUS.freeHeap + (i & 1) * 1024;
+            int64_t start = nowUs();
+            oledScreen.dashboard().update(status, 1);
+            lv_refr_now(disp);
+            total += nowUs() - start;
+        }
+        driver.getStats(&after);
+        uint32_t flushes = after.flushes - before.flushes;
+        printf("%-12s %10s %10.1f %8.1f %10.1f   (average of %d, update + refr)\n", "status_upd", "-",
+            (double)total / count, flushes > 0 ? (double)(after.totalBytes - before.totalBytes) / flushes : 0.0,
+            flushes > 0 ? (double)(after.totalTime - before.totalTime) / flushes : 0.0, count);
+    }
+
+    OledFlushStats stats;
+    driver.getStats(&stats);
+    printf("flushes %lu, total %llu bytes, %lld us (max %lld us), frames %lu\n",
+        (unsigned long)stats.flushes, (unsigned long long)stats.totalBytes,
+        (long long)stats.totalTime, (long long)stats.maxTime, (unsigned long)panel.getFrames());
+    if (checkDir != NULL)
+        printf("check : %d mismatch\n", mismatch);
+    return mismatch == 0 ? 0 : 1;
+}
@@ -0,0 +1,139 @@
+/**
+ * スナップショットの負荷試験 (PC上で実行)
+ *
+ * main/snapshot.hppのSnapshot<T>に対して、複数の読み込みスレッドがload()し続け、
+ * 複数の書き込みスレッドがupdate()し続けて、次の条件が常に成り立つことを確認します。
+ *   - 取得した版は全ての要素が同じ世代番号で、チェックサムが一致する (途中まで書き換えた版が見えない)
+ *   - 同じスレッドから見た世代番号は減らない
+ *   - 最後の世代番号が書き込み回数の合計と一致する (競合した更新が失われない)
+ * 異常があれば内容を表示して終了コード1で終了します。
+ *
+ * ビルド (ThreadSanitizerでデータ競合も検出):
+ *     g++ -std=gnu++20 -O1 -g -fsanitize=thread -Imain tools/snapshot_stress.cpp -lpthread -o snapshot_stress
+ *
+ * 使い方:
+ *     ./snapshot_stress [-r readers] [-w writers] [-n updates]
+ *         -r readers : 読み込みスレッド数 (既定は4)
+ *         -w writers : 書き込みスレッド数 (既定は2)
+ *         -n updates : 書き込みスレッド1つ当たりのupdate()回数 (既定は20000)
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "snapshot.hpp"
+
+#define STRESS_VALUES   16      // 1つの版の要素数
+
+// 試験用のデータ (全要素を同じ世代番号で書き換える)
+struct StressData {
+    uint32_t generation = 0;
+    uint32_t values[STRESS_VALUES] = {};
+    uint32_t checksum = 0;
+    uint32_t writer = 0;        // 最後に書き換えたスレッド
+};
+
+static uint32_t checksum(const StressData& data) {
+    uint32_t sum = data.generation;
+    for (int i = 0; i < STRESS_VALUES; i++)
+        sum = sum * 31 + data.values[i];
+    return sum;
+}
+
+static Snapshot<StressData> s_snapshot;
+static std::atomic<bool> s_isQuit(false);
+static std::atomic<int> s_errors(0);
+static std::atomic<uint64_t> s_loads(0);
+
+// 版の内容が一貫しているか
+static bool verify(const StressData& data, const char* who) {
+    for (int i = 0; i < STRESS_VALUES; i++) {
+        if (data.values[i] != data.generation) {
+            fprintf(stderr, "%s: torn snapshot (generation=%u values[%d]=%u)\n", who, data.generation, i, data.values[i]);
+            return false;
+        }
+    }
+    if (data.checksum != checksum(data)) {
+        fprintf(stderr, "%s: checksum mismatch (generation=%u)\n", who, data.generation);
+        return false;
+    }
+    return true;
+}
+
+static void readerFunc(int id) {
+    char who[16];
+    snprintf(who, sizeof(who), "reader%d", id);
+    uint32_t last = 0;
+    uint64_t loads = 0;
+    while(!s_isQuit.load(std::memory_order_relaxed)) {
+        std::shared_ptr<const StressData> data = s_snapshot.load();
+        if (!verify(*data, who) || data->generation < last) {
+            if (data->generation < last)
+                fprintf(stderr, "%s: generation went back (%u -> %u)\n", who, last, data->generation);
+            s_errors++;
+            return;
+        }
+        last = data->generation;
+        loads++;
+    }
+    s_loads += loads;
+}
+
+static void writerFunc(int id, int updates) {
+    char who[16];
+    snprintf(who, sizeof(who), "writer%d", id);
+    for (int n = 0; n < updates; n++) {
+        s_snapshot.update([&](StressData& data) {
+            data.generation++;
+            for (int i = 0; i < STRESS_VALUES; i++)
+                data.values[i] = data.generation;
+            data.checksum = checksum(data);
+            data.writer = id;
+        });
+        if ((n & 0xff) == 0 && !verify(*s_snapshot.load(), who)) {
+            s_errors++;
+            return;
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int readers = 4;
+    int writers = 2;
+    int updates = 20000;
+    int opt;
+    while((opt = getopt(argc, argv, "r:w:n:")) != -1) {
+        switch(opt) {
+            case 'r': readers = atoi(optarg); break;
+            case 'w': writers = atoi(optarg); break;
+            case 'n': updates = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-r readers] [-w writers] [-n updates]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    std::vector<std::thread> readerThreads;
+    std::vector<std::thread> writerThreads;
+    for (int i = 0; i < readers; i++)
+        readerThreads.emplace_back(readerFunc, i);
+    for (int i = 0; i < writers; i++)
+        writerThreads.emplace_back(writerFunc, i, updates);
+    for (auto& t : writerThreads)
+        t.join();
+    s_isQuit = true;
+    for (auto& t : readerThreads)
+        t.join();
+
+    std::shared_ptr<const StressData> last = s_snapshot.load();
+    uint32_t expected = (uint32_t)writers * updates;
+    if (last->generation != expected) {
+        fprintf(stderr, "lost updates: generation=%u expected=%u\n", last->generation, expected);
+        s_errors++;
+    }
+    printf("readers=%d writers=%d updates=%u loads=%llu errors=%d\n",
+        readers, writers, expected, (unsigned long long)s_loads.load(), s_errors.load());
+    return s_errors.load() == 0 ? 0 : 1;
+}
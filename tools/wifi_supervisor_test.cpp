@@ -0,0 +1,257 @@
+/**
+ * Wi-Fi接続の監視の試験 (PC上で実行)
+ *
+ * main/wifi_supervisor.cppのWiFiSupervisorに、WIFI_EVENT_STA_DISCONNECTEDの切断理由
+ * (wifi_event_sta_disconnected_t::reason)を含むイベント列を時刻付きで与え、次の条件を確認します。
+ *   - 接続中からの一時的な切断(ビーコン消失、ローミング、APからの切断など)はすぐに再接続する
+ *   - 再接続に失敗する度に間隔が倍になり、上限で止まる
+ *   - 再接続の間隔は(ジッタ前の)間隔の半分から全体の範囲に収まり、乱数の種が同じなら同じ値になる
+ *   - 認証失敗は下限の8倍の間隔から始まる
+ *   - stop()後の切断は再接続しない (-1)
+ *   - 接続回数、切断回数、再接続回数、切断時間、稼働率の集計が合う
+ * 続けて、多数の乱数の種でジッタの分布(間隔に対する比率の最小/平均/最大)を表示します。
+ * 異常があれば内容を表示して終了コード1で終了します。
+ *
+ * ビルド:
+ *     g++ -std=gnu++20 -O2 -Imain tools/wifi_supervisor_test.cpp main/wifi_supervisor.cpp -o wifi_supervisor_test
+ *
+ * 使い方:
+ *     ./wifi_supervisor_test [-s seeds]
+ *         -s seeds : ジッタの分布を調べる乱数の種の数 (既定は1000)
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "wifi_supervisor.hpp"
+
+// wifi_err_reason_t (esp_wifi_types.h)
+#define REASON_UNSPECIFIED              1
+#define REASON_AUTH_EXPIRE              2
+#define REASON_ASSOC_LEAVE              8
+#define REASON_4WAY_HANDSHAKE_TIMEOUT   15
+#define REASON_BEACON_TIMEOUT           200
+#define REASON_NO_AP_FOUND              201
+#define REASON_AUTH_FAIL                202
+#define REASON_HANDSHAKE_TIMEOUT        204
+#define REASON_CONNECTION_FAIL          205
+#define REASON_ROAMING                  207
+
+#define MIN_DELAY   500000LL        // CONFIG_WIFI_RETRY_MIN_MSの既定値(us)
+#define MAX_DELAY   60000000LL      // CONFIG_WIFI_RETRY_MAX_MSの既定値(us)
+#define SEC         1000000LL
+
+static int s_errors = 0;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: ", __func__, __LINE__); \
+        fprintf(stderr, __VA_ARGS__); \
+        fprintf(stderr, "\n"); \
+        s_errors++; \
+    } \
+} while(0)
+
+// 切断を与え、再接続の間隔がジッタ前の間隔dに対して[d/2, d)に収まるか確認
+static int64_t disconnect(WiFiSupervisor& sv, uint8_t reason, int64_t now, int64_t expected) {
+    int64_t delay = sv.onDisconnected(reason, now);
+    CHECK(delay >= expected / 2 && delay < expected,
+        "reason=%u delay=%lld expected [%lld, %lld)", reason, (long long)delay, (long long)(expected / 2), (long long)expected);
+    CHECK(sv.state() == WiFiSupervisorState::Backoff, "reason=%u state=%d", reason, (int)sv.state());
+    return delay;
+}
+
+// 分類
+static void testClassify() {
+    struct { uint8_t reason; WiFiDisconnectClass cls; } cases[] = {
+        { REASON_ASSOC_LEAVE,               WiFiDisconnectClass::Leave },
+        { REASON_AUTH_EXPIRE,               WiFiDisconnectClass::Transient },
+        { REASON_BEACON_TIMEOUT,            WiFiDisconnectClass::Transient },
+        { REASON_ROAMING,                   WiFiDisconnectClass::Transient },
+        { REASON_CONNECTION_FAIL,           WiFiDisconnectClass::Transient },
+        { REASON_NO_AP_FOUND,               WiFiDisconnectClass::NotFound },
+        { REASON_AUTH_FAIL,                 WiFiDisconnectClass::Auth },
+        { REASON_4WAY_HANDSHAKE_TIMEOUT,    WiFiDisconnectClass::Auth },
+        { REASON_HANDSHAKE_TIMEOUT,         WiFiDisconnectClass::Auth },
+        { REASON_UNSPECIFIED,               WiFiDisconnectClass::Other },
+    };
+    for (auto& c : cases)
+        CHECK(WiFiSupervisor::classify(c.reason) == c.cls, "reason=%u class=%d", c.reason, (int)WiFiSupervisor::classify(c.reason));
+}
+
+// 接続中の一時的な切断 → すぐに再接続 → 失敗が続くと間隔が倍になり上限で止まる
+static void testBackoff() {
+    WiFiSupervisor sv;
+    sv.init(MIN_DELAY, MAX_DELAY, 12345);
+    int64_t now = 1 * SEC;
+    sv.start(now);
+    now += 2 * SEC;
+    sv.onConnected(now);
+    CHECK(sv.state() == WiFiSupervisorState::Connected, "state=%d", (int)sv.state());
+
+    now += 100 * SEC;
+    int64_t delay = sv.onDisconnected(REASON_BEACON_TIMEOUT, now);
+    CHECK(delay == 0, "beacon timeout while connected: delay=%lld", (long long)delay);
+    CHECK(sv.wasConnected(), "wasConnected");
+    int64_t outageStart = now;
+
+    int64_t expected = MIN_DELAY;
+    for (int i = 0; i < 12; i++) {
+        sv.onRetry(now);
+        CHECK(sv.state() == WiFiSupervisorState::Connecting, "retry %d: state=%d", i, (int)sv.state());
+        now += 3 * SEC;
+        delay = disconnect(sv, REASON_NO_AP_FOUND, now, expected);
+        CHECK(!sv.wasConnected(), "retry %d: wasConnected", i);
+        now += delay;
+        expected = expected * 2 > MAX_DELAY ? MAX_DELAY : expected * 2;
+    }
+    CHECK(expected == MAX_DELAY, "backoff did not reach the maximum (%lld)", (long long)expected);
+
+    sv.onRetry(now);
+    now += 2 * SEC;
+    sv.onConnected(now);
+    WiFiSupervisorStats stats;
+    sv.getStats(now, &stats);
+    CHECK(stats.connects == 2, "connects=%u", stats.connects);
+    CHECK(stats.disconnects == 1, "disconnects=%u", stats.disconnects);
+    CHECK(stats.retries == 13, "retries=%u", stats.retries);
+    CHECK(stats.failures == 0, "failures=%u", stats.failures);
+    CHECK(stats.lastReason == REASON_NO_AP_FOUND, "lastReason=%u", stats.lastReason);
+    CHECK(stats.lastOutage == now - outageStart, "lastOutage=%lld expected=%lld", (long long)stats.lastOutage, (long long)(now - outageStart));
+    CHECK(stats.maxOutage == stats.lastOutage, "maxOutage=%lld", (long long)stats.maxOutage);
+    CHECK(stats.connectedTime == 100 * SEC, "connectedTime=%lld", (long long)stats.connectedTime);
+    CHECK(stats.outageTime == 2 * SEC + stats.lastOutage, "outageTime=%lld", (long long)stats.outageTime);
+    CHECK(stats.currentOutage == 0, "currentOutage=%lld", (long long)stats.currentOutage);
+
+    // 再接続に成功したら間隔は下限に戻る
+    now += 10 * SEC;
+    sv.onDisconnected(REASON_ROAMING, now);
+    sv.onRetry(now);
+    disconnect(sv, REASON_CONNECTION_FAIL, now + SEC, MIN_DELAY);
+}
+
+// 認証失敗は下限の8倍から、APからの切断(ASSOC_LEAVE)は一時的な切断として扱う
+static void testReasons() {
+    WiFiSupervisor sv;
+    sv.init(MIN_DELAY, MAX_DELAY, 99);
+    int64_t now = SEC;
+    sv.start(now);
+    now += SEC;
+    int64_t delay = disconnect(sv, REASON_AUTH_FAIL, now, MIN_DELAY * 8);
+    now += delay;
+    sv.onRetry(now);
+    now += SEC;
+    disconnect(sv, REASON_4WAY_HANDSHAKE_TIMEOUT, now, MIN_DELAY * 16);
+
+    // 接続中の認証失敗 (鍵の更新失敗など) もすぐには再接続しない
+    sv.onRetry(now);
+    sv.onConnected(now);
+    now += SEC;
+    disconnect(sv, REASON_HANDSHAKE_TIMEOUT, now, MIN_DELAY * 8);
+
+    // APからの切断
+    sv.onRetry(now);
+    sv.onConnected(now);
+    now += SEC;
+    delay = sv.onDisconnected(REASON_ASSOC_LEAVE, now);
+    CHECK(delay == 0, "assoc leave from AP: delay=%lld", (long long)delay);
+
+    // 分類できない理由は通常の間隔
+    sv.onRetry(now);
+    now += SEC;
+    disconnect(sv, REASON_UNSPECIFIED, now, MIN_DELAY);
+
+    // stop()後の自分からの切断は再接続しない
+    sv.onRetry(now);
+    sv.onConnected(now);
+    now += SEC;
+    sv.stop(now);
+    delay = sv.onDisconnected(REASON_ASSOC_LEAVE, now);
+    CHECK(delay == -1, "after stop(): delay=%lld", (long long)delay);
+    CHECK(sv.state() == WiFiSupervisorState::Idle, "after stop(): state=%d", (int)sv.state());
+
+    // 再接続待ちでないときのonRetry()は数えない
+    WiFiSupervisorStats stats;
+    sv.getStats(now, &stats);
+    uint32_t retries = stats.retries;
+    sv.onRetry(now);
+    sv.getStats(now, &stats);
+    CHECK(stats.retries == retries, "onRetry() while idle counted (%u -> %u)", retries, stats.retries);
+    CHECK(stats.currentOutage == 0, "currentOutage while idle=%lld", (long long)stats.currentOutage);
+}
+
+// 上限が下限より小さい設定は下限に揃える
+static void testLimits() {
+    WiFiSupervisor sv;
+    sv.init(2 * SEC, SEC, 7);
+    sv.start(0);
+    for (int i = 0; i < 4; i++) {
+        sv.onRetry(i * 10 * SEC);
+        disconnect(sv, REASON_NO_AP_FOUND, i * 10 * SEC + SEC, 2 * SEC);
+    }
+}
+
+// ジッタ : 同じ種なら同じ値、種が違えば間隔の範囲に散らばる
+static void testJitter(int seeds) {
+    int64_t first = -1;
+    for (int n = 0; n < 2; n++) {
+        WiFiSupervisor sv;
+        sv.init(MIN_DELAY, MAX_DELAY, 4242);
+        sv.start(0);
+        int64_t delay = sv.onDisconnected(REASON_NO_AP_FOUND, SEC);
+        if (first < 0)
+            first = delay;
+        else
+            CHECK(delay == first, "same seed gave different delays (%lld, %lld)", (long long)first, (long long)delay);
+    }
+
+    double minRatio = 1.0, maxRatio = 0.0, sum = 0.0;
+    int count = 0;
+    for (int seed = 1; seed <= seeds; seed++) {
+        WiFiSupervisor sv;
+        sv.init(MIN_DELAY, MAX_DELAY, (uint32_t)seed * 2654435761u);
+        sv.start(0);
+        int64_t now = SEC;
+        int64_t expected = MIN_DELAY;
+        for (int i = 0; i < 6; i++) {
+            int64_t delay = disconnect(sv, REASON_NO_AP_FOUND, now, expected);
+            double ratio = (double)delay / expected;
+            if (ratio < minRatio)
+                minRatio = ratio;
+            if (ratio > maxRatio)
+                maxRatio = ratio;
+            sum += ratio;
+            count++;
+            now += delay;
+            sv.onRetry(now);
+            now += SEC;
+            expected *= 2;
+        }
+    }
+    double average = sum / count;
+    printf("jitter: seeds=%d samples=%d ratio min=%.3f avg=%.3f max=%.3f\n", seeds, count, minRatio, average, maxRatio);
+    if (seeds >= 100) {
+        CHECK(minRatio < 0.55 && maxRatio > 0.95, "jitter does not cover the range (%.3f - %.3f)", minRatio, maxRatio);
+        CHECK(average > 0.7 && average < 0.8, "jitter average %.3f is not near 0.75", average);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int seeds = 1000;
+    int opt;
+    while((opt = getopt(argc, argv, "s:")) != -1) {
+        switch(opt) {
+            case 's': seeds = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-s seeds]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    testClassify();
+    testBackoff();
+    testReasons();
+    testLimits();
+    testJitter(seeds);
+    printf("errors=%d\n", s_errors);
+    return s_errors == 0 ? 0 : 1;
+}